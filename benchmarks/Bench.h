@@ -0,0 +1,67 @@
+// Bench.h
+// Minimal microbenchmark harness for the server components.
+//
+// A benchmark case is a named function that sets up its fixture, brackets
+// the measured work with BenchState::start() / stop() and reports how many
+// operations it did. The harness runs each case several times and keeps the
+// median run, optionally with hardware counters from perf_event_open
+// (cycles, cache misses, context switches) covering every thread the case
+// starts. Results can be written as JSON and compared against a baseline
+// file, failing the run when a case got slower than the tolerance allows.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+class PerfCounters;
+
+struct PerfSample {
+    bool valid{false};
+    uint64_t cycles{0};
+    uint64_t cache_misses{0};
+    uint64_t context_switches{0};
+};
+
+class BenchState {
+public:
+    // begin / end the measured region (counters included)
+    void start();
+    void stop();
+
+    // operations done in the measured region
+    void set_ops(uint64_t n) { ops_ = n; }
+    // report a per-operation time other than elapsed / ops (e.g. a mean
+    // latency measured inside the case)
+    void set_ns_per_op(double ns) { ns_per_op_override_ = ns; }
+    // extra named values shown next to the result (e.g. percentiles)
+    void add_metric(const std::string &name, double value) { metrics_.emplace_back(name, value); }
+
+    uint64_t elapsed_ns() const { return elapsed_ns_; }
+
+private:
+    friend class BenchRunner;
+
+    uint64_t t0_{0};
+    uint64_t elapsed_ns_{0};
+    uint64_t ops_{0};
+    double ns_per_op_override_{-1};
+    std::vector<std::pair<std::string, double>> metrics_;
+    PerfCounters *perf_{nullptr};
+    PerfSample perf_sample_;
+};
+
+struct BenchCase {
+    std::string name;
+    std::function<void(BenchState &)> fn;
+};
+
+// smaller sizes for a quick smoke run
+extern bool g_bench_quick;
+
+void add_threadpool_benches(std::vector<BenchCase> &out);
+void add_timer_benches(std::vector<BenchCase> &out);
+void add_logger_benches(std::vector<BenchCase> &out);
+void add_connection_benches(std::vector<BenchCase> &out);
@@ -0,0 +1,131 @@
+// Connection lookup under contention: the lock-free ConnectionTable against
+// the unordered_map + mutex registry it replaced. Reader threads look up
+// random live tokens; the "+churn" variants add a thread that keeps
+// registering and removing other connections, like accept / close traffic.
+
+#include "Bench.h"
+#include "../include/Connection.h"
+#include "../include/ConnectionTable.h"
+#include "../include/Epoch.h"
+#include <sys/eventfd.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const size_t kLive = 4096;  // connections looked up
+const size_t kChurn = 64;   // connections the churn thread cycles
+
+// the registry the server used before ConnectionTable
+class MutexMap {
+public:
+    uint64_t insert(Connection *c) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        uint64_t token = ((uint64_t)++gen_ << 32) | (uint32_t)c->fd;
+        map_[token] = c;
+        return token;
+    }
+    Connection *find(uint64_t token) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = map_.find(token);
+        return it == map_.end() ? nullptr : it->second;
+    }
+    void remove(uint64_t token) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        map_.erase(token);
+    }
+
+private:
+    std::mutex mtx_;
+    std::unordered_map<uint64_t, Connection *> map_;
+    uint32_t gen_{0};
+};
+
+// real descriptors, since the table is indexed by fd and Connection closes it
+struct Conns {
+    std::vector<std::unique_ptr<Connection>> live;
+    std::vector<std::unique_ptr<Connection>> churn;
+    Conns() {
+        for (size_t i = 0; i < kLive; ++i) live.emplace_back(new Connection(eventfd(0, EFD_CLOEXEC)));
+        for (size_t i = 0; i < kChurn; ++i) churn.emplace_back(new Connection(eventfd(0, EFD_CLOEXEC)));
+    }
+};
+
+struct TableOps {
+    ConnectionTable table;
+    uint64_t insert(Connection *c) { return table.insert(c); }
+    bool find(uint64_t token) {
+        EpochGuard guard;
+        return table.find(token) != nullptr;
+    }
+    void remove(uint64_t token) { table.remove(token); }
+};
+
+struct MapOps {
+    MutexMap map;
+    uint64_t insert(Connection *c) { return map.insert(c); }
+    bool find(uint64_t token) { return map.find(token) != nullptr; }
+    void remove(uint64_t token) { map.remove(token); }
+};
+
+template <typename Ops>
+void lookup(BenchState &st, size_t threads, bool churn) {
+    const size_t per_thread = g_bench_quick ? 200000 : 2000000;
+    Conns conns;
+    Ops ops;
+    std::vector<uint64_t> tokens;
+    for (auto &c : conns.live) tokens.push_back(ops.insert(c.get()));
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> hits(0);
+    std::thread churner;
+    std::vector<std::thread> readers;
+    st.start();
+    if (churn) {
+        churner = std::thread([&]() {
+            // the same objects are re-registered; readers never look them up
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (auto &c : conns.churn) ops.remove(ops.insert(c.get()));
+            }
+        });
+    }
+    for (size_t t = 0; t < threads; ++t) {
+        readers.emplace_back([&, t]() {
+            uint32_t r = (uint32_t)(t * 2654435761u + 1);
+            size_t found = 0;
+            for (size_t i = 0; i < per_thread; ++i) {
+                r ^= r << 13;
+                r ^= r >> 17;
+                r ^= r << 5;
+                found += ops.find(tokens[r % tokens.size()]);
+            }
+            hits.fetch_add(found);
+        });
+    }
+    for (auto &th : readers) th.join();
+    st.stop();
+    stop = true;
+    if (churner.joinable()) churner.join();
+    st.set_ops(threads * per_thread);
+
+    for (uint64_t token : tokens) ops.remove(token);
+    if (hits.load() != threads * per_thread) st.add_metric("misses", (double)(threads * per_thread - hits.load()));
+}
+
+} // namespace
+
+void add_connection_benches(std::vector<BenchCase> &out) {
+    const size_t counts[] = {1, 2, 4, 8};
+    for (size_t t : counts) {
+        std::string suffix = "/threads=" + std::to_string(t);
+        out.push_back({"connections/table" + suffix, [t](BenchState &st) { lookup<TableOps>(st, t, false); }});
+        out.push_back({"connections/mutex_map" + suffix, [t](BenchState &st) { lookup<MapOps>(st, t, false); }});
+        out.push_back({"connections/table+churn" + suffix, [t](BenchState &st) { lookup<TableOps>(st, t, true); }});
+        out.push_back(
+            {"connections/mutex_map+churn" + suffix, [t](BenchState &st) { lookup<MapOps>(st, t, true); }});
+    }
+}
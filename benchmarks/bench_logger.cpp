@@ -0,0 +1,50 @@
+// Logger: end-to-end throughput (producers plus the flusher writing the
+// lines out) with and without a log file. stdout is always off.
+
+#include "Bench.h"
+#include "../include/Logger.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+void log_throughput(BenchState &st, size_t threads, bool to_file) {
+    const size_t per_thread = g_bench_quick ? 20000 : 200000;
+    Logger &log = Logger::instance();
+    log.set_stdout(false);
+    log.set_level(Logger::INFO);
+    // block rather than drop so every line is actually written
+    log.set_overflow_policy(Logger::BLOCK);
+    std::string path = "/tmp/microbench_" + std::to_string(getpid()) + ".log";
+    // opening an empty path fails, which leaves file output off
+    log.init(to_file ? path : std::string());
+
+    const std::string msg = "[Worker] Received from fd=42: GET /index.html HTTP/1.1 keep-alive";
+    std::vector<std::thread> producers;
+    st.start();
+    for (size_t t = 0; t < threads; ++t) {
+        producers.emplace_back([&log, &msg, per_thread]() {
+            for (size_t i = 0; i < per_thread; ++i) log.log(Logger::INFO, msg);
+        });
+    }
+    for (auto &p : producers) p.join();
+    log.flush();
+    st.stop();
+    st.set_ops(threads * per_thread);
+
+    log.init(std::string());
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+void add_logger_benches(std::vector<BenchCase> &out) {
+    const size_t counts[] = {1, 4};
+    for (size_t t : counts) {
+        std::string suffix = "/threads=" + std::to_string(t);
+        out.push_back({"logger/log/no-file" + suffix, [t](BenchState &st) { log_throughput(st, t, false); }});
+        out.push_back({"logger/log/file" + suffix, [t](BenchState &st) { log_throughput(st, t, true); }});
+    }
+}
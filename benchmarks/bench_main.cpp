@@ -0,0 +1,300 @@
+// bench_main.cpp
+// Runner for the microbenchmarks: filtering, repetitions, perf counters,
+// JSON output and baseline comparison.
+//
+//   ./microbench                          run everything
+//   ./microbench --filter threadpool      cases whose name contains the text
+//   ./microbench --perf                   collect hardware counters
+//   ./microbench --json out.json          save the results
+//   ./microbench --baseline base.json     exit 1 if a case is slower than
+//                                         base * (1 + tolerance)
+
+#include "Bench.h"
+#include "../include/Metrics.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+bool g_bench_quick = false;
+
+// Counters for the calling thread and every thread it creates afterwards
+// (inherit), enabled only inside BenchState::start() / stop().
+class PerfCounters {
+public:
+    PerfCounters() {
+        for (int &fd : fds_) fd = -1;
+    }
+    ~PerfCounters() {
+        for (int fd : fds_) {
+            if (fd != -1) close(fd);
+        }
+    }
+
+    // false (with error() set) if the kernel refuses, e.g. perf_event_paranoid
+    bool open() {
+        static const struct {
+            uint32_t type;
+            uint64_t config;
+        } events[kEvents] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+        };
+        for (int i = 0; i < kEvents; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_hv = 1;
+            // user-space only for the hardware events, so a default
+            // perf_event_paranoid of 2 still allows them
+            attr.exclude_kernel = events[i].type == PERF_TYPE_HARDWARE;
+            fds_[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds_[i] == -1) {
+                error_ = std::strerror(errno);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void enable() {
+        for (int fd : fds_) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    PerfSample disable() {
+        PerfSample s;
+        uint64_t v[kEvents] = {0, 0, 0};
+        for (int i = 0; i < kEvents; ++i) {
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds_[i], &v[i], sizeof(v[i])) != (ssize_t)sizeof(v[i])) return s;
+        }
+        s.valid = true;
+        s.cycles = v[0];
+        s.cache_misses = v[1];
+        s.context_switches = v[2];
+        return s;
+    }
+
+    const std::string &error() const { return error_; }
+
+private:
+    static const int kEvents = 3;
+    int fds_[kEvents];
+    std::string error_;
+};
+
+void BenchState::start() {
+    if (perf_) perf_->enable();
+    t0_ = Metrics::now_ns();
+}
+
+void BenchState::stop() {
+    elapsed_ns_ = Metrics::now_ns() - t0_;
+    if (perf_) perf_sample_ = perf_->disable();
+}
+
+struct BenchResult {
+    std::string name;
+    double ns_per_op{0};
+    double ops_per_sec{0};
+    uint64_t ops{0};
+    std::vector<std::pair<std::string, double>> metrics;
+    PerfSample perf;
+};
+
+class BenchRunner {
+public:
+    BenchRunner(int repeat, bool perf) : repeat_(repeat), perf_(perf) {}
+
+    // run one case repeat_ times and keep the median by ns/op
+    BenchResult run(const BenchCase &c) {
+        std::vector<BenchResult> runs;
+        for (int r = 0; r < repeat_; ++r) {
+            PerfCounters counters;
+            BenchState st;
+            if (perf_ && counters.open()) {
+                st.perf_ = &counters;
+            } else if (perf_ && !warned_) {
+                std::fprintf(stderr, "perf counters unavailable: %s\n", counters.error().c_str());
+                warned_ = true;
+            }
+            c.fn(st);
+
+            BenchResult res;
+            res.name = c.name;
+            res.ops = st.ops_;
+            double elapsed = (double)st.elapsed_ns_;
+            res.ns_per_op = st.ns_per_op_override_ >= 0 ? st.ns_per_op_override_
+                            : st.ops_ ? elapsed / st.ops_ : elapsed;
+            res.ops_per_sec = elapsed > 0 ? st.ops_ * 1e9 / elapsed : 0;
+            res.metrics = st.metrics_;
+            res.perf = st.perf_sample_;
+            runs.push_back(res);
+        }
+        std::sort(runs.begin(), runs.end(),
+                  [](const BenchResult &a, const BenchResult &b) { return a.ns_per_op < b.ns_per_op; });
+        return runs[runs.size() / 2];
+    }
+
+private:
+    int repeat_;
+    bool perf_;
+    bool warned_{false};
+};
+
+static void print_result(const BenchResult &r) {
+    std::printf("%-44s %12.1f ns/op %14.0f ops/s", r.name.c_str(), r.ns_per_op, r.ops_per_sec);
+    for (const auto &m : r.metrics) std::printf("  %s=%.1f", m.first.c_str(), m.second);
+    if (r.perf.valid && r.ops > 0) {
+        std::printf("  cycles/op=%.1f cache-misses/op=%.3f ctx-switches=%llu", (double)r.perf.cycles / r.ops,
+                    (double)r.perf.cache_misses / r.ops, (unsigned long long)r.perf.context_switches);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+static std::string json_escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static void write_json(const std::string &path, const std::vector<BenchResult> &results) {
+    std::ofstream f(path);
+    f << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        f << "  {\"name\": \"" << json_escape(r.name) << "\", \"ns_per_op\": " << r.ns_per_op
+          << ", \"ops_per_sec\": " << r.ops_per_sec << ", \"ops\": " << r.ops;
+        for (const auto &m : r.metrics) f << ", \"" << json_escape(m.first) << "\": " << m.second;
+        if (r.perf.valid) {
+            f << ", \"cycles\": " << r.perf.cycles << ", \"cache_misses\": " << r.perf.cache_misses
+              << ", \"context_switches\": " << r.perf.context_switches;
+        }
+        f << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    f << "]\n";
+}
+
+// name -> ns_per_op from a file written by write_json (one object per line)
+static bool read_baseline(const std::string &path, std::map<std::string, double> &out) {
+    std::ifstream f(path);
+    if (!f) return false;
+    std::string line;
+    while (std::getline(f, line)) {
+        size_t n = line.find("\"name\": \"");
+        size_t v = line.find("\"ns_per_op\": ");
+        if (n == std::string::npos || v == std::string::npos) continue;
+        n += 9;
+        size_t end = line.find('"', n);
+        if (end == std::string::npos) continue;
+        out[line.substr(n, end - n)] = std::atof(line.c_str() + v + 13);
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+                 "Usage: %s [options]\n"
+                 "  --filter TEXT       run only cases whose name contains TEXT\n"
+                 "  --repeat N          runs per case, the median is reported (default 3)\n"
+                 "  --quick             smaller problem sizes\n"
+                 "  --perf              collect cycles, cache misses and context switches\n"
+                 "  --json PATH         write the results as JSON\n"
+                 "  --baseline PATH     compare ns/op against a previous --json file\n"
+                 "  --tolerance F       allowed slowdown vs. the baseline (default 0.10 = 10%%)\n"
+                 "  --list              print the case names\n",
+                 prog);
+}
+
+int main(int argc, char **argv) {
+    std::string filter, json_path, baseline_path;
+    int repeat = 3;
+    bool perf = false, list = false;
+    double tolerance = 0.10;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (a == "--quick") {
+            g_bench_quick = true;
+        } else if (a == "--perf") {
+            perf = true;
+        } else if (a == "--list") {
+            list = true;
+        } else if (a == "--filter" && has_value) {
+            filter = argv[++i];
+        } else if (a == "--repeat" && has_value) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (a == "--json" && has_value) {
+            json_path = argv[++i];
+        } else if (a == "--baseline" && has_value) {
+            baseline_path = argv[++i];
+        } else if (a == "--tolerance" && has_value) {
+            tolerance = std::atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchCase> cases;
+    add_threadpool_benches(cases);
+    add_timer_benches(cases);
+    add_logger_benches(cases);
+    add_connection_benches(cases);
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty() && !read_baseline(baseline_path, baseline)) {
+        std::fprintf(stderr, "cannot read baseline %s\n", baseline_path.c_str());
+        return 2;
+    }
+
+    BenchRunner runner(repeat, perf);
+    std::vector<BenchResult> results;
+    int regressions = 0;
+    for (const BenchCase &c : cases) {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+        if (list) {
+            std::printf("%s\n", c.name.c_str());
+            continue;
+        }
+        BenchResult r = runner.run(c);
+        print_result(r);
+        results.push_back(r);
+
+        auto it = baseline.find(r.name);
+        if (it != baseline.end() && it->second > 0) {
+            double change = r.ns_per_op / it->second - 1.0;
+            if (change > tolerance) {
+                std::printf("  REGRESSION: %.1f ns/op vs baseline %.1f (+%.1f%%, tolerance %.1f%%)\n", r.ns_per_op,
+                            it->second, change * 100, tolerance * 100);
+                ++regressions;
+            }
+        }
+    }
+
+    if (!json_path.empty()) write_json(json_path, results);
+    if (!baseline.empty()) {
+        std::printf("%d of %zu cases regressed beyond %.1f%%\n", regressions, results.size(), tolerance * 100);
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+// ThreadPool: submission throughput (single and bulk) and the latency of
+// waking a parked worker.
+
+#include "Bench.h"
+#include "../include/Metrics.h"
+#include "../include/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+void wait_zero(const std::atomic<size_t> &left) {
+    while (left.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+}
+
+void enqueue_throughput(BenchState &st, size_t threads) {
+    const size_t n = g_bench_quick ? 100000 : 1000000;
+    ThreadPool pool(threads);
+    std::atomic<size_t> left(n);
+    st.start();
+    for (size_t i = 0; i < n; ++i) {
+        pool.enqueue([&left]() { left.fetch_sub(1, std::memory_order_release); });
+    }
+    wait_zero(left);
+    st.stop();
+    st.set_ops(n);
+}
+
+void bulk_throughput(BenchState &st, size_t threads) {
+    const size_t n = g_bench_quick ? 100000 : 1000000;
+    const size_t batch_size = 64;
+    ThreadPool pool(threads);
+    std::atomic<size_t> left(n);
+    std::vector<ThreadPool::Task> batch;
+    batch.reserve(batch_size);
+    st.start();
+    for (size_t i = 0; i < n; i += batch_size) {
+        size_t k = std::min(batch_size, n - i);
+        for (size_t j = 0; j < k; ++j) {
+            batch.emplace_back([&left]() { left.fetch_sub(1, std::memory_order_release); });
+        }
+        pool.enqueue_bulk(batch);
+    }
+    wait_zero(left);
+    st.stop();
+    st.set_ops(n);
+}
+
+// submit one task to an idle pool whose workers have parked, and time how
+// long until it starts running
+void wakeup_latency(BenchState &st, size_t threads) {
+    const int rounds = g_bench_quick ? 50 : 300;
+    ThreadPool pool(threads);
+    std::vector<uint64_t> samples;
+    samples.reserve(rounds);
+    st.start();
+    for (int r = 0; r < rounds; ++r) {
+        // long enough for every worker to finish spinning and park
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::atomic<uint64_t> ran(0);
+        uint64_t t0 = Metrics::now_ns();
+        pool.enqueue([&ran]() { ran.store(Metrics::now_ns(), std::memory_order_release); });
+        while (ran.load(std::memory_order_acquire) == 0) std::this_thread::yield();
+        samples.push_back(ran.load() - t0);
+    }
+    st.stop();
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (uint64_t s : samples) sum += (double)s;
+    st.set_ops(samples.size());
+    st.set_ns_per_op(sum / samples.size());
+    st.add_metric("p50_ns", (double)samples[samples.size() / 2]);
+    st.add_metric("p99_ns", (double)samples[samples.size() * 99 / 100]);
+}
+
+} // namespace
+
+void add_threadpool_benches(std::vector<BenchCase> &out) {
+    const size_t counts[] = {1, 2, 4, 8};
+    for (size_t t : counts) {
+        std::string suffix = "/threads=" + std::to_string(t);
+        out.push_back({"threadpool/enqueue" + suffix, [t](BenchState &st) { enqueue_throughput(st, t); }});
+        out.push_back({"threadpool/enqueue_bulk" + suffix, [t](BenchState &st) { bulk_throughput(st, t); }});
+        out.push_back({"threadpool/wakeup" + suffix, [t](BenchState &st) { wakeup_latency(st, t); }});
+    }
+}
@@ -0,0 +1,69 @@
+// TimerManager: cost of refreshing and rescheduling deadlines as the number
+// of scheduled timers grows. The wheel should stay flat where the old
+// min-heap grew with log(n).
+
+#include "Bench.h"
+#include "../include/Timer.h"
+#include <memory>
+
+namespace {
+
+const int kTimeoutMs = 60000;
+
+struct TimerFixture {
+    TimerManager tm{100};
+    std::unique_ptr<TimerNode[]> nodes;
+    size_t n;
+
+    explicit TimerFixture(size_t count) : nodes(new TimerNode[count]), n(count) {
+        tm.set_default_timeout(TimerKind::KeepAlive, kTimeoutMs);
+        for (size_t i = 0; i < n; ++i) {
+            tm.refresh(nodes[i], TimerKind::KeepAlive);
+            tm.schedule(nodes[i], i + 1);
+        }
+    }
+    ~TimerFixture() {
+        for (size_t i = 0; i < n; ++i) tm.cancel(nodes[i]);
+    }
+};
+
+size_t iterations() { return g_bench_quick ? 200000 : 2000000; }
+
+// the per-request path: push the idle deadline forward
+void refresh(BenchState &st, size_t n) {
+    TimerFixture f(n);
+    const size_t iters = iterations();
+    st.start();
+    for (size_t k = 0; k < iters; ++k) {
+        // spread over the nodes and vary the timeout so deadlines move
+        f.tm.refresh(f.nodes[(k * 7919) % n], TimerKind::KeepAlive, kTimeoutMs + (int)(k & 1023));
+    }
+    st.stop();
+    st.set_ops(iters);
+}
+
+// the connection path: cancel at close, schedule at accept
+void reschedule(BenchState &st, size_t n) {
+    TimerFixture f(n);
+    const size_t iters = iterations() / 4;
+    st.start();
+    for (size_t k = 0; k < iters; ++k) {
+        TimerNode &node = f.nodes[(k * 7919) % n];
+        f.tm.cancel(node);
+        f.tm.refresh(node, TimerKind::KeepAlive);
+        f.tm.schedule(node, k + 1);
+    }
+    st.stop();
+    st.set_ops(iters);
+}
+
+} // namespace
+
+void add_timer_benches(std::vector<BenchCase> &out) {
+    const size_t sizes[] = {1000, 10000, 100000};
+    for (size_t n : sizes) {
+        std::string suffix = "/timers=" + std::to_string(n);
+        out.push_back({"timer/refresh" + suffix, [n](BenchState &st) { refresh(st, n); }});
+        out.push_back({"timer/reschedule" + suffix, [n](BenchState &st) { reschedule(st, n); }});
+    }
+}
@@ -0,0 +1,30 @@
+// AdminServer.h
+// Separate listener that serves the server's metrics over HTTP.
+//
+// Runs on its own thread with blocking sockets, one short request at a
+// time, so it never touches the event loops:
+//   GET /         plain-text counters and histogram summaries
+//   GET /metrics  Prometheus text exposition format
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+class AdminServer {
+public:
+    explicit AdminServer(int port) : port_(port), running_(false) {}
+    ~AdminServer();
+
+    // bind the admin port and start serving; false if the listener fails
+    bool start();
+    void stop();
+
+private:
+    void loop();
+    void serve(int fd);
+
+    int port_;
+    int listen_fd_{-1};
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
@@ -0,0 +1,83 @@
+// Admission.h
+// Admission control on the accept path, shared by every loop.
+//
+// Before taking a connection off the listen backlog a loop asks admit()
+// whether one may come in. Three limits apply:
+// - a cap on open connections (--max-conns);
+// - an accept rate (--accept-rate), a GCRA token bucket over all loops that
+//   lets through bursts of 100 ms worth of connections;
+// - pool overload, CoDel-style: the ThreadPool keeps the shortest time any
+//   task waited in its queues, and every interval (100 ms) that floor is
+//   compared with a target (--queue-target, default 5 ms). A burst drains
+//   within the interval and leaves the floor low; a floor above the target
+//   for a whole interval is a standing queue, and new connections are
+//   refused until an interval ends with the floor back under it. Queue
+//   depth above --max-queue counts as overload as well.
+// A connection refused by the rate limit is left in the backlog. So are
+// those refused by the other limits, unless --shed is set: then they are
+// accepted and reset at once so clients fail fast instead of waiting in a
+// backlog that is not moving. Either way the connections already open keep
+// their latency. Loops retry deferred accepts every few milliseconds; once
+// the backlog is full the kernel pushes back on new SYNs by itself.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Config.h"
+#include "Metrics.h"
+
+class ConnectionTable;
+class ThreadPool;
+
+class Admission {
+public:
+    enum Verdict {
+        Accept, // take the next connection
+        Defer,  // leave the backlog alone and retry later
+        Shed,   // take the next connection and reset it
+    };
+
+    // pool may be nullptr (inline loops): no overload signal then
+    Admission(const ServerConfig &cfg, const ConnectionTable &conns, ThreadPool *pool);
+
+    // may a connection come in now? Accept uses up one unit of the rate limit
+    Verdict admit();
+    // hand back the unit of an Accept that found the backlog empty
+    void release();
+    // whether admit() would return Accept, without using anything up
+    bool accepting();
+
+    // close the CoDel interval if it is over; loops call this every
+    // iteration so intervals stay short while nobody connects
+    void tick() { overloaded(Metrics::now_ns()); }
+
+    // how long a loop waits before retrying a deferred accept
+    static const int kRetryMs = 5;
+
+private:
+    static const uint64_t kIntervalNs = 100000000;
+
+    // CoDel state, re-evaluated at most once per interval by whichever
+    // loop gets there first
+    bool overloaded(uint64_t now);
+    bool limited(uint64_t now);
+
+    const ConnectionTable &conns_;
+    ThreadPool *pool_;
+    size_t max_conns_;
+    size_t max_queue_;
+    uint64_t target_ns_;
+    bool shed_;
+
+    // GCRA: the theoretical arrival time of the next connection; a new one
+    // fits while it is at most burst_ns_ ahead of now
+    uint64_t emission_ns_; // 0: no rate limit
+    uint64_t burst_ns_;
+    std::atomic<uint64_t> tat_;
+
+    std::atomic<uint64_t> next_check_ns_;
+    std::atomic<bool> overloaded_;
+};
@@ -0,0 +1,36 @@
+// Affinity.h
+// CPU placement for the latency profile.
+//
+// Threads are pinned to one CPU each, taken in NUMA order: every CPU of
+// node 0 first, then node 1, and so on (node membership comes from sysfs,
+// /sys/devices/system/cpu/cpuN/nodeM; without it everything is node 0).
+// Loops are placed before workers, so a pooled loop and the workers it
+// feeds share a node as long as it has room, and the per-thread chunk and
+// task-node caches a pinned thread fills are allocated on its own node by
+// first touch.
+
+#pragma once
+
+#include <pthread.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// CPUs of a list like "0-3,8,10-11"; false on a syntax error
+bool parse_cpu_list(const std::string &s, std::vector<int> &out);
+
+// the same list in its compact form
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+// NUMA node of cpu (0 if unknown)
+int cpu_node(int cpu);
+
+// distinct NUMA nodes among cpus
+size_t count_nodes(const std::vector<int> &cpus);
+
+// CPUs to place threads on: those in list (every CPU the process may run
+// on when list is empty) that the affinity mask allows, in NUMA order
+std::vector<int> placement_cpus(const std::string &list);
+
+// pin thread t to cpu; false with errno set on failure
+bool pin_thread(pthread_t t, int cpu);
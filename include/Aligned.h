@@ -0,0 +1,27 @@
+// Aligned.h
+// Heap allocation for cache-line-aligned types under C++11.
+//
+// Before C++17 a new-expression ignores an alignas larger than
+// alignof(std::max_align_t) (16 bytes on x86-64), so a per-thread record
+// whose hot fields are padded onto their own cache lines could still start
+// mid-line and share its first line with a neighbouring allocation.
+// Deriving from CacheAligned gives the type a class operator new that
+// returns memory aligned to a cache line; it is an empty base, so the
+// layout does not change.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+struct CacheAligned {
+    static const size_t kCacheLine = 64;
+
+    static void *operator new(size_t size) {
+        void *p = nullptr;
+        if (posix_memalign(&p, kCacheLine, size) != 0) throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete(void *p) { std::free(p); }
+};
@@ -0,0 +1,127 @@
+// Buffer.h
+// Chained I/O buffer built from fixed-size pooled chunks.
+//
+// A Buffer is a list of segments, each a [begin, end) window into a
+// refcounted BufferChunk. Reading from a socket fills the free tail of the
+// last chunk plus a fresh chunk with one readv; writing gathers up to 64
+// segments into one sendmsg (MSG_NOSIGNAL: a peer that reset the
+// connection is an EPIPE, not a SIGPIPE). Moving data between buffers (input -> output),
+// consuming a prefix, or slicing a range never copies payload bytes: whole
+// segments change hands and shared chunks are refcounted.
+//
+// Chunks come from a per-thread free list, so steady-state I/O does not touch
+// the allocator. A chunk may be freed on a different thread than the one that
+// allocated it; it then simply joins that thread's free list.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct iovec;
+
+struct BufferChunk {
+    static const size_t kSize = 16 * 1024; // payload bytes per chunk
+
+    std::atomic<uint32_t> refs;
+    uint32_t used; // bytes written so far (only the exclusive owner appends)
+    char data[kSize];
+
+    // take a chunk from the calling thread's pool (refs = 1, used = 0)
+    static BufferChunk *acquire();
+    void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+    // drop one reference; the last one returns the chunk to the pool
+    void release();
+};
+
+// pool statistics for the calling thread
+struct ChunkPoolStats {
+    uint64_t allocated; // chunks obtained from the heap
+    uint64_t reused;    // chunks served from the free list
+    size_t cached;      // chunks currently on the free list
+};
+ChunkPoolStats chunk_pool_stats();
+
+class Buffer {
+public:
+    struct Segment {
+        BufferChunk *chunk;
+        uint32_t begin;
+        uint32_t end;
+        const char *data() const { return chunk->data + begin; }
+        size_t size() const { return end - begin; }
+    };
+
+    Buffer() {}
+    ~Buffer() { clear(); }
+    Buffer(Buffer &&other);
+    Buffer &operator=(Buffer &&other);
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // readable segments, front to back
+    size_t segment_count() const { return segs_.size() - head_; }
+    const Segment &segment(size_t i) const { return segs_[head_ + i]; }
+
+    // copy bytes in (small writes, headers)
+    void append(const char *data, size_t len);
+    void append(const std::string &s) { append(s.data(), s.size()); }
+
+    // take ownership of a chunk filled elsewhere (e.g. by the kernel);
+    // its first len bytes become readable
+    void append_chunk(BufferChunk *chunk, size_t len);
+
+    // move every segment of other to the end of this buffer; only small
+    // segments that fit the free tail of the last chunk are copied
+    void append(Buffer &&other);
+
+    // share [offset, offset + len) of other without copying
+    void append_slice(const Buffer &other, size_t offset, size_t len);
+
+    // drop n bytes from the front
+    void consume(size_t n);
+    void clear();
+
+    // offset of the first c at or after from, or -1
+    ssize_t find(char c, size_t from) const;
+
+    // pointer to [offset, offset + len) if it lies within one segment,
+    // nullptr if it straddles a chunk boundary
+    const char *contiguous(size_t offset, size_t len) const;
+
+    // copy len bytes starting at offset into dst (caller checks bounds)
+    void copy_out(size_t offset, char *dst, size_t len) const;
+    std::string to_string() const;
+
+    // One readv into the free tail of the last chunk plus a fresh chunk.
+    // Returns what read() would: > 0 bytes, 0 on EOF, -1 with errno set.
+    ssize_t read_from(int fd);
+
+    // One sendmsg of up to 64 segments and at most limit bytes, with the
+    // given MSG_* flags (MSG_NOSIGNAL is always added); consumes what the
+    // socket accepted. Returns what write() would.
+    ssize_t write_to(int fd, size_t limit, int flags);
+
+    // fill up to max_iov iovecs with the first (at most) limit bytes;
+    // returns the number of iovecs used
+    int gather(iovec *iov, int max_iov, size_t limit) const;
+
+private:
+    // the last chunk has free space only this buffer can append to
+    bool tail_writable() const;
+    void push(BufferChunk *chunk, uint32_t begin, uint32_t end);
+    void pop_front();
+
+    // segs_[head_..] are live; popped entries are reclaimed lazily so the
+    // vector keeps its capacity across messages
+    std::vector<Segment> segs_;
+    size_t head_{0};
+    size_t size_{0};
+};
@@ -0,0 +1,222 @@
+// Codec.h
+// Framing and request handling between socket reads and application logic.
+//
+// A codec finds message boundaries in a connection's input Buffer and adds
+// framing to replies; a handler turns each complete frame into a reply.
+// Both are plain classes with the members below, not interfaces:
+//
+//     ssize_t decode(const Buffer &in, size_t &scan, Frame &frame) const;
+//     void encode_header(Buffer &out, size_t len) const;
+//     void encode_trailer(Buffer &out) const;
+//
+//     void on_frame(const Frame &frame, Reply<Codec> &reply);
+//
+// decode looks for one complete frame at the front of `in`. `scan` is per
+// connection state the codec may use to resume a partial search (reset to 0
+// after each frame). It returns the frame's size on the wire and sets the
+// payload range in frame.offset / frame.size, 0 if more data is needed, -1
+// on a protocol error; a codec that had to linearise the payload itself may
+// also set frame.data, and frame.meta is passed through. The encoders add
+// one reply's framing around its len bytes. In pooled mode several workers
+// call on_frame at once (for different connections), so handlers must be
+// thread-safe.
+//
+// Frames are views into the input buffer. The payload is linearised only
+// when a handler asks for it in one piece (Frame::bytes()) and it happens to
+// straddle two chunks; a handler that answers with the frame it received
+// replies without copying at all.
+//
+// Every frame parsed from one wakeup appends its reply to the connection's
+// output buffer, which is flushed once afterwards, so pipelined requests are
+// answered with a single writev. A reply may also name a range of an open
+// file; the loop sends it in order with the rest of the output, straight
+// from the page cache.
+//
+// Built-in codecs:
+// - LineCodec: newline-delimited frames ("\r\n" accepted); resumes the
+//   search where the previous partial read stopped;
+// - LengthPrefixCodec: u32 big-endian length followed by the payload;
+// - HttpCodec (Http.h): HTTP/1.1 requests, the body being the payload;
+// - MemcacheCodec (Memcache.h): memcached text commands, a set's data block
+//   being the payload.
+//
+// process_frames and Reply are templates over the codec, instantiated by
+// the protocol policies (Protocol.h): decode, on_frame and the encoders
+// are direct calls, inlined into the frame loop.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#include "Buffer.h"
+#include "Connection.h"
+
+struct CachedFile;
+
+// One decoded message: size bytes of source from offset, valid until the
+// handler returns.
+struct Frame {
+    mutable const char *data; // the payload in one piece once bytes() made it so (or the codec did)
+    size_t size;
+    const Buffer *source; // input buffer the payload lives in
+    size_t offset;        // payload offset within source
+    const void *meta;     // codec-specific parse result (HttpRequest), or nullptr
+
+    // The payload as one contiguous range: a view into its chunk, or, if it
+    // straddles two, a copy in thread-local scratch made on the first call.
+    const char *bytes() const;
+};
+
+// Scan state of a codec that parsed a frame's header but still waits for
+// its payload: the header's length and the frame's length on the wire, so
+// the reads in between compare one size instead of parsing the header
+// again. Plain resume positions stay far below kScanPending.
+const size_t kScanPending = size_t(1) << 63;
+static_assert(sizeof(size_t) == 8, "pending scan state packs two lengths into a size_t");
+inline size_t scan_pending(size_t head, size_t wire) { return kScanPending | (head << 32) | wire; }
+inline size_t pending_head(size_t scan) { return (scan & ~kScanPending) >> 32; }
+inline size_t pending_wire(size_t scan) { return scan & 0xffffffffu; }
+
+class LineCodec final {
+public:
+    static const size_t kMaxLine = 64 * 1024;
+
+    ssize_t decode(const Buffer &in, size_t &scan, Frame &frame) const;
+    void encode_header(Buffer &, size_t) const {}
+    void encode_trailer(Buffer &out) const { out.append("\n", 1); }
+};
+
+class LengthPrefixCodec final {
+public:
+    static const size_t kMaxFrame = 16 * 1024 * 1024;
+
+    ssize_t decode(const Buffer &in, size_t &scan, Frame &frame) const;
+    void encode_header(Buffer &out, size_t len) const {
+        char hdr[4] = {(char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+        out.append(hdr, 4);
+    }
+    void encode_trailer(Buffer &) const {}
+};
+
+// Reply sink handed to handlers; every write() becomes one reply framed by
+// codec C.
+template <class C>
+class Reply {
+public:
+    Reply(const C &codec, Buffer &out, std::vector<FileSend> &files) : codec_(codec), out_(out), files_(files) {}
+
+    void write(const char *data, size_t len) {
+        codec_.encode_header(out_, len);
+        out_.append(data, len);
+        codec_.encode_trailer(out_);
+    }
+    void write(const std::string &s) { write(s.data(), s.size()); }
+    // reply with a received frame; large payloads share the input chunks
+    void write(const Frame &frame);
+    // reply with len bytes of file from offset; the loop sends them from the
+    // page cache (sendfile / splice) after everything written before
+    void write_file(std::shared_ptr<const CachedFile> file, uint64_t offset, uint64_t len);
+
+    // close the connection once the replies queued so far are sent; later
+    // input is ignored
+    void close_after() { close_ = true; }
+    bool closing() const { return close_; }
+
+private:
+    // replies shorter than this are copied into the output chunk; longer
+    // ones share the input chunks
+    static const size_t kShareThreshold = 512;
+
+    const C &codec_;
+    Buffer &out_;
+    std::vector<FileSend> &files_;
+    bool close_{false};
+};
+
+// answers every frame with its own payload, under any codec
+class EchoHandler final {
+public:
+    template <class C>
+    void on_frame(const Frame &frame, Reply<C> &reply) { reply.write(frame); }
+};
+
+// thread-local scratch for payloads that straddle two chunks
+std::string &frame_scratch();
+
+inline const char *Frame::bytes() const {
+    if (data) return data;
+    data = source->contiguous(offset, size);
+    if (!data) {
+        std::string &scratch = frame_scratch();
+        scratch.resize(size);
+        source->copy_out(offset, &scratch[0], size);
+        data = scratch.data();
+    }
+    return data;
+}
+
+template <class C>
+void Reply<C>::write(const Frame &frame) {
+    if (frame.size < kShareThreshold || !frame.source) {
+        write(frame.bytes(), frame.size);
+        return;
+    }
+    codec_.encode_header(out_, frame.size);
+    out_.append_slice(*frame.source, frame.offset, frame.size);
+    codec_.encode_trailer(out_);
+}
+
+template <class C>
+void Reply<C>::write_file(std::shared_ptr<const CachedFile> file, uint64_t offset, uint64_t len) {
+    codec_.encode_header(out_, len);
+    if (len > 0) {
+        // output already queued in front of the previous files stays there
+        size_t before = 0;
+        for (const FileSend &f : files_) before += f.after;
+        files_.push_back(FileSend{std::move(file), offset, len, out_.size() - before});
+    }
+    codec_.encode_trailer(out_);
+}
+
+// Run every complete frame at the front of in through the handler,
+// consuming the frames handled; stops once reply.closing() is set. Returns
+// false on a protocol error.
+template <class C, class H>
+bool process_frames(Buffer &in, size_t &scan, const C &codec, H &handler, Reply<C> &reply) {
+    while (!in.empty()) {
+        Frame frame{nullptr, 0, &in, 0, nullptr};
+        ssize_t wire = codec.decode(in, scan, frame);
+        if (wire < 0) return false;
+        if (wire == 0) break;
+
+        // the payload is linearised only if the handler asks for it
+        handler.on_frame(frame, reply);
+
+        in.consume((size_t)wire);
+        scan = 0;
+        if (reply.closing()) break;
+    }
+    return true;
+}
+
+// The same over the connection's input, appending replies to its output
+// (the loop has attached conn->io). Stops early and sets
+// conn->close_after_write when a handler asked to close.
+template <class C, class H>
+bool process_frames(Connection *conn, const C &codec, H &handler) {
+    ConnectionIo &io = *conn->io;
+    Reply<C> reply(codec, io.out, io.files);
+    if (!process_frames(io.in, io.frame_scan, codec, handler, reply)) return false;
+    if (reply.closing()) {
+        // nothing after the last answered request is served
+        conn->close_after_write = true;
+        io.in.clear();
+    }
+    return true;
+}
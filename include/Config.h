@@ -0,0 +1,90 @@
+// Config.h
+// Runtime configuration for the server, filled in from command-line flags.
+
+#pragma once
+
+#include <string>
+
+#include "Logger.h"
+
+enum class IoBackend {
+    Epoll,   // readiness-based epoll loop (default)
+    IoUring, // completion-based io_uring loop, falls back to epoll if unavailable
+};
+
+enum class CodecKind {
+    Raw,          // echo the byte stream as it arrives
+    Line,         // newline-delimited frames
+    LengthPrefix, // u32 big-endian length + payload
+    Http,         // HTTP/1.1 requests with keep-alive and pipelining
+    Memcache,     // memcached text protocol subset served from the KvStore
+};
+
+enum class Profile {
+    Throughput, // block in the kernel when idle (default)
+    Latency,    // pinned threads that poll before blocking, busy-polling sockets
+};
+
+// How much a connection may read in one visit before it yields to the other
+// ready connections; 0 lifts a limit.
+struct ReadBudget {
+    int bytes{256 << 10};
+    int reads{16};
+};
+
+struct ServerConfig {
+    int port{8080};
+    int num_threads{4};        // worker threads (single-reactor mode)
+    int num_reactors{0};       // >0: one event loop per reactor, I/O served inline
+    int udp_threads{0};        // >0: also serve UDP on the port with this many loops
+    IoBackend backend{IoBackend::Epoll};
+    CodecKind codec{CodecKind::Raw};
+    int idle_timeout_sec{60};  // keep-alive: close connections idle for this long
+    int read_timeout_ms{0};    // max time a partial request may stay pending (0 = off)
+    int write_timeout_ms{0};   // max time queued output may stay unsent (0 = off)
+    int timer_resolution_ms{100};
+    // stop reading from a client once this much output is queued for it,
+    // resume when the queue drains below the low watermark
+    int high_watermark{1 << 20};
+    int low_watermark{256 << 10};
+    // per-visit read budget of the connections accepted on the listener
+    ReadBudget read_budget;
+    int starve_ms{10};         // count ready connections served later than this
+    Profile profile{Profile::Throughput};
+    std::string cpus;          // pin threads to these CPUs ("0-3,8"); latency: default all
+    int spin_us{-1};           // adaptive poll ceiling before blocking (-1: profile default)
+    int busy_poll_us{-1};      // SO_BUSY_POLL on sockets (-1: profile default)
+    int admin_port{0};         // >0: serve metrics on this port
+    // admission control (see Admission.h); 0 turns a limit off
+    int backlog{1024};         // listen() backlog
+    int max_conns{0};          // most connections open at once
+    int accept_rate{0};        // most new connections per second, all loops together
+    int queue_target_ms{5};    // pooled: refuse connections while tasks queue longer
+    int max_queue{0};          // pooled: refuse connections while more tasks are queued
+    bool shed{false};          // reset refused connections instead of leaving them queued
+    // http codec: serve the files under static_dir at static_prefix
+    std::string static_dir;
+    std::string static_prefix{"/static/"};
+    int file_cache_entries{1024}; // open files kept by the FileCache
+    int kv_memory_mb{64};      // memcache codec: slab memory of the KvStore
+    // proxy mode (see Proxy.h): relay every connection to one of these
+    // upstreams ("host:port,host:port") instead of answering it
+    std::string proxy;
+    int proxy_pool{4};         // connections kept open to each upstream for new clients
+    int proxy_check_ms{1000};  // upstream health check interval
+    // hot restart (see HotRestart.h): Unix socket a new binary takes the
+    // listeners over from, and how long the old one drains its connections
+    std::string upgrade_socket;
+    int drain_timeout_ms{30000};
+    // tracing (see Trace.h): one event in trace_sample, 0 = off; SIGUSR1
+    // writes the trace to trace_file
+    int trace_sample{0};
+    std::string trace_file{"trace.json"};
+    std::string log_path{"server.log"};
+    Logger::Level log_level{Logger::INFO};
+    Logger::OverflowPolicy log_overflow{Logger::DROP};
+};
+
+// Parse argv into cfg. Accepts a bare number (worker threads) for backwards
+// compatibility. Returns false after printing usage on unknown flags.
+bool parse_args(int argc, char **argv, ServerConfig &cfg);
@@ -1,29 +1,158 @@
 // Connection.h
-// Simple per-connection context used by the server.
-// This struct holds the socket fd, read/write buffers, last-active timestamp
-// and a mutex to protect per-connection fields when accessed by multiple threads.
+// Per-connection context used by the server, split by how often it is used.
+//
+// Connection is what every open connection keeps: the fd, its token, a few
+// state flags and its timer node. It is sized to stay small (96 bytes, with
+// the ConnectionTable slot 112 per idle connection) and allocated from a
+// slab of fixed-size slots carved out of large blocks, so a million mostly
+// idle connections are a few hundred contiguous blocks rather than a million
+// heap objects with allocator headers.
+//
+// ConnectionIo holds what only matters while data is in flight: the input
+// and output buffers, queued files, the codec's scan position and the
+// splice pipe. A loop attaches it before it reads and releases it once the
+// input is consumed and the output sent; released state goes to a small
+// per-thread cache (buffers empty, vector capacity and pipe kept) for the
+// next connection that wakes up. In proxy mode a Relay takes its place for
+// the life of the connection.
+//
+// Nothing in a Connection is locked: it is only touched by the thread that
+// serves it (the loop thread, or the one worker an EPOLLONESHOT event went
+// to). Connections are owned by the ConnectionTable and identified by
+// `token`. The fd is closed by the destructor, i.e. only once epoch
+// reclamation has proven no thread still holds the Connection, so a pointer
+// obtained under an EpochGuard never refers to a recycled fd.
 
 #pragma once
 
-#include <string>
-#include <mutex>
-#include <chrono>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+
+#include "Buffer.h"
+#include "Timer.h"
+
+struct CachedFile;
+
+// A file range queued for a connection. Its bytes go out with sendfile /
+// splice once the `after` bytes of `out` queued in front of it (counted from
+// the previous file) have been written.
+struct FileSend {
+    std::shared_ptr<const CachedFile> file;
+    uint64_t offset;
+    uint64_t remaining;
+    size_t after;
+};
+
+// The state of a connection with data in flight.
+struct ConnectionIo {
+    Buffer in;                   // data read from socket but not yet processed
+    Buffer out;                  // output not yet accepted by the socket
+    std::vector<FileSend> files; // file bodies interleaved with `out`, in order
+    size_t frame_scan{0};        // codec: input already searched for a frame boundary
+    int pipe_fds[2] = {-1, -1};  // splices file pages into the socket
+    size_t pipe_size{0};         // pipe capacity, the most one splice may move
+    size_t pipe_pending{0};      // bytes spliced into the pipe but not yet sent
+
+    ConnectionIo() {}
+    ~ConnectionIo() {
+        if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+        if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+    }
+    ConnectionIo(const ConnectionIo &) = delete;
+    ConnectionIo &operator=(const ConnectionIo &) = delete;
+
+    bool has_output() const { return !out.empty() || !files.empty(); }
+    // nothing read, queued or inside the pipe
+    bool idle() const { return in.empty() && !has_output() && pipe_pending == 0; }
+    // bytes of `out` that may be sent before the next file starts
+    size_t sendable() const { return files.empty() ? out.size() : files[0].after; }
+    // n bytes of `out` were written
+    void sent(size_t n) {
+        if (!files.empty()) files[0].after -= n;
+    }
+};
+
+// Proxy mode (Proxy.h): the upstream socket a client connection is relayed
+// to and the pipes that carry its bytes each way without a copy.
+struct Relay {
+    struct Direction {
+        int pipe_fds[2] = {-1, -1};
+        size_t pending{0}; // bytes in the pipe, not yet written on
+        bool eof{false};   // the source has sent everything
+        bool shut{false};  // and the destination was told (SHUT_WR)
+
+        ~Direction() {
+            if (pipe_fds[0] >= 0) close(pipe_fds[0]);
+            if (pipe_fds[1] >= 0) close(pipe_fds[1]);
+        }
+    };
+
+    int upstream_fd{-1};
+    int upstream{-1};        // index in the UpstreamPool
+    bool connecting{false};  // non-blocking connect still in progress
+    Direction up;            // client -> upstream
+    Direction down;          // upstream -> client
+    // pooled: threads that want to serve the pair; the first one serves it
+    // for all of them, so the two sockets' events never run concurrently
+    std::atomic<uint32_t> visits{0};
+
+    Relay() {}
+    ~Relay() {
+        if (upstream_fd >= 0) close(upstream_fd);
+    }
+    Relay(const Relay &) = delete;
+    Relay &operator=(const Relay &) = delete;
+};
 
 struct Connection {
     int fd; // socket file descriptor
-    std::string in_buffer;  // data read from socket but not yet processed
-    std::string out_buffer; // data to be written to socket
-    std::mutex mtx;         // protects buffers and closed flag
+    bool read_paused{false};       // output above the high watermark: stop reading
+    bool close_after_write{false}; // close once the output is flushed (e.g. "Connection: close")
+    // io_uring backend: operations the kernel may still complete; the
+    // Connection is retired only once both are clear
+    bool recv_armed{false}; // multishot recv in flight
+    bool sending{false};    // send queued or in flight
     bool closed{false};     // whether socket has been closed
-    // last active timestamp used by timer/idle detection
-    std::chrono::steady_clock::time_point last_active;
+    uint64_t token{0};      // generation << 32 | fd, assigned by ConnectionTable
+    ConnectionIo *io{nullptr}; // attached while data is in flight, nullptr when idle
+    Relay *relay{nullptr};     // proxy mode: the upstream this client is relayed to
+    // read / write / keep-alive deadlines, linked into the owning reactor's wheel
+    TimerNode timer;
 
-    explicit Connection(int _fd)
-        : fd(_fd), last_active(std::chrono::steady_clock::now()) {}
+    explicit Connection(int _fd) : fd(_fd) {}
+    ~Connection() {
+        delete io;
+        delete relay;
+        if (fd >= 0) close(fd);
+    }
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    // slab slots instead of heap objects
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 
-    // update last_active to now (call whenever data is received)
-    void touch() {
-        std::lock_guard<std::mutex> lock(mtx);
-        last_active = std::chrono::steady_clock::now();
+    // the I/O state, taken from the thread's cache if the connection was idle
+    ConnectionIo &attach_io() { return io ? *io : attach_io_slow(); }
+    // hand the I/O state back once nothing is in flight any more
+    void release_io() {
+        if (io && io->idle()) release_io_slow();
     }
+
+    bool has_output() const { return io && io->has_output(); }
+    // queued output reached high (a queued file counts as a full queue)
+    bool backlogged(size_t high) const { return io && (io->out.size() >= high || !io->files.empty()); }
+    // queued output is down to low: a paused reader may resume
+    bool drained_to(size_t low) const { return !io || (io->out.size() <= low && io->files.empty()); }
+
+    // bytes this connection holds: slab slot, table slot, I/O state and relay
+    size_t footprint() const;
+
+private:
+    ConnectionIo &attach_io_slow();
+    void release_io_slow();
 };
@@ -0,0 +1,83 @@
+// ConnectionTable.h
+// Process-wide connection registry indexed directly by fd.
+//
+// Every connection is identified by a 64-bit token: the fd in the low 32
+// bits and a per-slot generation in the high 32 bits. The generation is
+// bumped on every insert, so an event or timer carrying the token of a
+// closed connection never matches a newer connection that reused the fd.
+//
+// Lookups take no lock: they load the slot pointer and compare the token
+// stored in the Connection. Callers must hold an EpochGuard while they use
+// the returned pointer; removed connections are handed to EpochManager and
+// freed only once no thread can still be reading them.
+//
+// Slots live in lazily allocated pages so the table costs nothing for fds
+// that are never opened.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct Connection;
+
+class ConnectionTable {
+public:
+    // max_fds defaults to the process RLIMIT_NOFILE
+    explicit ConnectionTable(size_t max_fds = 0);
+    ~ConnectionTable();
+
+    ConnectionTable(const ConnectionTable &) = delete;
+    ConnectionTable &operator=(const ConnectionTable &) = delete;
+
+    // table memory per fd once its page exists
+    static const size_t kSlotBytes = 16;
+
+    static int token_fd(uint64_t token) { return (int)(uint32_t)token; }
+
+    // publish conn under its fd; returns the new token (also stored in
+    // conn->token), or 0 if fd is out of range
+    uint64_t insert(Connection *conn);
+
+    // connection for token, or nullptr if it was closed / the fd reused
+    Connection *find(uint64_t token) const;
+
+    // unlink the connection for token. Returns it if this call removed it
+    // (at most one caller wins); the caller closes the fd and retires it.
+    Connection *remove(uint64_t token);
+
+    // unlink every connection and pass it to fn (shutdown only)
+    template <typename F>
+    void drain(F fn) {
+        for (size_t p = 0; p < num_pages_; ++p) {
+            Slot *page = pages_[p].load(std::memory_order_acquire);
+            if (!page) continue;
+            for (size_t i = 0; i < kPageSize; ++i) {
+                Connection *c = page[i].conn.exchange(nullptr, std::memory_order_acq_rel);
+                if (!c) continue;
+                count_.fetch_sub(1, std::memory_order_relaxed);
+                fn(c);
+            }
+        }
+    }
+
+    size_t size() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t kPageBits = 12;
+    static const size_t kPageSize = size_t(1) << kPageBits;
+
+    struct Slot {
+        std::atomic<Connection *> conn{nullptr};
+        std::atomic<uint32_t> generation{0};
+    };
+
+    Slot *slot(int fd) const;
+    Slot *slot_or_create(int fd);
+
+    size_t max_fds_;
+    size_t num_pages_;
+    std::atomic<Slot *> *pages_;
+    std::atomic<size_t> count_;
+};
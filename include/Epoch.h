@@ -0,0 +1,67 @@
+// Epoch.h
+// Epoch-based memory reclamation for objects read without locks.
+//
+// Readers wrap every access to shared objects in an EpochGuard. Writers that
+// unlink an object call retire() instead of deleting it; the object is freed
+// only after every thread that might still hold a pointer to it has left the
+// epoch in which it was unlinked (global epoch advanced twice).
+//
+// Each thread gets a cache-line sized record the first time it enters; the
+// record is recycled when the thread exits, together with any objects it
+// had retired but not yet freed. Retiring and reclaiming happen once per
+// closed connection, never on the per-event read path.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+class EpochManager {
+public:
+    static EpochManager &instance();
+
+    // pin / unpin the calling thread (nesting is allowed)
+    void enter();
+    void exit();
+
+    // defer deleter(p) until no pinned thread can still observe p
+    void retire(void *p, void (*deleter)(void *));
+
+    template <typename T>
+    void retire(T *p) {
+        retire(p, [](void *q) { delete static_cast<T *>(q); });
+    }
+
+    // advance the epoch if possible and free whatever became unreachable in
+    // any thread's list; call periodically so objects retired by threads
+    // that went quiet are not held forever
+    void reclaim();
+
+    // number of objects retired but not yet freed (for diagnostics)
+    size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+
+    struct Record;
+
+private:
+    EpochManager();
+    ~EpochManager();
+
+    Record *acquire_record();
+    bool try_advance();
+    void collect(Record *rec);
+
+    std::atomic<uint64_t> global_epoch_;
+    std::atomic<Record *> records_; // push-only list of thread records
+    std::atomic<size_t> pending_;
+};
+
+// RAII pin of the current thread
+class EpochGuard {
+public:
+    EpochGuard() { EpochManager::instance().enter(); }
+    ~EpochGuard() { EpochManager::instance().exit(); }
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+};
@@ -0,0 +1,55 @@
+// EventLoop.h
+// Interface shared by the I/O backends.
+//
+// An event loop owns one listening socket and the connections accepted on
+// it, runs on its own thread and keeps its own timing wheel. Two backends
+// implement it:
+// - Reactor: epoll, edge-triggered; readiness events are served inline or
+//   handed to the worker pool;
+// - UringReactor: io_uring with multishot accept, multishot recv into
+//   provided buffers and batched sends; always serves inline.
+// UdpLoop (UdpLoop.h) implements the same interface for UDP sockets.
+// Server (Server.h) builds the TCP loops for the backend, protocol and
+// dispatch it is instantiated with. Every loop asks the shared Admission
+// before it takes a connection off its listener. In the latency profile a
+// loop is pinned to a CPU and, when it runs out of completions, polls for
+// an AdaptiveSpin window before it blocks in the kernel.
+//
+// drain() is the old process's half of a hot restart (HotRestart.h): the
+// loop stops accepting, connections close after the reply to their next
+// request, and the keep-alive deadlines are pulled in to kDrainIdleMs so
+// idle ones close soon; one that is still sending stops reading and
+// closes once its output is out.
+
+#pragma once
+
+#include <atomic>
+
+class EventLoop {
+public:
+    virtual ~EventLoop() {}
+
+    // set up the kernel objects and register the listener
+    virtual bool init() = 0;
+
+    // run the loop on a dedicated thread / stop and join it
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    // backend name for log messages
+    virtual const char *name() const = 0;
+
+    // pin the loop thread to cpu once it starts (call before start())
+    void set_cpu(int cpu) { cpu_ = cpu; }
+
+    // stop accepting and let the connections finish; picked up by the loop
+    // thread within a wheel tick
+    void drain() { draining_.store(true, std::memory_order_relaxed); }
+
+protected:
+    // draining: how long an idle connection may still send a request
+    static const int kDrainIdleMs = 1000;
+
+    int cpu_{-1};
+    std::atomic<bool> draining_{false};
+};
@@ -0,0 +1,86 @@
+// FileCache.h
+// Open descriptors and metadata of static files, shared by every loop.
+//
+// Serving a file takes an open fd plus its size and modification time. The
+// cache keeps both for the most recently used paths (LRU, bounded by the
+// number of open files), so a hit costs a hash lookup instead of a path
+// walk, open and fstat. Entries are reference counted: a file that is
+// evicted or invalidated stays open until the responses still sending it
+// are done.
+//
+// Invalidation uses inotify watches on the directories holding cached
+// files: a modify, attribute change, delete or rename of an entry drops it.
+// The event queue is drained by lookups themselves, at most once per
+// millisecond, so there is no watcher thread and a change is seen by
+// requests arriving more than 1 ms after it. If the kernel's event queue
+// overflows, or inotify is unavailable, correctness wins: the cache is
+// cleared or files are opened uncached.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+
+struct CachedFile {
+    int fd;
+    uint64_t size;
+    time_t mtime;
+
+    CachedFile(int _fd, uint64_t _size, time_t _mtime) : fd(_fd), size(_size), mtime(_mtime) {}
+    ~CachedFile();
+    CachedFile(const CachedFile &) = delete;
+    CachedFile &operator=(const CachedFile &) = delete;
+};
+
+class FileCache {
+public:
+    static FileCache &instance();
+
+    // most files kept open (default 1024); 0 disables caching
+    void set_capacity(size_t n);
+
+    // The regular file at path, opened read-only; nullptr with errno set if
+    // it does not exist or is not a regular file (EISDIR for directories).
+    std::shared_ptr<const CachedFile> open(const std::string &path);
+
+    void clear();
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::string path;
+        std::shared_ptr<const CachedFile> file;
+        int wd; // watch on the containing directory
+    };
+    struct Watch {
+        std::string dir;
+        size_t entries; // cached files in dir; the watch goes at zero
+    };
+
+    FileCache();
+    ~FileCache();
+    FileCache(const FileCache &) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+
+    // mtx_ held for all of these
+    void drain_events();
+    int watch_dir(const std::string &dir);
+    void drop(std::list<Entry>::iterator it);
+    void drop_dir(int wd);
+    void clear_locked();
+
+    mutable std::mutex mtx_;
+    size_t capacity_{1024};
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    int inotify_fd_{-1};
+    std::unordered_map<int, Watch> watches_;
+    std::unordered_map<std::string, int> dir_wd_;
+    uint64_t last_drain_ns_{0};
+};
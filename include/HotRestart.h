@@ -0,0 +1,70 @@
+// HotRestart.h
+// Zero-downtime binary upgrade: the listening sockets move from the running
+// server to its replacement over a Unix socket.
+//
+// Both processes are started with the same --upgrade-socket PATH. A server
+// that finds nobody at PATH binds its own sockets and waits at PATH for its
+// replacement, which connects there instead of binding:
+// 1. the old process sends its TCP listeners and UDP sockets (SCM_RIGHTS)
+//    and the port they serve, and keeps accepting meanwhile;
+// 2. the new process builds its loops on them, starts them and confirms.
+//    The sockets are already bound, listening and configured, so it skips
+//    that setup and serves within milliseconds of asking;
+// 3. the old process closes its admin listener and PATH and says so, then
+//    drains its connections (EventLoop::drain) for up to --drain-timeout
+//    and exits; the new process opens the admin port and waits at PATH for
+//    the next upgrade.
+// Between 1 and 3 both processes accept from the same listen queues, so no
+// connection is refused or reset along the way. A new process that fails
+// before it confirms just closes the Unix socket, and the old one carries
+// on as if nothing happened.
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// sockets received from the previous process
+struct InheritedSockets {
+    std::vector<int> tcp;
+    std::vector<int> udp;
+    int port{0};
+    int pid{0};
+};
+
+class HotRestart {
+public:
+    enum Takeover {
+        Cold,      // nobody listens at the path: bind fresh sockets
+        Inherited, // sockets received, confirm() once serving on them
+        Failed,    // a server answered but the exchange failed
+    };
+
+    explicit HotRestart(std::string path) : path_(std::move(path)) {}
+    ~HotRestart();
+
+    HotRestart(const HotRestart &) = delete;
+    HotRestart &operator=(const HotRestart &) = delete;
+
+    // new process: ask the server at the path for its sockets
+    Takeover take_over(InheritedSockets &out);
+    // new process, serving on the inherited sockets: tell the old one and
+    // wait until it has let go of the admin port and the path
+    void confirm();
+
+    // wait at the path for the next upgrade; replaces a stale socket file
+    bool listen();
+    // old process, instead of the main loop's sleep: wait up to timeout_ms
+    // for a new process and hand it the sockets; true once it confirmed it
+    // serves on them
+    bool wait(int timeout_ms, int port, const std::vector<int> &tcp, const std::vector<int> &udp);
+    // old process, after wait() returned true and the admin port is closed:
+    // stop listening at the path and let the new process take it
+    void release();
+
+private:
+    std::string path_;
+    int listen_fd_{-1};
+    int peer_fd_{-1}; // the other process during an exchange
+};
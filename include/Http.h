@@ -0,0 +1,148 @@
+// Http.h
+// HTTP/1.1 keep-alive mode: request parser, codec and a static routing table.
+//
+// HttpCodec plugs into the codec layer. It searches the input for the end of
+// the header block ("\r\n\r\n") with SSE2/AVX2, resuming where the previous
+// partial read stopped, then parses the request line and headers once into
+// an HttpRequest whose strings point straight into the receive buffer (a
+// header block that straddles two chunks is linearised first). The request
+// body, sized by Content-Length, becomes the frame payload.
+//
+// Pipelined requests are answered in order: every request parsed from one
+// read appends its response to the connection's output, which goes out with
+// a single writev. A request that asks for "Connection: close" (or an
+// HTTP/1.0 request without keep-alive) ends the connection once its
+// response is flushed; input after it is discarded.
+//
+// Responses come from an HttpRouter, a short table of pre-rendered static
+// responses (plus an echo route that returns the request body), so serving
+// a request costs one lookup and one copy. A file route maps a path prefix
+// to a directory: only the response headers are built in user space, the
+// file body follows them straight from the page cache.
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#include "Codec.h"
+#include "Config.h"
+
+// non-owning view into the buffer a request was parsed from
+struct HttpString {
+    const char *data;
+    size_t size;
+
+    bool equals(const char *s, size_t n) const { return size == n && std::memcmp(data, s, n) == 0; }
+    bool equals(const std::string &s) const { return equals(s.data(), s.size()); }
+    // ASCII case-insensitive, for header names and tokens
+    bool iequals(const char *s) const;
+};
+
+struct HttpHeader {
+    HttpString name;
+    HttpString value;
+};
+
+struct HttpRequest {
+    static const size_t kMaxHeaders = 32;
+
+    HttpString method;
+    HttpString target;  // as sent, including any query
+    HttpString path;    // target up to '?'
+    int minor_version;  // HTTP/1.<minor_version>
+    HttpHeader headers[kMaxHeaders];
+    size_t num_headers;
+    size_t content_length;
+    bool keep_alive;
+
+    // first header called name (case-insensitive), nullptr if absent
+    const HttpString *header(const char *name) const;
+};
+
+// Offset just past the "\r\n\r\n" ending the header block, or -1 if the
+// buffer does not hold a complete one yet. Terminators starting before
+// `from` were ruled out by an earlier call; on a miss `from` advances so the
+// next call only looks at bytes that arrived since.
+ssize_t http_find_header_end(const Buffer &in, size_t &from);
+
+// Parse a complete header block (request line, headers, blank line) of len
+// bytes. req's strings point into data. Returns false on a malformed or
+// unsupported request (including Transfer-Encoding bodies).
+bool http_parse_request(const char *data, size_t len, HttpRequest &req);
+
+class HttpCodec final {
+public:
+    static const size_t kMaxHeader = 8 * 1024;
+    static const size_t kMaxBody = 16 * 1024 * 1024;
+
+    // The frame payload is the body; frame.meta points to the parsed
+    // HttpRequest, valid (like the payload) until the handler returns. A
+    // malformed or oversized request yields one frame with a null meta that
+    // swallows the rest of the input.
+    ssize_t decode(const Buffer &in, size_t &scan, Frame &frame) const;
+    // handlers write complete responses
+    void encode_header(Buffer &, size_t) const {}
+    void encode_trailer(Buffer &) const {}
+};
+
+class HttpRouter {
+public:
+    // answer method + path with a fixed response
+    void add(const std::string &method, const std::string &path, int status,
+             const std::string &content_type, const std::string &body);
+    // answer method + path with the request body
+    void add_echo(const std::string &method, const std::string &path);
+    // serve the files under root for GET / HEAD requests whose path starts
+    // with prefix, with single-range support; bodies are sent from the page
+    // cache through the FileCache
+    void add_files(const std::string &prefix, const std::string &root);
+
+    // routes served by default: "GET /" (hello), "GET /health", "POST /echo"
+    static HttpRouter defaults();
+    // defaults() plus the --static-dir files of cfg
+    static HttpRouter from_config(const ServerConfig &cfg);
+
+    // append the response to req (404 / 405 when no route matches, 501 for
+    // unknown methods)
+    void respond(const HttpRequest &req, const Frame &body, Reply<HttpCodec> &reply) const;
+    // 400 for a request that could not be parsed; closes the connection
+    void reject(Reply<HttpCodec> &reply) const;
+
+private:
+    struct Route {
+        std::string method;
+        std::string path;
+        bool echo;
+        // pre-rendered status line and headers for keep-alive and closing
+        // connections; HEAD requests get these without the body
+        std::string head_keep_alive;
+        std::string head_close;
+        std::string body;
+        std::string root; // file route: directory served under path, a prefix
+    };
+
+    static Route render(const std::string &method, const std::string &path, int status,
+                        const std::string &content_type, const std::string &body);
+    void write_static(const Route &route, const HttpRequest &req, Reply<HttpCodec> &reply) const;
+    void write_file(const Route &route, const HttpRequest &req, Reply<HttpCodec> &reply) const;
+
+    std::vector<Route> routes_; // a handful of entries: a linear scan wins
+    Route not_found_{render("", "", 404, "text/plain", "Not Found\n")};
+    Route not_allowed_{render("", "", 405, "text/plain", "Method Not Allowed\n")};
+    Route not_implemented_{render("", "", 501, "text/plain", "Not Implemented\n")};
+    Route bad_request_{render("", "", 400, "text/plain", "Bad Request\n")};
+};
+
+class HttpHandler final {
+public:
+    explicit HttpHandler(HttpRouter router) : router_(std::move(router)) {}
+    void on_frame(const Frame &frame, Reply<HttpCodec> &reply);
+
+private:
+    const HttpRouter router_;
+};
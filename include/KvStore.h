@@ -0,0 +1,174 @@
+// KvStore.h
+// In-memory key-value store behind the memcache codec, shared by every loop.
+//
+// Keys hash to one of N shards (N = worker threads, or reactors in inline
+// mode), each guarded by its own mutex so threads only contend when they
+// touch the same shard. A shard holds:
+// - an open-addressing hash table (linear probing, backward-shift deletion,
+//   so there are no tombstones) of full 64-bit hashes and item pointers;
+// - slab classes: items live in fixed-size chunks carved from 1 MiB pages,
+//   sizes growing by 1.25x, so storing a value never calls malloc once the
+//   pages exist. Pages come from a budget shared by all shards (--kv-memory);
+// - CLOCK eviction per slab class: a get sets the item's reference bit, and
+//   when a class has no free chunk and the budget no page left, its hand
+//   sweeps the class's chunks, clearing set bits and reusing the first item
+//   whose bit was clear. A class that has no page at all once the budget
+//   is spent takes one from the class holding the most pages in its shard,
+//   evicting what was on it;
+// - an expiry wheel for TTLs, the TimerManager's design at one-second
+//   ticks: items with a deadline are linked into slot deadline % 256 and
+//   freed when their slot comes due (items further out stay linked until a
+//   later turn). expire() advances every shard's wheel; the server calls it
+//   from its main loop. A get also checks the deadline, so an item is never
+//   served after it expired even between ticks.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "Aligned.h"
+
+class Buffer;
+
+// Header of one stored item; the key follows it, then the value and "\r\n"
+// so a hit is answered with a single copy.
+struct KvItem {
+    KvItem *prev; // expiry wheel slot list (items with a deadline only)
+    KvItem *next;
+    uint64_t hash;
+    uint32_t deadline; // store second at which the item expires, 0 = never
+    uint32_t flags;    // opaque client flags
+    uint32_t nbytes;   // value size, without the "\r\n"
+    uint8_t nkey;
+    uint8_t cls;       // slab class
+    uint8_t ref;       // CLOCK reference bit
+    uint8_t live;      // 0 while the chunk is on its class's free list
+
+    char *key() { return reinterpret_cast<char *>(this + 1); }
+    char *value() { return key() + nkey; }
+    // the value followed by "\r\n"
+    const char *value() const { return reinterpret_cast<const char *>(this + 1) + nkey; }
+};
+
+class KvStore {
+public:
+    static const size_t kPageSize = 1 << 20;
+    static const size_t kMaxKey = 250;
+    // largest value that fits a page next to the header and a longest key
+    static const size_t kMaxValue = kPageSize - sizeof(KvItem) - kMaxKey - 2;
+
+    enum Result {
+        Stored,
+        TooLarge, // item does not fit a slab page
+        NoMemory, // no chunk could be found or evicted
+    };
+
+    static KvStore &instance();
+
+    // number of shards and memory budget for slab pages (at least one page
+    // per shard); call before the store is used
+    void configure(size_t shards, size_t max_bytes);
+
+    // exptime as in memcached: 0 never expires, up to 30 days is relative
+    // seconds, larger values are a Unix time; a past time stores nothing
+    // and drops the old value. The value is n bytes of src from offset,
+    // copied straight into the item even if it straddles chunks.
+    Result set(const char *key, size_t nkey, uint32_t flags, int64_t exptime, const Buffer &src, size_t offset,
+               size_t n);
+    // false if the key was not stored
+    bool remove(const char *key, size_t nkey);
+
+    // Calls f(flags, value, nbytes) under the shard lock on a hit; value is
+    // followed by "\r\n" and only valid during the call.
+    template <typename F>
+    bool get(const char *key, size_t nkey, F &&f) {
+        uint64_t h = hash(key, nkey);
+        Shard &s = shard(h);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        KvItem *it = find(s, h, key, nkey);
+        if (!it) {
+            miss();
+            return false;
+        }
+        it->ref = 1;
+        f(it->flags, static_cast<const KvItem *>(it)->value(), (size_t)it->nbytes);
+        hit();
+        return true;
+    }
+
+    // free the items whose deadline passed; cheap when called more often
+    // than once a second
+    void expire();
+
+    size_t items() const;
+    // bytes of slab pages in use
+    size_t memory() const { return pages_.load(std::memory_order_relaxed) * kPageSize; }
+
+private:
+    static const size_t kWheelSlots = 256;
+
+    struct SlabClass {
+        size_t size;      // chunk size
+        size_t per_page;  // chunks per page
+        std::vector<char *> pages;
+        KvItem *free{nullptr};
+        size_t hand{0};   // CLOCK hand: chunk index across the pages
+    };
+
+    struct Slot {
+        uint64_t hash;
+        KvItem *item; // nullptr: empty
+    };
+
+    struct alignas(64) Shard : CacheAligned {
+        std::mutex mtx;
+        std::vector<Slot> table;
+        size_t count{0};
+        std::vector<SlabClass> classes;
+        KvItem *wheel[kWheelSlots];
+        uint32_t wheel_now{0}; // last second the wheel was advanced to
+
+        Shard() { std::memset(wheel, 0, sizeof(wheel)); }
+    };
+
+    KvStore();
+    ~KvStore();
+    KvStore(const KvStore &) = delete;
+    KvStore &operator=(const KvStore &) = delete;
+
+    static uint64_t hash(const char *key, size_t nkey);
+    Shard &shard(uint64_t h) { return *shards_[(h >> 32) % shards_.size()]; }
+    // seconds since the store was created, starting at 1
+    uint32_t now_s() const;
+    static void hit();
+    static void miss();
+
+    // s.mtx held for all of these
+    KvItem *find(Shard &s, uint64_t h, const char *key, size_t nkey);
+    size_t find_slot(Shard &s, uint64_t h, const char *key, size_t nkey) const;
+    void insert(Shard &s, KvItem *it);
+    void erase_slot(Shard &s, size_t i);
+    void unlink(Shard &s, KvItem *it); // out of the table and wheel, chunk freed
+    void grow(Shard &s);
+    KvItem *alloc(Shard &s, size_t cls);
+    bool add_page(SlabClass &c);
+    void carve(SlabClass &c, char *page);
+    KvItem *evict(Shard &s, SlabClass &c);
+    bool reassign(Shard &s, SlabClass &c);
+    void free_chunk(Shard &s, KvItem *it);
+    void wheel_link(Shard &s, KvItem *it);
+    void wheel_unlink(Shard &s, KvItem *it);
+    void advance(Shard &s, uint32_t now);
+
+    std::vector<size_t> class_sizes_;
+    std::vector<Shard *> shards_;
+    size_t max_pages_;
+    std::atomic<size_t> pages_{0};
+    uint64_t start_ns_;
+    std::atomic<uint32_t> expired_at_{0};
+};
@@ -1,19 +1,48 @@
 // Logger.h
-// Simple thread-safe logger with levels and file output.
+// Asynchronous logger with levels and file output.
+//
+// Each logging thread appends records to its own lock-free single-producer
+// ring; a background thread drains all rings, formats the lines (with a
+// timestamp string cached per second) and writes them to stdout and the log
+// file in batches. When a ring is full the configured overflow policy either
+// drops the line (counted in dropped()) or blocks until the flusher catches up.
+//
+// Use the LOG_* macros on hot paths: they check the level before the message
+// expression is evaluated, so disabled levels cost one atomic load.
 #pragma once
 
 #include <string>
 #include <fstream>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
 
 class Logger {
 public:
     enum Level { DEBUG, INFO, WARN, ERROR };
+    enum OverflowPolicy { DROP, BLOCK };
 
     static Logger &instance();
     void init(const std::string &path);
 
-    void log(Level lvl, const std::string &msg);
+    void set_level(Level lvl) { level_.store(lvl, std::memory_order_relaxed); }
+    bool enabled(Level lvl) const { return lvl >= level_.load(std::memory_order_relaxed); }
+    void set_overflow_policy(OverflowPolicy p) { policy_.store(p, std::memory_order_relaxed); }
+    void set_stdout(bool on) { to_stdout_.store(on, std::memory_order_relaxed); }
+
+    // lines discarded because a ring was full under the DROP policy
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // block until every line logged before the call has been written
+    void flush();
+
+    void log(Level lvl, const char *msg, size_t len);
+    void log(Level lvl, const std::string &msg) { log(lvl, msg.data(), msg.size()); }
 
     // convenience
     void debug(const std::string &msg) { log(DEBUG, msg); }
@@ -21,10 +50,57 @@ public:
     void warn(const std::string &msg) { log(WARN, msg); }
     void error(const std::string &msg) { log(ERROR, msg); }
 
+    // "debug" / "info" / "warn" / "error" -> Level
+    static bool parse_level(const std::string &name, Level &out);
+
+    struct Ring;
+
 private:
     Logger();
     ~Logger();
-    std::mutex mtx_;
+
+    Ring *thread_ring();
+    void wake_flusher();
+    void flusher_loop();
+    // move every pending record into out_; returns true if anything was read
+    bool drain();
+    void format(int lvl, int64_t sec, const char *msg, size_t len);
+    void write_out();
+
+    std::atomic<int> level_;
+    std::atomic<int> policy_;
+    std::atomic<bool> to_stdout_;
+    std::atomic<uint64_t> dropped_;
+
+    std::mutex rings_mtx_; // guards rings_ (ring registration only)
+    std::vector<Ring *> rings_;
+
+    std::mutex mtx_; // guards the file and the flusher state below
+    std::condition_variable wake_cv_;
+    std::condition_variable flushed_cv_;
     std::ofstream ofs_;
     bool to_file_{false};
+    uint64_t flush_requested_{0};
+    uint64_t flush_done_{0};
+    bool wake_pending_{false};
+
+    // flusher-thread only
+    std::string out_;
+    std::time_t cached_sec_{-1};
+    char cached_time_[32];
+
+    std::atomic<bool> running_;
+    std::thread flusher_;
 };
+
+#define LOG_AT(lvl, expr)                                        \
+    do {                                                         \
+        if (Logger::instance().enabled(lvl)) {                   \
+            Logger::instance().log(lvl, (expr));                 \
+        }                                                        \
+    } while (0)
+
+#define LOG_DEBUG(expr) LOG_AT(Logger::DEBUG, expr)
+#define LOG_INFO(expr) LOG_AT(Logger::INFO, expr)
+#define LOG_WARN(expr) LOG_AT(Logger::WARN, expr)
+#define LOG_ERROR(expr) LOG_AT(Logger::ERROR, expr)
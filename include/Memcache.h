@@ -0,0 +1,86 @@
+// Memcache.h
+// Key-value mode: a memcached text protocol subset served from the KvStore.
+//
+// Supported commands:
+//   get <key>*                                    VALUE <key> <flags> <bytes>\r\n<data>\r\n ... END
+//   set <key> <flags> <exptime> <bytes> [noreply] STORED
+//   delete <key> [noreply]                        DELETED | NOT_FOUND
+//   version, quit
+// Anything else is answered with ERROR, as memcached does.
+//
+// MemcacheCodec frames one command line, plus the data block of a set, and
+// parses it once into a MemcacheRequest whose keys point straight into the
+// receive buffer. The data block becomes the frame payload and is copied
+// only once, into its slab chunk. A multi-get appends every hit to the
+// connection's output, and pipelined commands do the same, so all of their
+// replies leave in a single writev.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+#include "Codec.h"
+
+class KvStore;
+
+struct MemcacheRequest {
+    enum Command {
+        Get,
+        Set,
+        Delete,
+        Version,
+        Quit,
+        Unknown,   // ERROR
+        Malformed, // CLIENT_ERROR, the connection stays open
+        Invalid,   // CLIENT_ERROR, the connection is closed (input cannot be resynchronised)
+    };
+
+    // non-owning view into the buffer the command was parsed from
+    struct Key {
+        const char *data;
+        size_t size;
+    };
+
+    Command cmd;
+    std::vector<Key> keys; // get: every key; set / delete: one
+    uint32_t flags;
+    int64_t exptime;
+    bool noreply;
+    const char *error; // Malformed / Invalid: the CLIENT_ERROR message
+};
+
+// Parse one command line (without the "\n"; a trailing "\r" is allowed).
+// req.keys point into line. Returns true if a data block of `bytes` bytes
+// plus "\r\n" follows the line: after every set whose size parses, even one
+// refused as Malformed, so the block can be skipped.
+bool memcache_parse(const char *line, size_t len, MemcacheRequest &req, size_t &bytes);
+
+class MemcacheCodec final {
+public:
+    // long enough for a multi-get of a few hundred keys
+    static const size_t kMaxLine = 64 * 1024;
+    // data blocks above this close the connection instead of being read and
+    // refused
+    static const size_t kMaxData = 16 * 1024 * 1024;
+
+    // The frame payload is a set's data block; frame.meta points to the
+    // parsed MemcacheRequest, valid until the handler returns. A line that
+    // is too long or a data block without its "\r\n" yields an Invalid
+    // request that swallows the rest of the input.
+    ssize_t decode(const Buffer &in, size_t &scan, Frame &frame) const;
+    // handlers write complete replies
+    void encode_header(Buffer &, size_t) const {}
+    void encode_trailer(Buffer &) const {}
+};
+
+class MemcacheHandler final {
+public:
+    explicit MemcacheHandler(KvStore &store) : store_(store) {}
+    void on_frame(const Frame &frame, Reply<MemcacheCodec> &reply);
+
+private:
+    KvStore &store_;
+};
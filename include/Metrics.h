@@ -0,0 +1,132 @@
+// Metrics.h
+// Built-in server metrics: per-thread counters and latency histograms.
+//
+// Every thread that records something gets its own cache-line-aligned slot
+// on first use, so updates are plain relaxed load/store pairs on memory no
+// other thread writes: no locked instructions and no shared cache lines on
+// the hot path. Readers (the admin endpoint) sum all slots under the
+// registry lock; a thread that exits folds its slot into a retired total
+// so nothing it counted is lost.
+//
+// Histograms are HDR-style log-linear: exact below 64, then 32 buckets per
+// power of two (at most ~3% relative error) up to 2^40 ns.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class Counter {
+    Accepts,  // connections accepted
+    BytesIn,  // bytes read from clients
+    BytesOut, // bytes written to clients
+    Events,   // readiness events / completions handled
+    Closes,   // connections closed
+    Timeouts, // connections shut down by a timer
+    FileBytes,       // bytes sent straight from files (part of BytesOut)
+    FileCacheHits,   // static file lookups served from the FileCache
+    FileCacheMisses, // static file lookups that had to open the file
+    Shed,            // connections reset by admission control
+    AcceptPauses,    // times a loop left connections in the backlog
+    ReadYields,      // visits cut short by the read budget
+    Starved,         // ready connections served later than --starve-ms
+    KvHits,          // memcache keys found
+    KvMisses,        // memcache keys not found
+    KvEvictions,     // items evicted to make room
+    KvExpired,       // items dropped when their TTL ran out
+    UdpIn,           // datagrams received (GRO segments counted singly)
+    UdpOut,          // datagrams sent (GSO segments counted singly)
+    UdpDrops,        // datagrams truncated, or replies too large or not sent
+    ConnBytesAllocated, // per-connection state allocated (slots and I/O state)
+    ConnBytesFreed,     // per-connection state given back
+    UpstreamConnects,   // proxy: connections opened to upstreams for clients
+    UpstreamPoolHits,   // proxy: clients given an upstream connection already open
+    UpstreamFailures,   // proxy: upstream connects and health checks that failed
+    ProxyRefused,       // proxy: clients reset with no healthy upstream left
+};
+const int kNumCounters = 26;
+
+enum class Hist {
+    PoolQueue, // time a task waited in the ThreadPool before it ran
+    Handler,   // time spent decoding and handling one read's worth of input
+};
+const int kNumHists = 2;
+
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+
+    // upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+    uint64_t percentile(double p) const;
+};
+
+class Histogram {
+public:
+    static const int kSubBits = 5;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kMaxShift = 35;
+    static const int kBuckets = 2 * kSubBuckets + kMaxShift * kSubBuckets;
+
+    Histogram();
+
+    // owning thread only
+    void record(uint64_t v);
+    // add this histogram's counts to s (any thread)
+    void merge_into(HistogramSnapshot &s) const;
+
+    static int bucket_of(uint64_t v);
+    static uint64_t bucket_upper(int i);
+
+private:
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+class Metrics {
+public:
+    struct Snapshot {
+        uint64_t counters[kNumCounters];
+        HistogramSnapshot hists[kNumHists];
+    };
+
+    static Metrics &instance();
+
+    // record on the calling thread's slot
+    static void add(Counter c, uint64_t n = 1);
+    static void record(Hist h, uint64_t ns);
+    // CLOCK_MONOTONIC in nanoseconds
+    static uint64_t now_ns();
+
+    Snapshot snapshot();
+    // "name value" lines, histograms summarised in microseconds
+    std::string render_text();
+    // Prometheus text exposition format (counters and summaries)
+    std::string render_prometheus();
+
+    // a fixed fact about the running server (runtime profile, CPUs, ...),
+    // shown as "name value" in text and as a label of hps_runtime_info
+    void set_info(const std::string &name, const std::string &value);
+
+    struct Slot;
+
+private:
+    Metrics() {}
+
+    friend struct SlotHandle;
+    void attach(Slot *s);
+    void detach(Slot *s);
+    static void merge(const Slot &s, Snapshot &out);
+
+    std::mutex mtx_; // guards slots_ and retired_
+    std::vector<Slot *> slots_;
+    Snapshot retired_{}; // totals of threads that have exited
+    std::vector<std::pair<std::string, std::string>> info_; // guarded by mtx_
+};
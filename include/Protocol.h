@@ -0,0 +1,61 @@
+// Protocol.h
+// Protocol policies for Server (Server.h): what a loop does with the input
+// a read brought in.
+//
+// A policy is a copyable class with
+//     bool on_input(Connection *conn);
+// that consumes conn->io->in, appends replies to conn->io->out (and
+// conn->io->files) and returns false on a protocol error. Every loop owns a copy; in pooled
+// mode the workers call on_input of their loop's copy concurrently, for
+// different connections. A policy served over UDP (UdpLoop.h) also has
+//     void on_datagram(Buffer &in, Buffer &out, std::vector<FileSend> &files);
+// which answers one self-contained datagram into out. The loop templates
+// call both directly, so a policy over final codec and handler types is
+// inlined into the read path with no virtual call per frame.
+//
+// - RawEcho: the chunks just read become output without copying;
+// - Framed<C, H>: frames of codec C answered by handler H.
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "Codec.h"
+#include "Connection.h"
+#include "Http.h"
+#include "Memcache.h"
+
+class RawEcho {
+public:
+    bool on_input(Connection *conn) {
+        conn->io->out.append(std::move(conn->io->in));
+        return true;
+    }
+    // the whole datagram is one frame
+    void on_datagram(Buffer &in, Buffer &out, std::vector<FileSend> &) { out.append(std::move(in)); }
+};
+
+template <class C, class H>
+class Framed {
+public:
+    explicit Framed(H handler = H(), C codec = C()) : codec_(std::move(codec)), handler_(std::move(handler)) {}
+
+    bool on_input(Connection *conn) { return process_frames(conn, codec_, handler_); }
+    void on_datagram(Buffer &in, Buffer &out, std::vector<FileSend> &files) {
+        // a protocol error or an incomplete last frame just ends the datagram
+        size_t scan = 0;
+        Reply<C> reply(codec_, out, files);
+        process_frames(in, scan, codec_, handler_, reply);
+    }
+
+private:
+    C codec_;
+    H handler_;
+};
+
+// the protocols of --codec
+using LineEcho = Framed<LineCodec, EchoHandler>;
+using LengthPrefixEcho = Framed<LengthPrefixCodec, EchoHandler>;
+using HttpProtocol = Framed<HttpCodec, HttpHandler>;
+using MemcacheProtocol = Framed<MemcacheCodec, MemcacheHandler>;
@@ -0,0 +1,323 @@
+// Proxy.h
+// TCP reverse proxy: every client connection is relayed to an upstream
+// instead of being answered.
+//
+// - UpstreamPool: the upstreams of --proxy, shared by all loops. Each new
+//   client goes to the healthy upstream with the fewest relays open
+//   (ties rotate). A health thread connects to every upstream each
+//   --proxy-check ms: an upstream that refuses is skipped until a check
+//   succeeds again, as is one a loop failed to connect to. Successful check
+//   connections are kept, up to --proxy-pool per upstream, and handed to new
+//   clients, so most relays start without waiting for a handshake; a pooled
+//   connection the upstream closed meanwhile is noticed (MSG_PEEK) and
+//   dropped. An upstream connection carries one client's byte stream and is
+//   closed with it: without knowing the protocol there is no point at which
+//   it could be shared.
+// - ProxyReactor: the epoll loop of proxy mode, pooled or inline like
+//   Reactor, on the same accept, admission, timer and close code
+//   (ReactorBase). Both sockets of a pair are in the loop's epoll set; the
+//   upstream's events carry the client token with kUpstreamBit set, so
+//   either socket's readiness serves the pair. A visit moves bytes
+//   socket -> pipe -> socket with splice in both directions, so payload
+//   never enters user space; each direction moves at most Tuning's file
+//   budget per visit before the pair yields. A destination that stops
+//   taking data leaves the pipe full and the source unread, and TCP flow
+//   control pushes back on the sender, in each direction on its own. An
+//   EOF is passed on with shutdown(SHUT_WR) once the pipe is flushed and
+//   the pair closes when both directions have ended, after an error, or on
+//   its keep-alive timeout (refreshed by traffic either way).
+//
+// In pooled mode the two sockets are separate EPOLLONESHOT registrations;
+// Relay::visits lets one worker serve the pair for every event that comes
+// in meanwhile, so a pair is never served by two threads at once.
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "Connection.h"
+#include "ConnectionTable.h"
+#include "Reactor.h"
+#include "ThreadPool.h"
+
+class UpstreamPool {
+public:
+    UpstreamPool(int pool_size, int check_ms) : pool_size_((size_t)pool_size), check_ms_(check_ms) {}
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool &) = delete;
+    UpstreamPool &operator=(const UpstreamPool &) = delete;
+
+    // resolve "host:port[,host:port...]"; false (logged) if one does not
+    bool init(const std::string &list);
+    // run the health checks (and fill the pools) until stop()
+    void start();
+    void stop();
+
+    // the healthy upstream with the fewest relays open, -1 if none is
+    int pick();
+    // a non-blocking socket to upstream i, counted as one more relay;
+    // connecting is set while its handshake is still in progress. -1 if the
+    // connect failed at once.
+    int take(int i, bool &connecting);
+    // a relay to upstream i ended
+    void release(int i);
+    // a connect to upstream i failed: skip it until a check succeeds
+    void failed(int i);
+
+    bool healthy(int i) const { return upstreams_[(size_t)i]->healthy.load(std::memory_order_relaxed); }
+    size_t size() const { return upstreams_.size(); }
+    const std::string &name(int i) const { return upstreams_[(size_t)i]->name; }
+
+private:
+    struct Upstream {
+        std::string name; // as given on the command line
+        sockaddr_storage addr;
+        socklen_t addr_len{0};
+        std::atomic<bool> healthy{true}; // until a check says otherwise
+        std::atomic<int> active{0};      // relays open
+        std::mutex mtx;                  // guards idle
+        std::vector<int> idle;           // connected sockets for new clients
+    };
+
+    void check_loop();
+    // one health check; also tops the idle pool up
+    void check(Upstream &u);
+    void set_healthy(Upstream &u, bool healthy);
+    void publish();
+
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+    size_t pool_size_;
+    int check_ms_;
+    std::atomic<unsigned> next_{0}; // rotates ties between equally busy upstreams
+
+    std::mutex mtx_; // guards running_ for the wait
+    std::condition_variable cv_;
+    bool running_{false};
+    std::thread thread_;
+};
+
+// The protocol policy of proxy mode: which upstreams to relay to. Copies
+// share the pool.
+class TcpProxy {
+public:
+    explicit TcpProxy(std::shared_ptr<UpstreamPool> upstreams) : upstreams_(std::move(upstreams)) {}
+
+    UpstreamPool &upstreams() const { return *upstreams_; }
+
+private:
+    std::shared_ptr<UpstreamPool> upstreams_;
+};
+
+class ProxyReactorBase : public ReactorBase {
+public:
+    // set in the fd half of a token: the event is for the pair's upstream
+    // socket (ConnectionTable never hands out fds this large)
+    static const uint64_t kUpstreamBit = uint64_t(1) << 31;
+
+protected:
+    ProxyReactorBase(int id, int listen_fd, ConnectionTable &conns, Admission &admission, const ServerConfig &cfg,
+                     bool pooled, UpstreamPool &upstreams)
+        : ReactorBase(id, listen_fd, conns, admission, cfg, pooled), upstreams_(upstreams) {}
+
+    // pick an upstream and register its socket next to the client's
+    bool on_accepted(Connection *conn) override;
+    // the pair's upstream socket goes down with the client's
+    void on_timeout(uint64_t token, TimerKind kind) override;
+
+    // move what both sockets have, at most budget bytes each way; false
+    // once the pair is closed. yielded is set if a budget ran out.
+    bool relay(Connection *conn, size_t budget, bool &yielded, uint64_t trace);
+    // pooled: re-arm both sockets with the interest the pair needs
+    bool rearm_pair(Connection *conn);
+    void close_pair(Connection *conn);
+
+private:
+    // connect the relay to the best upstream left; false if none is healthy
+    bool connect_upstream(Connection *conn);
+    // the handshake of a connecting upstream finished; false if it failed
+    // and no other upstream could be reached
+    bool finish_connect(Connection *conn);
+    // src -> pipe -> dst until src runs dry, dst is full or budget is spent,
+    // adding the bytes moved to read and written; false on an error
+    bool pump(int src, int dst, Relay::Direction &d, size_t &budget, size_t &read, size_t &written);
+
+    UpstreamPool &upstreams_;
+};
+
+template <class Dispatch, class Tuning>
+class ProxyReactor final : public ProxyReactorBase {
+public:
+    // pool is only used with a pooled Dispatch
+    ProxyReactor(int id, int listen_fd, ConnectionTable &conns, ThreadPool *pool, Admission &admission,
+                 const ServerConfig &cfg, const TcpProxy &protocol)
+        : ProxyReactorBase(id, listen_fd, conns, admission, cfg, Dispatch::kPooled, protocol.upstreams()),
+          pool_(pool) {}
+    ~ProxyReactor() override { stop(); }
+
+    void start() override {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&ProxyReactor::loop, this);
+    }
+
+private:
+    void loop();
+    void on_event(uint64_t data, uint64_t ready_ns);
+    // serve the pair (pooled: for every thread that asked meanwhile)
+    void serve(Connection *conn, uint64_t trace);
+    void visit(Connection *conn, uint64_t trace);
+
+    ThreadPool *pool_;
+    std::vector<ThreadPool::Task> batch_; // pooled: tasks of the current epoll batch
+    std::vector<uint64_t> resume_;        // inline: pairs to serve again after the batch
+    std::vector<uint64_t> resuming_;
+    uint64_t wait_ns_{0};
+};
+
+template <class Dispatch, class Tuning>
+void ProxyReactor<Dispatch, Tuning>::loop() {
+    epoll_event events[Tuning::kEventBatch];
+    auto next_reclaim = TimerManager::Clock::now() + std::chrono::seconds(1);
+    if (cpu_ >= 0 && !pin_thread(pthread_self(), cpu_)) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] cannot pin to CPU " + std::to_string(cpu_) + ": " +
+                 std::strerror(errno));
+    }
+    Tracer::name_thread("reactor " + std::to_string(id_));
+    uint64_t last_event_ns = 0;
+    bool was_polling = false;
+
+    while (running_) {
+        if (accepting_ && draining_.load(std::memory_order_relaxed)) stop_accepting();
+        int timeout = timer_.resolution_ms();
+        if (accept_deferred_) timeout = std::min(timeout, Admission::kRetryMs);
+        bool polling = spin_.enabled() && Metrics::now_ns() - last_event_ns < spin_.window_ns();
+        if (was_polling && !polling) spin_.miss();
+        was_polling = polling;
+        wait_ns_ = Tracer::enabled() ? Metrics::now_ns() : 0;
+        int nfds = epoll_wait(epoll_fd_, events, (int)Tuning::kEventBatch, resume_.empty() && !polling ? timeout : 0);
+        if (nfds == -1) {
+            if (errno == EINTR) continue;
+            LOG_ERROR(std::string("epoll_wait failed errno=") + std::to_string(errno));
+            break;
+        }
+        uint64_t ready_ns = Metrics::now_ns();
+        if (nfds > 0) {
+            Metrics::add(Counter::Events, (uint64_t)nfds);
+            if (polling) spin_.hit();
+            last_event_ns = ready_ns;
+        }
+        {
+            EpochGuard guard;
+            for (int i = 0; i < nfds; ++i) {
+                if (events[i].data.u64 == (uint64_t)listen_fd_) {
+                    accept_connections();
+                } else {
+                    on_event(events[i].data.u64, ready_ns);
+                }
+            }
+            // inline: pairs that used up a budget carry on after the batch
+            resuming_.swap(resume_);
+            for (uint64_t token : resuming_) {
+                Connection *conn = conns_.find(token);
+                if (conn) serve(conn, 0);
+            }
+            resuming_.clear();
+        }
+        admission_.tick();
+        if (accept_deferred_) accept_connections();
+        if (Dispatch::kPooled && !batch_.empty()) pool_->enqueue_bulk(batch_);
+
+        auto now = TimerManager::Clock::now();
+        timer_.expire(now);
+        if (now >= next_reclaim) {
+            EpochManager::instance().reclaim();
+            next_reclaim = now + std::chrono::seconds(1);
+        }
+    }
+}
+
+template <class Dispatch, class Tuning>
+void ProxyReactor<Dispatch, Tuning>::on_event(uint64_t data, uint64_t ready_ns) {
+    // either socket of the pair: both are served
+    uint64_t token = data & ~kUpstreamBit;
+    uint64_t trace = Tracer::sample();
+    if (trace && wait_ns_) {
+        Tracer::record(TraceStage::Wait, trace, wait_ns_, ready_ns, (uint32_t)ConnectionTable::token_fd(token));
+        wait_ns_ = 0;
+    }
+    if (!Dispatch::kPooled) {
+        Connection *conn = conns_.find(token);
+        if (conn) serve(conn, trace);
+        return;
+    }
+    batch_.emplace_back([this, token, ready_ns, trace]() {
+        if (trace) {
+            Tracer::record(TraceStage::Queue, trace, ready_ns, Metrics::now_ns(),
+                           (uint32_t)ConnectionTable::token_fd(token));
+        }
+        EpochGuard guard;
+        Connection *conn = conns_.find(token);
+        if (conn) serve(conn, trace);
+    });
+}
+
+template <class Dispatch, class Tuning>
+void ProxyReactor<Dispatch, Tuning>::serve(Connection *conn, uint64_t trace) {
+    if (!Dispatch::kPooled) {
+        visit(conn, trace);
+        return;
+    }
+    // the client's and the upstream's events may reach two workers: the
+    // first serves the pair once more for each one that came meanwhile
+    std::atomic<uint32_t> &visits = conn->relay->visits;
+    if (visits.fetch_add(1, std::memory_order_acq_rel) != 0) return;
+    uint32_t taken = 1;
+    while (true) {
+        if (!conn->closed) visit(conn, trace);
+        uint32_t prev = visits.fetch_sub(taken, std::memory_order_acq_rel);
+        if (prev == taken) break;
+        taken = prev - taken;
+        trace = 0;
+    }
+}
+
+template <class Dispatch, class Tuning>
+void ProxyReactor<Dispatch, Tuning>::visit(Connection *conn, uint64_t trace) {
+    bool yielded = false;
+    if (!relay(conn, Tuning::kFileBudget, yielded, trace)) return;
+    if (!Dispatch::kPooled && yielded) resume_.push_back(conn->token);
+    if (Dispatch::kPooled && !rearm_pair(conn)) {
+        LOG_ERROR(std::string("epoll_ctl MOD failed for fd=") + std::to_string(conn->fd) + ", errno=" +
+                  std::to_string(errno));
+        close_pair(conn);
+    }
+}
+
+struct ProxyBackend {
+    static constexpr bool kPooledDispatch = true;
+
+    template <class P, class D, class T>
+    using Loop = ProxyReactor<D, T>;
+
+    template <class P, class D, class T>
+    static Loop<P, D, T> *create(int id, int listen_fd, ConnectionTable &conns, ThreadPool *pool,
+                                 Admission &admission, const ServerConfig &cfg, const P &protocol) {
+        return new Loop<P, D, T>(id, listen_fd, conns, pool, admission, cfg, protocol);
+    }
+
+    static const char *name() { return "epoll"; }
+};
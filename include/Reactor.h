@@ -0,0 +1,373 @@
+// Reactor.h
+// epoll backend: one event loop together with the connections it owns.
+//
+// A reactor accepts from its listening socket, registers connections in the
+// shared ConnectionTable, keeps its own timing wheel for their timeouts, and
+// serves readiness events in one of two ways:
+// - pooled: each event is handed to the shared ThreadPool and the fd is
+//   registered with EPOLLONESHOT so only one worker touches it at a time;
+// - inline (pool == nullptr): the reactor thread reads and writes the socket
+//   itself. With one reactor per core and a SO_REUSEPORT listener each,
+//   no connection state is shared between threads.
+//
+// Output that the socket does not accept immediately is queued on the
+// connection and flushed with writev when EPOLLOUT fires; a client whose
+// queue passes the high watermark is not read from until it drains below
+// the low watermark. File bodies queued by a handler go out with sendfile,
+// at most kFileBudget bytes per visit, and input is read up to the
+// listener's ReadBudget per visit: a multi-GB download or a bulk upload
+// then takes turns with other connections. Since edge-triggered epoll
+// reports nothing new for data that is already pending, a connection that
+// yields is put back in line explicitly (pooled: the EPOLLONESHOT re-arm
+// finds it ready at once and the next round is a new task behind the
+// queued ones; inline: the loop resumes it after the current batch).
+//
+// Accepts go through the shared Admission: a deferred accept leaves the
+// rest of the backlog in place and is retried every Admission::kRetryMs,
+// since an edge-triggered listener does not fire again for connections
+// that were already pending.
+//
+// epoll events carry the connection token rather than the fd, so an event
+// that was queued before a close never reaches a connection that reused the
+// fd. Connections are looked up without locks under an EpochGuard.
+//
+// With tracing on (Trace.h) an event sampled in on_event carries its trace
+// id through the pool task and serve(), which record the stages it passes.
+//
+// Reactor<Protocol, Dispatch, Tuning> is built by Server (Server.h): the
+// protocol policy, inline or pooled dispatch and the batch sizes are fixed
+// at compile time, so the event -> read -> handle path has no virtual call
+// and no mode check. What does not depend on them (setup, accept, output,
+// close, timeouts) lives in ReactorBase, compiled once.
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Admission.h"
+#include "Affinity.h"
+#include "Config.h"
+#include "Connection.h"
+#include "ConnectionTable.h"
+#include "Epoch.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Spin.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "Trace.h"
+
+class ReactorBase : public EventLoop {
+public:
+    ~ReactorBase() override;
+
+    // create the epoll instance and register the listener
+    bool init() override;
+
+    void stop() override;
+    const char *name() const override { return "epoll"; }
+
+protected:
+    // pooled: connections are registered EPOLLONESHOT and re-armed by the
+    // worker that served them
+    ReactorBase(int id, int listen_fd, ConnectionTable &conns, Admission &admission, const ServerConfig &cfg,
+                bool pooled);
+
+    void accept_connections();
+    // a new connection, before its fd is registered: false refuses it
+    // (refuse_connection)
+    virtual bool on_accepted(Connection *) { return true; }
+    // drain() was called: take the listener out and close idle connections
+    void stop_accepting();
+    // write as much queued output as the socket takes, sending at most
+    // file_budget file bytes; false on a fatal error
+    bool flush_output(Connection *conn, size_t &file_budget, uint64_t trace);
+    // one sendfile from the front file; returns what write() would
+    ssize_t send_file(Connection *conn, size_t &file_budget);
+    // pooled mode: re-arm EPOLLONESHOT with the interest the connection needs
+    bool rearm(Connection *conn);
+    // false if another thread closed it first
+    bool close_connection(Connection *conn);
+    // close a connection whose fd was never registered with a reset, at once
+    void refuse_connection(Connection *conn);
+    // timer callback: shut the socket down so its owner tears it down
+    virtual void on_timeout(uint64_t token, TimerKind kind);
+
+    int id_;
+    int listen_fd_;
+    int epoll_fd_{-1};
+    ConnectionTable &conns_;
+    Admission &admission_;
+    bool pooled_;
+    bool accept_deferred_{false}; // connections left in the backlog to retry
+    bool accepting_{true};        // false once draining
+    size_t high_watermark_;
+    size_t low_watermark_;
+    size_t budget_bytes_;   // per visit; SIZE_MAX: unlimited
+    size_t budget_reads_;
+    uint64_t starve_ns_;
+    int busy_poll_us_;
+    AdaptiveSpin spin_;     // latency profile: poll epoll before blocking
+    TimerManager timer_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+};
+
+template <class Protocol, class Dispatch, class Tuning>
+class Reactor final : public ReactorBase {
+public:
+    // pool is only used with a pooled Dispatch
+    Reactor(int id, int listen_fd, ConnectionTable &conns, ThreadPool *pool, Admission &admission,
+            const ServerConfig &cfg, const Protocol &protocol)
+        : ReactorBase(id, listen_fd, conns, admission, cfg, Dispatch::kPooled), pool_(pool), protocol_(protocol) {}
+    ~Reactor() override { stop(); }
+
+    void start() override {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&Reactor::loop, this);
+    }
+
+private:
+    void loop();
+    // inline: serve now; pooled: queue a task for the batch submission
+    void on_event(uint64_t token, uint64_t ready_ns);
+    // flush queued output, then read until EAGAIN or the read budget is
+    // spent, handling the input; ready_ns is when the event was reported,
+    // trace the event's trace id (0: not sampled)
+    void serve(Connection *conn, uint64_t ready_ns, uint64_t trace);
+    // hand newly read input to the protocol; false on a protocol error
+    bool handle_input(Connection *conn) {
+        uint64_t start = Metrics::now_ns();
+        bool ok = protocol_.on_input(conn);
+        Metrics::record(Hist::Handler, Metrics::now_ns() - start);
+        return ok;
+    }
+
+    ThreadPool *pool_;
+    Protocol protocol_;
+    std::vector<ThreadPool::Task> batch_; // pooled: tasks of the current epoll batch
+    std::vector<uint64_t> resume_;        // inline: tokens to serve again after the batch
+    std::vector<uint64_t> resuming_;
+    uint64_t wait_ns_{0};   // tracing: when the current batch's epoll_wait began (0: recorded)
+};
+
+// the hot path, instantiated once per Server type
+
+template <class Protocol, class Dispatch, class Tuning>
+void Reactor<Protocol, Dispatch, Tuning>::loop() {
+    epoll_event events[Tuning::kEventBatch];
+    auto next_reclaim = TimerManager::Clock::now() + std::chrono::seconds(1);
+    if (cpu_ >= 0 && !pin_thread(pthread_self(), cpu_)) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] cannot pin to CPU " + std::to_string(cpu_) + ": " +
+                 std::strerror(errno));
+    }
+    Tracer::name_thread("reactor " + std::to_string(id_));
+    uint64_t last_event_ns = 0;
+    bool was_polling = false;
+
+    while (running_) {
+        if (accepting_ && draining_.load(std::memory_order_relaxed)) stop_accepting();
+        // wake at least once per wheel tick to check the stop flag and timers
+        // (sooner while accepts are deferred); only poll while connections
+        // wait to resume sending, or in the latency profile for a while
+        // after the last event
+        int timeout = timer_.resolution_ms();
+        if (accept_deferred_) timeout = std::min(timeout, Admission::kRetryMs);
+        bool polling = spin_.enabled() && Metrics::now_ns() - last_event_ns < spin_.window_ns();
+        if (was_polling && !polling) spin_.miss();
+        was_polling = polling;
+        wait_ns_ = Tracer::enabled() ? Metrics::now_ns() : 0;
+        int nfds = epoll_wait(epoll_fd_, events, (int)Tuning::kEventBatch, resume_.empty() && !polling ? timeout : 0);
+        if (nfds == -1) {
+            if (errno == EINTR) continue;
+            LOG_ERROR(std::string("epoll_wait failed errno=") + std::to_string(errno));
+            break;
+        }
+        uint64_t ready_ns = Metrics::now_ns();
+        if (nfds > 0) {
+            Metrics::add(Counter::Events, (uint64_t)nfds);
+            if (polling) spin_.hit();
+            last_event_ns = ready_ns;
+        }
+        {
+            // one pin covers the whole batch of inline lookups
+            EpochGuard guard;
+            for (int i = 0; i < nfds; ++i) {
+                if (events[i].data.u64 == (uint64_t)listen_fd_) {
+                    accept_connections();
+                } else {
+                    on_event(events[i].data.u64, ready_ns);
+                }
+            }
+            // inline: connections that used up a budget carry on after the
+            // batch; no new edge would wake them
+            resuming_.swap(resume_);
+            for (uint64_t token : resuming_) {
+                Connection *conn = conns_.find(token);
+                if (conn) serve(conn, ready_ns, 0);
+            }
+            resuming_.clear();
+        }
+        admission_.tick();
+        if (accept_deferred_) accept_connections();
+        // pooled: the whole batch goes to the workers in one submission
+        if (Dispatch::kPooled && !batch_.empty()) pool_->enqueue_bulk(batch_);
+
+        auto now = TimerManager::Clock::now();
+        timer_.expire(now);
+        if (now >= next_reclaim) {
+            EpochManager::instance().reclaim();
+            next_reclaim = now + std::chrono::seconds(1);
+        }
+    }
+}
+
+template <class Protocol, class Dispatch, class Tuning>
+void Reactor<Protocol, Dispatch, Tuning>::on_event(uint64_t token, uint64_t ready_ns) {
+    uint64_t trace = Tracer::sample();
+    if (trace && wait_ns_) {
+        // the wait that reported the batch, once per batch
+        Tracer::record(TraceStage::Wait, trace, wait_ns_, ready_ns, (uint32_t)ConnectionTable::token_fd(token));
+        wait_ns_ = 0;
+    }
+    if (!Dispatch::kPooled) {
+        // caller holds the epoch guard for the batch
+        Connection *conn = conns_.find(token);
+        if (conn) serve(conn, ready_ns, trace);
+        return;
+    }
+
+    // the worker resolves the token itself: the connection may be closed
+    // and reclaimed while the task waits in the queue
+    batch_.emplace_back([this, token, ready_ns, trace]() {
+        if (trace) {
+            Tracer::record(TraceStage::Queue, trace, ready_ns, Metrics::now_ns(),
+                           (uint32_t)ConnectionTable::token_fd(token));
+        }
+        EpochGuard guard;
+        Connection *conn = conns_.find(token);
+        if (conn) serve(conn, ready_ns, trace);
+    });
+}
+
+template <class Protocol, class Dispatch, class Tuning>
+void Reactor<Protocol, Dispatch, Tuning>::serve(Connection *conn, uint64_t ready_ns, uint64_t trace) {
+    int fd = conn->fd;
+    if (Metrics::now_ns() - ready_ns > starve_ns_) Metrics::add(Counter::Starved);
+    // what this visit may send and read before the connection yields
+    size_t file_budget = Tuning::kFileBudget;
+    size_t read_bytes = budget_bytes_;
+    size_t reads = budget_reads_;
+    bool yielded = false;
+
+    // writable again (or first visit): push out what is queued, and resume
+    // reading once the backlog is below the low watermark
+    if (!flush_output(conn, file_budget, trace)) {
+        close_connection(conn);
+        return;
+    }
+    if (conn->read_paused && conn->drained_to(low_watermark_)) conn->read_paused = false;
+
+    // once a reply asked to close, only the queued output matters
+    while (!conn->read_paused && !conn->close_after_write) {
+        if (read_bytes == 0 || reads == 0) {
+            // more may be pending, and no new edge will say so
+            yielded = true;
+            Metrics::add(Counter::ReadYields);
+            break;
+        }
+        ssize_t n;
+        {
+            TraceSpan span(TraceStage::Read, trace, fd);
+            n = conn->attach_io().in.read_from(fd);
+        }
+        if (n > 0) {
+            Metrics::add(Counter::BytesIn, (uint64_t)n);
+            read_bytes -= std::min(read_bytes, (size_t)n);
+            --reads;
+            // push the keep-alive deadline forward (a lock-free store)
+            timer_.refresh(conn->timer, TimerKind::KeepAlive);
+            // replies to every complete request are queued and written
+            // together once the socket is drained
+            LOG_DEBUG(std::string("[Worker] Received from fd=") + std::to_string(fd) + ": " + conn->io->in.to_string());
+            bool ok;
+            {
+                TraceSpan span(TraceStage::Handle, trace, fd);
+                ok = handle_input(conn);
+            }
+            if (!ok) {
+                LOG_WARN(std::string("[Worker] Protocol error on fd=") + std::to_string(fd));
+                close_connection(conn);
+                return;
+            }
+            // draining: this request was the last one
+            if (draining_.load(std::memory_order_relaxed) && conn->io->in.empty()) conn->close_after_write = true;
+            if (conn->backlogged(high_watermark_)) {
+                if (!flush_output(conn, file_budget, trace)) {
+                    close_connection(conn);
+                    return;
+                }
+                // slow reader: leave the rest in the socket until it drains
+                if (conn->backlogged(high_watermark_)) conn->read_paused = true;
+            }
+        } else if (n == 0) {
+            // orderly shutdown by peer (or by the idle timer); replies
+            // already queued still go out
+            if (conn->has_output()) {
+                conn->close_after_write = true;
+                break;
+            }
+            LOG_INFO(std::string("[Worker] Client fd=") + std::to_string(fd) + " disconnected");
+            close_connection(conn);
+            return;
+        } else {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            LOG_ERROR(std::string("[Worker] Read error on fd=") + std::to_string(fd));
+            close_connection(conn);
+            return;
+        }
+    }
+
+    // a partial request has the read timeout to complete from its first
+    // bytes, however slowly the rest trickles in (not while reading is paused)
+    if (conn->io && !conn->io->in.empty() && !conn->read_paused) {
+        timer_.arm(conn->timer, TimerKind::Read);
+    } else {
+        timer_.disarm(conn->timer, TimerKind::Read);
+    }
+
+    if (!flush_output(conn, file_budget, trace)) {
+        close_connection(conn);
+        return;
+    }
+    if (conn->close_after_write && !conn->has_output()) {
+        close_connection(conn);
+        return;
+    }
+    // a budget used up with the socket still readable or writable: pooled
+    // mode re-arms (the event fires at once and queues behind the tasks
+    // already waiting), inline mode comes back after the batch
+    if (!Dispatch::kPooled && (yielded || (file_budget == 0 && conn->io && !conn->io->files.empty()))) {
+        resume_.push_back(conn->token);
+    }
+    // all caught up: an idle connection keeps only its slot
+    conn->release_io();
+
+    if (Dispatch::kPooled && !rearm(conn)) {
+        // if re-arm fails, clean up: socket may be closed
+        LOG_ERROR(std::string("epoll_ctl MOD failed for fd=") + std::to_string(fd) + ", errno=" + std::to_string(errno));
+        close_connection(conn);
+    }
+}
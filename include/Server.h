@@ -0,0 +1,185 @@
+// Server.h
+// The TCP server as a header library: Server<Backend, Protocol, Dispatch,
+// Tuning> puts the loops, the worker pool, the connection table and
+// admission control together for one combination fixed at compile time.
+//
+// - Backend: EpollBackend (Reactor) or UringBackend (UringReactor), or
+//   ProxyBackend (ProxyReactor, Proxy.h) with the TcpProxy protocol;
+// - Protocol: a policy from Protocol.h (RawEcho, Framed<Codec, Handler>)
+//   or any class with the same on_input() (and on_datagram() for UDP);
+// - Dispatch: InlineDispatch serves connections on their loop thread,
+//   PooledDispatch hands each readiness event to a ThreadPool worker
+//   (epoll only);
+// - Tuning: the epoll batch, per-visit file budget and io_uring ring sizes.
+// Each combination instantiates its own loop, so the read path calls the
+// protocol directly and the dispatch choice is a constant: no virtual call
+// and no mode check per event or frame. The executable (main.cpp) picks the
+// instantiation matching its flags; an application embeds the server with
+//
+//     Server<EpollBackend, HttpProtocol, InlineDispatch> server(cfg, protocol);
+//     if (!server.init(listen_fds)) ...;
+//     server.start();
+//
+// The listening sockets stay the caller's (SocketUtil.h creates them), as
+// do process-wide services such as the Logger, Metrics and the admin port.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Admission.h"
+#include "Config.h"
+#include "Connection.h"
+#include "ConnectionTable.h"
+#include "Logger.h"
+#include "Protocol.h"
+#include "Reactor.h"
+#include "ThreadPool.h"
+#include "UringReactor.h"
+
+// serve connections on the loop thread that owns them
+struct InlineDispatch {
+    static constexpr bool kPooled = false;
+};
+
+// hand each readiness event to the worker pool
+struct PooledDispatch {
+    static constexpr bool kPooled = true;
+};
+
+template <size_t EventBatch = 1024,      // epoll events taken per epoll_wait
+          size_t FileBudget = 1 << 20,   // file bytes a connection sends per visit
+          unsigned SqEntries = 256,      // io_uring submission queue
+          unsigned CqEntries = 4096,     // io_uring completion queue
+          unsigned RecvBuffers = 256>    // io_uring provided 16 KiB chunks per loop
+struct Tuning {
+    static constexpr size_t kEventBatch = EventBatch;
+    static constexpr size_t kFileBudget = FileBudget;
+    static constexpr unsigned kSqEntries = SqEntries;
+    static constexpr unsigned kCqEntries = CqEntries;
+    static constexpr unsigned kRecvBuffers = RecvBuffers;
+
+    static_assert(EventBatch > 0 && FileBudget > 0, "batch sizes must be positive");
+    static_assert((SqEntries & (SqEntries - 1)) == 0 && (CqEntries & (CqEntries - 1)) == 0 &&
+                      (RecvBuffers & (RecvBuffers - 1)) == 0 && RecvBuffers <= 32768,
+                  "io_uring ring sizes must be powers of two");
+};
+
+template <size_t A, size_t B, unsigned C, unsigned D, unsigned E>
+constexpr size_t Tuning<A, B, C, D, E>::kEventBatch;
+template <size_t A, size_t B, unsigned C, unsigned D, unsigned E>
+constexpr size_t Tuning<A, B, C, D, E>::kFileBudget;
+template <size_t A, size_t B, unsigned C, unsigned D, unsigned E>
+constexpr unsigned Tuning<A, B, C, D, E>::kSqEntries;
+template <size_t A, size_t B, unsigned C, unsigned D, unsigned E>
+constexpr unsigned Tuning<A, B, C, D, E>::kCqEntries;
+template <size_t A, size_t B, unsigned C, unsigned D, unsigned E>
+constexpr unsigned Tuning<A, B, C, D, E>::kRecvBuffers;
+
+using DefaultTuning = Tuning<>;
+
+struct EpollBackend {
+    static constexpr bool kPooledDispatch = true;
+
+    template <class P, class D, class T>
+    using Loop = Reactor<P, D, T>;
+
+    template <class P, class D, class T>
+    static Loop<P, D, T> *create(int id, int listen_fd, ConnectionTable &conns, ThreadPool *pool,
+                                 Admission &admission, const ServerConfig &cfg, const P &protocol) {
+        return new Loop<P, D, T>(id, listen_fd, conns, pool, admission, cfg, protocol);
+    }
+
+    static const char *name() { return "epoll"; }
+};
+
+struct UringBackend {
+    static constexpr bool kPooledDispatch = false; // io_uring loops serve inline
+
+    template <class P, class D, class T>
+    using Loop = UringReactor<P, T>;
+
+    template <class P, class D, class T>
+    static Loop<P, D, T> *create(int id, int listen_fd, ConnectionTable &conns, ThreadPool *,
+                                 Admission &admission, const ServerConfig &cfg, const P &protocol) {
+        return new Loop<P, D, T>(id, listen_fd, conns, admission, cfg, protocol);
+    }
+
+    static const char *name() { return "io_uring"; }
+};
+
+template <class Backend, class Protocol, class Dispatch, class Tune = DefaultTuning>
+class Server {
+    static_assert(Backend::kPooledDispatch || !Dispatch::kPooled, "this backend only serves connections inline");
+
+public:
+    using Loop = typename Backend::template Loop<Protocol, Dispatch, Tune>;
+
+    // cfg must outlive the server. A pooled server starts cfg.num_threads
+    // workers here; every loop gets its own copy of protocol.
+    explicit Server(const ServerConfig &cfg, Protocol protocol = Protocol())
+        : cfg_(cfg), protocol_(std::move(protocol)),
+          pool_(Dispatch::kPooled ? new ThreadPool((size_t)cfg.num_threads, (uint64_t)cfg.spin_us * 1000) : nullptr),
+          admission_(cfg, conns_, pool_.get()) {}
+
+    ~Server() {
+        stop();
+        if (pool_ && pool_->heap_fallbacks() > 0) {
+            LOG_WARN(std::to_string(pool_->heap_fallbacks()) + " tasks exceeded the inline task storage (" +
+                     std::to_string(THREADPOOL_TASK_INLINE_BYTES) + " bytes) and were heap-allocated");
+        }
+        // workers finish the queued tasks, which reference the loops
+        pool_.reset();
+        loops_.clear();
+        // no other thread is left, so connections can be freed directly
+        conns_.drain([](Connection *conn) {
+            conn->closed = true;
+            delete conn;
+        });
+    }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    // one loop per listening socket, loop i pinned to cpus[i] if given;
+    // false if a loop cannot be set up (for io_uring: the kernel lacks it)
+    bool init(const std::vector<int> &listen_fds, const std::vector<int> &cpus = std::vector<int>()) {
+        for (size_t i = 0; i < listen_fds.size(); ++i) {
+            std::unique_ptr<Loop> loop(Backend::template create<Protocol, Dispatch, Tune>(
+                (int)i, listen_fds[i], conns_, pool_.get(), admission_, cfg_, protocol_));
+            if (!loop->init()) return false;
+            if (i < cpus.size()) loop->set_cpu(cpus[i]);
+            loops_.push_back(std::move(loop));
+        }
+        return true;
+    }
+
+    void start() {
+        for (auto &loop : loops_) loop->start();
+    }
+    // stop accepting and let the connections finish (hot restart)
+    void drain() {
+        for (auto &loop : loops_) loop->drain();
+    }
+    void stop() {
+        for (auto &loop : loops_) loop->stop();
+    }
+
+    // the worker pool of a pooled server, nullptr otherwise
+    ThreadPool *pool() const { return pool_.get(); }
+    const ConnectionTable &connections() const { return conns_; }
+    static const char *backend_name() { return Backend::name(); }
+
+private:
+    const ServerConfig &cfg_;
+    Protocol protocol_;
+    // fd-indexed registry shared by the loops, workers and timers
+    ConnectionTable conns_;
+    std::unique_ptr<ThreadPool> pool_;
+    // connection limits and pool overload checks shared by the loops
+    Admission admission_;
+    std::vector<std::unique_ptr<Loop>> loops_;
+};
@@ -0,0 +1,32 @@
+// SocketUtil.h
+// Small helpers shared by the listeners and reactors.
+
+#pragma once
+
+// set O_NONBLOCK on fd
+void setNonBlocking(int fd);
+
+// Create a non-blocking IPv4 TCP listener bound to INADDR_ANY:port.
+// With reuse_port set, SO_REUSEPORT is enabled so several sockets can bind
+// the same port and the kernel load-balances incoming connections.
+// Returns the fd, or -1 on failure (errno preserved).
+int create_listen_socket(int port, int backlog, bool reuse_port);
+
+// Create a blocking IPv4 UDP socket bound to INADDR_ANY:port with
+// SO_REUSEPORT, so every UDP loop binds its own and the kernel spreads
+// datagrams over them by flow. Returns the fd, or -1 (errno preserved).
+int create_udp_socket(int port);
+
+// Close an accepted connection with a RST (SO_LINGER 0) so the client sees
+// the refusal at once instead of a graceful close.
+void reset_connection(int fd);
+
+// Busy polling for the latency profile: a blocking wait on fd polls the
+// device queue for up to usec before sleeping (SO_BUSY_POLL, plus
+// SO_PREFER_BUSY_POLL where the kernel has it). Accepted sockets inherit
+// both from their listener. Raising the value needs CAP_NET_ADMIN; false
+// with errno set on failure.
+bool set_busy_poll(int fd, int usec);
+
+// The same for epoll_wait on epfd (EPIOCSPARAMS, Linux 6.9+).
+bool set_epoll_busy_poll(int epfd, int usec);
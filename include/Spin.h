@@ -0,0 +1,47 @@
+// Spin.h
+// Busy-waiting helpers for the latency profile.
+//
+// AdaptiveSpin sizes the window a thread polls for new work before it
+// blocks in the kernel: a wait that ended with work doubles the window (up
+// to the configured ceiling), one that ran out halves it. A thread whose
+// work arrives at short intervals keeps polling and picks it up within
+// microseconds, without a futex or epoll wake-up; one that is mostly idle
+// quickly stops burning its core.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+class AdaptiveSpin {
+public:
+    // max_ns == 0: never spin
+    explicit AdaptiveSpin(uint64_t max_ns = 0) : max_ns_(max_ns), window_ns_(max_ns) {}
+
+    bool enabled() const { return max_ns_ > 0; }
+    uint64_t window_ns() const { return window_ns_; }
+
+    // work arrived while polling
+    void hit() { window_ns_ = std::min(max_ns_, window_ns_ * 2); }
+    // polled for the whole window in vain
+    void miss() {
+        // compared, not bound to std::min's reference: the header has no
+        // out-of-line definition of kMinNs
+        uint64_t floor = kMinNs < max_ns_ ? kMinNs : max_ns_;
+        window_ns_ = std::max(floor, window_ns_ / 2);
+    }
+
+private:
+    static const uint64_t kMinNs = 1000;
+
+    uint64_t max_ns_;
+    uint64_t window_ns_;
+};
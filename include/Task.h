@@ -0,0 +1,136 @@
+// Task.h
+// Move-only `void()` callable with inline storage.
+//
+// InlineTask<N> stores any callable of up to N bytes (and at most
+// max_align_t alignment, nothrow-movable) inside the object itself, so
+// building, moving and running a task never allocates. Larger callables
+// still work but are placed on the heap; every such fallback is counted in
+// task_heap_fallbacks() so an oversized capture shows up in the stats rather
+// than as silent malloc traffic.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// callables that did not fit the inline storage of their InlineTask
+inline std::atomic<uint64_t> &task_heap_counter() {
+    static std::atomic<uint64_t> n{0};
+    return n;
+}
+inline uint64_t task_heap_fallbacks() { return task_heap_counter().load(std::memory_order_relaxed); }
+
+template <size_t InlineSize>
+class InlineTask {
+public:
+    InlineTask() : ops_(nullptr) {}
+
+    template <typename F, typename Fn = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<Fn, InlineTask>::value>::type>
+    InlineTask(F &&f) : ops_(nullptr) {
+        construct<Fn>(std::forward<F>(f), std::integral_constant<bool, fits<Fn>()>());
+    }
+
+    InlineTask(InlineTask &&other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    InlineTask &operator=(InlineTask &&other) noexcept {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(&storage_, &other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask &) = delete;
+    InlineTask &operator=(const InlineTask &) = delete;
+
+    ~InlineTask() { reset(); }
+
+    void operator()() { ops_->invoke(&storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    static const size_t kInlineSize = InlineSize;
+
+private:
+    struct Ops {
+        void (*invoke)(void *);
+        void (*move)(void *dst, void *src); // move-construct dst, destroy src
+        void (*destroy)(void *);
+    };
+
+    template <typename Fn>
+    static constexpr bool fits() {
+        return sizeof(Fn) <= InlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct InlineOps {
+        static void invoke(void *p) { (*static_cast<Fn *>(p))(); }
+        static void move(void *dst, void *src) {
+            new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+        }
+        static void destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+        static const Ops table;
+    };
+
+    // the storage holds only a pointer to the heap copy
+    template <typename Fn>
+    struct HeapOps {
+        static void invoke(void *p) { (**static_cast<Fn **>(p))(); }
+        static void move(void *dst, void *src) { *static_cast<Fn **>(dst) = *static_cast<Fn **>(src); }
+        static void destroy(void *p) { delete *static_cast<Fn **>(p); }
+        static const Ops table;
+    };
+
+    template <typename Fn, typename F>
+    void construct(F &&f, std::true_type) {
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::table;
+    }
+
+    template <typename Fn, typename F>
+    void construct(F &&f, std::false_type) {
+        *reinterpret_cast<Fn **>(&storage_) = new Fn(std::forward<F>(f));
+        ops_ = &HeapOps<Fn>::table;
+        task_heap_counter().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static_assert(InlineSize >= sizeof(void *), "inline storage must hold a pointer");
+
+    typename std::aligned_storage<InlineSize, alignof(std::max_align_t)>::type storage_;
+    const Ops *ops_;
+};
+
+template <size_t N>
+template <typename Fn>
+const typename InlineTask<N>::Ops InlineTask<N>::InlineOps<Fn>::table = {
+    &InlineTask<N>::InlineOps<Fn>::invoke, &InlineTask<N>::InlineOps<Fn>::move,
+    &InlineTask<N>::InlineOps<Fn>::destroy};
+
+template <size_t N>
+template <typename Fn>
+const typename InlineTask<N>::Ops InlineTask<N>::HeapOps<Fn>::table = {
+    &InlineTask<N>::HeapOps<Fn>::invoke, &InlineTask<N>::HeapOps<Fn>::move,
+    &InlineTask<N>::HeapOps<Fn>::destroy};
@@ -1,22 +1,131 @@
+// ThreadPool.h
+// Work-stealing thread pool.
+//
+// Every worker owns a Chase-Lev deque: tasks a worker submits go to its own
+// deque and are popped LIFO without locks, while idle workers steal FIFO
+// from the others. Threads outside the pool (the epoll loop) submit to a
+// global injection queue; enqueue_bulk() hands over a whole batch of events
+// with one lock acquisition and one wake-up round. Workers take injected
+// tasks in batches, keeping one and pushing the rest onto their own deque
+// where other workers can steal them.
+//
+// An idle worker spins for a short while re-checking all queues before it
+// parks on a condition variable, so bursts are picked up without a futex
+// round trip while a quiet pool costs no CPU. With a spin ceiling (the
+// latency profile) the spin is timed instead and sized by an AdaptiveSpin:
+// a worker that keeps finding work polls for up to the ceiling.
+//
+// Tasks are InlineTasks built in place inside pooled nodes: per-thread node
+// caches exchange batches through a shared free list, and the injection
+// queue is a ring that keeps its capacity, so steady-state submission does
+// not call malloc. Callables larger than THREADPOOL_TASK_INLINE_BYTES (48 by
+// default, override with -D at build time) fall back to the heap and are
+// counted in heap_fallbacks().
+//
+// Each node is stamped when it is submitted; the wait until a worker runs
+// it is recorded in the Hist::PoolQueue histogram, and each worker keeps the
+// shortest such wait since it was last collected: take_min_wait() gives
+// admission control a CoDel-style standing-queue signal.
+//
+// The destructor lets the workers finish every queued task before joining.
 #pragma once
 #include <vector>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
 #include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "Aligned.h"
+#include "Task.h"
+#include "WorkStealingDeque.h"
+
+#ifndef THREADPOOL_TASK_INLINE_BYTES
+#define THREADPOOL_TASK_INLINE_BYTES 48
+#endif
 
 class ThreadPool {
 public:
-    ThreadPool(size_t numThreads);
+    using Task = InlineTask<THREADPOOL_TASK_INLINE_BYTES>;
+
+    // max_spin_ns > 0: poll adaptively for up to that long before parking
+    ThreadPool(size_t numThreads, uint64_t max_spin_ns = 0);
     ~ThreadPool();
-    void enqueue(std::function<void()> task);
+
+    // build the task directly in a pooled node
+    template <typename F>
+    void enqueue(F &&f) {
+        Node *n = alloc_node();
+        n->task = Task(std::forward<F>(f));
+        submit(n);
+    }
+
+    // submit every task in `tasks` at once; the vector is left empty but
+    // keeps its capacity for the next batch
+    void enqueue_bulk(std::vector<Task> &tasks);
+
+    size_t size() const { return workers_.size(); }
+
+    // pin worker i to cpus[i % cpus.size()]; false if any pin failed
+    bool pin(const std::vector<int> &cpus);
+
+    // tasks waiting in the queues (approximate)
+    size_t queued() const;
+
+    // shortest queue wait of the tasks started since the previous call, in
+    // ns; UINT64_MAX if none started
+    uint64_t take_min_wait();
+
+    // tasks whose callable did not fit the inline storage
+    uint64_t heap_fallbacks() const { return task_heap_fallbacks(); }
+
+    struct Node {
+        Task task;
+        uint64_t enqueued_ns; // Metrics::now_ns() at submission
+    };
+
 private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    std::atomic<bool> stop;
-    void worker();
+    // cache-aligned on the heap too, so the deque's padded indices really
+    // sit on lines of their own
+    struct Worker : CacheAligned {
+        WorkStealingDeque<Node> deque;
+        std::thread thread;
+        uint32_t rng;
+        std::atomic<uint64_t> min_wait{UINT64_MAX}; // written by the owner only
+    };
+
+    static Node *alloc_node();
+    static void free_node(Node *n);
+
+    void submit(Node *n);
+    void worker_loop(size_t index);
+    Node *find_task(size_t index);
+    Node *take_injected(size_t index);
+    Node *steal(size_t index);
+    bool has_work() const;
+    void wake(size_t n);
+    void run(Node *n, size_t index);
+    // inject_mtx_ held
+    void inject_push(Node *n);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    uint64_t max_spin_ns_;
+
+    // injection queue for submitters outside the pool: a ring buffer that
+    // doubles when full and never shrinks
+    std::mutex inject_mtx_;
+    std::vector<Node *> inject_;
+    size_t inject_head_{0};
+    size_t inject_count_{0};
+    std::atomic<size_t> inject_size_;
+
+    // parking
+    std::mutex park_mtx_;
+    std::condition_variable park_cv_;
+    std::atomic<size_t> idle_;
+
+    std::atomic<bool> stop_;
 };
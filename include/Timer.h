@@ -1,63 +1,131 @@
 // Timer.h
-// Lightweight timer manager using a min-heap to close idle connections.
-// The TimerManager runs a background thread which periodically checks the
-// earliest expiry and closes connections that have been idle longer than
-// the configured timeout. It verifies Connection::last_active to avoid
-// closing connections when heap entries are stale.
+// Hierarchical timing wheel for per-connection timeouts.
+// Each connection embeds one TimerNode holding separate read, write and
+// keep-alive deadlines. Scheduling, refreshing and cancelling are O(1), and
+// the number of wheel entries equals the number of connections regardless of
+// how many messages they send.
 
 #pragma once
 
 #include <chrono>
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <functional>
 #include <vector>
-#include <unordered_map>
-#include <memory>
+#include <cstdint>
+#include <utility>
 
-struct Connection; // forward declaration
+enum class TimerKind : int {
+    Read = 0,      // partial request pending for too long
+    Write = 1,     // queued output not drained in time
+    KeepAlive = 2, // connection idle between requests
+};
+
+// Intrusive timer node embedded in each Connection.
+// Deadlines are absolute wheel ticks (0 = disarmed) and are written without
+// the wheel lock; the node is re-slotted lazily when its slot comes due.
+struct TimerNode {
+    TimerNode *prev{nullptr};
+    TimerNode *next{nullptr};
+    uint64_t token{0};                  // passed to the expiry callback
+    std::atomic<int64_t> linked_at{-1}; // tick of the slot holding the node, -1 if unlinked
+    std::atomic<int64_t> deadline[3];
 
-// TimerManager: manages idle connection timeouts using a min-heap.
-// - It holds a reference to the connections map and its mutex so it can
-//   safely remove idle connections.
-// - It runs a background thread that periodically checks the heap and
-//   closes connections that have been idle longer than the timeout.
+    TimerNode() {
+        for (auto &d : deadline) d.store(0, std::memory_order_relaxed);
+    }
+    TimerNode(const TimerNode &) = delete;
+    TimerNode &operator=(const TimerNode &) = delete;
+};
+
+// TimerManager: owns a 4-level timing wheel (256 + 3 x 64 slots).
+// - Level 0 has one slot per tick; higher levels are cascaded down as the
+//   wheel turns, like the Linux kernel's timer wheel.
+// - refresh() only stores the new deadline when it moves later, which is the
+//   common case (activity pushes the idle deadline forward); a node whose
+//   slot comes due with a later deadline is simply re-slotted.
+// - The owner either calls expire() from its event loop, or start() to run
+//   a background thread that ticks at the configured resolution.
+// - Expired nodes are unlinked and reported through the expiry callback,
+//   outside the wheel lock.
 class TimerManager {
 public:
     using Clock = std::chrono::steady_clock;
+    using ExpireCallback = std::function<void(uint64_t token, TimerKind kind)>;
 
-    explicit TimerManager(int epoll_fd,
-                          std::unordered_map<int, std::shared_ptr<Connection>> &conns,
-                          std::mutex &conns_mtx,
-                          int default_timeout_sec = 60);
+    explicit TimerManager(int resolution_ms = 100);
     ~TimerManager();
 
     // start/stop the background thread
     void start();
     void stop();
 
-    // schedule or refresh timeout for fd (expires after timeout_sec seconds)
-    void add_or_refresh(int fd, int timeout_sec = -1);
+    void set_callback(ExpireCallback cb) { callback_ = std::move(cb); }
+
+    // default timeout used by refresh() when timeout_ms <= 0 (0 = disabled)
+    void set_default_timeout(TimerKind kind, int timeout_ms);
+
+    int resolution_ms() const { return resolution_ms_; }
+
+    // link node into the wheel; it reports `token` when it expires
+    void schedule(TimerNode &node, uint64_t token);
+
+    // (re)arm the deadline of `kind` to now + timeout_ms
+    void refresh(TimerNode &node, TimerKind kind, int timeout_ms = -1);
+
+    // arm the deadline of `kind` unless it is armed already: it then runs
+    // from the first call, however often this is called again
+    void arm(TimerNode &node, TimerKind kind) {
+        if (node.deadline[(int)kind].load(std::memory_order_relaxed) == 0) refresh(node, kind);
+    }
+
+    // disarm one deadline; the node stays scheduled for the others
+    void disarm(TimerNode &node, TimerKind kind);
+
+    // pull the `kind` deadline of every node with a deadline armed in to at
+    // most now + timeout_ms (arming it where it was off); for draining
+    void tighten(TimerKind kind, int timeout_ms);
+
+    // unlink node; must be called before the owning object is freed
+    void cancel(TimerNode &node);
+
+    // advance the wheel to `now`, reporting every expired deadline
+    void expire(Clock::time_point now);
+
+    // number of linked nodes
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
 
 private:
-    struct Item {
-        Clock::time_point expire;
-        int fd;
-        bool operator>(Item const &o) const { return expire > o.expire; }
-    };
+    static const int kLevels = 4;
+    static const int kL0Bits = 8;
+    static const int kLnBits = 6;
+    static const int kL0Size = 1 << kL0Bits;
+    static const int kLnSize = 1 << kLnBits;
+    static const int64_t kMaxSpan = int64_t(1) << (kL0Bits + 3 * kLnBits);
 
-    int epoll_fd_;
-    std::unordered_map<int, std::shared_ptr<Connection>> &conns_;
-    std::mutex &conns_mtx_;
-    int default_timeout_sec_;
+    int64_t ticks_for(int timeout_ms) const;
+    int64_t earliest(const TimerNode &node) const;
+    TimerNode *slot_head(int64_t tick);
+    void link(TimerNode &node, int64_t tick, bool allow_current = false);
+    void unlink(TimerNode &node);
+    void cascade(int level);
+    void run_slot(int64_t tick);
+    void run_loop();
+
+    int resolution_ms_;
+    Clock::time_point start_time_;
+    int default_ms_[3];
 
-    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> pq_;
-    std::mutex pq_mtx_;
+    std::mutex mtx_; // protects the slot lists and now_tick_ updates
+    TimerNode l0_[kL0Size];
+    TimerNode ln_[kLevels - 1][kLnSize];
+    // last processed tick; read without the lock by refresh()
+    std::atomic<int64_t> now_tick_;
+    std::atomic<size_t> size_;
+    std::vector<std::pair<uint64_t, TimerKind>> fired_;
+    ExpireCallback callback_;
 
     std::thread worker_;
     std::atomic<bool> running_;
-
-    void run_loop();
 };
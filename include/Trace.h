@@ -0,0 +1,112 @@
+// Trace.h
+// Sampled per-request tracing, exported as Chrome trace JSON.
+//
+// One event in --trace-sample N is picked when it comes out of the loop's
+// wait (epoll_wait / io_uring_enter) and gets a trace id. Each stage it
+// then goes through records a span on the thread that runs it:
+//   wait     the epoll_wait / io_uring_enter call that reported it
+//   queue    from the wait returning to a worker picking the task up (pooled)
+//   read     each read() of the visit
+//   handle   decoding the input and running the handler
+//   write    each attempt to flush queued output (writev / sendfile)
+// so a slow request shows whether it queued, sat in a syscall or ran long
+// in the handler, and on which threads. The io_uring backend records wait
+// and handle only: its reads and writes run in the kernel, not on a thread.
+//
+// Spans go into a ring owned by the recording thread: a plain single-writer
+// ring of fixed-size slots, created on the thread's first span, that keeps
+// the last kRingEvents spans and overwrites older ones. Nothing is shared on
+// the record path and there is no lock or locked instruction. A dump
+// (SIGUSR1 writes --trace-file, the admin port serves GET /trace) copies
+// every ring while the threads keep recording and drops the slots that were
+// overwritten during the copy. Timestamps are CLOCK_MONOTONIC through the
+// vDSO, the clock the rest of the server measures with.
+//
+// With tracing off (the default) sample() is one relaxed load and a span
+// for id 0 does not even read the clock.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Metrics.h"
+
+enum class TraceStage : uint32_t {
+    Wait,
+    Queue,
+    Read,
+    Handle,
+    Write,
+};
+const int kNumTraceStages = 5;
+
+class Tracer {
+public:
+    static const size_t kRingEvents = 1 << 16; // per thread, a power of two
+
+    static Tracer &instance();
+
+    // trace one event in `every`; 0 turns tracing off
+    void configure(int every);
+
+    static bool enabled() { return every_.load(std::memory_order_relaxed) != 0; }
+
+    // a non-zero trace id if this event is sampled
+    static uint64_t sample() {
+        uint32_t every = every_.load(std::memory_order_relaxed);
+        return every == 0 ? 0 : sample_slow(every);
+    }
+
+    // record [start_ns, end_ns) of a stage of event id on the calling thread
+    static void record(TraceStage stage, uint64_t id, uint64_t start_ns, uint64_t end_ns, uint32_t fd);
+
+    // label the calling thread's track in the trace ("reactor 0", ...)
+    static void name_thread(const std::string &name);
+
+    // Chrome trace JSON (the "traceEvents" form Perfetto loads) of what the
+    // rings hold
+    std::string dump_json();
+    // dump_json() into path; false if it cannot be written
+    bool dump(const std::string &path);
+
+    struct Ring;
+
+private:
+    Tracer();
+    ~Tracer();
+
+    static uint64_t sample_slow(uint32_t every);
+    Ring *attach();
+
+    static std::atomic<uint32_t> every_;
+    std::atomic<uint64_t> next_id_{0};
+
+    std::mutex mtx_; // guards rings_
+    // rings outlive their threads so a dump still shows what they recorded
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+// Records one stage of a sampled event over the object's lifetime; nothing
+// at all for id 0.
+class TraceSpan {
+public:
+    TraceSpan(TraceStage stage, uint64_t id, int fd)
+        : stage_(stage), id_(id), fd_((uint32_t)fd), start_ns_(id ? Metrics::now_ns() : 0) {}
+    ~TraceSpan() {
+        if (id_) Tracer::record(stage_, id_, start_ns_, Metrics::now_ns(), fd_);
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    TraceStage stage_;
+    uint64_t id_;
+    uint32_t fd_;
+    uint64_t start_ns_;
+};
@@ -0,0 +1,173 @@
+// UdpLoop.h
+// Datagram backend: one thread serving one SO_REUSEPORT UDP socket.
+//
+// Every UDP loop binds its own socket to the server port, so the kernel
+// spreads datagrams over the loops by flow hash and no socket is shared
+// between threads. A loop moves datagrams in batches:
+// - recvmmsg takes up to kBatch datagrams per call (MSG_WAITFORONE: it
+//   blocks for the first and returns whatever else is queued). With UDP_GRO
+//   the kernel may coalesce a flow's datagrams into one buffer of
+//   equal-size segments, split again here;
+// - every datagram is handed to the protocol policy the TCP loops use
+//   (Protocol.h, on_datagram): RawEcho returns the whole datagram, Framed
+//   runs its frames through the codec and handler. All replies to one
+//   datagram go back as one datagram to its sender. Handlers that write
+//   nothing (memcache noreply) send nothing;
+// - replies are sent with sendmmsg in batches of up to kBatch. Consecutive
+//   replies of the same size to the same peer are merged into one UDP_SEGMENT
+//   (GSO) send the kernel splits, or the NIC if it can.
+// GRO and GSO are used where the kernel has them (4.18+ / 5.0+); a GSO send
+// the device refuses turns GSO off for the loop.
+//
+// A datagram is self-contained: frames left incomplete at its end are
+// dropped, there is no stream state between datagrams, and a reply that
+// names a file range (write_file) is not sent.
+//
+// In a hot restart the new process inherits the sockets; the old one's
+// loops just stop receiving when drained, as a datagram carries no state.
+//
+// As with Reactor, UdpLoop<Protocol> holds the receive loop and the call
+// into the protocol, so a datagram reaches the codec and handler without a
+// virtual call; socket setup, batching and sends live in UdpLoopBase,
+// compiled once.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "Affinity.h"
+#include "Buffer.h"
+#include "Config.h"
+#include "Connection.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Spin.h"
+
+class UdpLoopBase : public EventLoop {
+public:
+    static const int kBatch = 32;
+    static const size_t kMaxDatagram = 65536;
+
+    ~UdpLoopBase() override;
+
+    // bind the socket (unless inherited) and turn on GRO / probe GSO
+    bool init() override;
+
+    void stop() override;
+    const char *name() const override { return "udp"; }
+
+    int fd() const { return fd_; }
+
+protected:
+    // fd: a socket inherited from the previous process, or -1 to bind one
+    UdpLoopBase(int id, int fd, int port, const ServerConfig &cfg);
+
+    // wait for the next batch of datagrams (polling in the latency
+    // profile); returns how many arrived, 0 to check the stop flag again,
+    // -1 on a fatal error
+    int next_batch();
+    // datagram i of the batch and its GRO segment size; nullptr for one
+    // that was truncated (counted as dropped)
+    const char *datagram(int i, size_t &len, size_t &seg);
+    const sockaddr_in &peer(int i) const { return rx_addr_[i]; }
+    // the reply slot for the next datagram, flushing a full batch first
+    Buffer &reply_slot();
+    // queue the reply written to reply_slot() for peer, if there is one
+    void queue_reply(const sockaddr_in &peer);
+    // send the pending replies
+    void flush();
+
+    int id_;
+    Buffer in_; // decode scratch
+    std::vector<FileSend> files_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+private:
+    // GSO merges at most this many segments into one send
+    static const int kMaxSegments = 64;
+
+    // one recvmmsg into the receive slots
+    int receive(int flags);
+
+    int port_;
+    int fd_{-1};
+    int busy_poll_us_;
+    bool gro_{false};
+    bool gso_{false};
+
+    // receive side: one slot per datagram of a batch
+    std::vector<char> rx_;
+    mmsghdr rx_hdrs_[kBatch];
+    iovec rx_iov_[kBatch];
+    sockaddr_in rx_addr_[kBatch];
+    alignas(cmsghdr) char rx_ctrl_[kBatch][64];
+
+    // reply slots
+    Buffer replies_[kBatch];
+    sockaddr_in peers_[kBatch];
+    int pending_{0};
+
+    AdaptiveSpin spin_;
+    uint64_t last_rx_ns_{0};
+    bool was_polling_{false};
+};
+
+template <class Protocol>
+class UdpLoop final : public UdpLoopBase {
+public:
+    UdpLoop(int id, int fd, int port, const ServerConfig &cfg, const Protocol &protocol)
+        : UdpLoopBase(id, fd, port, cfg), protocol_(protocol) {}
+    ~UdpLoop() override { stop(); }
+
+    void start() override {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&UdpLoop::loop, this);
+    }
+
+private:
+    void loop();
+    // run one datagram through the protocol into the next reply slot
+    void handle(const char *data, size_t len, const sockaddr_in &peer) {
+        Metrics::add(Counter::UdpIn);
+        Metrics::add(Counter::BytesIn, len);
+        Buffer &out = reply_slot();
+        in_.append(data, len);
+        protocol_.on_datagram(in_, out, files_);
+        in_.clear();
+        files_.clear();
+        queue_reply(peer);
+    }
+
+    Protocol protocol_;
+};
+
+template <class Protocol>
+void UdpLoop<Protocol>::loop() {
+    if (cpu_ >= 0 && !pin_thread(pthread_self(), cpu_)) {
+        LOG_WARN("[UDP " + std::to_string(id_) + "] cannot pin to CPU " + std::to_string(cpu_) + ": " +
+                 std::strerror(errno));
+    }
+    // drained: the next process reads from the same socket
+    while (running_ && !draining_.load(std::memory_order_relaxed)) {
+        int n = next_batch();
+        if (n < 0) break;
+        for (int i = 0; i < n; ++i) {
+            size_t len, seg;
+            const char *base = datagram(i, len, seg);
+            if (!base) continue;
+            for (size_t off = 0; off < len; off += seg) handle(base + off, std::min(seg, len - off), peer(i));
+        }
+        flush();
+    }
+}
@@ -0,0 +1,382 @@
+// UringReactor.h
+// io_uring backend: one completion-based event loop and the connections it
+// owns.
+//
+// The loop talks to the kernel through the raw io_uring syscalls:
+// - one multishot accept on the listener produces every new connection;
+// - each connection has one multishot recv that picks 16 KiB BufferChunks
+//   from a provided-buffer ring, so received data lands directly in pooled
+//   chunks that move into the connection's Buffer without a copy;
+// - replies are sent with IORING_OP_SENDMSG, one per connection with queued
+//   output, and all sends of an iteration go to the kernel in the same
+//   io_uring_enter call that waits for the next completions;
+// - file bodies move through a per-connection pipe with two linked
+//   IORING_OP_SPLICE operations (file -> pipe -> socket), at most one pipe
+//   capacity per round, so their pages never reach user space.
+// There is no re-arming per message burst and, under load, a single syscall
+// per loop iteration.
+//
+// Connections are served inline on the loop thread (no worker pool). A
+// client above the high watermark has its recv cancelled until its output
+// drains below the low watermark. There is no read loop to give a budget:
+// each recv completion carries one buffer and completions of all
+// connections arrive interleaved. Since the kernel may still complete an
+// operation that references a closed Connection, it is retired only once
+// neither its recv nor a send is in flight.
+//
+// A multishot accept hands over connections the kernel already took, so
+// when the shared Admission defers, the connection in hand is reset and
+// the accept is cancelled; it is re-armed once Admission lets connections
+// in again, and until then new ones wait in the listen backlog.
+//
+// init() fails (and the caller falls back to epoll) if the kernel is older
+// than 6.0 or any of the required io_uring features is missing.
+//
+// As with Reactor, the completion loop and the recv path are a template
+// over the protocol policy and Tuning (Server.h), which also sizes the
+// rings; ring setup, accept, send and splice live in UringReactorBase.
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "Admission.h"
+#include "Affinity.h"
+#include "Buffer.h"
+#include "Config.h"
+#include "Connection.h"
+#include "ConnectionTable.h"
+#include "Epoch.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Spin.h"
+#include "Timer.h"
+#include "Trace.h"
+
+class UringReactorBase : public EventLoop {
+public:
+    ~UringReactorBase() override;
+
+    // create the ring, register the provided buffers
+    bool init() override;
+
+    void stop() override;
+    const char *name() const override { return "io_uring"; }
+
+protected:
+    // ring sizes: sq_entries submissions, cq_entries completions and
+    // buf_entries provided buffers (chunks), each a power of two
+    UringReactorBase(int id, int listen_fd, ConnectionTable &conns, Admission &admission, const ServerConfig &cfg,
+                     unsigned sq_entries, unsigned cq_entries, unsigned buf_entries);
+
+    static const int kBufGroup = 0;
+    static const int kMaxIov = 64;
+    static const int kPipeSize = 1 << 20; // requested capacity of splice pipes
+
+    // user_data = Connection pointer | op (pointers are at least 8-aligned)
+    enum Op : uint64_t { OpAccept = 1, OpRecv = 2, OpSend = 3, OpCancel = 4, OpSpliceIn = 5, OpSpliceOut = 6 };
+
+    // sendmsg arguments; only need to live until the SQE is submitted
+    struct SendArgs {
+        msghdr msg;
+        iovec iov[kMaxIov];
+    };
+
+    bool setup_ring();
+    bool setup_buffers();
+    io_uring_sqe *get_sqe();
+    // publish queued SQEs; optionally wait up to timeout_ms for a completion
+    // (wait with timeout_ms 0: collect what is ready without sleeping)
+    int submit(bool wait, int timeout_ms);
+
+    void arm_accept();
+    // stop accepting until Admission lets connections in again
+    void defer_accept();
+    void cancel_accept();
+    // drain() was called: cancel the accept for good and close idle
+    // connections
+    void stop_accepting();
+    void arm_recv(Connection *conn);
+    void cancel_recv(Connection *conn);
+    void queue_send(Connection *conn);
+    void flush_sends();
+    // queue the next file -> pipe -> socket round of the front file; false
+    // if the pipe cannot be created
+    bool queue_splice(Connection *conn);
+    void on_accept(int res, uint32_t flags);
+    void on_send(Connection *conn, int res);
+    void on_splice_in(Connection *conn, int res);
+    void on_splice_out(Connection *conn, int res);
+    // bookkeeping shared by the send completions
+    void after_send(Connection *conn, int res);
+
+    // hand the chunk behind bid to the caller and refill the slot
+    BufferChunk *take_buffer(uint16_t bid);
+    // give the chunk behind bid back to the ring unused
+    void recycle_buffer(uint16_t bid);
+    void publish_buffer(uint16_t bid);
+
+    void close_connection(Connection *conn);
+    void maybe_retire(Connection *conn);
+    void on_timeout(uint64_t token, TimerKind kind);
+
+    int id_;
+    int listen_fd_;
+    ConnectionTable &conns_;
+    Admission &admission_;
+    int busy_poll_us_;
+    AdaptiveSpin spin_; // latency profile: poll the CQ before blocking
+    bool accept_armed_{false};
+    bool accept_deferred_{false};
+    bool accepting_{true}; // false once draining
+    uint64_t accept_retry_ns_{0};
+    // tracing: the last io_uring_enter, recorded for the first sampled recv
+    // it delivered (wait_ns_ 0: recorded or tracing off)
+    uint64_t wait_ns_{0};
+    uint64_t woke_ns_{0};
+    size_t high_watermark_;
+    size_t low_watermark_;
+    TimerManager timer_;
+    unsigned sq_request_;
+    unsigned cq_request_;
+    unsigned buf_entries_;
+
+    // rings shared with the kernel
+    int ring_fd_{-1};
+    void *sq_map_{nullptr};
+    size_t sq_map_len_{0};
+    void *cq_map_{nullptr};
+    size_t cq_map_len_{0};
+    io_uring_sqe *sqes_{nullptr};
+    size_t sqes_len_{0};
+    unsigned *sq_head_{nullptr};
+    unsigned *sq_tail_{nullptr};
+    unsigned *sq_array_{nullptr};
+    unsigned sq_mask_{0};
+    unsigned sq_entries_{0};
+    unsigned sq_local_tail_{0};
+    unsigned pending_{0}; // SQEs queued but not yet consumed by the kernel
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned cq_mask_{0};
+    io_uring_cqe *cqes_{nullptr};
+    std::vector<SendArgs> send_args_; // indexed like the SQE array
+
+    io_uring_buf *buf_ring_{nullptr};
+    size_t buf_ring_len_{0};
+    uint16_t buf_tail_{0};
+    std::vector<BufferChunk *> buf_chunks_; // bid -> chunk the kernel may fill
+
+    std::vector<Connection *> send_queue_;      // connections with output to send
+    std::unordered_set<Connection *> closing_;  // closed, waiting for the kernel
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+};
+
+template <class Protocol, class Tuning>
+class UringReactor final : public UringReactorBase {
+public:
+    UringReactor(int id, int listen_fd, ConnectionTable &conns, Admission &admission, const ServerConfig &cfg,
+                 const Protocol &protocol)
+        : UringReactorBase(id, listen_fd, conns, admission, cfg, Tuning::kSqEntries, Tuning::kCqEntries,
+                           Tuning::kRecvBuffers),
+          protocol_(protocol) {}
+    ~UringReactor() override { stop(); }
+
+    void start() override {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&UringReactor::loop, this);
+    }
+
+private:
+    void loop();
+    // handle every completion in the CQ; returns how many there were
+    unsigned reap();
+    void on_recv(Connection *conn, int res, uint32_t flags);
+    // hand newly read input to the protocol; false on a protocol error
+    bool handle_input(Connection *conn) {
+        uint64_t start = Metrics::now_ns();
+        bool ok = protocol_.on_input(conn);
+        Metrics::record(Hist::Handler, Metrics::now_ns() - start);
+        return ok;
+    }
+
+    Protocol protocol_;
+};
+
+// the hot path, instantiated once per Server type
+
+template <class Protocol, class Tuning>
+void UringReactor<Protocol, Tuning>::loop() {
+    auto next_reclaim = TimerManager::Clock::now() + std::chrono::seconds(1);
+    if (cpu_ >= 0 && !pin_thread(pthread_self(), cpu_)) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] cannot pin to CPU " + std::to_string(cpu_) + ": " +
+                 std::strerror(errno));
+    }
+    Tracer::name_thread("reactor " + std::to_string(id_));
+    uint64_t last_event_ns = 0;
+    bool was_polling = false;
+    arm_accept();
+
+    while (running_) {
+        if (accepting_ && draining_.load(std::memory_order_relaxed)) stop_accepting();
+        flush_sends();
+        // submit this iteration's work and wait for completions in one call;
+        // wake at least once per wheel tick to check the stop flag and timers
+        // (sooner while accepts are deferred). In the latency profile the
+        // loop collects completions without sleeping for a while after the
+        // last one.
+        int timeout = timer_.resolution_ms();
+        if (accept_deferred_) timeout = std::min(timeout, Admission::kRetryMs);
+        bool polling = spin_.enabled() && Metrics::now_ns() - last_event_ns < spin_.window_ns();
+        if (was_polling && !polling) spin_.miss();
+        was_polling = polling;
+        wait_ns_ = Tracer::enabled() ? Metrics::now_ns() : 0;
+        int ret = submit(true, polling ? 0 : timeout);
+        if (wait_ns_) woke_ns_ = Metrics::now_ns();
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            LOG_ERROR(std::string("io_uring_enter failed errno=") + std::to_string(errno));
+            break;
+        }
+        if (reap() > 0) {
+            if (polling) spin_.hit();
+            last_event_ns = Metrics::now_ns();
+        }
+        admission_.tick();
+        if (accepting_ && accept_deferred_ && Metrics::now_ns() >= accept_retry_ns_ && admission_.accepting()) {
+            accept_deferred_ = false;
+            // a cancel that has not completed yet re-arms from on_accept
+            if (!accept_armed_) arm_accept();
+        }
+
+        auto now = TimerManager::Clock::now();
+        timer_.expire(now);
+        if (now >= next_reclaim) {
+            EpochManager::instance().reclaim();
+            next_reclaim = now + std::chrono::seconds(1);
+        }
+    }
+}
+
+template <class Protocol, class Tuning>
+unsigned UringReactor<Protocol, Tuning>::reap() {
+    // one pin covers the whole batch of completions
+    EpochGuard guard;
+    uint64_t events = 0;
+    unsigned head = *cq_head_;
+    while (true) {
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+            ++events;
+            uint64_t op = cqe.user_data & 7;
+            Connection *conn = (Connection *)(uintptr_t)(cqe.user_data & ~uint64_t(7));
+            switch (op) {
+                case OpAccept: on_accept(cqe.res, cqe.flags); break;
+                case OpRecv: on_recv(conn, cqe.res, cqe.flags); break;
+                case OpSend: on_send(conn, cqe.res); break;
+                case OpSpliceIn: on_splice_in(conn, cqe.res); break;
+                case OpSpliceOut: on_splice_out(conn, cqe.res); break;
+                default: break; // cancel results carry nothing we need
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    if (events > 0) Metrics::add(Counter::Events, events);
+    return (unsigned)events;
+}
+
+template <class Protocol, class Tuning>
+void UringReactor<Protocol, Tuning>::on_recv(Connection *conn, int res, uint32_t flags) {
+    bool has_buf = (flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+    if (!(flags & IORING_CQE_F_MORE)) conn->recv_armed = false;
+
+    if (conn->closed) {
+        if (has_buf) recycle_buffer(bid);
+        maybe_retire(conn);
+        return;
+    }
+
+    if (res > 0 && conn->close_after_write) {
+        // arrived before the cancel took effect: nothing more is served
+        recycle_buffer(bid);
+    } else if (res > 0) {
+        // the chunk the kernel filled becomes the connection's input
+        Metrics::add(Counter::BytesIn, (uint64_t)res);
+        conn->attach_io().in.append_chunk(take_buffer(bid), (size_t)res);
+        timer_.refresh(conn->timer, TimerKind::KeepAlive);
+        LOG_DEBUG(std::string("[Worker] Received from fd=") + std::to_string(conn->fd) + ": " + conn->io->in.to_string());
+        uint64_t trace = Tracer::sample();
+        if (trace && wait_ns_) {
+            Tracer::record(TraceStage::Wait, trace, wait_ns_, woke_ns_, (uint32_t)conn->fd);
+            wait_ns_ = 0;
+        }
+        bool ok;
+        {
+            TraceSpan span(TraceStage::Handle, trace, conn->fd);
+            ok = handle_input(conn);
+        }
+        if (!ok) {
+            LOG_WARN(std::string("[Worker] Protocol error on fd=") + std::to_string(conn->fd));
+            close_connection(conn);
+            return;
+        }
+        // draining: this request was the last one
+        if (draining_.load(std::memory_order_relaxed) && conn->io->in.empty()) conn->close_after_write = true;
+        if (conn->has_output()) queue_send(conn);
+        if (conn->close_after_write) {
+            // stop receiving; the connection closes once the output is sent
+            if (conn->recv_armed) cancel_recv(conn);
+            if (!conn->has_output()) close_connection(conn);
+            return;
+        }
+        if (conn->backlogged(high_watermark_) && !conn->read_paused) {
+            // slow reader: stop receiving until the output drains
+            conn->read_paused = true;
+            if (conn->recv_armed) cancel_recv(conn);
+        }
+        // a partial request has the read timeout to complete from its first
+        // bytes, however slowly the rest trickles in (not while reading is
+        // paused)
+        if (!conn->io->in.empty() && !conn->read_paused) {
+            timer_.arm(conn->timer, TimerKind::Read);
+        } else {
+            timer_.disarm(conn->timer, TimerKind::Read);
+        }
+    } else if (res == 0) {
+        if (has_buf) recycle_buffer(bid);
+        // replies already queued still go out
+        if (conn->has_output()) {
+            conn->close_after_write = true;
+            return;
+        }
+        LOG_INFO(std::string("[Worker] Client fd=") + std::to_string(conn->fd) + " disconnected");
+        close_connection(conn);
+        return;
+    } else if (res != -ENOBUFS && res != -ECANCELED) {
+        LOG_ERROR(std::string("[Worker] Read error on fd=") + std::to_string(conn->fd));
+        close_connection(conn);
+        return;
+    }
+
+    // all caught up: an idle connection keeps only its slot
+    conn->release_io();
+    // out of provided buffers or cancelled: re-arm unless paused
+    if (!conn->recv_armed && !conn->read_paused && !conn->close_after_write) arm_recv(conn);
+}
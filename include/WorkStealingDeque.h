@@ -0,0 +1,118 @@
+// WorkStealingDeque.h
+// Chase-Lev work-stealing deque of pointers.
+//
+// The owning thread pushes and pops at the bottom without locks; any other
+// thread may steal from the top with one CAS. Only the last element is
+// contended between owner and thieves. The buffer grows on demand; old
+// buffers are kept until the deque is destroyed because a concurrent thief
+// may still be reading them.
+//
+// Memory orderings follow Le, Pop, Cohen, Zappa Nardelli, "Correct and
+// Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256)
+        : top_(0), bottom_(0), array_(new Array(capacity)) {
+        retired_.emplace_back(array_.load(std::memory_order_relaxed));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    // owner only
+    void push(T *item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array *a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) a = grow(a, t, b);
+        a->put(b, item);
+        // a release store instead of the paper's release fence + relaxed
+        // store: same cost on x86, and visible to ThreadSanitizer
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only; nullptr if empty
+    T *pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = a->get(b);
+        if (t == b) {
+            // last element: race the thieves for it
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // any thread; nullptr if empty or another thread won the race
+    T *steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        Array *a = array_.load(std::memory_order_acquire);
+        T *item = a->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // approximate, for idle checks
+    bool empty() const {
+        int64_t b = bottom_.load(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_seq_cst);
+        return b <= t;
+    }
+
+    // approximate, for monitoring
+    int64_t size() const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    struct Array {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+
+        explicit Array(int64_t cap) : capacity(cap), mask(cap - 1), slots(new std::atomic<T *>[cap]) {}
+        T *get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T *v) { slots[i & mask].store(v, std::memory_order_relaxed); }
+    };
+
+    Array *grow(Array *a, int64_t t, int64_t b) {
+        Array *bigger = new Array(a->capacity * 2);
+        for (int64_t i = t; i < b; ++i) bigger->put(i, a->get(i));
+        retired_.emplace_back(bigger);
+        array_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    std::atomic<Array *> array_;
+    std::vector<std::unique_ptr<Array>> retired_; // owner only; freed with the deque
+};
@@ -19,6 +19,12 @@ CLIENTS=100
 MSGS=100
 SIZE=256
 
+# client: "python" (tests/stress_test.py) or "native" (build/loadgen, which
+# is not limited by the GIL). Extra loadgen flags, e.g. "--rate 50000" for
+# open-loop latency or "--churn", go in LOADGEN_ARGS.
+CLIENT=${CLIENT:-python}
+LOADGEN_ARGS=${LOADGEN_ARGS:-}
+
 # Whether to apply sysctl tuning (requires sudo). Set to 1 to attempt.
 APPLY_SYSCTL=0
 
@@ -49,8 +55,13 @@ for T in "${THREAD_COUNTS[@]}"; do
   sleep 0.5
 
   OUTFILE="$OUTDIR/result_threads_${T}_$(date +%Y%m%d-%H%M%S).txt"
-  echo "Running stress_test.py -> $OUTFILE"
-  python3 tests/stress_test.py --clients "$CLIENTS" --msgs "$MSGS" --size "$SIZE" > "$OUTFILE" 2>&1 || true
+  if [ "$CLIENT" = "native" ]; then
+    echo "Running loadgen -> $OUTFILE"
+    ./build/loadgen --clients "$CLIENTS" --msgs "$MSGS" --size "$SIZE" $LOADGEN_ARGS > "$OUTFILE" 2>&1 || true
+  else
+    echo "Running stress_test.py -> $OUTFILE"
+    python3 tests/stress_test.py --clients "$CLIENTS" --msgs "$MSGS" --size "$SIZE" > "$OUTFILE" 2>&1 || true
+  fi
 
   echo "Killing server PID=$SERVER_PID"
   kill "$SERVER_PID" || true
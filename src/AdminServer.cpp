@@ -0,0 +1,105 @@
+#include "../include/AdminServer.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/SocketUtil.h"
+#include "../include/Trace.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+#include <string>
+
+AdminServer::~AdminServer() {
+    stop();
+}
+
+bool AdminServer::start() {
+    listen_fd_ = create_listen_socket(port_, 16, false);
+    if (listen_fd_ == -1) {
+        LOG_ERROR(std::string("Admin listen on port ") + std::to_string(port_) + " failed: " + std::strerror(errno));
+        return false;
+    }
+    running_ = true;
+    thread_ = std::thread(&AdminServer::loop, this);
+    LOG_INFO("Admin metrics on port " + std::to_string(port_) + " (/, /metrics and /trace)");
+    return true;
+}
+
+void AdminServer::stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void AdminServer::loop() {
+    while (running_) {
+        // wake periodically to check the stop flag
+        pollfd p;
+        p.fd = listen_fd_;
+        p.events = POLLIN;
+        if (poll(&p, 1, 100) <= 0) continue;
+        while (true) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd == -1) break;
+            serve(fd);
+            close(fd);
+        }
+    }
+}
+
+void AdminServer::serve(int fd) {
+    // a slow or silent client cannot stall the admin thread for long
+    timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos && req.find("\n\n") == std::string::npos &&
+           req.size() < 8192) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        req.append(buf, (size_t)n);
+    }
+
+    // "GET <path> ..." -> path
+    std::string path = "/";
+    size_t sp = req.find(' ');
+    if (sp != std::string::npos) {
+        size_t end = req.find_first_of(" ?\r\n", sp + 1);
+        path = req.substr(sp + 1, end == std::string::npos ? std::string::npos : end - sp - 1);
+    }
+
+    std::string status = "200 OK";
+    std::string type = "text/plain; charset=utf-8";
+    std::string body;
+    if (path == "/metrics") {
+        type = "text/plain; version=0.0.4; charset=utf-8";
+        body = Metrics::instance().render_prometheus();
+    } else if (path == "/" || path == "/stats") {
+        body = Metrics::instance().render_text();
+    } else if (path == "/trace") {
+        type = "application/json";
+        body = Tracer::instance().dump_json();
+    } else {
+        status = "404 Not Found";
+        body = "Not Found\n";
+    }
+
+    std::string resp = "HTTP/1.1 " + status + "\r\nContent-Type: " + type +
+                       "\r\nContent-Length: " + std::to_string(body.size()) +
+                       "\r\nConnection: close\r\n\r\n" + body;
+    size_t off = 0;
+    while (off < resp.size()) {
+        ssize_t w = send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+}
@@ -0,0 +1,68 @@
+#include "../include/Admission.h"
+#include "../include/ConnectionTable.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/ThreadPool.h"
+#include <algorithm>
+
+const int Admission::kRetryMs;
+
+Admission::Admission(const ServerConfig &cfg, const ConnectionTable &conns, ThreadPool *pool)
+    : conns_(conns), pool_(pool), max_conns_((size_t)cfg.max_conns), max_queue_((size_t)cfg.max_queue),
+      target_ns_((uint64_t)cfg.queue_target_ms * 1000000), shed_(cfg.shed),
+      emission_ns_(cfg.accept_rate > 0 ? 1000000000ull / (uint64_t)cfg.accept_rate : 0),
+      burst_ns_(0), tat_(0), next_check_ns_(0), overloaded_(false) {
+    // a burst is 100 ms worth of the rate, at least one connection
+    if (emission_ns_ > 0) burst_ns_ = (std::max(cfg.accept_rate / 10, 1) - 1) * emission_ns_;
+}
+
+Admission::Verdict Admission::admit() {
+    uint64_t now = Metrics::now_ns();
+    if (limited(now)) return shed_ ? Shed : Defer;
+    if (emission_ns_ == 0) return Accept;
+    uint64_t tat = tat_.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t base = std::max(tat, now);
+        if (base - now > burst_ns_) return Defer;
+        if (tat_.compare_exchange_weak(tat, base + emission_ns_, std::memory_order_relaxed)) return Accept;
+    }
+}
+
+void Admission::release() {
+    if (emission_ns_ > 0) tat_.fetch_sub(emission_ns_, std::memory_order_relaxed);
+}
+
+bool Admission::accepting() {
+    uint64_t now = Metrics::now_ns();
+    if (limited(now)) return false;
+    if (emission_ns_ == 0) return true;
+    return std::max(tat_.load(std::memory_order_relaxed), now) - now <= burst_ns_;
+}
+
+bool Admission::limited(uint64_t now) {
+    if (max_conns_ > 0 && conns_.size() >= max_conns_) return true;
+    return overloaded(now);
+}
+
+bool Admission::overloaded(uint64_t now) {
+    if (!pool_) return false;
+    if (max_queue_ > 0 && pool_->queued() > max_queue_) return true;
+    if (target_ns_ == 0) return false;
+
+    uint64_t next = next_check_ns_.load(std::memory_order_relaxed);
+    if (now >= next && next_check_ns_.compare_exchange_strong(next, now + kIntervalNs, std::memory_order_relaxed)) {
+        uint64_t floor = pool_->take_min_wait();
+        // nothing started during the interval: overloaded if tasks are
+        // waiting behind the ones that hold every worker
+        bool over = floor == UINT64_MAX ? pool_->queued() > 0 : floor > target_ns_;
+        bool was = overloaded_.exchange(over, std::memory_order_relaxed);
+        if (over && !was) {
+            LOG_WARN("Worker pool overloaded (queue wait floor " +
+                     (floor == UINT64_MAX ? std::string("unbounded") : std::to_string(floor / 1000) + " us") +
+                     "), refusing new connections");
+        } else if (!over && was) {
+            LOG_INFO("Worker pool queue drained, accepting connections again");
+        }
+    }
+    return overloaded_.load(std::memory_order_relaxed);
+}
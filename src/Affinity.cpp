@@ -0,0 +1,97 @@
+#include "../include/Affinity.h"
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+bool parse_cpu_list(const std::string &s, std::vector<int> &out) {
+    out.clear();
+    size_t i = 0;
+    while (i < s.size()) {
+        char *end;
+        long lo = std::strtol(s.c_str() + i, &end, 10);
+        if (end == s.c_str() + i || lo < 0 || lo >= CPU_SETSIZE) return false;
+        i = (size_t)(end - s.c_str());
+        long hi = lo;
+        if (i < s.size() && s[i] == '-') {
+            ++i;
+            hi = std::strtol(s.c_str() + i, &end, 10);
+            if (end == s.c_str() + i || hi < lo || hi >= CPU_SETSIZE) return false;
+            i = (size_t)(end - s.c_str());
+        }
+        for (long c = lo; c <= hi; ++c) out.push_back((int)c);
+        if (i < s.size() && s[i++] != ',') return false;
+    }
+    return !out.empty();
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+    std::vector<int> sorted(cpus);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    std::string out;
+    for (size_t i = 0; i < sorted.size();) {
+        size_t j = i;
+        while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) ++j;
+        if (!out.empty()) out += ',';
+        out += std::to_string(sorted[i]);
+        if (j > i) out += '-' + std::to_string(sorted[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+int cpu_node(int cpu) {
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *d = opendir(dir.c_str());
+    if (!d) return 0;
+    int node = 0;
+    while (dirent *e = readdir(d)) {
+        if (std::strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+            node = std::atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+size_t count_nodes(const std::vector<int> &cpus) {
+    std::vector<int> nodes;
+    for (int c : cpus) nodes.push_back(cpu_node(c));
+    std::sort(nodes.begin(), nodes.end());
+    return (size_t)(std::unique(nodes.begin(), nodes.end()) - nodes.begin());
+}
+
+std::vector<int> placement_cpus(const std::string &list) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {};
+
+    std::vector<int> wanted;
+    if (list.empty() || !parse_cpu_list(list, wanted)) {
+        wanted.clear();
+        for (int c = 0; c < CPU_SETSIZE; ++c) wanted.push_back(c);
+    }
+    std::vector<std::pair<int, int>> placed; // (node, cpu)
+    for (int c : wanted) {
+        if (CPU_ISSET(c, &allowed)) placed.emplace_back(cpu_node(c), c);
+    }
+    // stable: the order given within a node is kept
+    std::stable_sort(placed.begin(), placed.end(),
+                     [](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first < b.first; });
+    std::vector<int> out;
+    for (auto &p : placed) out.push_back(p.second);
+    return out;
+}
+
+bool pin_thread(pthread_t t, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(t, sizeof(set), &set);
+    if (rc != 0) errno = rc;
+    return rc == 0;
+}
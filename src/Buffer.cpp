@@ -0,0 +1,316 @@
+#include "../include/Buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace {
+
+// per-thread free list cap (4 MiB of chunks); extra chunks go back to the heap
+const size_t kMaxCached = 256;
+// iovecs handed to one readv / sendmsg call
+const int kMaxIov = 64;
+// append(Buffer&&) copies segments up to this size into the tail chunk
+// instead of linking them, so many small messages do not each pin a chunk
+const size_t kCopyThreshold = 2048;
+
+struct ChunkPool {
+    std::vector<BufferChunk *> free_list;
+    uint64_t allocated{0};
+    uint64_t reused{0};
+    ~ChunkPool();
+};
+
+thread_local ChunkPool tls_pool;
+// set once the pool is destroyed at thread exit; chunks released after that
+// (e.g. by static destructors) go straight back to the heap
+thread_local bool tls_pool_gone = false;
+
+ChunkPool::~ChunkPool() {
+    for (BufferChunk *c : free_list) delete c;
+    free_list.clear();
+    tls_pool_gone = true;
+}
+
+} // namespace
+
+const size_t BufferChunk::kSize;
+
+BufferChunk *BufferChunk::acquire() {
+    BufferChunk *c;
+    if (!tls_pool_gone && !tls_pool.free_list.empty()) {
+        c = tls_pool.free_list.back();
+        tls_pool.free_list.pop_back();
+        ++tls_pool.reused;
+    } else {
+        c = new BufferChunk; // default-init: the payload is not zeroed
+        if (!tls_pool_gone) ++tls_pool.allocated;
+    }
+    c->refs.store(1, std::memory_order_relaxed);
+    c->used = 0;
+    return c;
+}
+
+void BufferChunk::release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    if (!tls_pool_gone && tls_pool.free_list.size() < kMaxCached) {
+        tls_pool.free_list.push_back(this);
+    } else {
+        delete this;
+    }
+}
+
+ChunkPoolStats chunk_pool_stats() {
+    if (tls_pool_gone) return ChunkPoolStats{0, 0, 0};
+    return ChunkPoolStats{tls_pool.allocated, tls_pool.reused, tls_pool.free_list.size()};
+}
+
+Buffer::Buffer(Buffer &&other)
+    : segs_(std::move(other.segs_)), head_(other.head_), size_(other.size_) {
+    other.segs_.clear();
+    other.head_ = 0;
+    other.size_ = 0;
+}
+
+Buffer &Buffer::operator=(Buffer &&other) {
+    if (this != &other) {
+        clear();
+        segs_ = std::move(other.segs_);
+        head_ = other.head_;
+        size_ = other.size_;
+        other.segs_.clear();
+        other.head_ = 0;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+void Buffer::push(BufferChunk *chunk, uint32_t begin, uint32_t end) {
+    segs_.push_back(Segment{chunk, begin, end});
+    size_ += end - begin;
+}
+
+void Buffer::pop_front() {
+    segs_[head_].chunk->release();
+    ++head_;
+    if (head_ == segs_.size()) {
+        segs_.clear();
+        head_ = 0;
+    } else if (head_ >= 32 && head_ * 2 >= segs_.size()) {
+        segs_.erase(segs_.begin(), segs_.begin() + head_);
+        head_ = 0;
+    }
+}
+
+void Buffer::clear() {
+    for (size_t i = head_; i < segs_.size(); ++i) segs_[i].chunk->release();
+    segs_.clear();
+    head_ = 0;
+    size_ = 0;
+}
+
+void Buffer::append(const char *data, size_t len) {
+    while (len > 0) {
+        // fill the tail chunk if nobody else can see its free space
+        if (tail_writable()) {
+            Segment &tail = segs_.back();
+            BufferChunk *c = tail.chunk;
+            size_t n = std::min(len, BufferChunk::kSize - c->used);
+            std::memcpy(c->data + c->used, data, n);
+            c->used += (uint32_t)n;
+            tail.end += (uint32_t)n;
+            size_ += n;
+            data += n;
+            len -= n;
+            continue;
+        }
+        BufferChunk *c = BufferChunk::acquire();
+        size_t n = std::min(len, BufferChunk::kSize);
+        std::memcpy(c->data, data, n);
+        c->used = (uint32_t)n;
+        push(c, 0, (uint32_t)n);
+        data += n;
+        len -= n;
+    }
+}
+
+void Buffer::append_chunk(BufferChunk *chunk, size_t len) {
+    chunk->used = (uint32_t)len;
+    if (len == 0) {
+        chunk->release();
+        return;
+    }
+    push(chunk, 0, (uint32_t)len);
+}
+
+bool Buffer::tail_writable() const {
+    if (empty()) return false;
+    const Segment &tail = segs_.back();
+    const BufferChunk *c = tail.chunk;
+    return c->refs.load(std::memory_order_relaxed) == 1 && tail.end == c->used &&
+           c->used < BufferChunk::kSize;
+}
+
+void Buffer::append(Buffer &&other) {
+    if (&other == this || other.empty()) return;
+    if (empty()) {
+        *this = std::move(other);
+        return;
+    }
+    for (size_t i = other.head_; i < other.segs_.size(); ++i) {
+        const Segment &s = other.segs_[i];
+        if (s.size() <= kCopyThreshold && tail_writable() &&
+            BufferChunk::kSize - segs_.back().chunk->used >= s.size()) {
+            Segment &tail = segs_.back();
+            std::memcpy(tail.chunk->data + tail.chunk->used, s.data(), s.size());
+            tail.chunk->used += (uint32_t)s.size();
+            tail.end += (uint32_t)s.size();
+            size_ += s.size();
+            s.chunk->release();
+        } else {
+            // the reference moves along with the segment
+            segs_.push_back(s);
+            size_ += s.size();
+        }
+    }
+    other.segs_.clear();
+    other.head_ = 0;
+    other.size_ = 0;
+}
+
+void Buffer::append_slice(const Buffer &other, size_t offset, size_t len) {
+    for (size_t i = other.head_; i < other.segs_.size() && len > 0; ++i) {
+        const Segment &s = other.segs_[i];
+        if (offset >= s.size()) {
+            offset -= s.size();
+            continue;
+        }
+        size_t n = std::min(len, s.size() - offset);
+        s.chunk->retain();
+        push(s.chunk, s.begin + (uint32_t)offset, s.begin + (uint32_t)(offset + n));
+        offset = 0;
+        len -= n;
+    }
+}
+
+void Buffer::consume(size_t n) {
+    while (n > 0 && !empty()) {
+        Segment &s = segs_[head_];
+        if (n >= s.size()) {
+            n -= s.size();
+            size_ -= s.size();
+            pop_front();
+        } else {
+            s.begin += (uint32_t)n;
+            size_ -= n;
+            n = 0;
+        }
+    }
+}
+
+ssize_t Buffer::find(char c, size_t from) const {
+    size_t base = 0;
+    for (size_t i = head_; i < segs_.size(); ++i) {
+        const Segment &s = segs_[i];
+        if (from < base + s.size()) {
+            size_t skip = from > base ? from - base : 0;
+            const void *hit = std::memchr(s.data() + skip, c, s.size() - skip);
+            if (hit) return (ssize_t)(base + ((const char *)hit - s.data()));
+        }
+        base += s.size();
+    }
+    return -1;
+}
+
+const char *Buffer::contiguous(size_t offset, size_t len) const {
+    for (size_t i = head_; i < segs_.size(); ++i) {
+        const Segment &s = segs_[i];
+        if (offset < s.size()) return offset + len <= s.size() ? s.data() + offset : nullptr;
+        offset -= s.size();
+    }
+    return len == 0 ? "" : nullptr;
+}
+
+void Buffer::copy_out(size_t offset, char *dst, size_t len) const {
+    for (size_t i = head_; i < segs_.size() && len > 0; ++i) {
+        const Segment &s = segs_[i];
+        if (offset >= s.size()) {
+            offset -= s.size();
+            continue;
+        }
+        size_t n = std::min(len, s.size() - offset);
+        std::memcpy(dst, s.data() + offset, n);
+        dst += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+std::string Buffer::to_string() const {
+    std::string out(size_, '\0');
+    if (size_) copy_out(0, &out[0], size_);
+    return out;
+}
+
+ssize_t Buffer::read_from(int fd) {
+    iovec iov[2];
+    int cnt = 0;
+
+    Segment *tail = nullptr;
+    if (tail_writable()) {
+        tail = &segs_.back();
+        iov[cnt].iov_base = tail->chunk->data + tail->chunk->used;
+        iov[cnt].iov_len = BufferChunk::kSize - tail->chunk->used;
+        ++cnt;
+    }
+    BufferChunk *fresh = BufferChunk::acquire();
+    iov[cnt].iov_base = fresh->data;
+    iov[cnt].iov_len = BufferChunk::kSize;
+    ++cnt;
+
+    ssize_t n = readv(fd, iov, cnt);
+    if (n <= 0) {
+        fresh->release();
+        return n;
+    }
+
+    size_t left = (size_t)n;
+    if (tail) {
+        size_t take = std::min(left, iov[0].iov_len);
+        tail->chunk->used += (uint32_t)take;
+        tail->end += (uint32_t)take;
+        size_ += take;
+        left -= take;
+    }
+    if (left > 0) {
+        fresh->used = (uint32_t)left;
+        push(fresh, 0, (uint32_t)left);
+    } else {
+        fresh->release();
+    }
+    return n;
+}
+
+ssize_t Buffer::write_to(int fd, size_t limit, int flags) {
+    iovec iov[kMaxIov];
+    int cnt = gather(iov, kMaxIov, limit);
+    if (cnt == 0) return 0;
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)cnt;
+    ssize_t w = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+    if (w > 0) consume((size_t)w);
+    return w;
+}
+
+int Buffer::gather(iovec *iov, int max_iov, size_t limit) const {
+    int cnt = 0;
+    for (size_t i = head_; i < segs_.size() && cnt < max_iov && limit > 0; ++i, ++cnt) {
+        size_t len = std::min(segs_[i].size(), limit);
+        iov[cnt].iov_base = const_cast<char *>(segs_[i].data());
+        iov[cnt].iov_len = len;
+        limit -= len;
+    }
+    return cnt;
+}
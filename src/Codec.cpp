@@ -0,0 +1,43 @@
+#include "../include/Codec.h"
+#include "../include/Buffer.h"
+#include "../include/Connection.h"
+
+const size_t LineCodec::kMaxLine;
+const size_t LengthPrefixCodec::kMaxFrame;
+
+ssize_t LineCodec::decode(const Buffer &in, size_t &scan, Frame &frame) const {
+    // bytes before `scan` were searched by an earlier call
+    ssize_t nl = in.find('\n', scan);
+    if (nl < 0) {
+        scan = in.size();
+        return scan > kMaxLine ? -1 : 0;
+    }
+    // however the bytes arrived
+    if ((size_t)nl > kMaxLine) return -1;
+    frame.offset = 0;
+    frame.size = (size_t)nl;
+    if (frame.size > 0) {
+        char last;
+        in.copy_out(frame.size - 1, &last, 1);
+        if (last == '\r') --frame.size;
+    }
+    return nl + 1;
+}
+
+ssize_t LengthPrefixCodec::decode(const Buffer &in, size_t &, Frame &frame) const {
+    if (in.size() < 4) return 0;
+    unsigned char hdr[4];
+    in.copy_out(0, (char *)hdr, 4);
+    size_t n = ((size_t)hdr[0] << 24) | ((size_t)hdr[1] << 16) | ((size_t)hdr[2] << 8) | hdr[3];
+    if (n > kMaxFrame) return -1;
+    if (in.size() < 4 + n) return 0;
+    frame.offset = 4;
+    frame.size = n;
+    return (ssize_t)(4 + n);
+}
+
+std::string &frame_scratch() {
+    // linearised payloads of frames that straddle a chunk boundary
+    static thread_local std::string scratch;
+    return scratch;
+}
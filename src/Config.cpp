@@ -0,0 +1,225 @@
+#include "../include/Config.h"
+#include "../include/Affinity.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void print_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [N] [options]\n"
+              << "  --threads N             worker threads behind the single epoll loop (default 4)\n"
+              << "  --reactors N            run N epoll loops with SO_REUSEPORT listeners and\n"
+              << "                          handle I/O inline on each loop (no worker pool)\n"
+              << "  --udp-threads N         also serve UDP datagrams on the port from N loops\n"
+              << "                          (SO_REUSEPORT, recvmmsg/sendmmsg, GRO/GSO; default off)\n"
+              << "  --backend B             epoll | io_uring (default epoll; io_uring falls back to\n"
+              << "                          epoll when the kernel lacks it and always serves inline)\n"
+              << "  --codec C               raw | line | length | http | memcache framing of requests\n"
+              << "                          (default raw; http serves HTTP/1.1 keep-alive with a static\n"
+              << "                          routing table, memcache a sharded in-memory key-value cache)\n"
+              << "  --port P                listening port (default 8080)\n"
+              << "  --idle-timeout S        close connections idle for S seconds (default 60)\n"
+              << "  --read-timeout MS       limit for a partially received request (default off)\n"
+              << "  --write-timeout MS      limit for queued output to drain (default off)\n"
+              << "  --timer-resolution MS   timing wheel tick (default 100)\n"
+              << "  --high-watermark B      pause reading a client with B bytes of output queued (default 1 MiB)\n"
+              << "  --low-watermark B       resume reading below B queued bytes (default 256 KiB)\n"
+              << "  --read-budget B         bytes a connection may read per visit before other ready\n"
+              << "                          connections get their turn (default 256 KiB, 0 = no limit)\n"
+              << "  --read-budget-reads N   reads per visit, same idea (default 16, 0 = no limit)\n"
+              << "  --starve-ms MS          count ready connections that wait longer than MS to be\n"
+              << "                          served as starved (default 10)\n"
+              << "  --profile P             throughput | latency (default throughput); latency pins\n"
+              << "                          threads, polls before blocking and busy-polls sockets\n"
+              << "  --cpus LIST             pin loops, then workers, to these CPUs in NUMA order\n"
+              << "                          (e.g. 0-3,8; latency profile default: every allowed CPU)\n"
+              << "  --spin-us US            longest adaptive poll before blocking (latency default 50)\n"
+              << "  --busy-poll-us US       SO_BUSY_POLL on the sockets (latency default 50)\n"
+              << "  --admin-port P          serve metrics on port P: / plain text, /metrics Prometheus\n"
+              << "                          (default off)\n"
+              << "  --backlog N             listen backlog (default 1024)\n"
+              << "  --max-conns N           refuse new connections while N are open (default off)\n"
+              << "  --accept-rate N         accept at most N connections per second (default off)\n"
+              << "  --queue-target MS       pooled: refuse new connections while tasks keep waiting\n"
+              << "                          longer than MS in the worker queues (default 5, 0 = off)\n"
+              << "  --max-queue N           pooled: refuse new connections while N tasks are queued\n"
+              << "                          (default off)\n"
+              << "  --shed                  reset refused connections at once instead of leaving them\n"
+              << "                          in the listen backlog\n"
+              << "  --static-dir DIR        with --codec http: serve the files under DIR (sendfile, ranges)\n"
+              << "  --static-prefix P       URL prefix for --static-dir (default /static/)\n"
+              << "  --file-cache N          open files kept in the static file cache (default 1024)\n"
+              << "  --kv-memory MB          with --codec memcache: memory for stored items (default 64)\n"
+              << "  --proxy LIST            relay each connection to the least busy healthy upstream in\n"
+              << "                          LIST (host:port,...) through splice instead of answering it\n"
+              << "  --proxy-pool N          connections kept open to each upstream for new clients\n"
+              << "                          (default 4, 0 = connect per client)\n"
+              << "  --proxy-check MS        upstream health check interval (default 1000)\n"
+              << "  --upgrade-socket PATH   hot restart: take the listeners over from the server at PATH\n"
+              << "                          if one runs there, then wait at PATH for the next upgrade\n"
+              << "  --drain-timeout MS      after handing the listeners over, close the connections\n"
+              << "                          still open after MS (default 30000)\n"
+              << "  --trace-sample N        trace one event in N, 0 = off (default 0)\n"
+              << "  --trace-file PATH       where SIGUSR1 writes the trace (default trace.json)\n"
+              << "  --log-level L           debug | info | warn | error (default info)\n"
+              << "  --log-overflow P        drop | block when a thread's log ring is full (default drop)\n"
+              << "  --log-file PATH         log file (default server.log)\n";
+}
+
+// read the integer value following argv[i]; non-positive values keep the default
+static bool next_int(int argc, char **argv, int &i, int &out) {
+    if (i + 1 >= argc) return false;
+    int v = std::atoi(argv[++i]);
+    if (v > 0) out = v;
+    return true;
+}
+
+// read the integer value following argv[i] where 0 means off; negative
+// values keep the default
+static bool next_limit(int argc, char **argv, int &i, int &out) {
+    if (i + 1 >= argc) return false;
+    int v = std::atoi(argv[++i]);
+    if (v >= 0) out = v;
+    return true;
+}
+
+bool parse_args(int argc, char **argv, ServerConfig &cfg) {
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        bool ok = true;
+        if (std::strcmp(a, "--threads") == 0) {
+            ok = next_int(argc, argv, i, cfg.num_threads);
+        } else if (std::strcmp(a, "--reactors") == 0) {
+            ok = next_int(argc, argv, i, cfg.num_reactors);
+        } else if (std::strcmp(a, "--udp-threads") == 0) {
+            ok = next_int(argc, argv, i, cfg.udp_threads);
+        } else if (std::strcmp(a, "--backend") == 0) {
+            ok = i + 1 < argc;
+            if (ok) {
+                std::string b = argv[++i];
+                ok = b == "epoll" || b == "io_uring";
+                cfg.backend = b == "io_uring" ? IoBackend::IoUring : IoBackend::Epoll;
+            }
+        } else if (std::strcmp(a, "--codec") == 0) {
+            ok = i + 1 < argc;
+            if (ok) {
+                std::string c = argv[++i];
+                ok = c == "raw" || c == "line" || c == "length" || c == "http" || c == "memcache";
+                cfg.codec = c == "line" ? CodecKind::Line
+                          : c == "length" ? CodecKind::LengthPrefix
+                          : c == "http" ? CodecKind::Http
+                          : c == "memcache" ? CodecKind::Memcache : CodecKind::Raw;
+            }
+        } else if (std::strcmp(a, "--port") == 0) {
+            ok = next_int(argc, argv, i, cfg.port);
+        } else if (std::strcmp(a, "--idle-timeout") == 0) {
+            ok = next_int(argc, argv, i, cfg.idle_timeout_sec);
+        } else if (std::strcmp(a, "--read-timeout") == 0) {
+            ok = next_int(argc, argv, i, cfg.read_timeout_ms);
+        } else if (std::strcmp(a, "--write-timeout") == 0) {
+            ok = next_int(argc, argv, i, cfg.write_timeout_ms);
+        } else if (std::strcmp(a, "--timer-resolution") == 0) {
+            ok = next_int(argc, argv, i, cfg.timer_resolution_ms);
+        } else if (std::strcmp(a, "--high-watermark") == 0) {
+            ok = next_int(argc, argv, i, cfg.high_watermark);
+        } else if (std::strcmp(a, "--low-watermark") == 0) {
+            ok = next_int(argc, argv, i, cfg.low_watermark);
+        } else if (std::strcmp(a, "--read-budget") == 0) {
+            ok = next_limit(argc, argv, i, cfg.read_budget.bytes);
+        } else if (std::strcmp(a, "--read-budget-reads") == 0) {
+            ok = next_limit(argc, argv, i, cfg.read_budget.reads);
+        } else if (std::strcmp(a, "--starve-ms") == 0) {
+            ok = next_int(argc, argv, i, cfg.starve_ms);
+        } else if (std::strcmp(a, "--profile") == 0) {
+            ok = i + 1 < argc;
+            if (ok) {
+                std::string p = argv[++i];
+                ok = p == "throughput" || p == "latency";
+                cfg.profile = p == "latency" ? Profile::Latency : Profile::Throughput;
+            }
+        } else if (std::strcmp(a, "--cpus") == 0) {
+            std::vector<int> cpus;
+            ok = i + 1 < argc && parse_cpu_list(argv[i + 1], cpus);
+            if (ok) cfg.cpus = argv[++i];
+        } else if (std::strcmp(a, "--spin-us") == 0) {
+            ok = next_limit(argc, argv, i, cfg.spin_us);
+        } else if (std::strcmp(a, "--busy-poll-us") == 0) {
+            ok = next_limit(argc, argv, i, cfg.busy_poll_us);
+        } else if (std::strcmp(a, "--admin-port") == 0) {
+            ok = next_int(argc, argv, i, cfg.admin_port);
+        } else if (std::strcmp(a, "--backlog") == 0) {
+            ok = next_int(argc, argv, i, cfg.backlog);
+        } else if (std::strcmp(a, "--max-conns") == 0) {
+            ok = next_limit(argc, argv, i, cfg.max_conns);
+        } else if (std::strcmp(a, "--accept-rate") == 0) {
+            ok = next_limit(argc, argv, i, cfg.accept_rate);
+        } else if (std::strcmp(a, "--queue-target") == 0) {
+            ok = next_limit(argc, argv, i, cfg.queue_target_ms);
+        } else if (std::strcmp(a, "--max-queue") == 0) {
+            ok = next_limit(argc, argv, i, cfg.max_queue);
+        } else if (std::strcmp(a, "--shed") == 0) {
+            cfg.shed = true;
+        } else if (std::strcmp(a, "--static-dir") == 0) {
+            ok = i + 1 < argc;
+            if (ok) cfg.static_dir = argv[++i];
+        } else if (std::strcmp(a, "--static-prefix") == 0) {
+            ok = i + 1 < argc && argv[i + 1][0] == '/';
+            if (ok) cfg.static_prefix = argv[++i];
+        } else if (std::strcmp(a, "--file-cache") == 0) {
+            ok = next_int(argc, argv, i, cfg.file_cache_entries);
+        } else if (std::strcmp(a, "--kv-memory") == 0) {
+            ok = next_int(argc, argv, i, cfg.kv_memory_mb);
+        } else if (std::strcmp(a, "--proxy") == 0) {
+            ok = i + 1 < argc;
+            if (ok) cfg.proxy = argv[++i];
+        } else if (std::strcmp(a, "--proxy-pool") == 0) {
+            ok = next_limit(argc, argv, i, cfg.proxy_pool);
+        } else if (std::strcmp(a, "--proxy-check") == 0) {
+            ok = next_int(argc, argv, i, cfg.proxy_check_ms);
+        } else if (std::strcmp(a, "--upgrade-socket") == 0) {
+            ok = i + 1 < argc;
+            if (ok) cfg.upgrade_socket = argv[++i];
+        } else if (std::strcmp(a, "--drain-timeout") == 0) {
+            ok = next_int(argc, argv, i, cfg.drain_timeout_ms);
+        } else if (std::strcmp(a, "--trace-sample") == 0) {
+            ok = next_limit(argc, argv, i, cfg.trace_sample);
+        } else if (std::strcmp(a, "--trace-file") == 0) {
+            ok = i + 1 < argc;
+            if (ok) cfg.trace_file = argv[++i];
+        } else if (std::strcmp(a, "--log-level") == 0) {
+            ok = i + 1 < argc && Logger::parse_level(argv[++i], cfg.log_level);
+        } else if (std::strcmp(a, "--log-overflow") == 0) {
+            ok = i + 1 < argc;
+            if (ok) {
+                std::string p = argv[++i];
+                ok = p == "drop" || p == "block";
+                cfg.log_overflow = p == "block" ? Logger::BLOCK : Logger::DROP;
+            }
+        } else if (std::strcmp(a, "--log-file") == 0) {
+            ok = i + 1 < argc;
+            if (ok) cfg.log_path = argv[++i];
+        } else if (a[0] != '-') {
+            // legacy form: first positional argument is the worker count
+            int v = std::atoi(a);
+            if (v > 0) cfg.num_threads = v;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    if (cfg.low_watermark > cfg.high_watermark) cfg.low_watermark = cfg.high_watermark;
+    bool latency = cfg.profile == Profile::Latency;
+    if (cfg.spin_us < 0) cfg.spin_us = latency ? 50 : 0;
+    if (cfg.busy_poll_us < 0) cfg.busy_poll_us = latency ? 50 : 0;
+    if (!cfg.static_dir.empty() && cfg.codec != CodecKind::Http) {
+        std::cerr << "--static-dir needs --codec http\n";
+        return false;
+    }
+    if (!cfg.proxy.empty() && cfg.codec != CodecKind::Raw) {
+        std::cerr << "--proxy relays bytes unchanged and takes no --codec\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,117 @@
+#include "../include/Connection.h"
+#include "../include/ConnectionTable.h"
+#include "../include/Metrics.h"
+#include <mutex>
+#include <new>
+
+namespace {
+
+// Fixed-size Connection slots carved out of blocks of kSlotsPerBlock and
+// recycled through a free list. Accepts and reclaims take the lock once per
+// connection, never per event. Blocks are kept for the life of the process,
+// like the chunk pools: a server that once held a million connections is
+// likely to again.
+class Slab {
+public:
+    static const size_t kSlotsPerBlock = 4096;
+
+    void *take() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!free_) grow();
+        FreeSlot *s = free_;
+        free_ = s->next;
+        return s;
+    }
+
+    void give(void *p) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        push(p);
+    }
+
+private:
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    void push(void *p) {
+        FreeSlot *s = static_cast<FreeSlot *>(p);
+        s->next = free_;
+        free_ = s;
+    }
+
+    void grow() {
+        char *block = static_cast<char *>(::operator new(kSlotsPerBlock * sizeof(Connection)));
+        // lowest address on top, so a fresh block fills front to back
+        for (size_t i = kSlotsPerBlock; i-- > 0;) push(block + i * sizeof(Connection));
+    }
+
+    std::mutex mtx_;
+    FreeSlot *free_{nullptr};
+};
+
+const size_t Slab::kSlotsPerBlock;
+
+Slab &slab() {
+    // never destroyed: EpochManager frees the connections still retired at
+    // static destruction time
+    static Slab *s = new Slab();
+    return *s;
+}
+
+// released I/O state ready for the next connection that wakes up on this
+// thread; bounded so a burst does not keep its buffers and pipes forever
+const size_t kIoCacheSize = 64;
+
+struct IoCache {
+    std::vector<ConnectionIo *> free;
+    ~IoCache() {
+        for (ConnectionIo *io : free) delete io;
+    }
+};
+
+thread_local IoCache tls_io;
+
+} // namespace
+
+static_assert(sizeof(Connection) + ConnectionTable::kSlotBytes <= 128,
+              "an idle connection must fit in 128 bytes");
+
+void *Connection::operator new(size_t size) {
+    return size == sizeof(Connection) ? slab().take() : ::operator new(size);
+}
+
+void Connection::operator delete(void *p, size_t size) {
+    if (!p) return;
+    if (size == sizeof(Connection)) {
+        slab().give(p);
+    } else {
+        ::operator delete(p);
+    }
+}
+
+ConnectionIo &Connection::attach_io_slow() {
+    if (!tls_io.free.empty()) {
+        io = tls_io.free.back();
+        tls_io.free.pop_back();
+    } else {
+        io = new ConnectionIo();
+    }
+    Metrics::add(Counter::ConnBytesAllocated, sizeof(ConnectionIo));
+    return *io;
+}
+
+void Connection::release_io_slow() {
+    io->frame_scan = 0;
+    if (tls_io.free.size() < kIoCacheSize) {
+        tls_io.free.push_back(io);
+    } else {
+        delete io;
+    }
+    io = nullptr;
+    Metrics::add(Counter::ConnBytesFreed, sizeof(ConnectionIo));
+}
+
+size_t Connection::footprint() const {
+    return sizeof(Connection) + ConnectionTable::kSlotBytes + (io ? sizeof(ConnectionIo) : 0) +
+           (relay ? sizeof(Relay) : 0);
+}
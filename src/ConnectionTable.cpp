@@ -0,0 +1,85 @@
+#include "../include/ConnectionTable.h"
+#include "../include/Connection.h"
+#include <sys/resource.h>
+
+namespace {
+
+// keep the page directory bounded even with an "unlimited" fd limit
+const size_t kMaxFdsCap = size_t(1) << 24;
+
+size_t default_max_fds() {
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        return (size_t)rl.rlim_cur;
+    }
+    return kMaxFdsCap;
+}
+
+} // namespace
+
+const size_t ConnectionTable::kSlotBytes;
+
+ConnectionTable::ConnectionTable(size_t max_fds)
+    : max_fds_(max_fds ? max_fds : default_max_fds()), count_(0) {
+    static_assert(sizeof(Slot) == kSlotBytes, "kSlotBytes is out of date");
+    if (max_fds_ > kMaxFdsCap) max_fds_ = kMaxFdsCap;
+    num_pages_ = (max_fds_ + kPageSize - 1) / kPageSize;
+    pages_ = new std::atomic<Slot *>[num_pages_];
+    for (size_t i = 0; i < num_pages_; ++i) pages_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ConnectionTable::~ConnectionTable() {
+    for (size_t i = 0; i < num_pages_; ++i) delete[] pages_[i].load(std::memory_order_relaxed);
+    delete[] pages_;
+}
+
+ConnectionTable::Slot *ConnectionTable::slot(int fd) const {
+    if (fd < 0 || (size_t)fd >= max_fds_) return nullptr;
+    Slot *page = pages_[(size_t)fd >> kPageBits].load(std::memory_order_acquire);
+    return page ? &page[(size_t)fd & (kPageSize - 1)] : nullptr;
+}
+
+ConnectionTable::Slot *ConnectionTable::slot_or_create(int fd) {
+    if (fd < 0 || (size_t)fd >= max_fds_) return nullptr;
+    std::atomic<Slot *> &dir = pages_[(size_t)fd >> kPageBits];
+    Slot *page = dir.load(std::memory_order_acquire);
+    if (!page) {
+        // several acceptors may race to create the same page; one wins
+        Slot *fresh = new Slot[kPageSize];
+        if (dir.compare_exchange_strong(page, fresh, std::memory_order_acq_rel)) {
+            page = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return &page[(size_t)fd & (kPageSize - 1)];
+}
+
+uint64_t ConnectionTable::insert(Connection *conn) {
+    Slot *s = slot_or_create(conn->fd);
+    if (!s) return 0;
+    // generation 0 is never handed out so a token is never 0
+    uint32_t gen = s->generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (gen == 0) gen = s->generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    conn->token = ((uint64_t)gen << 32) | (uint32_t)conn->fd;
+    s->conn.store(conn, std::memory_order_release);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    return conn->token;
+}
+
+Connection *ConnectionTable::find(uint64_t token) const {
+    Slot *s = slot(token_fd(token));
+    if (!s) return nullptr;
+    Connection *c = s->conn.load(std::memory_order_acquire);
+    return (c && c->token == token) ? c : nullptr;
+}
+
+Connection *ConnectionTable::remove(uint64_t token) {
+    Slot *s = slot(token_fd(token));
+    if (!s) return nullptr;
+    Connection *c = s->conn.load(std::memory_order_acquire);
+    if (!c || c->token != token) return nullptr;
+    if (!s->conn.compare_exchange_strong(c, nullptr, std::memory_order_acq_rel)) return nullptr;
+    count_.fetch_sub(1, std::memory_order_relaxed);
+    return c;
+}
@@ -0,0 +1,142 @@
+#include "../include/Epoch.h"
+#include "../include/Aligned.h"
+#include <mutex>
+
+namespace {
+
+struct Retired {
+    uint64_t epoch;
+    void *ptr;
+    void (*deleter)(void *);
+};
+
+} // namespace
+
+// allocated on its own cache line: other threads read state on every reclaim
+struct EpochManager::Record : CacheAligned {
+    // (epoch << 1) | active, written by the owning thread only
+    alignas(64) std::atomic<uint64_t> state{0};
+    std::atomic<bool> in_use{false};
+    int nesting{0};
+    // retired objects in epoch order; the mutex is only contended when
+    // reclaim() sweeps another thread's record
+    std::mutex limbo_mtx;
+    std::deque<Retired> limbo;
+    Record *next{nullptr};
+};
+
+namespace {
+
+// releases the thread's record for reuse when the thread exits
+struct RecordHolder {
+    EpochManager::Record *rec{nullptr};
+    ~RecordHolder();
+};
+
+thread_local RecordHolder tls_record;
+
+} // namespace
+
+RecordHolder::~RecordHolder() {
+    if (rec) rec->in_use.store(false, std::memory_order_release);
+}
+
+EpochManager &EpochManager::instance() {
+    static EpochManager em;
+    return em;
+}
+
+EpochManager::EpochManager() : global_epoch_(0), records_(nullptr), pending_(0) {}
+
+EpochManager::~EpochManager() {
+    // all other threads are gone at static destruction time
+    Record *r = records_.load(std::memory_order_acquire);
+    while (r) {
+        for (auto &item : r->limbo) item.deleter(item.ptr);
+        Record *next = r->next;
+        delete r;
+        r = next;
+    }
+}
+
+EpochManager::Record *EpochManager::acquire_record() {
+    // reuse a record left behind by an exited thread
+    for (Record *r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        bool expected = false;
+        if (!r->in_use.load(std::memory_order_relaxed) &&
+            r->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return r;
+        }
+    }
+    Record *r = new Record();
+    r->in_use.store(true, std::memory_order_relaxed);
+    Record *head = records_.load(std::memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!records_.compare_exchange_weak(head, r, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    return r;
+}
+
+void EpochManager::enter() {
+    Record *r = tls_record.rec;
+    if (!r) r = tls_record.rec = acquire_record();
+    if (r->nesting++ > 0) return;
+    uint64_t e = global_epoch_.load(std::memory_order_relaxed);
+    r->state.store((e << 1) | 1, std::memory_order_relaxed);
+    // make the pin visible before any shared pointer is loaded
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochManager::exit() {
+    Record *r = tls_record.rec;
+    if (--r->nesting > 0) return;
+    uint64_t s = r->state.load(std::memory_order_relaxed);
+    r->state.store(s & ~uint64_t(1), std::memory_order_release);
+}
+
+void EpochManager::retire(void *p, void (*deleter)(void *)) {
+    Record *r = tls_record.rec;
+    if (!r) r = tls_record.rec = acquire_record();
+    {
+        std::lock_guard<std::mutex> lk(r->limbo_mtx);
+        r->limbo.push_back(Retired{global_epoch_.load(std::memory_order_acquire), p, deleter});
+    }
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    // retire() runs once per closed connection, so a full scan is cheap here
+    try_advance();
+    collect(r);
+}
+
+void EpochManager::reclaim() {
+    try_advance();
+    for (Record *r = records_.load(std::memory_order_acquire); r; r = r->next) collect(r);
+}
+
+bool EpochManager::try_advance() {
+    uint64_t e = global_epoch_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (Record *r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t s = r->state.load(std::memory_order_acquire);
+        // a thread pinned in an older epoch may still hold unlinked objects
+        if ((s & 1) && (s >> 1) != e) return false;
+    }
+    return global_epoch_.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel);
+}
+
+void EpochManager::collect(Record *r) {
+    uint64_t e = global_epoch_.load(std::memory_order_acquire);
+    std::deque<Retired> ready;
+    {
+        // objects retired in epoch k are unreachable once the epoch reaches k + 2
+        std::lock_guard<std::mutex> lk(r->limbo_mtx);
+        while (!r->limbo.empty() && r->limbo.front().epoch + 2 <= e) {
+            ready.push_back(r->limbo.front());
+            r->limbo.pop_front();
+        }
+    }
+    for (auto &item : ready) {
+        item.deleter(item.ptr);
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
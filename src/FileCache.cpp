@@ -0,0 +1,172 @@
+#include "../include/FileCache.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+namespace {
+
+// lookups drain pending inotify events at most this often
+const uint64_t kDrainIntervalNs = 1000000;
+
+const uint32_t kWatchMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                            IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+} // namespace
+
+CachedFile::~CachedFile() {
+    if (fd >= 0) close(fd);
+}
+
+FileCache &FileCache::instance() {
+    static FileCache cache;
+    return cache;
+}
+
+FileCache::FileCache() {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ == -1) {
+        LOG_WARN(std::string("inotify unavailable, static files are opened uncached: ") + std::strerror(errno));
+    }
+}
+
+FileCache::~FileCache() {
+    clear_locked();
+    if (inotify_fd_ != -1) close(inotify_fd_);
+}
+
+void FileCache::set_capacity(size_t n) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    capacity_ = n;
+    while (lru_.size() > capacity_) drop(std::prev(lru_.end()));
+}
+
+size_t FileCache::size() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return lru_.size();
+}
+
+void FileCache::clear() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    clear_locked();
+}
+
+std::shared_ptr<const CachedFile> FileCache::open(const std::string &path) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        uint64_t now = Metrics::now_ns();
+        if (now - last_drain_ns_ >= kDrainIntervalNs) {
+            drain_events();
+            last_drain_ns_ = now;
+        }
+        auto it = index_.find(path);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            Metrics::add(Counter::FileCacheHits);
+            return it->second->file;
+        }
+    }
+    Metrics::add(Counter::FileCacheMisses);
+
+    // open outside the lock: a cold path walk may touch the disk
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return nullptr;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+        return nullptr;
+    }
+    std::shared_ptr<const CachedFile> file =
+        std::make_shared<CachedFile>(fd, (uint64_t)st.st_size, st.st_mtime);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (capacity_ == 0 || inotify_fd_ == -1 || index_.count(path)) return file;
+    // (a change between the fstat above and a brand-new watch goes unseen
+    // until the entry is evicted; later ones are caught)
+    size_t slash = path.rfind('/');
+    int wd = watch_dir(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+    if (wd < 0) return file;
+    lru_.push_front(Entry{path, file, wd});
+    index_[path] = lru_.begin();
+    ++watches_[wd].entries;
+    while (lru_.size() > capacity_) drop(std::prev(lru_.end()));
+    return file;
+}
+
+int FileCache::watch_dir(const std::string &dir) {
+    auto it = dir_wd_.find(dir);
+    if (it != dir_wd_.end()) return it->second;
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(), kWatchMask);
+    if (wd < 0) {
+        LOG_WARN("inotify_add_watch failed for " + dir + ": " + std::strerror(errno));
+        return -1;
+    }
+    watches_.emplace(wd, Watch{dir, 0});
+    dir_wd_[dir] = wd;
+    return wd;
+}
+
+void FileCache::drop(std::list<Entry>::iterator it) {
+    int wd = it->wd;
+    index_.erase(it->path);
+    lru_.erase(it);
+    auto w = watches_.find(wd);
+    if (w == watches_.end() || --w->second.entries > 0) return;
+    inotify_rm_watch(inotify_fd_, wd);
+    for (auto d = dir_wd_.begin(); d != dir_wd_.end();) {
+        d = d->second == wd ? dir_wd_.erase(d) : std::next(d);
+    }
+    watches_.erase(w);
+}
+
+void FileCache::drop_dir(int wd) {
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        auto next = std::next(it);
+        if (it->wd == wd) drop(it);
+        it = next;
+    }
+}
+
+void FileCache::clear_locked() {
+    while (!lru_.empty()) drop(lru_.begin());
+}
+
+void FileCache::drain_events() {
+    if (inotify_fd_ == -1) return;
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+        ssize_t n = read(inotify_fd_, buf, sizeof(buf));
+        if (n <= 0) return;
+        for (ssize_t off = 0; off < n;) {
+            const inotify_event *ev = (const inotify_event *)(buf + off);
+            off += (ssize_t)(sizeof(inotify_event) + ev->len);
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // events were lost: nothing cached can be trusted
+                clear_locked();
+                continue;
+            }
+            auto w = watches_.find(ev->wd);
+            if (w == watches_.end()) continue;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                drop_dir(ev->wd);
+                continue;
+            }
+            if (ev->len == 0) continue;
+            const std::string &dir = w->second.dir;
+            std::string path = dir == "/" ? "/" + std::string(ev->name) : dir + "/" + ev->name;
+            auto it = index_.find(path);
+            if (it != index_.end()) drop(it->second);
+        }
+    }
+}
@@ -0,0 +1,204 @@
+#include "../include/HotRestart.h"
+#include "../include/Logger.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const uint32_t kMagic = 0x48525331; // "HRS1"
+// most descriptors one SCM_RIGHTS message carries (SCM_MAX_FD)
+const size_t kMaxFds = 253;
+// the new process builds its loops between receiving the sockets and
+// confirming, the old one closes its admin port between confirm and release
+const int kExchangeTimeoutMs = 10000;
+const char kReady = 'R';
+const char kReleased = 'D';
+
+struct Hello {
+    uint32_t magic;
+    uint32_t port;
+    uint32_t tcp;
+    uint32_t udp;
+    int32_t pid;
+};
+
+bool make_address(const std::string &path, sockaddr_un &addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Upgrade socket path too long: " + path);
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+void set_timeouts(int fd) {
+    timeval tv;
+    tv.tv_sec = kExchangeTimeoutMs / 1000;
+    tv.tv_usec = (kExchangeTimeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+} // namespace
+
+HotRestart::~HotRestart() {
+    if (peer_fd_ != -1) close(peer_fd_);
+    if (listen_fd_ != -1) {
+        // still ours: nobody took the path over
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+}
+
+HotRestart::Takeover HotRestart::take_over(InheritedSockets &out) {
+    sockaddr_un addr;
+    if (!make_address(path_, addr)) return Failed;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return Failed;
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        int e = errno;
+        close(fd);
+        // no file, or a file left behind by a server that is gone
+        if (e == ENOENT || e == ECONNREFUSED) return Cold;
+        LOG_ERROR("Cannot reach the server at " + path_ + ": " + std::strerror(e));
+        return Failed;
+    }
+    set_timeouts(fd);
+
+    Hello hello;
+    iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * kMaxFds)];
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+    std::vector<int> fds;
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int received;
+            std::memcpy(&received, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            fds.push_back(received);
+        }
+    }
+    bool ok = n == (ssize_t)sizeof(hello) && hello.magic == kMagic && !(msg.msg_flags & MSG_CTRUNC) &&
+              fds.size() == (size_t)hello.tcp + hello.udp;
+    if (!ok) {
+        LOG_ERROR("Bad socket handoff from the server at " + path_ +
+                  (n < 0 ? std::string(": ") + std::strerror(errno) : std::string()));
+        for (int f : fds) close(f);
+        close(fd);
+        return Failed;
+    }
+    out.tcp.assign(fds.begin(), fds.begin() + hello.tcp);
+    out.udp.assign(fds.begin() + hello.tcp, fds.end());
+    out.port = (int)hello.port;
+    out.pid = hello.pid;
+    peer_fd_ = fd;
+    return Inherited;
+}
+
+void HotRestart::confirm() {
+    if (peer_fd_ == -1) return;
+    char c = kReady;
+    // a closed connection also means the old process let go
+    if (send(peer_fd_, &c, 1, MSG_NOSIGNAL) == 1 && recv(peer_fd_, &c, 1, 0) < 0) {
+        LOG_WARN("The previous server did not release the upgrade socket: " + std::string(std::strerror(errno)));
+    }
+    close(peer_fd_);
+    peer_fd_ = -1;
+}
+
+bool HotRestart::listen() {
+    sockaddr_un addr;
+    if (!make_address(path_, addr)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    unlink(path_.c_str());
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(fd, 1) < 0) {
+        LOG_ERROR("Cannot listen for upgrades at " + path_ + ": " + std::strerror(errno));
+        close(fd);
+        return false;
+    }
+    listen_fd_ = fd;
+    return true;
+}
+
+bool HotRestart::wait(int timeout_ms, int port, const std::vector<int> &tcp, const std::vector<int> &udp) {
+    pollfd p;
+    p.fd = listen_fd_;
+    p.events = POLLIN;
+    if (::poll(&p, 1, timeout_ms) <= 0) return false;
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) return false;
+    set_timeouts(fd);
+
+    std::vector<int> fds(tcp);
+    fds.insert(fds.end(), udp.begin(), udp.end());
+    if (fds.size() > kMaxFds) {
+        LOG_ERROR("Cannot hand over " + std::to_string(fds.size()) + " sockets, at most " +
+                  std::to_string(kMaxFds) + " fit one message");
+        close(fd);
+        return false;
+    }
+    Hello hello;
+    hello.magic = kMagic;
+    hello.port = (uint32_t)port;
+    hello.tcp = (uint32_t)tcp.size();
+    hello.udp = (uint32_t)udp.size();
+    hello.pid = (int32_t)getpid();
+    iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * kMaxFds)];
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+    LOG_INFO("Handing " + std::to_string(fds.size()) + " sockets to a new process");
+
+    char ack = 0;
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hello) || recv(fd, &ack, 1, 0) != 1 || ack != kReady) {
+        // it exited or gave up before serving: keep going as before
+        LOG_WARN("Upgrade abandoned, the new process did not start serving");
+        close(fd);
+        return false;
+    }
+    peer_fd_ = fd;
+    return true;
+}
+
+void HotRestart::release() {
+    // the new process unlinks the path and binds it again itself
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+    if (peer_fd_ == -1) return;
+    char c = kReleased;
+    send(peer_fd_, &c, 1, MSG_NOSIGNAL);
+    close(peer_fd_);
+    peer_fd_ = -1;
+}
@@ -0,0 +1,554 @@
+#include "../include/Http.h"
+#include "../include/Buffer.h"
+#include "../include/FileCache.h"
+
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SIMD_X86 1
+#endif
+
+namespace {
+
+// Header-block terminator search. Each kernel returns the first s in
+// [p, last) with s[0..3] == "\r\n\r\n", or last; the caller guarantees that
+// three bytes past `last` are readable.
+typedef const char *(*FindTerminatorFn)(const char *p, const char *last);
+
+const char *find_terminator_scalar(const char *p, const char *last) {
+    for (; p < last; ++p) {
+        if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return p;
+    }
+    return last;
+}
+
+#ifdef HTTP_SIMD_X86
+// four unaligned loads shifted by one byte each: bit i of the mask is set
+// when a terminator starts at p + i
+__attribute__((target("sse2")))
+const char *find_terminator_sse2(const char *p, const char *last) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; last - p >= 16; p += 16) {
+        __m128i m = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), lf)),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 3)), lf)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz((unsigned)mask);
+    }
+    return find_terminator_scalar(p, last);
+}
+
+__attribute__((target("avx2")))
+const char *find_terminator_avx2(const char *p, const char *last) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; last - p >= 32; p += 32) {
+        __m256i m = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 3)), lf)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return find_terminator_sse2(p, last);
+}
+#endif
+
+FindTerminatorFn pick_find_terminator() {
+#ifdef HTTP_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return find_terminator_avx2;
+    if (__builtin_cpu_supports("sse2")) return find_terminator_sse2;
+#endif
+    return find_terminator_scalar;
+}
+
+// chosen once for the CPU we run on
+const FindTerminatorFn find_terminator = pick_find_terminator();
+
+// RFC 9110 token characters (method and header names)
+bool is_tchar(char c) {
+    static const char extra[] = "!#$%&'*+-.^_`|~";
+    unsigned char u = (unsigned char)c;
+    return std::isalnum(u) || (u != 0 && std::strchr(extra, c) != nullptr);
+}
+
+bool is_ows(char c) { return c == ' ' || c == '\t'; }
+
+bool known_method(const HttpString &m) {
+    static const char *methods[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH"};
+    for (const char *name : methods) {
+        if (m.equals(name, std::strlen(name))) return true;
+    }
+    return false;
+}
+
+// does the comma-separated header value list `token`?
+bool has_token(const HttpString &value, const char *token) {
+    const char *p = value.data, *end = value.data + value.size;
+    while (p < end) {
+        const char *comma = (const char *)std::memchr(p, ',', end - p);
+        const char *e = comma ? comma : end;
+        const char *b = p;
+        while (b < e && is_ows(*b)) ++b;
+        const char *t = e;
+        while (t > b && is_ows(t[-1])) --t;
+        if (HttpString{b, (size_t)(t - b)}.iequals(token)) return true;
+        p = e + 1;
+    }
+    return false;
+}
+
+const char *reason_phrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
+        case 501: return "Not Implemented";
+        default: return "Unknown";
+    }
+}
+
+const char *content_type_for(const std::string &path) {
+    static const struct {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        {".html", "text/html"},         {".htm", "text/html"},          {".css", "text/css"},
+        {".js", "text/javascript"},     {".json", "application/json"},  {".txt", "text/plain"},
+        {".svg", "image/svg+xml"},      {".png", "image/png"},          {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},        {".gif", "image/gif"},          {".ico", "image/x-icon"},
+        {".webp", "image/webp"},        {".woff2", "font/woff2"},       {".wasm", "application/wasm"},
+        {".pdf", "application/pdf"},    {".mp4", "video/mp4"},          {".webm", "video/webm"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+        for (const auto &t : types) {
+            if (path.compare(dot, std::string::npos, t.ext) == 0) return t.type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string http_date(time_t t) {
+    struct tm tm;
+    char buf[40];
+    gmtime_r(&t, &tm);
+    size_t n = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+// a ".." segment (or a NUL) could leave the served directory
+bool unsafe_path(const HttpString &rel) {
+    if (std::memchr(rel.data, '\0', rel.size)) return true;
+    const char *p = rel.data, *end = rel.data + rel.size;
+    while (p <= end) {
+        const char *slash = (const char *)std::memchr(p, '/', end - p);
+        const char *e = slash ? slash : end;
+        if (e - p == 2 && p[0] == '.' && p[1] == '.') return true;
+        p = e + 1;
+    }
+    return false;
+}
+
+bool parse_u64(const char *&p, const char *end, uint64_t &out) {
+    const char *start = p;
+    out = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        if (out > (UINT64_MAX - 9) / 10) return false;
+        out = out * 10 + (uint64_t)(*p - '0');
+    }
+    return p > start;
+}
+
+enum class RangeResult { Whole, Partial, Unsatisfiable };
+
+// One "bytes=first-last", "bytes=first-" or "bytes=-suffix" range of a file
+// of `size` bytes. Anything else (several ranges, other units, bad syntax)
+// is ignored and the whole file is sent, as RFC 9110 allows.
+RangeResult parse_range(const HttpString &value, uint64_t size, uint64_t &offset, uint64_t &len) {
+    const char *p = value.data, *end = value.data + value.size;
+    if (end - p < 6 || std::memcmp(p, "bytes=", 6) != 0) return RangeResult::Whole;
+    p += 6;
+    if (std::memchr(p, ',', end - p)) return RangeResult::Whole;
+    uint64_t first = 0, last = 0;
+    bool has_first = parse_u64(p, end, first);
+    if (p == end || *p++ != '-') return RangeResult::Whole;
+    bool has_last = parse_u64(p, end, last);
+    if (p != end || (!has_first && !has_last)) return RangeResult::Whole;
+
+    if (!has_first) {
+        // the final `last` bytes
+        if (last == 0 || size == 0) return RangeResult::Unsatisfiable;
+        len = last < size ? last : size;
+        offset = size - len;
+        return RangeResult::Partial;
+    }
+    if (has_last && last < first) return RangeResult::Whole;
+    if (first >= size) return RangeResult::Unsatisfiable;
+    offset = first;
+    len = (has_last && last < size - 1 ? last + 1 : size) - first;
+    return RangeResult::Partial;
+}
+
+// header blocks that straddle a chunk boundary, and the request parsed last
+thread_local std::string tls_head;
+thread_local HttpRequest tls_request;
+
+} // namespace
+
+const size_t HttpRequest::kMaxHeaders;
+const size_t HttpCodec::kMaxHeader;
+const size_t HttpCodec::kMaxBody;
+
+bool HttpString::iequals(const char *s) const {
+    for (size_t i = 0; i < size; ++i, ++s) {
+        if (*s == '\0' || std::tolower((unsigned char)data[i]) != std::tolower((unsigned char)*s)) return false;
+    }
+    return *s == '\0';
+}
+
+const HttpString *HttpRequest::header(const char *name) const {
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (headers[i].name.iequals(name)) return &headers[i].value;
+    }
+    return nullptr;
+}
+
+ssize_t http_find_header_end(const Buffer &in, size_t &from) {
+    size_t total = in.size();
+    if (total < 4) return -1;
+    size_t limit = total - 3; // terminators can start before this offset
+    size_t base = 0;
+    for (size_t i = 0; i < in.segment_count() && from < limit; ++i) {
+        const Buffer::Segment &seg = in.segment(i);
+        size_t n = seg.size();
+        if (from >= base + n) {
+            base += n;
+            continue;
+        }
+        // candidates that lie entirely within this segment
+        size_t start = from - base;
+        if (n >= 4 && start < n - 3) {
+            const char *last = seg.data() + (n - 3);
+            const char *hit = find_terminator(seg.data() + start, last);
+            if (hit != last) return (ssize_t)(base + (hit - seg.data()) + 4);
+            start = n - 3;
+        }
+        // the last few that run into the next segment
+        for (; start < n && base + start < limit; ++start) {
+            char q[4];
+            in.copy_out(base + start, q, 4);
+            if (std::memcmp(q, "\r\n\r\n", 4) == 0) return (ssize_t)(base + start + 4);
+        }
+        base += n;
+        from = base;
+    }
+    from = limit;
+    return -1;
+}
+
+bool http_parse_request(const char *data, size_t len, HttpRequest &req) {
+    const char *p = data, *end = data + len;
+
+    // request line: method SP target SP HTTP/1.x CRLF
+    const char *e = p;
+    while (e < end && is_tchar(*e)) ++e;
+    if (e == p || e == end || *e != ' ') return false;
+    req.method = HttpString{p, (size_t)(e - p)};
+    p = e + 1;
+
+    e = p;
+    while (e < end && (unsigned char)*e > ' ' && *e != 0x7f) ++e;
+    if (e == p || e == end || *e != ' ') return false;
+    req.target = HttpString{p, (size_t)(e - p)};
+    const char *query = (const char *)std::memchr(p, '?', e - p);
+    req.path = HttpString{p, (size_t)((query ? query : e) - p)};
+    p = e + 1;
+
+    if (end - p < 10 || std::memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1') ||
+        p[8] != '\r' || p[9] != '\n') {
+        return false;
+    }
+    req.minor_version = p[7] - '0';
+    p += 10;
+
+    // header fields up to the blank line
+    req.num_headers = 0;
+    while (true) {
+        if (end - p < 2) return false;
+        if (p[0] == '\r' && p[1] == '\n') break;
+        const char *eol = (const char *)std::memchr(p, '\r', end - p);
+        if (!eol || eol + 1 >= end || eol[1] != '\n') return false;
+        // a name that does not start the line also rejects obsolete folding
+        const char *colon = p;
+        while (colon < eol && is_tchar(*colon)) ++colon;
+        if (colon == p || colon == eol || *colon != ':') return false;
+        const char *v = colon + 1;
+        while (v < eol && is_ows(*v)) ++v;
+        const char *ve = eol;
+        while (ve > v && is_ows(ve[-1])) --ve;
+        if (req.num_headers == HttpRequest::kMaxHeaders) return false;
+        HttpHeader &h = req.headers[req.num_headers++];
+        h.name = HttpString{p, (size_t)(colon - p)};
+        h.value = HttpString{v, (size_t)(ve - v)};
+        p = eol + 2;
+    }
+
+    // the headers the server acts on
+    req.content_length = 0;
+    bool have_length = false, close = false, keep_alive = false;
+    for (size_t i = 0; i < req.num_headers; ++i) {
+        const HttpHeader &h = req.headers[i];
+        if (h.name.iequals("content-length")) {
+            if (h.value.size == 0 || h.value.size > 18) return false;
+            size_t n = 0;
+            for (size_t k = 0; k < h.value.size; ++k) {
+                char c = h.value.data[k];
+                if (c < '0' || c > '9') return false;
+                n = n * 10 + (size_t)(c - '0');
+            }
+            if (have_length && n != req.content_length) return false;
+            req.content_length = n;
+            have_length = true;
+        } else if (h.name.iequals("transfer-encoding")) {
+            // chunked bodies are not supported
+            return false;
+        } else if (h.name.iequals("connection")) {
+            close = close || has_token(h.value, "close");
+            keep_alive = keep_alive || has_token(h.value, "keep-alive");
+        }
+    }
+    // HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only on request
+    req.keep_alive = req.minor_version >= 1 ? !close : keep_alive && !close;
+    return true;
+}
+
+ssize_t HttpCodec::decode(const Buffer &in, size_t &scan, Frame &frame) const {
+    ssize_t head;
+    if (scan & kScanPending) {
+        // the headers were parsed by an earlier call; only the body was missing
+        if (in.size() < pending_wire(scan)) return 0;
+        head = (ssize_t)pending_head(scan);
+    } else {
+        head = http_find_header_end(in, scan);
+    }
+    bool bad = false;
+    if (head < 0) {
+        if (in.size() <= kMaxHeader) return 0;
+        bad = true;
+    } else if ((size_t)head > kMaxHeader) {
+        bad = true;
+    }
+
+    HttpRequest &req = tls_request;
+    if (!bad) {
+        // header views point into the input unless the block straddles chunks
+        const char *data = in.contiguous(0, (size_t)head);
+        if (!data) {
+            tls_head.resize((size_t)head);
+            in.copy_out(0, &tls_head[0], (size_t)head);
+            data = tls_head.data();
+        }
+        bad = !http_parse_request(data, (size_t)head, req) || req.content_length > kMaxBody;
+    }
+    if (bad) {
+        // a frame without a request: the handler answers 400 and closes
+        frame.offset = 0;
+        frame.size = 0;
+        frame.data = "";
+        frame.meta = nullptr;
+        return (ssize_t)in.size();
+    }
+
+    size_t wire = (size_t)head + req.content_length;
+    if (in.size() < wire) {
+        // wait for the body, checking only its size until it is complete;
+        // the headers are then parsed once more for their views
+        scan = scan_pending((size_t)head, wire);
+        return 0;
+    }
+    frame.offset = (size_t)head;
+    frame.size = req.content_length;
+    frame.meta = &req;
+    return (ssize_t)wire;
+}
+
+HttpRouter::Route HttpRouter::render(const std::string &method, const std::string &path, int status,
+                                     const std::string &content_type, const std::string &body) {
+    std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase(status) +
+                       "\r\nContent-Type: " + content_type +
+                       "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    Route r;
+    r.method = method;
+    r.path = path;
+    r.echo = false;
+    r.head_keep_alive = head + "Connection: keep-alive\r\n\r\n";
+    r.head_close = head + "Connection: close\r\n\r\n";
+    r.body = body;
+    return r;
+}
+
+void HttpRouter::add(const std::string &method, const std::string &path, int status,
+                     const std::string &content_type, const std::string &body) {
+    routes_.push_back(render(method, path, status, content_type, body));
+}
+
+void HttpRouter::add_echo(const std::string &method, const std::string &path) {
+    Route r;
+    r.method = method;
+    r.path = path;
+    r.echo = true;
+    routes_.push_back(r);
+}
+
+void HttpRouter::add_files(const std::string &prefix, const std::string &root) {
+    Route r;
+    r.method = "GET";
+    r.path = prefix.empty() || prefix.back() != '/' ? prefix + "/" : prefix;
+    r.echo = false;
+    r.root = root.size() > 1 && root.back() == '/' ? root.substr(0, root.size() - 1) : root;
+    routes_.push_back(r);
+}
+
+HttpRouter HttpRouter::defaults() {
+    HttpRouter router;
+    router.add("GET", "/", 200, "text/plain", "Hello, World!\n");
+    router.add("GET", "/health", 200, "text/plain", "OK\n");
+    router.add_echo("POST", "/echo");
+    return router;
+}
+
+HttpRouter HttpRouter::from_config(const ServerConfig &cfg) {
+    HttpRouter router = defaults();
+    if (!cfg.static_dir.empty()) router.add_files(cfg.static_prefix, cfg.static_dir);
+    return router;
+}
+
+void HttpRouter::write_static(const Route &route, const HttpRequest &req, Reply<HttpCodec> &reply) const {
+    reply.write(req.keep_alive ? route.head_keep_alive : route.head_close);
+    if (!req.method.equals("HEAD", 4)) reply.write(route.body);
+    if (!req.keep_alive) reply.close_after();
+}
+
+void HttpRouter::respond(const HttpRequest &req, const Frame &body, Reply<HttpCodec> &reply) const {
+    if (!known_method(req.method)) {
+        write_static(not_implemented_, req, reply);
+        return;
+    }
+    bool head_only = req.method.equals("HEAD", 4);
+    const Route *path_match = nullptr;
+    for (const Route &r : routes_) {
+        if (!r.root.empty()) {
+            // file routes own every path under their prefix
+            if (req.path.size < r.path.size() || std::memcmp(req.path.data, r.path.data(), r.path.size()) != 0) {
+                continue;
+            }
+            if (req.method.equals("GET", 3) || head_only) {
+                write_file(r, req, reply);
+            } else {
+                write_static(not_allowed_, req, reply);
+            }
+            return;
+        }
+        if (!req.path.equals(r.path)) continue;
+        path_match = &r;
+        if (!req.method.equals(r.method) && !(head_only && r.method == "GET")) continue;
+
+        if (!r.echo) {
+            write_static(r, req, reply);
+            return;
+        }
+        char head[160];
+        int n = std::snprintf(head, sizeof(head),
+                              "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                              "Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+                              body.size, req.keep_alive ? "keep-alive" : "close");
+        reply.write(head, (size_t)n);
+        // large bodies share the input chunks
+        if (!head_only && body.size > 0) reply.write(body);
+        if (!req.keep_alive) reply.close_after();
+        return;
+    }
+    write_static(path_match ? not_allowed_ : not_found_, req, reply);
+}
+
+void HttpRouter::write_file(const Route &route, const HttpRequest &req, Reply<HttpCodec> &reply) const {
+    HttpString rel{req.path.data + route.path.size(), req.path.size - route.path.size()};
+    if (unsafe_path(rel)) {
+        write_static(not_found_, req, reply);
+        return;
+    }
+    std::string path = route.root + "/" + std::string(rel.data, rel.size);
+    if (path.back() == '/') path += "index.html";
+    std::shared_ptr<const CachedFile> file = FileCache::instance().open(path);
+    if (!file) {
+        write_static(not_found_, req, reply);
+        return;
+    }
+
+    std::string modified = http_date(file->mtime);
+    uint64_t offset = 0, len = file->size;
+    RangeResult range = RangeResult::Whole;
+    const HttpString *range_hdr = req.header("Range");
+    if (range_hdr) {
+        // If-Range: only a matching validator keeps the range
+        const HttpString *if_range = req.header("If-Range");
+        if (!if_range || if_range->equals(modified)) range = parse_range(*range_hdr, file->size, offset, len);
+    }
+
+    const char *connection = req.keep_alive ? "keep-alive" : "close";
+    char head[512];
+    int n;
+    if (range == RangeResult::Unsatisfiable) {
+        n = std::snprintf(head, sizeof(head),
+                          "HTTP/1.1 416 %s\r\nContent-Range: bytes */%llu\r\nContent-Length: 0\r\n"
+                          "Connection: %s\r\n\r\n",
+                          reason_phrase(416), (unsigned long long)file->size, connection);
+        reply.write(head, (size_t)n);
+        if (!req.keep_alive) reply.close_after();
+        return;
+    }
+    char content_range[96] = "";
+    if (range == RangeResult::Partial) {
+        std::snprintf(content_range, sizeof(content_range), "Content-Range: bytes %llu-%llu/%llu\r\n",
+                      (unsigned long long)offset, (unsigned long long)(offset + len - 1),
+                      (unsigned long long)file->size);
+    }
+    int status = range == RangeResult::Partial ? 206 : 200;
+    n = std::snprintf(head, sizeof(head),
+                      "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %llu\r\n%s"
+                      "Last-Modified: %s\r\nAccept-Ranges: bytes\r\nConnection: %s\r\n\r\n",
+                      status, reason_phrase(status), content_type_for(path), (unsigned long long)len,
+                      content_range, modified.c_str(), connection);
+    reply.write(head, (size_t)n);
+    // the body goes out with sendfile / splice behind the headers
+    if (!req.method.equals("HEAD", 4)) reply.write_file(std::move(file), offset, len);
+    if (!req.keep_alive) reply.close_after();
+}
+
+void HttpRouter::reject(Reply<HttpCodec> &reply) const {
+    reply.write(bad_request_.head_close);
+    reply.write(bad_request_.body);
+    reply.close_after();
+}
+
+void HttpHandler::on_frame(const Frame &frame, Reply<HttpCodec> &reply) {
+    const HttpRequest *req = static_cast<const HttpRequest *>(frame.meta);
+    if (!req) {
+        router_.reject(reply);
+        return;
+    }
+    router_.respond(*req, frame, reply);
+}
@@ -0,0 +1,353 @@
+#include "../include/KvStore.h"
+#include "../include/Buffer.h"
+#include "../include/Metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+namespace {
+
+const size_t kMinChunk = 64;
+const double kGrowth = 1.25;
+const size_t kMinTable = 1024;
+// memcached: exptimes up to 30 days are relative, larger ones absolute
+const int64_t kMaxRelative = 60 * 60 * 24 * 30;
+
+inline uint64_t fmix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+} // namespace
+
+const size_t KvStore::kPageSize;
+const size_t KvStore::kMaxKey;
+const size_t KvStore::kMaxValue;
+const size_t KvStore::kWheelSlots;
+
+KvStore &KvStore::instance() {
+    static KvStore store;
+    return store;
+}
+
+KvStore::KvStore() : max_pages_(64), start_ns_(Metrics::now_ns()) {
+    for (size_t size = kMinChunk; size < (size_t)(kPageSize / kGrowth); size = ((size_t)(size * kGrowth) + 7) & ~(size_t)7) {
+        class_sizes_.push_back(size);
+    }
+    class_sizes_.push_back(kPageSize);
+    configure(1, max_pages_ * kPageSize);
+}
+
+KvStore::~KvStore() {
+    configure(0, 0);
+}
+
+void KvStore::configure(size_t shards, size_t max_bytes) {
+    for (Shard *s : shards_) {
+        for (SlabClass &c : s->classes) {
+            for (char *page : c.pages) std::free(page);
+        }
+        delete s;
+    }
+    shards_.clear();
+    pages_.store(0, std::memory_order_relaxed);
+    // every shard can hold at least one page
+    max_pages_ = std::max<size_t>(max_bytes / kPageSize, shards);
+    for (size_t i = 0; i < shards; ++i) {
+        Shard *s = new Shard();
+        for (size_t size : class_sizes_) {
+            SlabClass c;
+            c.size = size;
+            c.per_page = kPageSize / size;
+            s->classes.push_back(c);
+        }
+        s->wheel_now = now_s();
+        shards_.push_back(s);
+    }
+}
+
+uint64_t KvStore::hash(const char *key, size_t nkey) {
+    // 8 bytes per step, then a murmur3 finaliser over the lot
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ nkey;
+    size_t i = 0;
+    for (; i + 8 <= nkey; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, key + i, 8);
+        h = (h ^ fmix(v)) * 0x9e3779b97f4a7c15ull;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, key + i, nkey - i);
+    return fmix(h ^ tail);
+}
+
+uint32_t KvStore::now_s() const {
+    return (uint32_t)((Metrics::now_ns() - start_ns_) / 1000000000ull) + 1;
+}
+
+void KvStore::hit() {
+    Metrics::add(Counter::KvHits);
+}
+
+void KvStore::miss() {
+    Metrics::add(Counter::KvMisses);
+}
+
+KvStore::Result KvStore::set(const char *key, size_t nkey, uint32_t flags, int64_t exptime, const Buffer &src,
+                             size_t offset, size_t n) {
+    uint64_t h = hash(key, nkey);
+    Shard &s = shard(h);
+    size_t total = sizeof(KvItem) + nkey + n + 2;
+    uint32_t now = now_s();
+    int64_t ttl = exptime;
+    if (exptime > kMaxRelative) ttl = exptime - (int64_t)std::time(nullptr);
+    bool past = exptime < 0 || (exptime > kMaxRelative && ttl <= 0);
+    uint32_t deadline = exptime == 0 || past ? 0 : (uint32_t)std::min<int64_t>(now + ttl, UINT32_MAX);
+
+    std::lock_guard<std::mutex> lock(s.mtx);
+    // the old value goes whatever happens to the new one
+    size_t i = find_slot(s, h, key, nkey);
+    if (i != SIZE_MAX) unlink(s, s.table[i].item);
+    if (total > kPageSize) return TooLarge;
+    if (past) return Stored;
+
+    size_t cls = (size_t)(std::lower_bound(class_sizes_.begin(), class_sizes_.end(), total) - class_sizes_.begin());
+    KvItem *it = alloc(s, cls);
+    if (!it) return NoMemory;
+    it->hash = h;
+    it->deadline = deadline;
+    it->flags = flags;
+    it->nbytes = (uint32_t)n;
+    it->nkey = (uint8_t)nkey;
+    it->cls = (uint8_t)cls;
+    it->ref = 0;
+    it->live = 1;
+    std::memcpy(it->key(), key, nkey);
+    src.copy_out(offset, it->value(), n);
+    std::memcpy(it->value() + n, "\r\n", 2);
+    insert(s, it);
+    if (deadline) wheel_link(s, it);
+    return Stored;
+}
+
+bool KvStore::remove(const char *key, size_t nkey) {
+    uint64_t h = hash(key, nkey);
+    Shard &s = shard(h);
+    std::lock_guard<std::mutex> lock(s.mtx);
+    KvItem *it = find(s, h, key, nkey);
+    if (!it) return false;
+    unlink(s, it);
+    return true;
+}
+
+void KvStore::expire() {
+    uint32_t now = now_s();
+    if (expired_at_.exchange(now, std::memory_order_relaxed) == now) return;
+    for (Shard *s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mtx);
+        advance(*s, now);
+    }
+}
+
+size_t KvStore::items() const {
+    size_t n = 0;
+    for (Shard *s : shards_) {
+        std::lock_guard<std::mutex> lock(s->mtx);
+        n += s->count;
+    }
+    return n;
+}
+
+KvItem *KvStore::find(Shard &s, uint64_t h, const char *key, size_t nkey) {
+    size_t i = find_slot(s, h, key, nkey);
+    if (i == SIZE_MAX) return nullptr;
+    KvItem *it = s.table[i].item;
+    if (it->deadline && it->deadline <= now_s()) {
+        // due, but its wheel slot has not come round yet
+        unlink(s, it);
+        Metrics::add(Counter::KvExpired);
+        return nullptr;
+    }
+    return it;
+}
+
+size_t KvStore::find_slot(Shard &s, uint64_t h, const char *key, size_t nkey) const {
+    if (s.table.empty()) return SIZE_MAX;
+    size_t mask = s.table.size() - 1;
+    for (size_t i = h & mask; s.table[i].item; i = (i + 1) & mask) {
+        KvItem *it = s.table[i].item;
+        if (s.table[i].hash == h && it->nkey == nkey && std::memcmp(it->key(), key, nkey) == 0) return i;
+    }
+    return SIZE_MAX;
+}
+
+void KvStore::insert(Shard &s, KvItem *it) {
+    // load factor at most 3/4
+    if ((s.count + 1) * 4 > s.table.size() * 3) grow(s);
+    size_t mask = s.table.size() - 1;
+    size_t i = it->hash & mask;
+    while (s.table[i].item) i = (i + 1) & mask;
+    s.table[i].hash = it->hash;
+    s.table[i].item = it;
+    ++s.count;
+}
+
+void KvStore::erase_slot(Shard &s, size_t i) {
+    // backward-shift deletion: pull later entries of the probe run into the
+    // hole unless that would move them before their home slot
+    size_t mask = s.table.size() - 1;
+    for (size_t j = (i + 1) & mask; s.table[j].item; j = (j + 1) & mask) {
+        size_t home = s.table[j].hash & mask;
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            s.table[i] = s.table[j];
+            i = j;
+        }
+    }
+    s.table[i].item = nullptr;
+    --s.count;
+}
+
+void KvStore::unlink(Shard &s, KvItem *it) {
+    erase_slot(s, find_slot(s, it->hash, it->key(), it->nkey));
+    if (it->deadline) wheel_unlink(s, it);
+    free_chunk(s, it);
+}
+
+void KvStore::grow(Shard &s) {
+    std::vector<Slot> old;
+    old.swap(s.table);
+    s.table.assign(std::max(kMinTable, old.size() * 2), Slot{0, nullptr});
+    s.count = 0;
+    for (const Slot &slot : old) {
+        if (slot.item) insert(s, slot.item);
+    }
+}
+
+KvItem *KvStore::alloc(Shard &s, size_t cls) {
+    SlabClass &c = s.classes[cls];
+    if (!c.free && !add_page(c) && !evict(s, c) && !reassign(s, c)) return nullptr;
+    KvItem *it = c.free;
+    c.free = it->next;
+    return it;
+}
+
+bool KvStore::add_page(SlabClass &c) {
+    if (pages_.fetch_add(1, std::memory_order_relaxed) >= max_pages_) {
+        pages_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    char *page = static_cast<char *>(std::malloc(kPageSize));
+    if (!page) {
+        pages_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    carve(c, page);
+    return true;
+}
+
+void KvStore::carve(SlabClass &c, char *page) {
+    c.pages.push_back(page);
+    // pushed back to front so chunks are handed out in address order
+    for (size_t i = c.per_page; i-- > 0;) {
+        KvItem *it = reinterpret_cast<KvItem *>(page + i * c.size);
+        it->live = 0;
+        it->next = c.free;
+        c.free = it;
+    }
+}
+
+KvItem *KvStore::evict(Shard &s, SlabClass &c) {
+    size_t chunks = c.pages.size() * c.per_page;
+    // two turns: the first may only clear reference bits
+    for (size_t step = 0; step < 2 * chunks; ++step) {
+        size_t i = c.hand;
+        c.hand = (c.hand + 1) % chunks;
+        KvItem *it = reinterpret_cast<KvItem *>(c.pages[i / c.per_page] + (i % c.per_page) * c.size);
+        if (!it->live) continue;
+        bool expired = it->deadline && it->deadline <= now_s();
+        if (it->ref && !expired) {
+            it->ref = 0;
+            continue;
+        }
+        Metrics::add(expired ? Counter::KvExpired : Counter::KvEvictions);
+        unlink(s, it);
+        return it;
+    }
+    return nullptr;
+}
+
+bool KvStore::reassign(Shard &s, SlabClass &c) {
+    // c has no page at all: take the last page of the class holding the most
+    SlabClass *victim = nullptr;
+    for (SlabClass &v : s.classes) {
+        if (&v != &c && !v.pages.empty() && (!victim || v.pages.size() > victim->pages.size())) victim = &v;
+    }
+    if (!victim) return false;
+    char *page = victim->pages.back();
+    char *end = page + victim->per_page * victim->size;
+    for (char *p = page; p < end; p += victim->size) {
+        KvItem *it = reinterpret_cast<KvItem *>(p);
+        if (!it->live) continue;
+        Metrics::add(Counter::KvEvictions);
+        unlink(s, it);
+    }
+    // drop the page's chunks from the victim's free list
+    for (KvItem **link = &victim->free; *link;) {
+        char *p = reinterpret_cast<char *>(*link);
+        if (p >= page && p < end) {
+            *link = (*link)->next;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    victim->pages.pop_back();
+    victim->hand = 0;
+    carve(c, page);
+    return true;
+}
+
+void KvStore::free_chunk(Shard &s, KvItem *it) {
+    SlabClass &c = s.classes[it->cls];
+    it->live = 0;
+    it->next = c.free;
+    c.free = it;
+}
+
+void KvStore::wheel_link(Shard &s, KvItem *it) {
+    KvItem *&head = s.wheel[it->deadline % kWheelSlots];
+    it->prev = nullptr;
+    it->next = head;
+    if (head) head->prev = it;
+    head = it;
+}
+
+void KvStore::wheel_unlink(Shard &s, KvItem *it) {
+    if (it->prev) {
+        it->prev->next = it->next;
+    } else {
+        s.wheel[it->deadline % kWheelSlots] = it->next;
+    }
+    if (it->next) it->next->prev = it->prev;
+}
+
+void KvStore::advance(Shard &s, uint32_t now) {
+    // after a gap longer than a turn every slot is due once
+    uint32_t from = now - s.wheel_now > kWheelSlots ? now - (uint32_t)kWheelSlots : s.wheel_now;
+    for (uint32_t t = from + 1; t <= now; ++t) {
+        KvItem *it = s.wheel[t % kWheelSlots];
+        while (it) {
+            KvItem *next = it->next;
+            // later turns stay linked
+            if (it->deadline <= now) {
+                unlink(s, it);
+                Metrics::add(Counter::KvExpired);
+            }
+            it = next;
+        }
+    }
+    s.wheel_now = now;
+}
@@ -1,15 +1,79 @@
 #include "../include/Logger.h"
-#include <iostream>
-#include <ctime>
+#include "../include/Aligned.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <time.h>
+
+namespace {
+
+const size_t kRingSize = 1 << 16;   // per-thread ring, power of two
+const size_t kMaxLine = 4096;       // longer messages are truncated
+const uint32_t kPadFlag = 0x80000000u;
+
+// fixed header in front of every message in a ring
+struct RecordHeader {
+    uint32_t size;  // header + message, rounded to 8; kPadFlag marks a wrap filler
+    int32_t level;
+    int64_t sec;
+    uint32_t len;
+    uint32_t reserved;
+};
+
+size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+const char *level_name(int lvl) {
+    switch (lvl) {
+        case Logger::DEBUG: return "DEBUG";
+        case Logger::INFO: return "INFO";
+        case Logger::WARN: return "WARN";
+        case Logger::ERROR: return "ERROR";
+    }
+    return "INFO";
+}
+
+} // namespace
+
+// single-producer / single-consumer byte ring owned by one logging thread;
+// heap-allocated cache-aligned so head and tail really get a line each
+struct Logger::Ring : CacheAligned {
+    alignas(64) std::atomic<uint64_t> head{0}; // bytes published by the producer
+    alignas(64) std::atomic<uint64_t> tail{0}; // bytes consumed by the flusher
+    std::atomic<bool> orphaned{false};         // owning thread has exited
+    char data[kRingSize];
+};
+
+namespace {
+
+struct RingHolder {
+    Logger::Ring *ring{nullptr};
+    ~RingHolder() {
+        if (ring) ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+thread_local RingHolder tls_ring;
+
+} // namespace
 
 Logger &Logger::instance() {
     static Logger lg;
     return lg;
 }
 
-Logger::Logger() {}
+Logger::Logger()
+    : level_(INFO), policy_(DROP), to_stdout_(true), dropped_(0), running_(true) {
+    flusher_ = std::thread(&Logger::flusher_loop, this);
+}
 
 Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        running_ = false;
+    }
+    wake_cv_.notify_one();
+    if (flusher_.joinable()) flusher_.join();
+    for (Ring *r : rings_) delete r;
     if (ofs_.is_open()) ofs_.close();
 }
 
@@ -20,27 +84,186 @@ void Logger::init(const std::string &path) {
     to_file_ = ofs_.is_open();
 }
 
-void Logger::log(Level lvl, const std::string &msg) {
-    std::lock_guard<std::mutex> lk(mtx_);
-    const char *lvl_s = "INFO";
-    switch (lvl) {
-        case DEBUG: lvl_s = "DEBUG"; break;
-        case INFO: lvl_s = "INFO"; break;
-        case WARN: lvl_s = "WARN"; break;
-        case ERROR: lvl_s = "ERROR"; break;
+bool Logger::parse_level(const std::string &name, Level &out) {
+    static const char *names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; ++i) {
+        if (name == names[i]) {
+            out = (Level)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+Logger::Ring *Logger::thread_ring() {
+    Ring *r = tls_ring.ring;
+    if (r) return r;
+    r = new Ring();
+    {
+        std::lock_guard<std::mutex> lk(rings_mtx_);
+        rings_.push_back(r);
+    }
+    tls_ring.ring = r;
+    return r;
+}
+
+void Logger::wake_flusher() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        wake_pending_ = true;
+    }
+    wake_cv_.notify_one();
+}
+
+void Logger::log(Level lvl, const char *msg, size_t len) {
+    if (!enabled(lvl)) return;
+    if (len > kMaxLine) len = kMaxLine;
+
+    // coarse clock: a vDSO read, the flusher only prints seconds
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+    Ring *r = thread_ring();
+    size_t need = align8(sizeof(RecordHeader) + len);
+    while (true) {
+        uint64_t h = r->head.load(std::memory_order_relaxed);
+        uint64_t t = r->tail.load(std::memory_order_acquire);
+        size_t pos = h & (kRingSize - 1);
+        size_t contiguous = kRingSize - pos;
+        // records never wrap; a filler covers the unused end of the ring
+        size_t total = contiguous < need ? contiguous + need : need;
+
+        if (kRingSize - (h - t) >= total) {
+            if (total != need) {
+                uint32_t pad = (uint32_t)contiguous | kPadFlag;
+                std::memcpy(r->data + pos, &pad, sizeof(pad));
+                pos = 0;
+            }
+            RecordHeader hdr{(uint32_t)need, (int32_t)lvl, (int64_t)ts.tv_sec, (uint32_t)len, 0};
+            std::memcpy(r->data + pos, &hdr, sizeof(hdr));
+            std::memcpy(r->data + pos + sizeof(hdr), msg, len);
+            r->head.store(h + total, std::memory_order_release);
+
+            // nudge the flusher once the ring passes half full
+            uint64_t before = h - t, after = h + total - t;
+            if (before < kRingSize / 2 && after >= kRingSize / 2) wake_flusher();
+            return;
+        }
+
+        if (policy_.load(std::memory_order_relaxed) == DROP) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wake_flusher();
+        std::this_thread::yield();
+    }
+}
+
+void Logger::flush() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    uint64_t req = ++flush_requested_;
+    wake_cv_.notify_one();
+    flushed_cv_.wait(lk, [this, req]() { return flush_done_ >= req || !running_; });
+}
+
+void Logger::format(int lvl, int64_t sec, const char *msg, size_t len) {
+    if (sec != cached_sec_) {
+        std::time_t t = (std::time_t)sec;
+        std::tm tm;
+        localtime_r(&t, &tm);
+        std::strftime(cached_time_, sizeof(cached_time_), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec_ = sec;
+    }
+    out_ += '[';
+    out_ += cached_time_;
+    out_ += "] [";
+    out_ += level_name(lvl);
+    out_ += "] ";
+    out_.append(msg, len);
+    out_ += '\n';
+}
+
+bool Logger::drain() {
+    std::vector<Ring *> rings;
+    {
+        std::lock_guard<std::mutex> lk(rings_mtx_);
+        rings = rings_;
+    }
+
+    bool any = false;
+    for (Ring *r : rings) {
+        // read orphaned first: after it is set the producer writes nothing more
+        bool orphaned = r->orphaned.load(std::memory_order_acquire);
+        uint64_t h = r->head.load(std::memory_order_acquire);
+        uint64_t t = r->tail.load(std::memory_order_relaxed);
+        while (t != h) {
+            size_t pos = t & (kRingSize - 1);
+            uint32_t size;
+            std::memcpy(&size, r->data + pos, sizeof(size));
+            if (size & kPadFlag) {
+                t += size & ~kPadFlag;
+                continue;
+            }
+            RecordHeader hdr;
+            std::memcpy(&hdr, r->data + pos, sizeof(hdr));
+            format(hdr.level, hdr.sec, r->data + pos + sizeof(hdr), hdr.len);
+            t += hdr.size;
+            any = true;
+        }
+        r->tail.store(t, std::memory_order_release);
+
+        if (orphaned) {
+            std::lock_guard<std::mutex> lk(rings_mtx_);
+            for (size_t i = 0; i < rings_.size(); ++i) {
+                if (rings_[i] == r) {
+                    rings_.erase(rings_.begin() + i);
+                    break;
+                }
+            }
+            delete r;
+        }
     }
+    return any;
+}
 
-    std::time_t t = std::time(nullptr);
-    char timebuf[64];
-    std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+void Logger::write_out() {
+    if (out_.empty()) return;
+    if (to_stdout_.load(std::memory_order_relaxed)) {
+        std::fwrite(out_.data(), 1, out_.size(), stdout);
+        std::fflush(stdout);
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (to_file_) {
+            ofs_.write(out_.data(), (std::streamsize)out_.size());
+            ofs_.flush();
+        }
+    }
+    out_.clear();
+}
 
-    std::string out = std::string("[") + timebuf + "] [" + lvl_s + "] " + msg + "\n";
+void Logger::flusher_loop() {
+    while (true) {
+        uint64_t req;
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            // batch whatever accumulates over a few milliseconds
+            wake_cv_.wait_for(lk, std::chrono::milliseconds(5), [this]() {
+                return wake_pending_ || flush_requested_ != flush_done_ || !running_;
+            });
+            wake_pending_ = false;
+            req = flush_requested_;
+            stopping = !running_;
+        }
 
-    // always echo to stdout as well
-    std::fwrite(out.data(), 1, out.size(), stdout);
+        while (drain()) write_out();
 
-    if (to_file_) {
-        ofs_ << out;
-        ofs_.flush();
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            flush_done_ = req;
+        }
+        flushed_cv_.notify_all();
+        if (stopping) return;
     }
 }
@@ -0,0 +1,250 @@
+#include "../include/Memcache.h"
+#include "../include/Buffer.h"
+#include "../include/KvStore.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+
+// parse result of the frame being handled, see MemcacheCodec::decode
+thread_local MemcacheRequest tls_request;
+// command lines that straddle two chunks
+thread_local std::string tls_line;
+
+typedef MemcacheRequest::Key Token;
+
+bool is(const Token &t, const char *s) {
+    size_t n = std::strlen(s);
+    return t.size == n && std::memcmp(t.data, s, n) == 0;
+}
+
+// decimal digits only, at most max
+bool parse_uint(const Token &t, uint64_t max, uint64_t &out) {
+    if (t.size == 0 || t.size > 20) return false;
+    uint64_t v = 0;
+    for (size_t i = 0; i < t.size; ++i) {
+        char c = t.data[i];
+        if (c < '0' || c > '9') return false;
+        uint64_t d = (uint64_t)(c - '0');
+        if (v > (max - d) / 10) return false;
+        v = v * 10 + d;
+    }
+    out = v;
+    return true;
+}
+
+bool parse_int(const Token &t, int64_t &out) {
+    bool neg = t.size > 0 && t.data[0] == '-';
+    uint64_t v;
+    if (!parse_uint(Token{t.data + neg, t.size - neg}, INT64_MAX, v)) return false;
+    out = neg ? -(int64_t)v : (int64_t)v;
+    return true;
+}
+
+bool valid_key(const Token &t) {
+    return t.size > 0 && t.size <= KvStore::kMaxKey;
+}
+
+} // namespace
+
+const size_t MemcacheCodec::kMaxLine;
+const size_t MemcacheCodec::kMaxData;
+
+bool memcache_parse(const char *line, size_t len, MemcacheRequest &req, size_t &bytes) {
+    if (len > 0 && line[len - 1] == '\r') --len;
+    req.keys.clear();
+    req.flags = 0;
+    req.exptime = 0;
+    req.noreply = false;
+    req.error = nullptr;
+    bytes = 0;
+
+    // every token after the command goes to keys first and is sorted out
+    // once the command is known
+    Token cmd{nullptr, 0};
+    for (size_t i = 0; i < len;) {
+        while (i < len && line[i] == ' ') ++i;
+        size_t start = i;
+        while (i < len && line[i] != ' ') ++i;
+        if (i == start) break;
+        Token t{line + start, i - start};
+        if (!cmd.data) {
+            cmd = t;
+        } else {
+            req.keys.push_back(t);
+        }
+    }
+    std::vector<Token> &args = req.keys;
+    req.cmd = MemcacheRequest::Unknown;
+    if (!cmd.data) return false;
+
+    if (is(cmd, "get")) {
+        if (args.empty()) return false;
+        req.cmd = MemcacheRequest::Get;
+        for (const Token &k : args) {
+            if (!valid_key(k)) {
+                req.cmd = MemcacheRequest::Malformed;
+                req.error = "bad command line format";
+            }
+        }
+        return false;
+    }
+    if (is(cmd, "set")) {
+        uint64_t flags, n;
+        if (args.size() < 4 || args.size() > 5 || !parse_uint(args[3], UINT32_MAX, n)) {
+            // no size to skip the data block by
+            req.cmd = MemcacheRequest::Invalid;
+            req.error = "bad command line format";
+            return false;
+        }
+        bytes = (size_t)n;
+        req.noreply = args.size() == 5 && is(args[4], "noreply");
+        if (!valid_key(args[0]) || !parse_uint(args[1], UINT32_MAX, flags) || !parse_int(args[2], req.exptime) ||
+            (args.size() == 5 && !req.noreply)) {
+            req.cmd = MemcacheRequest::Malformed;
+            req.error = "bad command line format";
+            return true;
+        }
+        req.cmd = MemcacheRequest::Set;
+        req.flags = (uint32_t)flags;
+        args.resize(1);
+        return true;
+    }
+    if (is(cmd, "delete")) {
+        req.noreply = args.size() == 2 && is(args[1], "noreply");
+        if (args.empty() || args.size() > 2 || !valid_key(args[0]) || (args.size() == 2 && !req.noreply)) {
+            req.cmd = MemcacheRequest::Malformed;
+            req.error = "bad command line format.  Usage: delete <key> [noreply]";
+            return false;
+        }
+        req.cmd = MemcacheRequest::Delete;
+        args.resize(1);
+        return false;
+    }
+    if (is(cmd, "version") && args.empty()) {
+        req.cmd = MemcacheRequest::Version;
+    } else if (is(cmd, "quit") && args.empty()) {
+        req.cmd = MemcacheRequest::Quit;
+    }
+    return false;
+}
+
+ssize_t MemcacheCodec::decode(const Buffer &in, size_t &scan, Frame &frame) const {
+    MemcacheRequest &req = tls_request;
+    ssize_t nl;
+    if (scan & kScanPending) {
+        // the line was parsed by an earlier call; only the data block was missing
+        if (in.size() < pending_wire(scan)) return 0;
+        nl = (ssize_t)pending_head(scan);
+    } else {
+        // bytes before `scan` were searched by an earlier call
+        nl = in.find('\n', scan);
+    }
+    const char *error = nullptr;
+    if (nl < 0) {
+        scan = in.size();
+        if (scan <= kMaxLine) return 0;
+        error = "line too long";
+    } else if ((size_t)nl > kMaxLine) {
+        error = "line too long";
+    }
+
+    size_t wire = (size_t)nl + 1;
+    if (!error) {
+        const char *line = in.contiguous(0, (size_t)nl);
+        if (!line) {
+            tls_line.resize((size_t)nl);
+            in.copy_out(0, &tls_line[0], (size_t)nl);
+            line = tls_line.data();
+        }
+        size_t bytes;
+        bool block = memcache_parse(line, (size_t)nl, req, bytes);
+        if (req.cmd == MemcacheRequest::Invalid) {
+            error = req.error;
+        } else if (block && bytes > kMaxData) {
+            error = "object too large";
+        } else if (block) {
+            if (in.size() < wire + bytes + 2) {
+                // wait for the data block, checking only its size until it
+                // is complete; the line is then parsed once more for its keys
+                scan = scan_pending((size_t)nl, wire + bytes + 2);
+                return 0;
+            }
+            char end[2];
+            in.copy_out(wire + bytes, end, 2);
+            if (end[0] != '\r' || end[1] != '\n') error = "bad data chunk";
+            frame.offset = wire;
+            frame.size = bytes;
+            wire += bytes + 2;
+        }
+    }
+    if (error) {
+        // a frame that only tells the handler to refuse and close
+        req.cmd = MemcacheRequest::Invalid;
+        req.error = error;
+        frame.offset = 0;
+        frame.size = 0;
+        frame.data = "";
+        wire = in.size();
+    }
+    frame.meta = &req;
+    return (ssize_t)wire;
+}
+
+void MemcacheHandler::on_frame(const Frame &frame, Reply<MemcacheCodec> &reply) {
+    const MemcacheRequest &req = *static_cast<const MemcacheRequest *>(frame.meta);
+    switch (req.cmd) {
+        case MemcacheRequest::Get:
+            for (const MemcacheRequest::Key &k : req.keys) {
+                store_.get(k.data, k.size, [&](uint32_t flags, const char *value, size_t n) {
+                    char head[KvStore::kMaxKey + 48];
+                    std::memcpy(head, "VALUE ", 6);
+                    std::memcpy(head + 6, k.data, k.size);
+                    int len = std::snprintf(head + 6 + k.size, sizeof(head) - 6 - k.size, " %u %zu\r\n", flags, n);
+                    reply.write(head, 6 + k.size + (size_t)len);
+                    reply.write(value, n + 2);
+                });
+            }
+            reply.write("END\r\n", 5);
+            break;
+        case MemcacheRequest::Set: {
+            // straight from the input chunks into the item
+            KvStore::Result r = store_.set(req.keys[0].data, req.keys[0].size, req.flags, req.exptime,
+                                           *frame.source, frame.offset, frame.size);
+            if (req.noreply) break;
+            if (r == KvStore::Stored) {
+                reply.write("STORED\r\n", 8);
+            } else if (r == KvStore::TooLarge) {
+                reply.write(std::string("SERVER_ERROR object too large for cache\r\n"));
+            } else {
+                reply.write(std::string("SERVER_ERROR out of memory storing object\r\n"));
+            }
+            break;
+        }
+        case MemcacheRequest::Delete: {
+            bool found = store_.remove(req.keys[0].data, req.keys[0].size);
+            if (req.noreply) break;
+            if (found) {
+                reply.write("DELETED\r\n", 9);
+            } else {
+                reply.write("NOT_FOUND\r\n", 11);
+            }
+            break;
+        }
+        case MemcacheRequest::Version:
+            reply.write(std::string("VERSION 1.6.0\r\n"));
+            break;
+        case MemcacheRequest::Quit:
+            reply.close_after();
+            break;
+        case MemcacheRequest::Unknown:
+            reply.write("ERROR\r\n", 7);
+            break;
+        case MemcacheRequest::Malformed:
+        case MemcacheRequest::Invalid:
+            reply.write("CLIENT_ERROR " + std::string(req.error) + "\r\n");
+            if (req.cmd == MemcacheRequest::Invalid) reply.close_after();
+            break;
+    }
+}
@@ -0,0 +1,290 @@
+#include "../include/Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <time.h>
+
+const int Histogram::kSubBits;
+const int Histogram::kSubBuckets;
+const int Histogram::kMaxShift;
+const int Histogram::kBuckets;
+
+namespace {
+
+struct CounterInfo {
+    const char *name;
+    const char *help;
+};
+
+const CounterInfo kCounterInfo[kNumCounters] = {
+    {"accepts", "Connections accepted."},
+    {"bytes_in", "Bytes read from clients."},
+    {"bytes_out", "Bytes written to clients."},
+    {"events", "Readiness events and completions handled."},
+    {"closes", "Connections closed."},
+    {"timeouts", "Connections shut down by a read, write or keep-alive timeout."},
+    {"file_bytes", "Bytes sent from static files with sendfile or splice."},
+    {"file_cache_hits", "Static file lookups answered from the open-file cache."},
+    {"file_cache_misses", "Static file lookups that had to open and stat the file."},
+    {"shed", "Connections reset right after accept by admission control."},
+    {"accept_pauses", "Times a loop stopped accepting and left connections in the listen backlog."},
+    {"read_yields", "Times a connection used up its read budget and yielded to other ready connections."},
+    {"starved", "Ready connections that waited longer than the starvation threshold to be served."},
+    {"kv_hits", "Key-value lookups that found the key."},
+    {"kv_misses", "Key-value lookups that did not find the key."},
+    {"kv_evictions", "Key-value items evicted by CLOCK to make room for new ones."},
+    {"kv_expired", "Key-value items dropped because their TTL ran out."},
+    {"udp_datagrams_in", "UDP datagrams received."},
+    {"udp_datagrams_out", "UDP datagrams sent."},
+    {"udp_drops", "UDP datagrams dropped: truncated on receive, replies over 64 KiB or failed sends."},
+    {"connection_bytes_allocated", "Bytes of per-connection state allocated: connection and table slots, I/O state."},
+    {"connection_bytes_freed", "Bytes of per-connection state given back on close or when a connection went idle."},
+    {"upstream_connects", "Proxy connections opened to an upstream for a client."},
+    {"upstream_pool_hits", "Proxy clients relayed over an upstream connection the pool had open already."},
+    {"upstream_failures", "Proxy connects to an upstream and health checks that failed."},
+    {"proxy_refused", "Proxy clients reset because no upstream was healthy."},
+};
+
+const CounterInfo kHistInfo[kNumHists] = {
+    {"pool_queue", "Time tasks waited in the worker pool before running."},
+    {"handler", "Time spent decoding and handling the input of one read."},
+};
+
+const double kQuantiles[] = {50, 90, 99, 99.9};
+
+// single-writer increment: no locked instruction
+inline void bump(std::atomic<uint64_t> &a, uint64_t n) {
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void init_snapshot(Metrics::Snapshot &s) {
+    for (int i = 0; i < kNumCounters; ++i) s.counters[i] = 0;
+    for (int i = 0; i < kNumHists; ++i) {
+        s.hists[i] = HistogramSnapshot();
+        s.hists[i].buckets.assign(Histogram::kBuckets, 0);
+    }
+}
+
+// gauges derived from counter pairs; the pair is summed from different
+// threads' slots, so a snapshot may briefly see a close before its accept
+uint64_t connections_open(const Metrics::Snapshot &s) {
+    uint64_t accepts = s.counters[(int)Counter::Accepts];
+    return accepts - std::min(accepts, s.counters[(int)Counter::Closes]);
+}
+
+uint64_t connection_bytes(const Metrics::Snapshot &s) {
+    uint64_t allocated = s.counters[(int)Counter::ConnBytesAllocated];
+    return allocated - std::min(allocated, s.counters[(int)Counter::ConnBytesFreed]);
+}
+
+std::string fmt(const char *f, double v) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), f, v);
+    return buf;
+}
+
+} // namespace
+
+// cache-line aligned so no two threads' counters share a line
+struct alignas(64) Metrics::Slot {
+    std::atomic<uint64_t> counters[kNumCounters];
+    Histogram hists[kNumHists];
+
+    Slot() {
+        for (auto &c : counters) c.store(0, std::memory_order_relaxed);
+    }
+};
+
+// registers the calling thread's slot on first use and retires it at exit
+struct SlotHandle {
+    Metrics::Slot slot;
+    SlotHandle() { Metrics::instance().attach(&slot); }
+    ~SlotHandle() { Metrics::instance().detach(&slot); }
+};
+
+static thread_local SlotHandle tls_slot;
+
+Histogram::Histogram() : count_(0), sum_(0), max_(0) {
+    for (auto &b : buckets_) b.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::bucket_of(uint64_t v) {
+    if (v < (uint64_t)(2 * kSubBuckets)) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - kSubBits; // >= 1: v >> shift lies in [kSubBuckets, 2 * kSubBuckets)
+    if (shift > kMaxShift) return kBuckets - 1;
+    return 2 * kSubBuckets + (shift - 1) * kSubBuckets + (int)((v >> shift) - kSubBuckets);
+}
+
+uint64_t Histogram::bucket_upper(int i) {
+    if (i < 2 * kSubBuckets) return (uint64_t)i;
+    int j = i - 2 * kSubBuckets;
+    int shift = j / kSubBuckets + 1;
+    uint64_t sub = (uint64_t)(j % kSubBuckets + kSubBuckets);
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t v) {
+    bump(buckets_[bucket_of(v)], 1);
+    bump(count_, 1);
+    bump(sum_, v);
+    if (v > max_.load(std::memory_order_relaxed)) max_.store(v, std::memory_order_relaxed);
+}
+
+void Histogram::merge_into(HistogramSnapshot &s) const {
+    if (s.buckets.size() != (size_t)kBuckets) s.buckets.resize(kBuckets, 0);
+    for (int i = 0; i < kBuckets; ++i) s.buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+    s.count += count_.load(std::memory_order_relaxed);
+    s.sum += sum_.load(std::memory_order_relaxed);
+    s.max = std::max(s.max, max_.load(std::memory_order_relaxed));
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const {
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)std::ceil(p / 100.0 * (double)count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) return std::min(Histogram::bucket_upper((int)i), max);
+    }
+    return max;
+}
+
+Metrics &Metrics::instance() {
+    static Metrics m;
+    return m;
+}
+
+void Metrics::add(Counter c, uint64_t n) {
+    bump(tls_slot.slot.counters[(int)c], n);
+}
+
+void Metrics::record(Hist h, uint64_t ns) {
+    tls_slot.slot.hists[(int)h].record(ns);
+}
+
+uint64_t Metrics::now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void Metrics::attach(Slot *s) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (retired_.hists[0].buckets.empty()) init_snapshot(retired_);
+    slots_.push_back(s);
+}
+
+void Metrics::detach(Slot *s) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    merge(*s, retired_);
+    slots_.erase(std::remove(slots_.begin(), slots_.end(), s), slots_.end());
+}
+
+void Metrics::merge(const Slot &s, Snapshot &out) {
+    for (int i = 0; i < kNumCounters; ++i) out.counters[i] += s.counters[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < kNumHists; ++i) s.hists[i].merge_into(out.hists[i]);
+}
+
+Metrics::Snapshot Metrics::snapshot() {
+    Snapshot out;
+    init_snapshot(out);
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!retired_.hists[0].buckets.empty()) {
+        for (int i = 0; i < kNumCounters; ++i) out.counters[i] += retired_.counters[i];
+        for (int i = 0; i < kNumHists; ++i) {
+            HistogramSnapshot &d = out.hists[i];
+            const HistogramSnapshot &r = retired_.hists[i];
+            for (int b = 0; b < Histogram::kBuckets; ++b) d.buckets[b] += r.buckets[b];
+            d.count += r.count;
+            d.sum += r.sum;
+            d.max = std::max(d.max, r.max);
+        }
+    }
+    for (Slot *s : slots_) merge(*s, out);
+    return out;
+}
+
+void Metrics::set_info(const std::string &name, const std::string &value) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto &kv : info_) {
+        if (kv.first == name) {
+            kv.second = value;
+            return;
+        }
+    }
+    info_.emplace_back(name, value);
+}
+
+std::string Metrics::render_text() {
+    Snapshot s = snapshot();
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto &kv : info_) out += kv.first + " " + kv.second + "\n";
+    }
+    for (int i = 0; i < kNumCounters; ++i) {
+        out += std::string(kCounterInfo[i].name) + " " + std::to_string(s.counters[i]) + "\n";
+    }
+    uint64_t open = connections_open(s);
+    out += "connections_open " + std::to_string(open) + "\n";
+    out += "connection_bytes " + std::to_string(connection_bytes(s)) + "\n";
+    out += "bytes_per_connection " + std::to_string(open ? connection_bytes(s) / open : 0) + "\n";
+    for (int i = 0; i < kNumHists; ++i) {
+        const HistogramSnapshot &h = s.hists[i];
+        out += std::string(kHistInfo[i].name) + "_us count=" + std::to_string(h.count);
+        out += " mean=" + fmt("%.3f", h.count ? (double)h.sum / h.count / 1000.0 : 0.0);
+        for (double q : kQuantiles) {
+            out += " p" + fmt("%g", q) + "=" + fmt("%.3f", h.percentile(q) / 1000.0);
+        }
+        out += " max=" + fmt("%.3f", h.max / 1000.0) + "\n";
+    }
+    return out;
+}
+
+std::string Metrics::render_prometheus() {
+    Snapshot s = snapshot();
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!info_.empty()) {
+            out += "# HELP hps_runtime_info Runtime profile and placement of the server.\n";
+            out += "# TYPE hps_runtime_info gauge\n";
+            out += "hps_runtime_info{";
+            for (size_t i = 0; i < info_.size(); ++i) {
+                out += (i ? "," : "") + info_[i].first + "=\"" + info_[i].second + "\"";
+            }
+            out += "} 1\n";
+        }
+    }
+    for (int i = 0; i < kNumCounters; ++i) {
+        std::string name = std::string("hps_") + kCounterInfo[i].name + "_total";
+        out += "# HELP " + name + " " + kCounterInfo[i].help + "\n";
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + std::to_string(s.counters[i]) + "\n";
+    }
+    uint64_t open = connections_open(s);
+    out += "# HELP hps_connections_open Connections accepted and not yet closed.\n";
+    out += "# TYPE hps_connections_open gauge\n";
+    out += "hps_connections_open " + std::to_string(open) + "\n";
+    out += "# HELP hps_connection_bytes Bytes of per-connection state held by open connections.\n";
+    out += "# TYPE hps_connection_bytes gauge\n";
+    out += "hps_connection_bytes " + std::to_string(connection_bytes(s)) + "\n";
+    out += "# HELP hps_bytes_per_connection Per-connection state divided by the open connections.\n";
+    out += "# TYPE hps_bytes_per_connection gauge\n";
+    out += "hps_bytes_per_connection " + std::to_string(open ? connection_bytes(s) / open : 0) + "\n";
+    for (int i = 0; i < kNumHists; ++i) {
+        const HistogramSnapshot &h = s.hists[i];
+        std::string name = std::string("hps_") + kHistInfo[i].name + "_seconds";
+        out += "# HELP " + name + " " + kHistInfo[i].help + "\n";
+        out += "# TYPE " + name + " summary\n";
+        for (double q : kQuantiles) {
+            out += name + "{quantile=\"" + fmt("%g", q / 100.0) + "\"} " +
+                   fmt("%.9f", h.percentile(q) / 1e9) + "\n";
+        }
+        out += name + "_sum " + fmt("%.9f", h.sum / 1e9) + "\n";
+        out += name + "_count " + std::to_string(h.count) + "\n";
+    }
+    return out;
+}
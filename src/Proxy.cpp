@@ -0,0 +1,474 @@
+#include "../include/Proxy.h"
+#include "../include/Connection.h"
+#include "../include/Epoch.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/Trace.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// the most one splice moves into a relay pipe: the default pipe capacity,
+// so a visit never blocks on a pipe it filled itself
+const size_t kSpliceChunk = 64 * 1024;
+
+// n bytes could be sent (or a banner is waiting): the upstream has not
+// closed a pooled connection
+bool alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// a non-blocking socket connecting to addr; connecting is set while the
+// handshake is in progress. -1 with errno set if the connect failed.
+int open_upstream(const sockaddr_storage &addr, socklen_t len, bool &connecting) {
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), len) == 0) {
+        connecting = false;
+        return fd;
+    }
+    if (errno == EINPROGRESS) {
+        connecting = true;
+        return fd;
+    }
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+// 0 once fd's connect finished, EINPROGRESS while it runs, else its error
+int connect_result(int fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) return errno;
+    if (err != 0) return err;
+    sockaddr_storage peer;
+    socklen_t plen = sizeof(peer);
+    if (getpeername(fd, reinterpret_cast<sockaddr *>(&peer), &plen) == 0) return 0;
+    return errno == ENOTCONN ? EINPROGRESS : errno;
+}
+
+// open_upstream, waiting up to ms for the handshake
+int connect_within(const sockaddr_storage &addr, socklen_t len, int ms) {
+    bool connecting = false;
+    int fd = open_upstream(addr, len, connecting);
+    if (fd == -1 || !connecting) return fd;
+    pollfd p{fd, POLLOUT, 0};
+    int err = poll(&p, 1, ms) == 1 ? connect_result(fd) : ETIMEDOUT;
+    if (err == 0) return fd;
+    close(fd);
+    errno = err == EINPROGRESS ? ETIMEDOUT : err;
+    return -1;
+}
+
+} // namespace
+
+UpstreamPool::~UpstreamPool() {
+    stop();
+    for (auto &u : upstreams_) {
+        for (int fd : u->idle) close(fd);
+    }
+}
+
+bool UpstreamPool::init(const std::string &list) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string spec = list.substr(start, end - start);
+        start = end + 1;
+        if (spec.empty()) continue;
+
+        // host:port, [v6addr]:port
+        size_t colon = spec.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == spec.size()) {
+            LOG_ERROR("Upstream " + spec + " is not host:port");
+            return false;
+        }
+        std::string host = spec.substr(0, colon);
+        std::string port = spec.substr(colon + 1);
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *res = nullptr;
+        int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+        if (rc != 0 || !res) {
+            LOG_ERROR("Cannot resolve upstream " + spec + ": " + gai_strerror(rc));
+            return false;
+        }
+        std::unique_ptr<Upstream> u(new Upstream());
+        u->name = spec;
+        std::memcpy(&u->addr, res->ai_addr, res->ai_addrlen);
+        u->addr_len = res->ai_addrlen;
+        freeaddrinfo(res);
+        upstreams_.push_back(std::move(u));
+    }
+    if (upstreams_.empty()) {
+        LOG_ERROR("--proxy names no upstream");
+        return false;
+    }
+    publish();
+    return true;
+}
+
+void UpstreamPool::start() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (running_) return;
+        running_ = true;
+    }
+    thread_ = std::thread(&UpstreamPool::check_loop, this);
+}
+
+void UpstreamPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+int UpstreamPool::pick() {
+    // least connections; the rotating start spreads ties
+    size_t n = upstreams_.size();
+    size_t first = next_.fetch_add(1, std::memory_order_relaxed) % n;
+    int best = -1;
+    int best_active = INT_MAX;
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = (first + k) % n;
+        Upstream &u = *upstreams_[i];
+        if (!u.healthy.load(std::memory_order_relaxed)) continue;
+        int active = u.active.load(std::memory_order_relaxed);
+        if (active < best_active) {
+            best = (int)i;
+            best_active = active;
+        }
+    }
+    return best;
+}
+
+int UpstreamPool::take(int i, bool &connecting) {
+    Upstream &u = *upstreams_[(size_t)i];
+    while (true) {
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(u.mtx);
+            if (u.idle.empty()) break;
+            fd = u.idle.back();
+            u.idle.pop_back();
+        }
+        if (alive(fd)) {
+            Metrics::add(Counter::UpstreamPoolHits);
+            u.active.fetch_add(1, std::memory_order_relaxed);
+            connecting = false;
+            return fd;
+        }
+        close(fd);
+    }
+
+    int fd = open_upstream(u.addr, u.addr_len, connecting);
+    if (fd == -1) {
+        // out of descriptors is not the upstream's fault
+        if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM) {
+            LOG_WARN("Connect to upstream " + u.name + " failed: " + std::strerror(errno));
+            failed(i);
+        }
+        return -1;
+    }
+    Metrics::add(Counter::UpstreamConnects);
+    u.active.fetch_add(1, std::memory_order_relaxed);
+    return fd;
+}
+
+void UpstreamPool::release(int i) {
+    upstreams_[(size_t)i]->active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void UpstreamPool::failed(int i) {
+    Metrics::add(Counter::UpstreamFailures);
+    set_healthy(*upstreams_[(size_t)i], false);
+}
+
+void UpstreamPool::check_loop() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (running_) {
+        lock.unlock();
+        for (auto &u : upstreams_) check(*u);
+        lock.lock();
+        cv_.wait_for(lock, std::chrono::milliseconds(check_ms_), [this]() { return !running_; });
+    }
+}
+
+void UpstreamPool::check(Upstream &u) {
+    // drop pooled connections the upstream closed meanwhile
+    std::vector<int> idle;
+    {
+        std::lock_guard<std::mutex> lock(u.mtx);
+        idle.swap(u.idle);
+    }
+    idle.erase(std::remove_if(idle.begin(), idle.end(),
+                              [](int fd) {
+                                  if (alive(fd)) return false;
+                                  close(fd);
+                                  return true;
+                              }),
+               idle.end());
+
+    // the check itself: a fresh connect that completes within the
+    // interval. Its socket, and those that top the pool up, wait there for
+    // clients.
+    int fd = connect_within(u.addr, u.addr_len, check_ms_);
+    if (fd == -1) {
+        if (u.healthy.load(std::memory_order_relaxed)) {
+            LOG_WARN("Health check of upstream " + u.name + " failed: " + std::strerror(errno));
+            Metrics::add(Counter::UpstreamFailures);
+        }
+        set_healthy(u, false);
+        for (int c : idle) close(c);
+        return;
+    }
+    set_healthy(u, true);
+    idle.push_back(fd);
+    while (idle.size() < pool_size_ && (fd = connect_within(u.addr, u.addr_len, check_ms_)) != -1) {
+        idle.push_back(fd);
+    }
+    if (idle.size() > pool_size_) {
+        close(idle.back());
+        idle.pop_back();
+    }
+    std::lock_guard<std::mutex> lock(u.mtx);
+    u.idle.insert(u.idle.end(), idle.begin(), idle.end());
+}
+
+void UpstreamPool::set_healthy(Upstream &u, bool healthy) {
+    if (u.healthy.exchange(healthy) == healthy) return;
+    if (healthy) {
+        LOG_INFO("Upstream " + u.name + " is up");
+    } else {
+        LOG_WARN("Upstream " + u.name + " is down, skipped until a health check succeeds");
+    }
+    publish();
+}
+
+void UpstreamPool::publish() {
+    std::string state;
+    for (auto &u : upstreams_) {
+        if (!state.empty()) state += ",";
+        state += u->name + (u->healthy.load(std::memory_order_relaxed) ? "=up" : "=down");
+    }
+    Metrics::instance().set_info("upstreams", state);
+}
+
+bool ProxyReactorBase::on_accepted(Connection *conn) {
+    conn->relay = new Relay();
+    Metrics::add(Counter::ConnBytesAllocated, sizeof(Relay));
+    if (connect_upstream(conn)) return true;
+    // no upstream to relay to: the client sees a reset, not an empty reply.
+    // An upstream taken before its registration failed is given back here,
+    // as close_pair never sees this connection
+    Relay &r = *conn->relay;
+    if (r.upstream != -1) {
+        upstreams_.release(r.upstream);
+        r.upstream = -1;
+    }
+    Metrics::add(Counter::ProxyRefused);
+    LOG_INFO(std::string("[Reactor ") + std::to_string(id_) + "] No upstream for fd=" + std::to_string(conn->fd));
+    return false;
+}
+
+void ProxyReactorBase::on_timeout(uint64_t token, TimerKind kind) {
+    ReactorBase::on_timeout(token, kind);
+    // draining, an idle client only stops sending: the upstream's reply
+    // still goes out and its close ends the pair
+    if (kind == TimerKind::KeepAlive && draining_.load(std::memory_order_relaxed)) return;
+    EpochGuard guard;
+    Connection *conn = conns_.find(token);
+    // the upstream fd keeps its number for the life of the pair
+    if (conn && conn->relay && conn->relay->upstream_fd >= 0) shutdown(conn->relay->upstream_fd, SHUT_RDWR);
+}
+
+bool ProxyReactorBase::connect_upstream(Connection *conn) {
+    Relay &r = *conn->relay;
+    while (true) {
+        int i = upstreams_.pick();
+        if (i < 0) return false;
+        bool connecting = false;
+        int fd = upstreams_.take(i, connecting);
+        if (fd == -1) {
+            // a failed upstream is now skipped by pick(); anything else
+            // (out of descriptors) would fail for the next one too
+            if (upstreams_.healthy(i)) return false;
+            continue;
+        }
+        if (r.upstream_fd == -1) {
+            r.upstream_fd = fd;
+        } else {
+            // another try: the new socket takes the old one's fd number, so
+            // the loop thread's timer never shuts down a recycled fd
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, r.upstream_fd, nullptr);
+            int ok = dup3(fd, r.upstream_fd, O_CLOEXEC);
+            close(fd);
+            if (ok == -1) {
+                upstreams_.release(i);
+                return false;
+            }
+        }
+        r.upstream = i;
+        r.connecting = connecting;
+
+        epoll_event ev;
+        // pooled: armed for what the first visit needs, re-armed after it
+        if (pooled_) {
+            ev.events = (connecting ? EPOLLOUT : EPOLLIN) | EPOLLET | EPOLLONESHOT;
+        } else {
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        }
+        ev.data.u64 = conn->token | kUpstreamBit;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, r.upstream_fd, &ev) == 0;
+    }
+}
+
+bool ProxyReactorBase::finish_connect(Connection *conn) {
+    Relay &r = *conn->relay;
+    int err = connect_result(r.upstream_fd);
+    if (err == EINPROGRESS) return true;
+    if (err == 0) {
+        r.connecting = false;
+        return true;
+    }
+    // nothing was read from the client yet: try the next upstream
+    LOG_WARN("Connect to upstream " + upstreams_.name(r.upstream) + " failed: " + std::strerror(err));
+    upstreams_.failed(r.upstream);
+    upstreams_.release(r.upstream);
+    r.upstream = -1;
+    return connect_upstream(conn);
+}
+
+bool ProxyReactorBase::pump(int src, int dst, Relay::Direction &d, size_t &budget, size_t &read, size_t &written) {
+    while (true) {
+        if (d.pending > 0) {
+            ssize_t w = splice(d.pipe_fds[0], nullptr, dst, nullptr, d.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                // the destination is full: its EPOLLOUT resumes, the source
+                // stays unread meanwhile
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            d.pending -= (size_t)w;
+            written += (size_t)w;
+            continue;
+        }
+        if (d.eof) {
+            // everything the source sent is through: pass its FIN on
+            if (!d.shut) {
+                shutdown(dst, SHUT_WR);
+                d.shut = true;
+            }
+            return true;
+        }
+        if (budget == 0) return true;
+        if (d.pipe_fds[0] == -1 && pipe2(d.pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) return false;
+        ssize_t n = splice(src, nullptr, d.pipe_fds[1], nullptr, std::min(budget, kSpliceChunk),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            d.pending = (size_t)n;
+            read += (size_t)n;
+            budget -= std::min(budget, (size_t)n);
+        } else if (n == 0) {
+            d.eof = true;
+        } else {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+}
+
+bool ProxyReactorBase::relay(Connection *conn, size_t budget, bool &yielded, uint64_t trace) {
+    Relay &r = *conn->relay;
+    if (r.connecting) {
+        if (!finish_connect(conn)) {
+            Metrics::add(Counter::ProxyRefused);
+            close_pair(conn);
+            return false;
+        }
+        // the client is not read until the upstream can take its bytes
+        if (r.connecting) return true;
+    }
+
+    size_t up_budget = budget;
+    size_t down_budget = budget;
+    size_t up_read = 0, up_written = 0, down_read = 0, down_written = 0;
+    bool ok;
+    {
+        TraceSpan span(TraceStage::Handle, trace, conn->fd);
+        ok = pump(conn->fd, r.upstream_fd, r.up, up_budget, up_read, up_written) &&
+             pump(r.upstream_fd, conn->fd, r.down, down_budget, down_read, down_written);
+    }
+    if (!ok) {
+        LOG_INFO(std::string("[Worker] Relay of fd=") + std::to_string(conn->fd) + " ended: " + std::strerror(errno));
+        close_pair(conn);
+        return false;
+    }
+    if (up_read > 0) Metrics::add(Counter::BytesIn, (uint64_t)up_read);
+    if (down_written > 0) Metrics::add(Counter::BytesOut, (uint64_t)down_written);
+    // traffic either way keeps the pair open
+    if (up_read + up_written + down_read + down_written > 0) timer_.refresh(conn->timer, TimerKind::KeepAlive);
+
+    if (r.up.shut && r.down.shut) {
+        LOG_INFO(std::string("[Worker] Client fd=") + std::to_string(conn->fd) + " disconnected");
+        close_pair(conn);
+        return false;
+    }
+    yielded = up_budget == 0 || down_budget == 0;
+    if (yielded) Metrics::add(Counter::ReadYields);
+    return true;
+}
+
+bool ProxyReactorBase::rearm_pair(Connection *conn) {
+    Relay &r = *conn->relay;
+    // each side reads while its pipe is empty and writes while the other's is not
+    epoll_event ev;
+    ev.events = EPOLLET | EPOLLONESHOT;
+    if (!r.connecting && !r.up.eof && r.up.pending == 0) ev.events |= EPOLLIN;
+    if (r.down.pending > 0) ev.events |= EPOLLOUT;
+    ev.data.u64 = conn->token;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev) != 0) return false;
+
+    ev.events = EPOLLET | EPOLLONESHOT;
+    if (!r.connecting && !r.down.eof && r.down.pending == 0) ev.events |= EPOLLIN;
+    if (r.connecting || r.up.pending > 0) ev.events |= EPOLLOUT;
+    ev.data.u64 = conn->token | kUpstreamBit;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, r.upstream_fd, &ev) == 0;
+}
+
+void ProxyReactorBase::close_pair(Connection *conn) {
+    Relay &r = *conn->relay;
+    if (!close_connection(conn)) return;
+    if (r.upstream_fd != -1) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, r.upstream_fd, nullptr);
+        // like the client's: the fd is closed when the Connection is reclaimed
+        shutdown(r.upstream_fd, SHUT_RDWR);
+    }
+    if (r.upstream != -1) upstreams_.release(r.upstream);
+}
@@ -0,0 +1,245 @@
+#include "../include/Reactor.h"
+#include "../include/Admission.h"
+#include "../include/Connection.h"
+#include "../include/ConnectionTable.h"
+#include "../include/Epoch.h"
+#include "../include/FileCache.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/SocketUtil.h"
+#include "../include/Trace.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+
+ReactorBase::ReactorBase(int id, int listen_fd, ConnectionTable &conns, Admission &admission,
+                         const ServerConfig &cfg, bool pooled)
+    : id_(id), listen_fd_(listen_fd), conns_(conns), admission_(admission), pooled_(pooled),
+      high_watermark_((size_t)cfg.high_watermark), low_watermark_((size_t)cfg.low_watermark),
+      budget_bytes_(cfg.read_budget.bytes > 0 ? (size_t)cfg.read_budget.bytes : SIZE_MAX),
+      budget_reads_(cfg.read_budget.reads > 0 ? (size_t)cfg.read_budget.reads : SIZE_MAX),
+      starve_ns_((uint64_t)cfg.starve_ms * 1000000), busy_poll_us_(cfg.busy_poll_us),
+      spin_((uint64_t)cfg.spin_us * 1000), timer_(cfg.timer_resolution_ms), running_(false) {
+    timer_.set_default_timeout(TimerKind::KeepAlive, cfg.idle_timeout_sec * 1000);
+    timer_.set_default_timeout(TimerKind::Read, cfg.read_timeout_ms);
+    timer_.set_default_timeout(TimerKind::Write, cfg.write_timeout_ms);
+    timer_.set_callback([this](uint64_t token, TimerKind kind) { on_timeout(token, kind); });
+}
+
+ReactorBase::~ReactorBase() {
+    stop();
+    if (epoll_fd_ != -1) close(epoll_fd_);
+}
+
+bool ReactorBase::init() {
+    epoll_fd_ = epoll_create1(0);
+    if (epoll_fd_ == -1) {
+        LOG_ERROR("epoll_create1 failed");
+        return false;
+    }
+
+    // accept4 must not block; a listener inherited from (or left by) an
+    // io_uring loop is blocking
+    int flags = fcntl(listen_fd_, F_GETFL, 0);
+    if (flags != -1) fcntl(listen_fd_, F_SETFL, flags | O_NONBLOCK);
+
+    // tokens always carry a non-zero generation, so the bare fd is unambiguous
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = (uint64_t)listen_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == -1) {
+        LOG_ERROR("epoll_ctl failed for listener");
+        return false;
+    }
+    if (busy_poll_us_ > 0 && !set_epoll_busy_poll(epoll_fd_, busy_poll_us_)) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] epoll busy polling unavailable: " + std::strerror(errno));
+    }
+    return true;
+}
+
+void ReactorBase::stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+}
+
+void ReactorBase::accept_connections() {
+    bool deferred = false;
+    while (true) {
+        Admission::Verdict verdict = admission_.admit();
+        if (verdict == Admission::Defer) {
+            deferred = true;
+            break;
+        }
+        int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (verdict == Admission::Accept) admission_.release();
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // out of descriptors or memory: the backlog keeps the
+                // connections until a retry succeeds
+                if (!accept_deferred_) LOG_WARN(std::string("accept failed: ") + std::strerror(errno));
+                deferred = true;
+            }
+            break;
+        }
+        if (verdict == Admission::Shed) {
+            reset_connection(client_fd);
+            Metrics::add(Counter::Shed);
+            continue;
+        }
+        Metrics::add(Counter::Accepts);
+
+        // publish the Connection before the fd can fire
+        Connection *conn = new Connection(client_fd);
+        uint64_t token = conns_.insert(conn);
+        if (token == 0) {
+            LOG_ERROR(std::string("fd=") + std::to_string(client_fd) + " exceeds connection table size");
+            delete conn;
+            continue;
+        }
+        Metrics::add(Counter::ConnBytesAllocated, conn->footprint());
+
+        // arm the keep-alive deadline before the fd can fire
+        timer_.refresh(conn->timer, TimerKind::KeepAlive);
+        timer_.schedule(conn->timer, token);
+        if (!on_accepted(conn)) {
+            refuse_connection(conn);
+            continue;
+        }
+
+        epoll_event client_ev;
+        // pooled: EPOLLONESHOT so only one worker handles the fd at a time,
+        // re-armed with EPOLLOUT while output is queued.
+        // inline: the reactor is the only user; with both directions
+        // registered edge-triggered the interest never has to change.
+        client_ev.events = pooled_ ? (EPOLLIN | EPOLLET | EPOLLONESHOT) : (EPOLLIN | EPOLLOUT | EPOLLET);
+        client_ev.data.u64 = token;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &client_ev);
+
+        LOG_INFO(std::string("[Reactor ") + std::to_string(id_) +
+                                "] New connection accepted, fd=" + std::to_string(client_fd));
+    }
+    if (deferred && !accept_deferred_) Metrics::add(Counter::AcceptPauses);
+    accept_deferred_ = deferred;
+}
+
+void ReactorBase::stop_accepting() {
+    // the listener stays open: the new process accepts from it now
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+    accepting_ = false;
+    accept_deferred_ = false;
+    timer_.tighten(TimerKind::KeepAlive, kDrainIdleMs);
+    LOG_INFO("[Reactor " + std::to_string(id_) + "] Draining " + std::to_string(timer_.size()) + " connections");
+}
+
+bool ReactorBase::flush_output(Connection *conn, size_t &file_budget, uint64_t trace) {
+    TraceSpan span(TraceStage::Write, conn->has_output() ? trace : 0, conn->fd);
+    bool progressed = false;
+    while (conn->has_output()) {
+        ssize_t w;
+        if (conn->io->sendable() > 0) {
+            // bytes right before a file (its headers) go out with MSG_MORE
+            // so they share a segment with the start of the body
+            ConnectionIo &io = *conn->io;
+            w = io.out.write_to(conn->fd, io.sendable(), io.files.empty() ? 0 : MSG_MORE);
+            if (w > 0) io.sent((size_t)w);
+        } else {
+            if (file_budget == 0) break;
+            w = send_file(conn, file_budget);
+        }
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            LOG_ERROR(std::string("[Worker] Write error on fd=") + std::to_string(conn->fd));
+            return false;
+        }
+        if (w > 0) Metrics::add(Counter::BytesOut, (uint64_t)w);
+        progressed = progressed || w > 0;
+    }
+
+    // the write deadline runs while output is stuck and restarts on progress
+    if (!conn->has_output()) {
+        timer_.disarm(conn->timer, TimerKind::Write);
+    } else if (progressed || conn->timer.deadline[(int)TimerKind::Write].load(std::memory_order_relaxed) == 0) {
+        timer_.refresh(conn->timer, TimerKind::Write);
+    }
+    return true;
+}
+
+ssize_t ReactorBase::send_file(Connection *conn, size_t &file_budget) {
+    std::vector<FileSend> &files = conn->io->files;
+    FileSend &f = files[0];
+    off_t offset = (off_t)f.offset;
+    size_t len = (size_t)std::min<uint64_t>(f.remaining, file_budget);
+    ssize_t w = sendfile(conn->fd, f.file->fd, &offset, len);
+    if (w == 0) {
+        // the file shrank under us: the promised length cannot be sent
+        LOG_WARN(std::string("[Worker] File truncated while sending to fd=") + std::to_string(conn->fd));
+        errno = EIO;
+        return -1;
+    }
+    if (w < 0) return w;
+    Metrics::add(Counter::FileBytes, (uint64_t)w);
+    f.offset += (uint64_t)w;
+    f.remaining -= (uint64_t)w;
+    file_budget -= (size_t)w;
+    if (f.remaining == 0) files.erase(files.begin());
+    return w;
+}
+
+bool ReactorBase::rearm(Connection *conn) {
+    epoll_event ev_mod;
+    ev_mod.events = EPOLLET | EPOLLONESHOT;
+    if (!conn->read_paused && !conn->close_after_write) ev_mod.events |= EPOLLIN;
+    if (conn->has_output()) ev_mod.events |= EPOLLOUT;
+    ev_mod.data.u64 = conn->token;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev_mod) == 0;
+}
+
+bool ReactorBase::close_connection(Connection *conn) {
+    // only the caller that unlinks the connection tears it down
+    if (conns_.remove(conn->token) != conn) return false;
+    Metrics::add(Counter::Closes);
+    Metrics::add(Counter::ConnBytesFreed, conn->footprint());
+    timer_.cancel(conn->timer);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    // the peer sees the close now; the fd itself is released when the
+    // Connection is reclaimed
+    shutdown(conn->fd, SHUT_RDWR);
+    conn->closed = true;
+    EpochManager::instance().retire(conn);
+    return true;
+}
+
+void ReactorBase::refuse_connection(Connection *conn) {
+    conns_.remove(conn->token);
+    Metrics::add(Counter::Closes);
+    Metrics::add(Counter::ConnBytesFreed, conn->footprint());
+    timer_.cancel(conn->timer);
+    // no event and no other thread knows the fd yet, so it can be released
+    // now, out of the table, rather than when the Connection is reclaimed
+    reset_connection(conn->fd);
+    conn->fd = -1;
+    conn->closed = true;
+    EpochManager::instance().retire(conn);
+}
+
+void ReactorBase::on_timeout(uint64_t token, TimerKind kind) {
+    static const char *names[] = {"read", "write", "keep-alive"};
+    EpochGuard guard;
+    Connection *conn = conns_.find(token);
+    if (!conn) return;
+    Metrics::add(Counter::Timeouts);
+    // wake the owner with EOF; it removes the connection and closes the fd.
+    // Draining, an idle connection only stops reading so that queued
+    // output still goes out
+    bool idle_drain = kind == TimerKind::KeepAlive && draining_.load(std::memory_order_relaxed);
+    shutdown(conn->fd, idle_drain ? SHUT_RD : SHUT_RDWR);
+    LOG_INFO(std::string("[Timer] Shut down fd=") + std::to_string(conn->fd) +
+                            " after " + names[(int)kind] + " timeout");
+}
@@ -1,37 +1,318 @@
 #include "../include/ThreadPool.h"
+#include "../include/Affinity.h"
+#include "../include/Metrics.h"
+#include "../include/Spin.h"
+#include "../include/Trace.h"
+#include <algorithm>
 
-ThreadPool::ThreadPool(size_t numThreads) : stop(false) {
+namespace {
+
+// rounds an idle worker re-checks the queues before parking; the first half
+// busy-waits with a pause instruction, the second half yields the CPU
+const int kSpinRounds = 64;
+// most injected tasks a worker moves to its own deque at once
+const size_t kInjectBatch = 32;
+
+// the pool and worker index the calling thread belongs to, if any
+thread_local ThreadPool *tls_pool = nullptr;
+thread_local size_t tls_index = 0;
+
+// Task nodes: each thread keeps a small cache and trades batches with a
+// shared free list, so a submitter that only allocates and workers that
+// only free still reach a steady state without malloc.
+const size_t kNodeBatch = 64;
+const size_t kNodeCacheMax = 4 * kNodeBatch;
+
+struct SharedNodes {
+    std::mutex mtx;
+    std::vector<ThreadPool::Node *> free_list;
+    ~SharedNodes() {
+        for (ThreadPool::Node *n : free_list) delete n;
+    }
+};
+
+SharedNodes &shared_nodes() {
+    static SharedNodes s;
+    return s;
+}
+
+struct NodeCache {
+    std::vector<ThreadPool::Node *> nodes;
+    ~NodeCache() {
+        if (nodes.empty()) return;
+        SharedNodes &s = shared_nodes();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        s.free_list.insert(s.free_list.end(), nodes.begin(), nodes.end());
+    }
+};
+
+thread_local NodeCache tls_nodes;
+
+} // namespace
+
+ThreadPool::Node *ThreadPool::alloc_node() {
+    std::vector<Node *> &cache = tls_nodes.nodes;
+    if (cache.empty()) {
+        SharedNodes &s = shared_nodes();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        size_t n = std::min(kNodeBatch, s.free_list.size());
+        cache.insert(cache.end(), s.free_list.end() - n, s.free_list.end());
+        s.free_list.resize(s.free_list.size() - n);
+    }
+    if (cache.empty()) return new Node();
+    Node *n = cache.back();
+    cache.pop_back();
+    return n;
+}
+
+void ThreadPool::free_node(Node *n) {
+    n->task.reset();
+    std::vector<Node *> &cache = tls_nodes.nodes;
+    cache.push_back(n);
+    if (cache.size() >= kNodeCacheMax) {
+        SharedNodes &s = shared_nodes();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        s.free_list.insert(s.free_list.end(), cache.end() - kNodeBatch, cache.end());
+        cache.resize(cache.size() - kNodeBatch);
+    }
+}
+
+ThreadPool::ThreadPool(size_t numThreads, uint64_t max_spin_ns)
+    : max_spin_ns_(max_spin_ns), inject_(64), inject_size_(0), idle_(0), stop_(false) {
+    if (numThreads == 0) numThreads = 1;
+    // every worker exists before any thread can try to steal from it
+    for (size_t i = 0; i < numThreads; ++i) {
+        std::unique_ptr<Worker> w(new Worker());
+        w->rng = (uint32_t)(i * 2654435761u + 1);
+        workers_.push_back(std::move(w));
+    }
     for (size_t i = 0; i < numThreads; ++i) {
-        workers.emplace_back([this]() { this->worker(); });
+        workers_[i]->thread = std::thread([this, i]() { this->worker_loop(i); });
     }
 }
 
+bool ThreadPool::pin(const std::vector<int> &cpus) {
+    if (cpus.empty()) return false;
+    bool ok = true;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        ok = pin_thread(workers_[i]->thread.native_handle(), cpus[i % cpus.size()]) && ok;
+    }
+    return ok;
+}
+
 ThreadPool::~ThreadPool() {
-    stop = true;
-    condition.notify_all();
-    for (auto& t : workers) {
-        if (t.joinable()) t.join();
+    {
+        std::lock_guard<std::mutex> lock(park_mtx_);
+        stop_ = true;
     }
+    park_cv_.notify_all();
+    for (auto &w : workers_) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+    // nothing is left: workers only exit once every queue is empty
 }
 
-void ThreadPool::enqueue(std::function<void()> task) {
+void ThreadPool::inject_push(Node *n) {
+    if (inject_count_ == inject_.size()) {
+        // full: unroll the ring into a buffer twice the size
+        std::vector<Node *> bigger(inject_.size() * 2);
+        for (size_t i = 0; i < inject_count_; ++i) {
+            bigger[i] = inject_[(inject_head_ + i) % inject_.size()];
+        }
+        inject_.swap(bigger);
+        inject_head_ = 0;
+    }
+    inject_[(inject_head_ + inject_count_) % inject_.size()] = n;
+    ++inject_count_;
+}
+
+void ThreadPool::submit(Node *n) {
+    n->enqueued_ns = Metrics::now_ns();
+    if (tls_pool == this) {
+        // submitted by one of our workers: no lock, others may steal it
+        workers_[tls_index]->deque.push(n);
+    } else {
+        std::lock_guard<std::mutex> lock(inject_mtx_);
+        inject_push(n);
+        inject_size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake(1);
+}
+
+void ThreadPool::enqueue_bulk(std::vector<Task> &tasks) {
+    if (tasks.empty()) return;
+    size_t count = tasks.size();
+    // one timestamp covers the batch
+    uint64_t now = Metrics::now_ns();
+    if (tls_pool == this) {
+        WorkStealingDeque<Node> &dq = workers_[tls_index]->deque;
+        for (auto &task : tasks) {
+            Node *n = alloc_node();
+            n->task = std::move(task);
+            n->enqueued_ns = now;
+            dq.push(n);
+        }
+    } else {
+        // fill nodes in stack-sized groups before taking the lock
+        Node *batch[64];
+        for (size_t done = 0; done < count;) {
+            size_t n = std::min(count - done, sizeof(batch) / sizeof(batch[0]));
+            for (size_t i = 0; i < n; ++i) {
+                batch[i] = alloc_node();
+                batch[i]->task = std::move(tasks[done + i]);
+                batch[i]->enqueued_ns = now;
+            }
+            std::lock_guard<std::mutex> lock(inject_mtx_);
+            for (size_t i = 0; i < n; ++i) inject_push(batch[i]);
+            inject_size_.fetch_add(n, std::memory_order_relaxed);
+            done += n;
+        }
+    }
+    tasks.clear();
+    wake(count);
+}
+
+void ThreadPool::wake(size_t n) {
+    // pairs with the idle_ increment in worker_loop: either the parking
+    // worker sees the new task or we see it idle
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t idle = idle_.load(std::memory_order_seq_cst);
+    if (idle == 0) return;
+    {
+        // a worker between its last check and wait() holds the lock
+        std::lock_guard<std::mutex> lock(park_mtx_);
+    }
+    if (n >= idle) {
+        park_cv_.notify_all();
+    } else {
+        for (size_t i = 0; i < n; ++i) park_cv_.notify_one();
+    }
+}
+
+size_t ThreadPool::queued() const {
+    size_t n = inject_size_.load(std::memory_order_relaxed);
+    for (auto &w : workers_) n += (size_t)w->deque.size();
+    return n;
+}
+
+uint64_t ThreadPool::take_min_wait() {
+    uint64_t m = UINT64_MAX;
+    for (auto &w : workers_) m = std::min(m, w->min_wait.exchange(UINT64_MAX, std::memory_order_relaxed));
+    return m;
+}
+
+bool ThreadPool::has_work() const {
+    if (inject_size_.load(std::memory_order_seq_cst) > 0) return true;
+    for (auto &w : workers_) {
+        if (!w->deque.empty()) return true;
+    }
+    return false;
+}
+
+ThreadPool::Node *ThreadPool::take_injected(size_t index) {
+    if (inject_size_.load(std::memory_order_relaxed) == 0) return nullptr;
+    Node *first = nullptr;
+    size_t moved = 0;
     {
-        std::lock_guard<std::mutex> lock(queue_mutex);
-        tasks.push(std::move(task));
+        std::lock_guard<std::mutex> lock(inject_mtx_);
+        if (inject_count_ == 0) return nullptr;
+        // a fair share, so one worker does not hoard a burst (never more
+        // than is queued: with one worker the share is count + 1)
+        size_t n = std::min(std::min(kInjectBatch, inject_count_), inject_count_ / workers_.size() + 1);
+        for (size_t i = 0; i < n; ++i) {
+            Node *node = inject_[inject_head_];
+            inject_head_ = (inject_head_ + 1) % inject_.size();
+            if (i == 0) {
+                first = node;
+            } else {
+                workers_[index]->deque.push(node);
+            }
+        }
+        inject_count_ -= n;
+        inject_size_.fetch_sub(n, std::memory_order_relaxed);
+        moved = n - 1;
     }
-    condition.notify_one();
+    if (moved > 0) wake(1);
+    return first;
 }
 
-void ThreadPool::worker() {
-    while (!stop) {
-        std::function<void()> task;
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            condition.wait(lock, [this]() { return stop || !tasks.empty(); });
-            if (stop && tasks.empty()) return;
-            task = std::move(tasks.front());
-            tasks.pop();
+ThreadPool::Node *ThreadPool::steal(size_t index) {
+    size_t n = workers_.size();
+    if (n < 2) return nullptr;
+    // xorshift picks where to start so thieves spread over the victims
+    uint32_t &r = workers_[index]->rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    size_t start = r % n;
+    for (size_t i = 0; i < n; ++i) {
+        size_t victim = (start + i) % n;
+        if (victim == index) continue;
+        Node *t = workers_[victim]->deque.steal();
+        if (t) return t;
+    }
+    return nullptr;
+}
+
+ThreadPool::Node *ThreadPool::find_task(size_t index) {
+    Node *t = workers_[index]->deque.pop();
+    if (!t) t = take_injected(index);
+    if (!t) t = steal(index);
+    return t;
+}
+
+void ThreadPool::run(Node *n, size_t index) {
+    uint64_t wait = Metrics::now_ns() - n->enqueued_ns;
+    Metrics::record(Hist::PoolQueue, wait);
+    // a reset racing with this store is lost; the next task sets it again
+    std::atomic<uint64_t> &min_wait = workers_[index]->min_wait;
+    if (wait < min_wait.load(std::memory_order_relaxed)) min_wait.store(wait, std::memory_order_relaxed);
+    n->task();
+    free_node(n);
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    tls_pool = this;
+    tls_index = index;
+    Tracer::name_thread("worker " + std::to_string(index));
+
+    int spins = 0;
+    AdaptiveSpin spin(max_spin_ns_);
+    uint64_t spin_start = 0; // timed spin: when the current idle stretch began
+    while (true) {
+        Node *t = find_task(index);
+        if (t) {
+            if (spin_start != 0) spin.hit();
+            spin_start = 0;
+            run(t, index);
+            spins = 0;
+            continue;
         }
-        task();
+        // shutdown only once every queue is drained
+        if (stop_.load(std::memory_order_acquire) && !has_work()) return;
+
+        if (spin.enabled()) {
+            uint64_t now = Metrics::now_ns();
+            if (spin_start == 0) spin_start = now;
+            if (now - spin_start < spin.window_ns()) {
+                cpu_relax();
+                continue;
+            }
+            spin.miss();
+            spin_start = 0;
+        } else if (++spins < kSpinRounds) {
+            if (spins < kSpinRounds / 2) {
+                cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+        spins = 0;
+
+        std::unique_lock<std::mutex> lock(park_mtx_);
+        idle_.fetch_add(1, std::memory_order_seq_cst);
+        while (!stop_ && !has_work()) park_cv_.wait(lock);
+        idle_.fetch_sub(1, std::memory_order_relaxed);
     }
 }
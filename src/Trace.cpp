@@ -0,0 +1,205 @@
+#include "../include/Trace.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+
+struct StageInfo {
+    const char *name;
+    const char *cat;
+};
+
+const StageInfo kStageInfo[kNumTraceStages] = {
+    {"wait", "io"},
+    {"queue", "sched"},
+    {"read", "io"},
+    {"handle", "app"},
+    {"write", "io"},
+};
+
+// a span as copied out of a ring
+struct Span {
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    uint64_t id;
+    uint32_t stage;
+    uint32_t fd;
+    int tid;
+};
+
+thread_local Tracer::Ring *tls_ring = nullptr;
+thread_local uint32_t tls_seen = 0;
+thread_local std::string tls_name;
+
+void append_us(std::string &out, uint64_t ns) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+    out += buf;
+}
+
+void append_escaped(std::string &out, const std::string &s) {
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c >= 0x20) out += c;
+    }
+}
+
+} // namespace
+
+// written only by its thread; every field is a relaxed atomic so a dump may
+// read a slot while it is rewritten and then discard it
+struct Tracer::Ring {
+    struct Slot {
+        std::atomic<uint64_t> start_ns{0};
+        std::atomic<uint64_t> dur_ns{0};
+        std::atomic<uint64_t> id{0};
+        std::atomic<uint32_t> stage{0};
+        std::atomic<uint32_t> fd{0};
+    };
+
+    std::unique_ptr<Slot[]> slots{new Slot[kRingEvents]};
+    std::atomic<uint64_t> head{0}; // spans ever recorded
+    int tid{0};
+    std::string name;
+};
+
+const size_t Tracer::kRingEvents;
+std::atomic<uint32_t> Tracer::every_{0};
+
+Tracer &Tracer::instance() {
+    static Tracer t;
+    return t;
+}
+
+Tracer::Tracer() {}
+Tracer::~Tracer() {}
+
+void Tracer::configure(int every) {
+    every_.store(every > 0 ? (uint32_t)every : 0, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::sample_slow(uint32_t every) {
+    if (++tls_seen < every) return 0;
+    tls_seen = 0;
+    return instance().next_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+Tracer::Ring *Tracer::attach() {
+    Ring *r = new Ring();
+    r->tid = (int)syscall(SYS_gettid);
+    r->name = tls_name.empty() ? "thread " + std::to_string(r->tid) : tls_name;
+    std::lock_guard<std::mutex> lock(mtx_);
+    rings_.emplace_back(r);
+    return r;
+}
+
+void Tracer::record(TraceStage stage, uint64_t id, uint64_t start_ns, uint64_t end_ns, uint32_t fd) {
+    Ring *r = tls_ring;
+    if (!r) r = tls_ring = instance().attach();
+    uint64_t h = r->head.load(std::memory_order_relaxed);
+    // the previous head store is ordered before the slot is overwritten, so
+    // a dump that sees the new contents also sees the head that covers them
+    std::atomic_thread_fence(std::memory_order_release);
+    Ring::Slot &s = r->slots[h & (kRingEvents - 1)];
+    s.start_ns.store(start_ns, std::memory_order_relaxed);
+    s.dur_ns.store(end_ns - start_ns, std::memory_order_relaxed);
+    s.id.store(id, std::memory_order_relaxed);
+    s.stage.store((uint32_t)stage, std::memory_order_relaxed);
+    s.fd.store(fd, std::memory_order_relaxed);
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void Tracer::name_thread(const std::string &name) {
+    tls_name = name;
+    if (tls_ring) {
+        std::lock_guard<std::mutex> lock(instance().mtx_);
+        tls_ring->name = name;
+    }
+}
+
+std::string Tracer::dump_json() {
+    std::vector<Span> spans;
+    std::vector<std::pair<int, std::string>> threads;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const std::unique_ptr<Ring> &r : rings_) {
+            threads.emplace_back(r->tid, r->name);
+            uint64_t end = r->head.load(std::memory_order_acquire);
+            uint64_t begin = end > kRingEvents ? end - kRingEvents : 0;
+            size_t first = spans.size();
+            for (uint64_t i = begin; i < end; ++i) {
+                const Ring::Slot &s = r->slots[i & (kRingEvents - 1)];
+                spans.push_back(Span{s.start_ns.load(std::memory_order_relaxed), s.dur_ns.load(std::memory_order_relaxed),
+                                     s.id.load(std::memory_order_relaxed), s.stage.load(std::memory_order_relaxed),
+                                     s.fd.load(std::memory_order_relaxed), r->tid});
+            }
+            // slots the thread reached again while they were copied (the one
+            // it may be writing included) are torn: drop them
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t now = r->head.load(std::memory_order_relaxed);
+            uint64_t safe = now + 1 > kRingEvents ? now + 1 - kRingEvents : 0;
+            if (safe > begin) {
+                size_t torn = (size_t)std::min(safe - begin, end - begin);
+                spans.erase(spans.begin() + (ptrdiff_t)first, spans.begin() + (ptrdiff_t)(first + torn));
+            }
+        }
+    }
+
+    int pid = (int)getpid();
+    std::string pid_s = std::to_string(pid);
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid_s +
+           ",\"tid\":0,\"args\":{\"name\":\"high_performance_server\"}}";
+    for (auto &t : threads) {
+        out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid_s + ",\"tid\":" + std::to_string(t.first) +
+               ",\"args\":{\"name\":\"";
+        append_escaped(out, t.second);
+        out += "\"}}";
+    }
+    // first span of each event per thread, for the flow arrows between them
+    std::unordered_map<uint64_t, const Span *> first_of;
+    std::sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) { return a.start_ns < b.start_ns; });
+    for (const Span &s : spans) {
+        const StageInfo &info = kStageInfo[s.stage < (uint32_t)kNumTraceStages ? s.stage : 0];
+        out += ",\n{\"name\":\"";
+        out += info.name;
+        out += "\",\"cat\":\"";
+        out += info.cat;
+        out += "\",\"ph\":\"X\",\"pid\":" + pid_s + ",\"tid\":" + std::to_string(s.tid) + ",\"ts\":";
+        append_us(out, s.start_ns);
+        out += ",\"dur\":";
+        append_us(out, s.dur_ns);
+        out += ",\"args\":{\"trace\":" + std::to_string(s.id) + ",\"fd\":" + std::to_string(s.fd) + "}}";
+
+        // the event moved to another thread (reactor -> worker): an arrow
+        // from its first span there
+        auto it = first_of.find(s.id);
+        if (it == first_of.end()) {
+            first_of[s.id] = &s;
+        } else if (it->second && it->second->tid != s.tid) {
+            const Span &from = *it->second;
+            std::string id = std::to_string(s.id);
+            out += ",\n{\"name\":\"event\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":" + id + ",\"pid\":" + pid_s +
+                   ",\"tid\":" + std::to_string(from.tid) + ",\"ts\":";
+            append_us(out, from.start_ns);
+            out += "},\n{\"name\":\"event\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" + id +
+                   ",\"pid\":" + pid_s + ",\"tid\":" + std::to_string(s.tid) + ",\"ts\":";
+            append_us(out, s.start_ns);
+            out += "}";
+            it->second = nullptr; // one arrow per event
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool Tracer::dump(const std::string &path) {
+    std::ofstream f(path.c_str(), std::ios::trunc);
+    if (!f) return false;
+    f << dump_json();
+    return (bool)f;
+}
@@ -0,0 +1,236 @@
+#include "../include/UdpLoop.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/SocketUtil.h"
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace {
+
+// blocking receives wake this often to check the stop flag
+const int kRecvTimeoutMs = 100;
+// iovecs per reply: a datagram spans at most five 16 KiB chunks
+const int kReplyIov = 8;
+// largest IPv4 UDP payload, and the largest segment merged with GSO: the
+// kernel refuses segments that would not fit the path MTU, so stay within
+// an Ethernet frame
+const size_t kMaxPayload = 65507;
+const size_t kMaxGsoSegment = 1472;
+
+bool same_peer(const sockaddr_in &a, const sockaddr_in &b) {
+    return a.sin_port == b.sin_port && a.sin_addr.s_addr == b.sin_addr.s_addr;
+}
+
+} // namespace
+
+const int UdpLoopBase::kBatch;
+const size_t UdpLoopBase::kMaxDatagram;
+const int UdpLoopBase::kMaxSegments;
+
+UdpLoopBase::UdpLoopBase(int id, int fd, int port, const ServerConfig &cfg)
+    : id_(id), running_(false), port_(port), fd_(fd), busy_poll_us_(cfg.busy_poll_us),
+      rx_((size_t)kBatch * kMaxDatagram), spin_((uint64_t)cfg.spin_us * 1000) {
+    for (int i = 0; i < kBatch; ++i) {
+        rx_iov_[i].iov_base = &rx_[(size_t)i * kMaxDatagram];
+        rx_iov_[i].iov_len = kMaxDatagram;
+    }
+}
+
+UdpLoopBase::~UdpLoopBase() {
+    stop();
+    if (fd_ != -1) close(fd_);
+}
+
+bool UdpLoopBase::init() {
+    if (fd_ == -1) fd_ = create_udp_socket(port_);
+    if (fd_ == -1) {
+        LOG_ERROR("[UDP " + std::to_string(id_) + "] bind to port " + std::to_string(port_) +
+                  " failed: " + std::strerror(errno));
+        return false;
+    }
+    timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = kRecvTimeoutMs * 1000;
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int one = 1, zero = 0;
+    gro_ = setsockopt(fd_, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    // a socket-wide segment size of 0 leaves every send unsegmented; it
+    // only tells whether the kernel knows UDP_SEGMENT
+    gso_ = setsockopt(fd_, IPPROTO_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+    if (busy_poll_us_ > 0 && !set_busy_poll(fd_, busy_poll_us_)) {
+        LOG_WARN("[UDP " + std::to_string(id_) + "] SO_BUSY_POLL unavailable: " + std::strerror(errno));
+    }
+    if (id_ == 0) {
+        LOG_INFO(std::string("UDP on port ") + std::to_string(port_) + ": GRO " + (gro_ ? "on" : "off") +
+                 ", GSO " + (gso_ ? "on" : "off"));
+    }
+    return true;
+}
+
+void UdpLoopBase::stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+}
+
+int UdpLoopBase::receive(int flags) {
+    for (int i = 0; i < kBatch; ++i) {
+        msghdr &m = rx_hdrs_[i].msg_hdr;
+        m.msg_name = &rx_addr_[i];
+        m.msg_namelen = sizeof(rx_addr_[i]);
+        m.msg_iov = &rx_iov_[i];
+        m.msg_iovlen = 1;
+        m.msg_control = gro_ ? rx_ctrl_[i] : nullptr;
+        m.msg_controllen = gro_ ? sizeof(rx_ctrl_[i]) : 0;
+        m.msg_flags = 0;
+    }
+    return recvmmsg(fd_, rx_hdrs_, kBatch, flags, nullptr);
+}
+
+int UdpLoopBase::next_batch() {
+    // latency profile: poll without blocking for a while after the last
+    // datagram
+    bool polling = spin_.enabled() && Metrics::now_ns() - last_rx_ns_ < spin_.window_ns();
+    if (was_polling_ && !polling) spin_.miss();
+    was_polling_ = polling;
+    // blocking: wait (up to the receive timeout) for the first datagram and
+    // take whatever else is queued behind it
+    int n = receive(polling ? MSG_DONTWAIT : MSG_WAITFORONE);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            if (polling) cpu_relax();
+            return 0;
+        }
+        LOG_ERROR("[UDP " + std::to_string(id_) + "] recvmmsg failed: " + std::strerror(errno));
+        return -1;
+    }
+    if (polling) spin_.hit();
+    last_rx_ns_ = Metrics::now_ns();
+    return n;
+}
+
+const char *UdpLoopBase::datagram(int i, size_t &len, size_t &seg) {
+    msghdr &m = rx_hdrs_[i].msg_hdr;
+    len = rx_hdrs_[i].msg_len;
+    if (m.msg_flags & MSG_TRUNC) {
+        Metrics::add(Counter::UdpDrops);
+        return nullptr;
+    }
+    // GRO: equal-size segments, the last one possibly shorter
+    seg = len;
+    if (gro_) {
+        for (cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+            if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+                int size;
+                std::memcpy(&size, CMSG_DATA(c), sizeof(size));
+                if (size > 0) seg = (size_t)size;
+            }
+        }
+    }
+    return static_cast<const char *>(rx_iov_[i].iov_base);
+}
+
+Buffer &UdpLoopBase::reply_slot() {
+    if (pending_ == kBatch) flush();
+    return replies_[pending_];
+}
+
+void UdpLoopBase::queue_reply(const sockaddr_in &peer) {
+    Buffer &out = replies_[pending_];
+    if (out.empty()) return;
+    if (out.size() > kMaxPayload) {
+        Metrics::add(Counter::UdpDrops);
+        out.clear();
+        return;
+    }
+    peers_[pending_++] = peer;
+}
+
+void UdpLoopBase::flush() {
+    if (pending_ == 0) return;
+    mmsghdr hdrs[kBatch];
+    iovec iov[kBatch * kReplyIov];
+    alignas(cmsghdr) char ctrl[kBatch][CMSG_SPACE(sizeof(uint16_t))];
+    int first[kBatch + 1]; // first reply of each message
+    int msgs = 0;
+    size_t niov = 0;
+    size_t bytes = 0;
+    int dropped = 0;
+
+    for (int i = 0; i < pending_;) {
+        // GSO: a run of replies to one peer, all as long as the first but
+        // the last, sent as one message the kernel segments
+        size_t seg = replies_[i].size();
+        int j = i + 1;
+        if (gso_ && seg <= kMaxGsoSegment) {
+            size_t total = seg;
+            while (j < pending_ && j - i < kMaxSegments && same_peer(peers_[j], peers_[i]) &&
+                   replies_[j].size() <= seg && total + replies_[j].size() <= kMaxPayload) {
+                total += replies_[j].size();
+                bool shorter = replies_[j].size() < seg;
+                ++j;
+                if (shorter) break;
+            }
+        }
+        msghdr &m = hdrs[msgs].msg_hdr;
+        std::memset(&m, 0, sizeof(m));
+        m.msg_name = &peers_[i];
+        m.msg_namelen = sizeof(peers_[i]);
+        m.msg_iov = &iov[niov];
+        for (int k = i; k < j; ++k) {
+            niov += (size_t)replies_[k].gather(&iov[niov], kReplyIov, replies_[k].size());
+            bytes += replies_[k].size();
+        }
+        m.msg_iovlen = (size_t)(&iov[niov] - m.msg_iov);
+        if (j - i > 1) {
+            m.msg_control = ctrl[msgs];
+            m.msg_controllen = sizeof(ctrl[msgs]);
+            cmsghdr *c = CMSG_FIRSTHDR(&m);
+            c->cmsg_level = IPPROTO_UDP;
+            c->cmsg_type = UDP_SEGMENT;
+            c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t size = (uint16_t)seg;
+            std::memcpy(CMSG_DATA(c), &size, sizeof(size));
+        }
+        first[msgs++] = i;
+        i = j;
+    }
+    first[msgs] = pending_;
+
+    for (int off = 0; off < msgs;) {
+        int r = sendmmsg(fd_, hdrs + off, (unsigned)(msgs - off), 0);
+        if (r > 0) {
+            off += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        // the message at off failed: drop its replies and go on
+        int e = errno;
+        bool segmented = hdrs[off].msg_hdr.msg_controllen > 0;
+        if (segmented && (e == EIO || e == EINVAL)) {
+            // the device cannot segment (no checksum offload): send singly
+            // from now on
+            gso_ = false;
+            LOG_WARN("[UDP " + std::to_string(id_) + "] GSO send failed (" + std::strerror(e) + "), GSO off");
+        }
+        for (int k = first[off]; k < first[off + 1]; ++k) bytes -= replies_[k].size();
+        dropped += first[off + 1] - first[off];
+        ++off;
+    }
+    if (dropped > 0) Metrics::add(Counter::UdpDrops, (uint64_t)dropped);
+    Metrics::add(Counter::UdpOut, (uint64_t)(pending_ - dropped));
+    Metrics::add(Counter::BytesOut, bytes);
+    for (int i = 0; i < pending_; ++i) replies_[i].clear();
+    pending_ = 0;
+}
@@ -0,0 +1,602 @@
+#include "../include/UringReactor.h"
+#include "../include/Admission.h"
+#include "../include/Buffer.h"
+#include "../include/Connection.h"
+#include "../include/ConnectionTable.h"
+#include "../include/Epoch.h"
+#include "../include/FileCache.h"
+#include "../include/Logger.h"
+#include "../include/Metrics.h"
+#include "../include/SocketUtil.h"
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace {
+
+int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                       const void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// multishot recv needs 6.0; provided buffer rings and multishot accept 5.19
+bool kernel_at_least(int major, int minor) {
+    utsname u;
+    if (uname(&u) != 0) return false;
+    int ma = 0, mi = 0;
+    if (std::sscanf(u.release, "%d.%d", &ma, &mi) != 2) return false;
+    return ma > major || (ma == major && mi >= minor);
+}
+
+// IORING_REGISTER_NAPI and its argument; newer than the installed headers
+const unsigned kRegisterNapi = 27;
+struct io_uring_napi_args {
+    uint32_t busy_poll_to;
+    uint8_t prefer_busy_poll;
+    uint8_t pad[3];
+    uint64_t resv;
+};
+
+} // namespace
+
+UringReactorBase::UringReactorBase(int id, int listen_fd, ConnectionTable &conns, Admission &admission,
+                                   const ServerConfig &cfg, unsigned sq_entries, unsigned cq_entries,
+                                   unsigned buf_entries)
+    : id_(id), listen_fd_(listen_fd), conns_(conns), admission_(admission), busy_poll_us_(cfg.busy_poll_us),
+      spin_((uint64_t)cfg.spin_us * 1000),
+      high_watermark_((size_t)cfg.high_watermark), low_watermark_((size_t)cfg.low_watermark),
+      timer_(cfg.timer_resolution_ms), sq_request_(sq_entries), cq_request_(cq_entries), buf_entries_(buf_entries),
+      running_(false) {
+    timer_.set_default_timeout(TimerKind::KeepAlive, cfg.idle_timeout_sec * 1000);
+    timer_.set_default_timeout(TimerKind::Read, cfg.read_timeout_ms);
+    timer_.set_default_timeout(TimerKind::Write, cfg.write_timeout_ms);
+    timer_.set_callback([this](uint64_t token, TimerKind kind) { on_timeout(token, kind); });
+}
+
+UringReactorBase::~UringReactorBase() {
+    stop();
+    // closing the ring cancels whatever is still in flight
+    if (ring_fd_ != -1) close(ring_fd_);
+    if (sqes_) munmap(sqes_, sqes_len_);
+    if (cq_map_ && cq_map_ != sq_map_) munmap(cq_map_, cq_map_len_);
+    if (sq_map_) munmap(sq_map_, sq_map_len_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_len_);
+    for (BufferChunk *c : buf_chunks_) {
+        if (c) c->release();
+    }
+    // already unlinked from the table, so nobody else frees them
+    for (Connection *conn : closing_) delete conn;
+}
+
+bool UringReactorBase::init() {
+    if (!kernel_at_least(6, 0)) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring multishot recv needs Linux 6.0+");
+        return false;
+    }
+    if (!setup_ring() || !setup_buffers()) return false;
+
+    // the kernel waits for connections itself; a blocking listener keeps
+    // multishot accept from completing with -EAGAIN
+    int flags = fcntl(listen_fd_, F_GETFL, 0);
+    if (flags != -1) fcntl(listen_fd_, F_SETFL, flags & ~O_NONBLOCK);
+
+    if (busy_poll_us_ > 0) {
+        // NAPI busy polling while the ring waits (6.9+)
+        io_uring_napi_args napi;
+        std::memset(&napi, 0, sizeof(napi));
+        napi.busy_poll_to = (uint32_t)busy_poll_us_;
+        napi.prefer_busy_poll = 1;
+        if (sys_io_uring_register(ring_fd_, kRegisterNapi, &napi, 1) != 0) {
+            LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring busy polling unavailable: " +
+                     std::strerror(errno));
+        }
+    }
+    return true;
+}
+
+bool UringReactorBase::setup_ring() {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = cq_request_;
+    ring_fd_ = sys_io_uring_setup(sq_request_, &p);
+    if (ring_fd_ < 0) {
+        // COOP_TASKRUN is only an optimisation
+        std::memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_request_;
+        ring_fd_ = sys_io_uring_setup(sq_request_, &p);
+    }
+    if (ring_fd_ < 0) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring_setup failed: " + std::strerror(errno));
+        ring_fd_ = -1;
+        return false;
+    }
+
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                              IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_EXT_ARG;
+    if ((p.features & required) != required) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring lacks required features");
+        return false;
+    }
+
+    sq_map_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    // SINGLE_MMAP: one mapping holds both rings
+    if (cq_map_len_ > sq_map_len_) sq_map_len_ = cq_map_len_;
+    sq_map_ = mmap(nullptr, sq_map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_map_ == MAP_FAILED) {
+        sq_map_ = nullptr;
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring ring mmap failed");
+        return false;
+    }
+    cq_map_ = sq_map_;
+    cq_map_len_ = sq_map_len_;
+
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] io_uring sqe mmap failed");
+        return false;
+    }
+    sqes_ = (io_uring_sqe *)sqes;
+
+    char *sq = (char *)sq_map_;
+    sq_head_ = (unsigned *)(sq + p.sq_off.head);
+    sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask_ = *(unsigned *)(sq + p.sq_off.ring_mask);
+    sq_entries_ = *(unsigned *)(sq + p.sq_off.ring_entries);
+    sq_array_ = (unsigned *)(sq + p.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+
+    char *cq = (char *)cq_map_;
+    cq_head_ = (unsigned *)(cq + p.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask_ = *(unsigned *)(cq + p.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    send_args_.resize(sq_entries_);
+    return true;
+}
+
+bool UringReactorBase::setup_buffers() {
+    buf_ring_len_ = buf_entries_ * sizeof(io_uring_buf);
+    void *mem = mmap(nullptr, buf_ring_len_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] buffer ring mmap failed");
+        return false;
+    }
+    // io_uring_buf_ring's flexible array is not at offset 0 when compiled as
+    // C++, so the ring is addressed as a plain io_uring_buf array
+    buf_ring_ = (io_uring_buf *)mem;
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring_;
+    reg.ring_entries = buf_entries_;
+    reg.bgid = kBufGroup;
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        LOG_WARN("[Reactor " + std::to_string(id_) + "] provided buffer ring registration failed: " +
+                 std::strerror(errno));
+        return false;
+    }
+
+    buf_chunks_.resize(buf_entries_, nullptr);
+    for (unsigned i = 0; i < buf_entries_; ++i) {
+        buf_chunks_[i] = BufferChunk::acquire();
+        publish_buffer((uint16_t)i);
+    }
+    return true;
+}
+
+void UringReactorBase::publish_buffer(uint16_t bid) {
+    io_uring_buf &b = buf_ring_[buf_tail_ & (buf_entries_ - 1)];
+    b.addr = (uint64_t)(uintptr_t)buf_chunks_[bid]->data;
+    b.len = (uint32_t)BufferChunk::kSize;
+    b.bid = bid;
+    ++buf_tail_;
+    // the ring tail overlays the reserved field of the first entry
+    __atomic_store_n(&buf_ring_[0].resv, buf_tail_, __ATOMIC_RELEASE);
+}
+
+BufferChunk *UringReactorBase::take_buffer(uint16_t bid) {
+    BufferChunk *c = buf_chunks_[bid];
+    buf_chunks_[bid] = BufferChunk::acquire();
+    publish_buffer(bid);
+    return c;
+}
+
+void UringReactorBase::recycle_buffer(uint16_t bid) {
+    publish_buffer(bid);
+}
+
+void UringReactorBase::stop() {
+    running_ = false;
+    if (thread_.joinable()) thread_.join();
+}
+
+io_uring_sqe *UringReactorBase::get_sqe() {
+    // full: hand what is queued to the kernel first
+    if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        submit(false, 0);
+        if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            LOG_ERROR("io_uring submission queue full");
+            return nullptr;
+        }
+    }
+    unsigned idx = sq_local_tail_ & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++sq_local_tail_;
+    ++pending_;
+    return sqe;
+}
+
+int UringReactorBase::submit(bool wait, int timeout_ms) {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    int ret;
+    if (wait && timeout_ms == 0) {
+        // collect only: runs pending task work without sleeping
+        ret = sys_io_uring_enter(ring_fd_, pending_, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } else if (wait) {
+        ret = sys_io_uring_enter(ring_fd_, pending_, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                 &arg, sizeof(arg));
+    } else {
+        if (pending_ == 0) return 0;
+        ret = sys_io_uring_enter(ring_fd_, pending_, 0, 0, nullptr, 0);
+    }
+    if (ret > 0) pending_ -= (unsigned)ret < pending_ ? (unsigned)ret : pending_;
+    return ret;
+}
+
+void UringReactorBase::arm_accept() {
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OpAccept;
+    accept_armed_ = true;
+}
+
+void UringReactorBase::defer_accept() {
+    if (accept_deferred_) return;
+    accept_deferred_ = true;
+    accept_retry_ns_ = Metrics::now_ns() + Admission::kRetryMs * 1000000ull;
+    Metrics::add(Counter::AcceptPauses);
+    cancel_accept();
+}
+
+void UringReactorBase::cancel_accept() {
+    if (!accept_armed_) return;
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = OpAccept;
+    sqe->user_data = OpCancel;
+}
+
+void UringReactorBase::stop_accepting() {
+    // connections the kernel accepted before the cancel are still served;
+    // the listener stays open for the new process
+    accepting_ = false;
+    cancel_accept();
+    timer_.tighten(TimerKind::KeepAlive, kDrainIdleMs);
+    LOG_INFO("[Reactor " + std::to_string(id_) + "] Draining " + std::to_string(timer_.size()) + " connections");
+}
+
+void UringReactorBase::arm_recv(Connection *conn) {
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufGroup;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OpRecv;
+    conn->recv_armed = true;
+}
+
+void UringReactorBase::cancel_recv(Connection *conn) {
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)conn | OpRecv;
+    sqe->user_data = OpCancel;
+}
+
+void UringReactorBase::on_accept(int res, uint32_t flags) {
+    bool exhausted = res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM;
+    if (exhausted && !accept_deferred_) {
+        // out of descriptors or memory: the backlog keeps the connections
+        // until a retry succeeds
+        LOG_WARN(std::string("accept failed: ") + std::strerror(-res));
+        defer_accept();
+    }
+    // the multishot accept stays armed while the kernel sets F_MORE
+    if (!(flags & IORING_CQE_F_MORE)) {
+        accept_armed_ = false;
+        if (running_ && accepting_ && !accept_deferred_) arm_accept();
+    }
+    if (res < 0) {
+        if (res != -ECANCELED && !exhausted) LOG_ERROR(std::string("accept failed: ") + std::strerror(-res));
+        return;
+    }
+
+    int client_fd = res;
+    Admission::Verdict verdict = admission_.admit();
+    if (verdict != Admission::Accept) {
+        // the kernel has taken it already: there is no backlog to leave it in
+        reset_connection(client_fd);
+        Metrics::add(Counter::Shed);
+        if (verdict == Admission::Defer) defer_accept();
+        return;
+    }
+    Metrics::add(Counter::Accepts);
+    Connection *conn = new Connection(client_fd);
+    uint64_t token = conns_.insert(conn);
+    if (token == 0) {
+        LOG_ERROR(std::string("fd=") + std::to_string(client_fd) + " exceeds connection table size");
+        delete conn;
+        return;
+    }
+    Metrics::add(Counter::ConnBytesAllocated, conn->footprint());
+
+    timer_.refresh(conn->timer, TimerKind::KeepAlive);
+    timer_.schedule(conn->timer, token);
+    arm_recv(conn);
+
+    LOG_INFO(std::string("[Reactor ") + std::to_string(id_) +
+                            "] New connection accepted, fd=" + std::to_string(client_fd));
+}
+
+void UringReactorBase::queue_send(Connection *conn) {
+    if (conn->sending) return;
+    conn->sending = true;
+    send_queue_.push_back(conn);
+}
+
+void UringReactorBase::flush_sends() {
+    for (size_t i = 0; i < send_queue_.size(); ++i) {
+        Connection *conn = send_queue_[i];
+        if (conn->closed || !conn->has_output()) {
+            conn->sending = false;
+            maybe_retire(conn);
+            continue;
+        }
+        ConnectionIo &io = *conn->io;
+        if (io.sendable() == 0) {
+            // the front file's turn
+            if (!queue_splice(conn)) {
+                conn->sending = false;
+                close_connection(conn);
+            }
+            continue;
+        }
+
+        io_uring_sqe *sqe = get_sqe();
+        if (!sqe) {
+            conn->sending = false;
+            close_connection(conn);
+            continue;
+        }
+        // stable submission: the arguments only have to outlive io_uring_enter
+        SendArgs &args = send_args_[(sqe - sqes_)];
+        std::memset(&args.msg, 0, sizeof(args.msg));
+        args.msg.msg_iov = args.iov;
+        args.msg.msg_iovlen = (size_t)io.out.gather(args.iov, kMaxIov, io.sendable());
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&args.msg;
+        sqe->len = 1;
+        // headers right before a file share a segment with its first pages
+        sqe->msg_flags = MSG_NOSIGNAL | (io.files.empty() ? 0 : MSG_MORE);
+        sqe->user_data = (uint64_t)(uintptr_t)conn | OpSend;
+
+        // the write deadline runs while output is queued and restarts on progress
+        if (conn->timer.deadline[(int)TimerKind::Write].load(std::memory_order_relaxed) == 0) {
+            timer_.refresh(conn->timer, TimerKind::Write);
+        }
+    }
+    send_queue_.clear();
+}
+
+bool UringReactorBase::queue_splice(Connection *conn) {
+    ConnectionIo &io = *conn->io;
+    // the pipe stays with the I/O state, across connections once it is idle
+    if (io.pipe_fds[0] == -1) {
+        if (pipe2(io.pipe_fds, O_CLOEXEC) != 0) {
+            LOG_ERROR(std::string("pipe2 failed: ") + std::strerror(errno));
+            return false;
+        }
+        // a bigger pipe means fewer rounds; the kernel may grant less
+        fcntl(io.pipe_fds[1], F_SETPIPE_SZ, kPipeSize);
+        int size = fcntl(io.pipe_fds[1], F_GETPIPE_SZ);
+        io.pipe_size = size > 0 ? (size_t)size : 4096;
+    }
+
+    // both halves of a round must reach the kernel in one submission, or
+    // the link between them would be cut
+    if (sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) < 2) submit(false, 0);
+    if (sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) < 2) {
+        LOG_ERROR("io_uring submission queue full");
+        return false;
+    }
+
+    const FileSend &f = io.files[0];
+    // a round never moves more than the pipe holds: the file -> pipe splice
+    // would block on a full pipe before the linked pipe -> socket one starts
+    size_t len = io.pipe_pending;
+    if (len == 0) {
+        len = (size_t)std::min<uint64_t>(f.remaining, io.pipe_size);
+        io_uring_sqe *in = get_sqe();
+        if (!in) return false;
+        in->opcode = IORING_OP_SPLICE;
+        in->fd = io.pipe_fds[1];
+        in->off = (uint64_t)-1;
+        in->splice_fd_in = f.file->fd;
+        in->splice_off_in = f.offset;
+        in->len = (uint32_t)len;
+        in->splice_flags = SPLICE_F_MOVE;
+        // the send starts once the pipe is filled; a short fill cancels it
+        in->flags = IOSQE_IO_LINK;
+        in->user_data = (uint64_t)(uintptr_t)conn | OpSpliceIn;
+    }
+    io_uring_sqe *out = get_sqe();
+    if (!out) return false;
+    out->opcode = IORING_OP_SPLICE;
+    out->fd = conn->fd;
+    out->off = (uint64_t)-1;
+    out->splice_fd_in = io.pipe_fds[0];
+    out->splice_off_in = (uint64_t)-1;
+    out->len = (uint32_t)len;
+    out->splice_flags = SPLICE_F_MOVE;
+    out->user_data = (uint64_t)(uintptr_t)conn | OpSpliceOut;
+
+    if (conn->timer.deadline[(int)TimerKind::Write].load(std::memory_order_relaxed) == 0) {
+        timer_.refresh(conn->timer, TimerKind::Write);
+    }
+    return true;
+}
+
+void UringReactorBase::on_splice_in(Connection *conn, int res) {
+    // `sending` stays set: the linked pipe -> socket splice completes next
+    if (conn->closed) return;
+    if (res <= 0) {
+        // 0: the file shrank under us and the promised length cannot be sent
+        LOG_ERROR(std::string("[Worker] File read error for fd=") + std::to_string(conn->fd));
+        close_connection(conn);
+        return;
+    }
+    FileSend &f = conn->io->files[0];
+    f.offset += (uint64_t)res;
+    f.remaining -= (uint64_t)res;
+    conn->io->pipe_pending += (size_t)res;
+}
+
+void UringReactorBase::on_splice_out(Connection *conn, int res) {
+    conn->sending = false;
+    if (conn->closed) {
+        maybe_retire(conn);
+        return;
+    }
+    if (res == -ECANCELED) {
+        // the file splice came up short; send what it moved next round
+        res = 0;
+    } else if (res < 0) {
+        LOG_ERROR(std::string("[Worker] Write error on fd=") + std::to_string(conn->fd));
+        close_connection(conn);
+        return;
+    }
+    ConnectionIo &io = *conn->io;
+    io.pipe_pending -= (size_t)res;
+    Metrics::add(Counter::BytesOut, (uint64_t)res);
+    Metrics::add(Counter::FileBytes, (uint64_t)res);
+    if (io.files[0].remaining == 0 && io.pipe_pending == 0) io.files.erase(io.files.begin());
+    after_send(conn, res);
+}
+
+void UringReactorBase::on_send(Connection *conn, int res) {
+    conn->sending = false;
+    if (conn->closed) {
+        maybe_retire(conn);
+        return;
+    }
+    if (res < 0) {
+        LOG_ERROR(std::string("[Worker] Write error on fd=") + std::to_string(conn->fd));
+        close_connection(conn);
+        return;
+    }
+
+    Metrics::add(Counter::BytesOut, (uint64_t)res);
+    conn->io->out.consume((size_t)res);
+    conn->io->sent((size_t)res);
+    after_send(conn, res);
+}
+
+void UringReactorBase::after_send(Connection *conn, int res) {
+    if (!conn->has_output()) {
+        timer_.disarm(conn->timer, TimerKind::Write);
+        if (conn->close_after_write) {
+            close_connection(conn);
+            return;
+        }
+    } else {
+        if (res > 0) timer_.refresh(conn->timer, TimerKind::Write);
+        queue_send(conn);
+    }
+
+    if (conn->read_paused && conn->drained_to(low_watermark_)) {
+        conn->read_paused = false;
+        if (!conn->recv_armed && !conn->close_after_write) arm_recv(conn);
+    }
+    conn->release_io();
+}
+
+void UringReactorBase::close_connection(Connection *conn) {
+    // only the caller that unlinks the connection tears it down
+    if (conns_.remove(conn->token) != conn) return;
+    Metrics::add(Counter::Closes);
+    Metrics::add(Counter::ConnBytesFreed, conn->footprint());
+    timer_.cancel(conn->timer);
+    // ends the multishot recv and fails a pending send; the fd itself is
+    // released when the Connection is reclaimed
+    shutdown(conn->fd, SHUT_RDWR);
+    conn->closed = true;
+    closing_.insert(conn);
+    if (conn->recv_armed) cancel_recv(conn);
+    maybe_retire(conn);
+}
+
+void UringReactorBase::maybe_retire(Connection *conn) {
+    if (!conn->closed || conn->recv_armed || conn->sending) return;
+    if (closing_.erase(conn) == 0) return;
+    EpochManager::instance().retire(conn);
+}
+
+void UringReactorBase::on_timeout(uint64_t token, TimerKind kind) {
+    static const char *names[] = {"read", "write", "keep-alive"};
+    EpochGuard guard;
+    Connection *conn = conns_.find(token);
+    if (!conn) return;
+    Metrics::add(Counter::Timeouts);
+    // wake the owner with EOF; it removes the connection and closes the fd.
+    // Draining, an idle connection only stops reading so that queued
+    // output still goes out
+    bool idle_drain = kind == TimerKind::KeepAlive && draining_.load(std::memory_order_relaxed);
+    shutdown(conn->fd, idle_drain ? SHUT_RD : SHUT_RDWR);
+    LOG_INFO(std::string("[Timer] Shut down fd=") + std::to_string(conn->fd) +
+                            " after " + names[(int)kind] + " timeout");
+}
@@ -1,226 +1,314 @@
+#include <algorithm>
 #include <iostream>
-#include <sys/socket.h>
-#include <netinet/in.h>
 #include <unistd.h>
-#include <sys/epoll.h>
-#include <fcntl.h>
-#include <cstring>
 #include <errno.h>
 #include <signal.h>
-#include <atomic>
+#include <cstring>
+#include <chrono>
 #include <memory>
-#include <cstdlib>
-#include <unordered_map>
-#include <mutex>
-#include "../include/ThreadPool.h"
-#include "../include/Connection.h"
-#include "../include/Timer.h"
+#include <thread>
+#include <vector>
+#include "../include/AdminServer.h"
+#include "../include/Affinity.h"
+#include "../include/Config.h"
+#include "../include/FileCache.h"
+#include "../include/HotRestart.h"
+#include "../include/KvStore.h"
+#include "../include/Metrics.h"
+#include "../include/Protocol.h"
+#include "../include/Proxy.h"
+#include "../include/Server.h"
+#include "../include/SocketUtil.h"
+#include "../include/Trace.h"
+#include "../include/UdpLoop.h"
 #include "../include/Logger.h"
 
 
-//set non-blocking
-void setNonBlocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-}
-
 static volatile sig_atomic_t stop_flag = 0;
 
+static volatile sig_atomic_t dump_flag = 0;
+
 static void handle_signal(int) {
     stop_flag = 1;
 }
 
-int main(int argc, char **argv) {
-    // optional: first argument is number of worker threads
-    int num_threads = 4;
-    if (argc > 1) {
-        // allow `--threads N` or just `N`
-        if (std::string(argv[1]) == "--threads" && argc > 2) {
-            num_threads = std::atoi(argv[2]);
-        } else {
-            num_threads = std::atoi(argv[1]);
-        }
-        if (num_threads <= 0) num_threads = 4;
+static void handle_dump(int) {
+    dump_flag = 1;
+}
+
+static void dump_trace(const std::string &path) {
+    if (Tracer::instance().dump(path)) {
+        LOG_INFO("Trace written to " + path);
+    } else {
+        LOG_ERROR("Cannot write the trace to " + path + ": " + std::strerror(errno));
     }
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        Logger::instance().error("Socket creation failed");
-        return -1;
+}
+
+// serve() could not set the backend's loops up (io_uring on an old kernel)
+static const int kBackendUnavailable = 2;
+
+// what main() sets up before the server type is picked
+struct Launch {
+    std::vector<int> listen_fds;
+    InheritedSockets inherited;
+    std::unique_ptr<HotRestart> upgrade;
+    uint64_t takeover_ns{0};
+};
+
+// UDP loops answer datagrams with the TCP loops' protocol; a proxy relays
+// streams only, so next to it they echo
+template <class Protocol>
+static UdpLoopBase *make_udp_loop(int id, int fd, const ServerConfig &cfg, const Protocol &protocol) {
+    return new UdpLoop<Protocol>(id, fd, cfg.port, cfg, protocol);
+}
+
+static UdpLoopBase *make_udp_loop(int id, int fd, const ServerConfig &cfg, const TcpProxy &) {
+    return new UdpLoop<RawEcho>(id, fd, cfg.port, cfg, RawEcho());
+}
+
+// Run the server until a stop signal or a completed hot restart. Returns
+// the exit code, or kBackendUnavailable before serving anything.
+template <class Backend, class Protocol, class Dispatch>
+static int serve(const ServerConfig &cfg, Protocol protocol, Launch &launch) {
+    bool multi = cfg.num_reactors > 0;
+    bool kv = cfg.codec == CodecKind::Memcache;
+    size_t num_loops = launch.listen_fds.size();
+    Server<Backend, Protocol, Dispatch> server(cfg, protocol);
+    ThreadPool *pool = server.pool();
+
+    // latency profile (or --cpus): loops first, then workers, then UDP
+    // loops, one CPU each in NUMA order
+    std::vector<int> cpus;
+    if (cfg.profile == Profile::Latency || !cfg.cpus.empty()) {
+        cpus = placement_cpus(cfg.cpus);
+        if (cpus.empty()) LOG_WARN("No usable CPU to pin threads to, running unpinned");
+    }
+    std::vector<int> placed;
+    if (!cpus.empty()) {
+        size_t workers = pool ? pool->size() : 0;
+        size_t threads = num_loops + workers + (size_t)cfg.udp_threads;
+        if (threads > cpus.size()) {
+            LOG_WARN(std::to_string(threads) + " threads share " + std::to_string(cpus.size()) + " CPUs");
+        }
+        for (size_t i = 0; i < threads; ++i) placed.push_back(cpus[i % cpus.size()]);
+        if (pool && !pool->pin(std::vector<int>(placed.begin() + num_loops, placed.begin() + num_loops + workers))) {
+            LOG_WARN(std::string("Cannot pin every worker: ") + std::strerror(errno));
+        }
     }
 
-    sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;//Listen on all IPs
-    address.sin_port = htons(8080);//host to network byte order
+    if (!server.init(launch.listen_fds, placed)) return kBackendUnavailable;
+    // UDP loops bind their own SO_REUSEPORT sockets on the same port
+    std::vector<std::unique_ptr<UdpLoopBase>> udp_loops;
+    std::vector<int> udp_fds;
+    for (int i = 0; i < cfg.udp_threads; ++i) {
+        int fd = (size_t)i < launch.inherited.udp.size() ? launch.inherited.udp[(size_t)i] : -1;
+        std::unique_ptr<UdpLoopBase> u(make_udp_loop(i, fd, cfg, protocol));
+        if (!u->init()) return -1;
+        if (!placed.empty()) u->set_cpu(placed[placed.size() - (size_t)cfg.udp_threads + (size_t)i]);
+        udp_fds.push_back(u->fd());
+        udp_loops.push_back(std::move(u));
+    }
+    server.start();
+    for (auto &u : udp_loops) u->start();
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        Logger::instance().error("Bind failed");
-        return -1;
+    // serving now: the old process lets go of the admin port and the
+    // upgrade path, and both become ours
+    const InheritedSockets &inherited = launch.inherited;
+    std::unique_ptr<HotRestart> &upgrade = launch.upgrade;
+    if (!inherited.tcp.empty() || !inherited.udp.empty()) {
+        upgrade->confirm();
+        LOG_INFO("Took over " + std::to_string(inherited.tcp.size() + inherited.udp.size()) +
+                 " sockets from pid " + std::to_string(inherited.pid) + " in " +
+                 std::to_string((Metrics::now_ns() - launch.takeover_ns) / 1000000) + " ms");
     }
+    if (upgrade && !upgrade->listen()) upgrade.reset();
+
+    Metrics &metrics = Metrics::instance();
+    metrics.set_info("profile", cfg.profile == Profile::Latency ? "latency" : "throughput");
+    metrics.set_info("cpus", placed.empty() ? "unpinned" : format_cpu_list(placed));
+    metrics.set_info("numa_nodes", std::to_string(count_nodes(placed)));
+    metrics.set_info("spin_us", std::to_string(cfg.spin_us));
+    metrics.set_info("busy_poll_us", std::to_string(cfg.busy_poll_us));
+    metrics.set_info("restart", inherited.pid ? "from pid " + std::to_string(inherited.pid) : "cold");
 
-    if (listen(server_fd, 10) < 0) {
-        Logger::instance().error("Listen failed");
-        return -1;
+    std::unique_ptr<AdminServer> admin;
+    if (cfg.admin_port > 0) {
+        admin.reset(new AdminServer(cfg.admin_port));
+        if (!admin->start()) admin.reset();
     }
 
-    setNonBlocking(server_fd);
+    std::string backend = std::string(server.backend_name()) == "epoll" ? "Epoll ET" : "io_uring";
+    if (!cfg.proxy.empty()) backend += ", proxy to " + cfg.proxy;
+    if (multi) backend += ", " + std::to_string(num_loops) + " reactors";
+    if (cfg.udp_threads > 0) backend += ", " + std::to_string(cfg.udp_threads) + " UDP loops";
+    LOG_INFO("Server is running on port " + std::to_string(cfg.port) + " (" + backend + ")...");
 
-    int epoll_fd = epoll_create1(0);
-    if (epoll_fd == -1) {
-        Logger::instance().error("epoll_create1 failed");
-        return -1;
+    bool handed_off = false;
+    while (!stop_flag && !handed_off) {
+        // an upgrade request ends the wait at once
+        if (upgrade) {
+            handed_off = upgrade->wait(100, cfg.port, launch.listen_fds, udp_fds);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (kv) KvStore::instance().expire();
+        if (dump_flag) {
+            dump_flag = 0;
+            dump_trace(cfg.trace_file);
+        }
     }
 
-    epoll_event ev, events[1024];
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = server_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
-        std::cerr << "epoll_ctl failed\n";
-        return -1;
+    if (handed_off) {
+        // a new process serves the sockets: give it the admin port and the
+        // upgrade path, then let the connections finish
+        admin.reset();
+        upgrade->release();
+        server.drain();
+        for (auto &u : udp_loops) u->drain();
+        const ConnectionTable &connections = server.connections();
+        LOG_INFO("Sockets handed over, draining " + std::to_string(connections.size()) + " connections");
+        uint64_t deadline = Metrics::now_ns() + (uint64_t)cfg.drain_timeout_ms * 1000000;
+        while (!stop_flag && connections.size() > 0 && Metrics::now_ns() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (kv) KvStore::instance().expire();
+        }
+        if (connections.size() > 0) {
+            LOG_WARN(std::to_string(connections.size()) + " connections still open after the drain, closing them");
+        }
     }
 
-    // initialize logger file output (optional)
-    Logger::instance().init("server.log");
+    // graceful shutdown: stop the loops; the server then lets the workers
+    // finish queued tasks and frees the connections
+    LOG_INFO("Shutting down server...");
+    admin.reset();
+    server.stop();
+    for (auto &u : udp_loops) u->stop();
+    return 0;
+}
 
-    // register simple signal handlers for graceful shutdown
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+// the protocol for --codec
+template <class Backend, class Dispatch>
+static int serve_codec(const ServerConfig &cfg, Launch &launch) {
+    switch (cfg.codec) {
+        case CodecKind::Line: return serve<Backend, LineEcho, Dispatch>(cfg, LineEcho(), launch);
+        case CodecKind::LengthPrefix:
+            return serve<Backend, LengthPrefixEcho, Dispatch>(cfg, LengthPrefixEcho(), launch);
+        case CodecKind::Http:
+            return serve<Backend, HttpProtocol, Dispatch>(
+                cfg, HttpProtocol(HttpHandler(HttpRouter::from_config(cfg))), launch);
+        case CodecKind::Memcache:
+            return serve<Backend, MemcacheProtocol, Dispatch>(
+                cfg, MemcacheProtocol(MemcacheHandler(KvStore::instance())), launch);
+        default: return serve<Backend, RawEcho, Dispatch>(cfg, RawEcho(), launch);
+    }
+}
 
-    // Create a thread pool using configured number of worker threads
-    ThreadPool pool((size_t)num_threads);
+int main(int argc, char **argv) {
+    ServerConfig cfg;
+    if (!parse_args(argc, argv, cfg)) return -1;
 
-    // per-connection map: fd -> Connection
-    // protected by connections_mutex because both main thread and workers
-    // may insert/erase entries.
-    std::unordered_map<int, std::shared_ptr<Connection>> connections;
-    std::mutex connections_mutex;
+    // multi-reactor mode: one SO_REUSEPORT listener and epoll loop per reactor.
+    // default mode: a single loop dispatching to the worker pool.
+    bool multi = cfg.num_reactors > 0;
+    int num_loops = multi ? cfg.num_reactors : 1;
 
-    // Timer manager: closes idle connections after timeout seconds
-    TimerManager timer(epoll_fd, connections, connections_mutex, 60); // 60s default
-    timer.start();
+    // initialize logger file output (optional)
+    Logger::instance().set_level(cfg.log_level);
+    Logger::instance().set_overflow_policy(cfg.log_overflow);
+    Logger::instance().init(cfg.log_path);
+    Tracer::instance().configure(cfg.trace_sample);
 
-    Logger::instance().info("Server is running on port 8080 (Epoll ET)...");
+    // hot restart: take the sockets over from the server at the upgrade
+    // path if one runs there
+    Launch launch;
+    InheritedSockets &inherited = launch.inherited;
+    launch.takeover_ns = Metrics::now_ns();
+    if (!cfg.upgrade_socket.empty()) {
+        launch.upgrade.reset(new HotRestart(cfg.upgrade_socket));
+        HotRestart::Takeover t = launch.upgrade->take_over(inherited);
+        if (t == HotRestart::Failed) return -1;
+        if (t == HotRestart::Inherited && inherited.port != cfg.port) {
+            LOG_ERROR("The server at " + cfg.upgrade_socket + " serves port " + std::to_string(inherited.port) +
+                      ", not " + std::to_string(cfg.port));
+            return -1;
+        }
+    }
+    // a socket count that differs from the old process's: extra listeners
+    // are closed (resetting what waits in their backlog), missing ones bound
+    if (inherited.tcp.size() > (size_t)num_loops || inherited.udp.size() > (size_t)cfg.udp_threads) {
+        LOG_WARN("Closing the inherited sockets beyond " + std::to_string(num_loops) + " listeners and " +
+                 std::to_string(cfg.udp_threads) + " UDP sockets");
+        for (size_t i = (size_t)num_loops; i < inherited.tcp.size(); ++i) close(inherited.tcp[i]);
+        for (size_t i = (size_t)cfg.udp_threads; i < inherited.udp.size(); ++i) close(inherited.udp[i]);
+        inherited.tcp.resize(std::min(inherited.tcp.size(), (size_t)num_loops));
+        inherited.udp.resize(std::min(inherited.udp.size(), (size_t)cfg.udp_threads));
+    }
 
-    while (!stop_flag) {
-        // wake periodically to check stop flag
-        int nfds = epoll_wait(epoll_fd, events, 1024, 1000);
-        if (nfds == -1) {
-            if (errno == EINTR) continue;
-            Logger::instance().error(std::string("epoll_wait failed errno=") + std::to_string(errno));
-            break;
+    std::vector<int> &listen_fds = launch.listen_fds;
+    listen_fds = inherited.tcp;
+    for (int i = (int)listen_fds.size(); i < num_loops; ++i) {
+        int fd = create_listen_socket(cfg.port, cfg.backlog, multi);
+        if (fd == -1) {
+            LOG_ERROR(std::string("Listen on port ") + std::to_string(cfg.port) +
+                                     " failed: " + std::strerror(errno));
+            for (int lfd : listen_fds) close(lfd);
+            return -1;
         }
-        for (int i = 0; i < nfds; ++i) {
-            if (events[i].data.fd == server_fd) {
-                //process new connection
-                while (true) {
-                    int client_fd = accept(server_fd, nullptr, nullptr);
-                    if (client_fd == -1) {
-                        break;
-                    }
-                    setNonBlocking(client_fd);
-                    epoll_event client_ev;
-                    // 使用 EPOLLONESHOT 确保每次只有一个线程处理该 fd
-                    client_ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
-                    client_ev.data.fd = client_fd;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev);
-
-                    // create Connection object and insert into map
-                    {
-                        auto conn = std::make_shared<Connection>(client_fd);
-                        std::lock_guard<std::mutex> lock(connections_mutex);
-                        connections[client_fd] = conn;
-                    }
-
-                    // schedule initial timer for this connection
-                    timer.add_or_refresh(client_fd, 60);
-
-                    Logger::instance().info(std::string("New connection accepted, fd=") + std::to_string(client_fd));
-                }
-            } else if (events[i].events & EPOLLIN) {
-                int client_fd = events[i].data.fd;
-
-                // lookup the Connection object for this fd
-                std::shared_ptr<Connection> conn;
-                {
-                    std::lock_guard<std::mutex> lock(connections_mutex);
-                    auto it = connections.find(client_fd);
-                    if (it != connections.end()) conn = it->second;
-                }
-
-                if (!conn) {
-                    // Connection not found; it may have been closed concurrently
-                    continue;
-                }
-
-                // enqueue a task that holds a shared_ptr to the Connection
-                // so the Connection object stays alive while the worker runs.
-                pool.enqueue([epoll_fd, client_fd, conn, &connections, &connections_mutex, &timer]() {
-                    char buf[4096];
-                    while (true) {
-                        ssize_t n = read(client_fd, buf, sizeof(buf));
-                        if (n > 0) {
-                            // update last-active timestamp
-                            conn->touch();
-                            // refresh timer because we received activity
-                            timer.add_or_refresh(client_fd, 60);
-                            // perform simple echo logic; protect out_buffer if necessary
-                            Logger::instance().debug(std::string("[Worker] Received from fd=") + std::to_string(client_fd) + ": " + std::string(buf, n));
-                            ssize_t w = write(client_fd, buf, n);
-                            (void)w; // ignore short writes for this simple example
-                        } else if (n == 0) {
-                            // orderly shutdown by peer
-                            Logger::instance().info(std::string("[Worker] Client fd=") + std::to_string(client_fd) + " disconnected");
-                            close(client_fd);
-                            // remove from connections map
-                            {
-                                std::lock_guard<std::mutex> lock(connections_mutex);
-                                connections.erase(client_fd);
-                            }
-                            break;
-                        } else {
-                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                                // drained all data for ET + non-blocking; re-arm EPOLLONESHOT
-                                epoll_event ev_mod;
-                                ev_mod.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
-                                ev_mod.data.fd = client_fd;
-                                if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &ev_mod) == -1) {
-                                    // if re-arm fails, clean up: socket may be closed
-                                    Logger::instance().error(std::string("epoll_ctl MOD failed for fd=") + std::to_string(client_fd) + ", errno=" + std::to_string(errno));
-                                    close(client_fd);
-                                    std::lock_guard<std::mutex> lock(connections_mutex);
-                                    connections.erase(client_fd);
-                                }
-                                break;
-                            }
-                            Logger::instance().error(std::string("[Worker] Read error on fd=") + std::to_string(client_fd));
-                            close(client_fd);
-                            {
-                                std::lock_guard<std::mutex> lock(connections_mutex);
-                                connections.erase(client_fd);
-                            }
-                            break;
-                        }
-                    }
-                });
-            }
+        // accepted sockets inherit busy polling from their listener;
+        // inherited listeners keep what they were set up with
+        if (cfg.busy_poll_us > 0 && !set_busy_poll(fd, cfg.busy_poll_us)) {
+            LOG_WARN(std::string("SO_BUSY_POLL unavailable: ") + std::strerror(errno));
         }
+        listen_fds.push_back(fd);
+    }
+
+    // register simple signal handlers for graceful shutdown
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    // on demand: write the trace (--trace-sample) without stopping
+    signal(SIGUSR1, handle_dump);
+    // sendfile has no MSG_NOSIGNAL: a peer that resets must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!cfg.static_dir.empty()) FileCache::instance().set_capacity((size_t)cfg.file_cache_entries);
+    // one key-value shard per thread that handles requests
+    if (cfg.codec == CodecKind::Memcache) {
+        KvStore::instance().configure((size_t)(multi ? num_loops : cfg.num_threads),
+                                      (size_t)cfg.kv_memory_mb << 20);
     }
-    // graceful shutdown: stop timer, close connections and fds
-    Logger::instance().info("Shutting down server...");
-    timer.stop();
-
-    {
-        std::lock_guard<std::mutex> lk(connections_mutex);
-        for (auto &p : connections) {
-            int fd = p.first;
-            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-            close(fd);
-            p.second->closed = true;
+
+    // the loops of every backend and dispatch are compiled for each codec;
+    // io_uring loops always serve inline and fall back to epoll when the
+    // kernel cannot run them
+    int rc = kBackendUnavailable;
+    if (!cfg.proxy.empty()) {
+        // proxy mode relays on epoll loops (pooled or one per reactor)
+        std::shared_ptr<UpstreamPool> upstreams(new UpstreamPool(cfg.proxy_pool, cfg.proxy_check_ms));
+        if (!upstreams->init(cfg.proxy)) {
+            for (int fd : listen_fds) close(fd);
+            return -1;
         }
-        connections.clear();
+        if (cfg.backend == IoBackend::IoUring) LOG_WARN("--proxy relays on epoll loops, ignoring --backend io_uring");
+        upstreams->start();
+        rc = multi ? serve<ProxyBackend, TcpProxy, InlineDispatch>(cfg, TcpProxy(upstreams), launch)
+                   : serve<ProxyBackend, TcpProxy, PooledDispatch>(cfg, TcpProxy(upstreams), launch);
+        upstreams->stop();
+        if (rc == kBackendUnavailable) rc = -1;
+    } else if (cfg.backend == IoBackend::IoUring) {
+        rc = serve_codec<UringBackend, InlineDispatch>(cfg, launch);
+        if (rc == kBackendUnavailable) LOG_WARN("io_uring unavailable, falling back to epoll");
+    }
+    if (rc == kBackendUnavailable && cfg.proxy.empty()) {
+        rc = multi ? serve_codec<EpollBackend, InlineDispatch>(cfg, launch)
+                   : serve_codec<EpollBackend, PooledDispatch>(cfg, launch);
+        if (rc == kBackendUnavailable) rc = -1;
     }
 
-    close(server_fd);
-    close(epoll_fd);
-    return 0;
-}
\ No newline at end of file
+    for (int fd : listen_fds) close(fd);
+
+    if (Logger::instance().dropped() > 0) {
+        LOG_WARN("Dropped " + std::to_string(Logger::instance().dropped()) + " log lines (ring full)");
+    }
+    Logger::instance().flush();
+    return rc;
+}
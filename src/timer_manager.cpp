@@ -1,16 +1,24 @@
 // timer_manager.cpp
 #include "../include/Timer.h"
-#include "../include/Connection.h"
-#include <unistd.h>
-#include <sys/epoll.h>
-#include "../include/Logger.h"
-
-TimerManager::TimerManager(int epoll_fd,
-                           std::unordered_map<int, std::shared_ptr<Connection>> &conns,
-                           std::mutex &conns_mtx,
-                           int default_timeout_sec)
-    : epoll_fd_(epoll_fd), conns_(conns), conns_mtx_(conns_mtx),
-      default_timeout_sec_(default_timeout_sec), running_(false) {}
+#include <limits>
+
+namespace {
+
+// linked_at value of a node that is scheduled but has no deadline armed
+const int64_t kParked = std::numeric_limits<int64_t>::max();
+
+void list_init(TimerNode &head) { head.prev = head.next = &head; }
+
+} // namespace
+
+TimerManager::TimerManager(int resolution_ms)
+    : resolution_ms_(resolution_ms > 0 ? resolution_ms : 100),
+      start_time_(Clock::now()), now_tick_(0), size_(0), running_(false) {
+    for (auto &ms : default_ms_) ms = 0;
+    for (auto &h : l0_) list_init(h);
+    for (auto &level : ln_)
+        for (auto &h : level) list_init(h);
+}
 
 TimerManager::~TimerManager() { stop(); }
 
@@ -26,63 +34,226 @@ void TimerManager::stop() {
     if (worker_.joinable()) worker_.join();
 }
 
-void TimerManager::add_or_refresh(int fd, int timeout_sec) {
-    int t = timeout_sec > 0 ? timeout_sec : default_timeout_sec_;
-    Item it{Clock::now() + std::chrono::seconds(t), fd};
-    {
-        std::lock_guard<std::mutex> lk(pq_mtx_);
-        pq_.push(std::move(it));
+void TimerManager::run_loop() {
+    while (running_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(resolution_ms_));
+        expire(Clock::now());
     }
 }
 
-void TimerManager::run_loop() {
-    while (running_) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        auto now = Clock::now();
-
-        while (true) {
-            Item it;
-            {
-                std::lock_guard<std::mutex> lk(pq_mtx_);
-                if (pq_.empty()) break;
-                it = pq_.top();
-                if (it.expire > now) break;
-                pq_.pop();
-            }
+void TimerManager::set_default_timeout(TimerKind kind, int timeout_ms) {
+    default_ms_[(int)kind] = timeout_ms > 0 ? timeout_ms : 0;
+}
 
-            // Find connection; skip if not present
-            std::shared_ptr<Connection> conn;
-            {
-                std::lock_guard<std::mutex> lk(conns_mtx_);
-                auto itc = conns_.find(it.fd);
-                if (itc == conns_.end()) continue;
-                conn = itc->second;
-            }
+int64_t TimerManager::ticks_for(int timeout_ms) const {
+    int64_t t = (timeout_ms + resolution_ms_ - 1) / resolution_ms_;
+    return t > 0 ? t : 1;
+}
+
+int64_t TimerManager::earliest(const TimerNode &node) const {
+    int64_t e = 0;
+    for (auto &d : node.deadline) {
+        int64_t v = d.load(std::memory_order_relaxed);
+        if (v != 0 && (e == 0 || v < e)) e = v;
+    }
+    return e;
+}
+
+TimerNode *TimerManager::slot_head(int64_t tick) {
+    int64_t delta = tick - now_tick_.load(std::memory_order_relaxed);
+    if (delta < kL0Size) return &l0_[tick & (kL0Size - 1)];
+    int shift = kL0Bits;
+    for (int level = 0; level < kLevels - 1; ++level, shift += kLnBits) {
+        if (level == kLevels - 2 || delta < (int64_t(1) << (shift + kLnBits))) {
+            return &ln_[level][(tick >> shift) & (kLnSize - 1)];
+        }
+    }
+    return nullptr; // unreachable
+}
+
+void TimerManager::link(TimerNode &node, int64_t tick, bool allow_current) {
+    // the current tick's slot has normally been run already; only cascade
+    // (which runs before it) may still target it
+    int64_t now = now_tick_.load(std::memory_order_relaxed);
+    int64_t first = allow_current ? now : now + 1;
+    if (tick < first) tick = first;
+    if (tick - now >= kMaxSpan) tick = now + kMaxSpan - 1;
+    TimerNode *head = slot_head(tick);
+    node.prev = head->prev;
+    node.next = head;
+    head->prev->next = &node;
+    head->prev = &node;
+    node.linked_at.store(tick, std::memory_order_release);
+}
+
+void TimerManager::unlink(TimerNode &node) {
+    if (!node.next) return;
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+}
+
+void TimerManager::schedule(TimerNode &node, uint64_t token) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (node.linked_at.load(std::memory_order_relaxed) < 0) size_.fetch_add(1, std::memory_order_relaxed);
+    unlink(node);
+    node.token = token;
+    int64_t e = earliest(node);
+    if (e == 0) {
+        node.linked_at.store(kParked, std::memory_order_release);
+    } else {
+        link(node, e);
+    }
+}
+
+void TimerManager::refresh(TimerNode &node, TimerKind kind, int timeout_ms) {
+    int t = timeout_ms > 0 ? timeout_ms : default_ms_[(int)kind];
+    if (t <= 0) {
+        disarm(node, kind);
+        return;
+    }
+    int64_t d = now_tick_.load(std::memory_order_relaxed) + ticks_for(t);
+    node.deadline[(int)kind].store(d, std::memory_order_relaxed);
+
+    // a later deadline is picked up when the current slot comes due
+    int64_t at = node.linked_at.load(std::memory_order_acquire);
+    if (at < 0 || d >= at) return;
+
+    std::lock_guard<std::mutex> lk(mtx_);
+    at = node.linked_at.load(std::memory_order_relaxed);
+    if (at < 0 || d >= at) return;
+    unlink(node);
+    link(node, earliest(node));
+}
+
+void TimerManager::disarm(TimerNode &node, TimerKind kind) {
+    // lazily dropped: the node is parked when its slot finds nothing armed
+    node.deadline[(int)kind].store(0, std::memory_order_relaxed);
+}
+
+void TimerManager::tighten(TimerKind kind, int timeout_ms) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    int64_t d = now_tick_.load(std::memory_order_relaxed) + ticks_for(timeout_ms);
+    // collect first: relinking moves nodes between the lists being walked
+    std::vector<TimerNode *> nodes;
+    auto collect = [&nodes](TimerNode &head) {
+        for (TimerNode *n = head.next; n != &head; n = n->next) nodes.push_back(n);
+    };
+    for (auto &h : l0_) collect(h);
+    for (auto &level : ln_)
+        for (auto &h : level) collect(h);
+
+    for (TimerNode *n : nodes) {
+        std::atomic<int64_t> &deadline = n->deadline[(int)kind];
+        int64_t cur = deadline.load(std::memory_order_relaxed);
+        if (cur != 0 && cur <= d) continue;
+        deadline.store(d, std::memory_order_relaxed);
+        if (n->linked_at.load(std::memory_order_relaxed) <= d) continue;
+        unlink(*n);
+        link(*n, earliest(*n));
+    }
+}
+
+void TimerManager::cancel(TimerNode &node) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (node.linked_at.load(std::memory_order_relaxed) < 0) return;
+    unlink(node);
+    node.linked_at.store(-1, std::memory_order_release);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+}
 
-            // Compare last_active under conn->mtx to avoid races
-            bool should_close = false;
-            {
-                std::lock_guard<std::mutex> lk(conn->mtx);
-                auto last = conn->last_active;
-                if (last + std::chrono::seconds(default_timeout_sec_) <= now) {
-                    should_close = true;
+void TimerManager::cascade(int level) {
+    int shift = kL0Bits + level * kLnBits;
+    int64_t now = now_tick_.load(std::memory_order_relaxed);
+    TimerNode &head = ln_[level][(now >> shift) & (kLnSize - 1)];
+    if (head.next == &head) return;
+
+    // detach the slot, then re-slot every node closer to its deadline;
+    // nodes due at this very tick land in the level-0 slot about to run
+    TimerNode pending;
+    pending.next = head.next;
+    pending.prev = head.prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    TimerNode *n = pending.next;
+    while (n != &pending) {
+        TimerNode *next = n->next;
+        n->prev = n->next = nullptr;
+        int64_t e = earliest(*n);
+        if (e == 0) {
+            n->linked_at.store(kParked, std::memory_order_release);
+        } else {
+            link(*n, e, true);
+        }
+        n = next;
+    }
+}
+
+void TimerManager::run_slot(int64_t tick) {
+    TimerNode &head = l0_[tick & (kL0Size - 1)];
+    if (head.next == &head) return;
+
+    TimerNode pending;
+    pending.next = head.next;
+    pending.prev = head.prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    TimerNode *n = pending.next;
+    while (n != &pending) {
+        TimerNode *next = n->next;
+        n->prev = n->next = nullptr;
+        int64_t e = earliest(*n);
+        if (e == 0) {
+            n->linked_at.store(kParked, std::memory_order_release);
+        } else if (e > tick) {
+            link(*n, e); // refreshed since it was slotted
+        } else {
+            int kind = 0;
+            for (int k = 0; k < 3; ++k) {
+                int64_t v = n->deadline[k].load(std::memory_order_relaxed);
+                if (v != 0 && v <= tick) {
+                    kind = k;
+                    break;
                 }
             }
+            n->linked_at.store(-1, std::memory_order_release);
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            fired_.push_back(std::make_pair(n->token, (TimerKind)kind));
+        }
+        n = next;
+    }
+}
 
-            if (!should_close) continue; // was refreshed
-
-            // close connection: remove from epoll and from map
-            {
-                std::lock_guard<std::mutex> lk(conns_mtx_);
-                auto itc2 = conns_.find(it.fd);
-                if (itc2 != conns_.end()) {
-                    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it.fd, nullptr);
-                    close(it.fd);
-                    itc2->second->closed = true;
-                    conns_.erase(itc2);
-                    Logger::instance().info(std::string("[Timer] Closed idle fd=") + std::to_string(it.fd));
+void TimerManager::expire(Clock::time_point now) {
+    if (now < start_time_) return;
+    int64_t target = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time_).count() /
+                     resolution_ms_;
+
+    std::vector<std::pair<uint64_t, TimerKind>> fired;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        while (now_tick_.load(std::memory_order_relaxed) < target) {
+            int64_t t = now_tick_.load(std::memory_order_relaxed) + 1;
+            now_tick_.store(t, std::memory_order_relaxed);
+            if ((t & (kL0Size - 1)) == 0) {
+                // cascade from the highest level whose index wrapped
+                int level = 0;
+                int64_t hi = t >> kL0Bits;
+                while (level < kLevels - 2 && (hi & (kLnSize - 1)) == 0) {
+                    hi >>= kLnBits;
+                    ++level;
                 }
+                for (int l = level; l >= 0; --l) cascade(l);
             }
+            run_slot(t);
         }
+        fired.swap(fired_);
     }
+
+    if (!callback_) return;
+    for (auto &f : fired) callback_(f.first, f.second);
 }
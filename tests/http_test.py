@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+Functional test for the HTTP mode.
+
+Start the server with a static directory the test can write to:
+
+    mkdir -p /tmp/hps-static
+    ./high_performance_server --codec http --static-dir /tmp/hps-static
+
+then run this script. It checks pipelined requests, bodies split over
+writes, byte ranges and path traversal, prints a summary and exits non-zero
+if a check failed.
+"""
+import os, socket, sys, time, argparse
+
+parser = argparse.ArgumentParser(description='Functional test for --codec http')
+parser.add_argument('--host', default='127.0.0.1')
+parser.add_argument('--port', type=int, default=8080)
+parser.add_argument('--static-dir', default='/tmp/hps-static')
+parser.add_argument('--static-prefix', default='/static/')
+parser.add_argument('--io-timeout', type=float, default=5.0)
+args = parser.parse_args()
+
+results = []
+
+def check(name, ok, detail=""):
+    results.append((name, ok, detail))
+
+class Client:
+    def __init__(self):
+        self.s = socket.create_connection((args.host, args.port), timeout=args.io_timeout)
+        self.s.settimeout(args.io_timeout)
+        self.buf = b""
+
+    def send(self, data):
+        self.s.sendall(data)
+
+    def _fill(self):
+        chunk = self.s.recv(65536)
+        if not chunk:
+            raise EOFError("connection closed")
+        self.buf += chunk
+
+    # one response: (status, headers, body); head requests carry no body
+    def response(self, head=False):
+        while b"\r\n\r\n" not in self.buf:
+            self._fill()
+        header, _, self.buf = self.buf.partition(b"\r\n\r\n")
+        lines = header.decode().split("\r\n")
+        status = int(lines[0].split()[1])
+        headers = {}
+        for line in lines[1:]:
+            k, _, v = line.partition(":")
+            headers[k.strip().lower()] = v.strip()
+        n = 0 if head else int(headers.get("content-length", "0"))
+        while len(self.buf) < n:
+            self._fill()
+        body, self.buf = self.buf[:n], self.buf[n:]
+        return status, headers, body
+
+    def closed(self):
+        try:
+            return self.buf == b"" and self.s.recv(1) == b""
+        except (ConnectionResetError, socket.timeout):
+            return True
+
+    def close(self):
+        self.s.close()
+
+def get(path, extra=""):
+    return ("GET %s HTTP/1.1\r\nHost: test\r\n%s\r\n" % (path, extra)).encode()
+
+def test_pipelining():
+    c = Client()
+    # three requests in one write, answered in order
+    c.send(get("/") + get("/health") + b"POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 5\r\n\r\nhello")
+    statuses = [c.response()[0] for _ in range(2)]
+    status, _, body = c.response()
+    check("pipelined GETs", statuses == [200, 200], statuses)
+    check("pipelined POST", status == 200 and body == b"hello", (status, body))
+    # the request after "Connection: close" is not served
+    c.send(get("/", "Connection: close\r\n") + get("/health"))
+    status, headers, _ = c.response()
+    check("pipelined close", status == 200 and headers.get("connection") == "close", headers)
+    check("closed after Connection: close", c.closed())
+    c.close()
+
+def test_split_body():
+    c = Client()
+    body = os.urandom(1024 * 1024)
+    c.send(b"POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: %d\r\n\r\n" % len(body))
+    for off in range(0, len(body), 64 * 1024):
+        c.send(body[off:off + 64 * 1024])
+        time.sleep(0.005)
+    status, _, echoed = c.response()
+    check("body split over writes", status == 200 and echoed == body, (status, len(echoed)))
+    # the connection keeps serving
+    c.send(get("/health"))
+    check("keep-alive after body", c.response()[0] == 200)
+    c.close()
+
+def test_ranges():
+    data = bytes(range(256)) * 40
+    with open(os.path.join(args.static_dir, "range.bin"), "wb") as f:
+        f.write(data)
+    url = args.static_prefix + "range.bin"
+    c = Client()
+    c.send(get(url))
+    status, headers, body = c.response()
+    check("whole file", status == 200 and body == data, status)
+    modified = headers.get("last-modified", "")
+    cases = [
+        ("bytes=0-99", 0, 100),
+        ("bytes=10000-", 10000, len(data) - 10000),
+        ("bytes=-16", len(data) - 16, 16),
+        ("bytes=100-199999", 100, len(data) - 100),
+    ]
+    for spec, offset, n in cases:
+        c.send(get(url, "Range: %s\r\n" % spec))
+        status, headers, body = c.response()
+        want = "bytes %d-%d/%d" % (offset, offset + n - 1, len(data))
+        check("range " + spec, status == 206 and headers.get("content-range") == want and
+              body == data[offset:offset + n], (status, headers.get("content-range")))
+    c.send(get(url, "Range: bytes=20000-\r\n"))
+    status, headers, _ = c.response()
+    check("unsatisfiable range", status == 416 and headers.get("content-range") == "bytes */%d" % len(data),
+          (status, headers))
+    c.send(get(url, "Range: bytes=0-9\r\nIf-Range: %s\r\n" % modified))
+    status, _, body = c.response()
+    check("If-Range match", status == 206 and body == data[:10], status)
+    c.send(get(url, "Range: bytes=0-9\r\nIf-Range: Thu, 01 Jan 1970 00:00:00 GMT\r\n"))
+    status, _, body = c.response()
+    check("If-Range mismatch", status == 200 and body == data, status)
+    c.send(("HEAD %s HTTP/1.1\r\nHost: test\r\n\r\n" % url).encode())
+    status, headers, _ = c.response(head=True)
+    check("HEAD", status == 200 and headers.get("content-length") == str(len(data)), headers)
+    c.send(get("/health"))
+    check("keep-alive after HEAD", c.response()[0] == 200)
+    c.close()
+
+def test_traversal():
+    c = Client()
+    for path in ("../../../../etc/passwd", "a/../../../../etc/passwd", "..", "%2e%2e/%2e%2e/etc/passwd"):
+        c.send(get(args.static_prefix + path))
+        status, _, body = c.response()
+        check("traversal " + path, status == 404 and b"root:" not in body, status)
+    c.close()
+
+def test_bad_request():
+    c = Client()
+    c.send(b"NOT A REQUEST\r\n\r\n")
+    status, _, _ = c.response()
+    check("bad request", status == 400, status)
+    check("closed after bad request", c.closed())
+    c.close()
+
+for test in (test_pipelining, test_split_body, test_ranges, test_traversal, test_bad_request):
+    try:
+        test()
+    except Exception as e:
+        check(test.__name__, False, repr(e))
+
+ok_count = sum(1 for r in results if r[1])
+print(f"Total checks: {len(results)}, OK: {ok_count}, Failed: {len(results) - ok_count}")
+for r in results:
+    if not r[1]:
+        print("FAILED:", r)
+sys.exit(0 if ok_count == len(results) else 1)
@@ -0,0 +1,713 @@
+// loadgen.cpp
+// Native load generator for the echo server.
+//
+// Runs the same clients x messages x size matrix as tests/stress_test.py,
+// but from a few epoll threads instead of one Python thread per client, so
+// the client is not the bottleneck. Three modes:
+// - closed loop (default): each client sends a message, waits for the echo,
+//   sends the next;
+// - open loop (--rate R): messages are sent on a fixed schedule of R per
+//   second in total, pipelined on each connection, whether or not earlier
+//   replies are back. Latency is measured from the scheduled send time, which
+//   corrects for coordinated omission: a stalled server is charged for every
+//   message that should have been sent during the stall. The uncorrected
+//   latency (from the actual send) is reported alongside;
+// - churn (--churn): every message uses a fresh connection, so latency
+//   includes connect, accept and close.
+// With --kv-keys N the messages are memcache commands for --codec memcache
+// instead of echoes: N keys with --size byte values are stored before the
+// clock starts, then each message is a get of a random key, or a set with
+// probability --kv-sets (default 0.1), a read-heavy cache workload.
+//
+// The summary uses the same lines as stress_test.py, so the output files
+// work with scripts/aggregate_results.py; --csv / --json write the
+// aggregator's row schema directly and --hist-out dumps the full HDR
+// percentile distribution.
+
+#include "../include/Metrics.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string host{"127.0.0.1"};
+    int port{8080};
+    int clients{200};
+    int msgs{200};
+    int size{256};
+    int threads{0};
+    double rate{0};         // >0: open loop, messages per second in total
+    bool churn{false};
+    double io_timeout{5.0}; // seconds without progress before a client fails
+    std::string label{"loadgen"};
+    std::string csv;
+    std::string json;
+    std::string hist_out;
+    int kv_keys{0};         // >0: memcache gets / sets over this many keys
+    double kv_sets{0.1};    // share of sets among them
+};
+
+void usage(const char *prog) {
+    std::fprintf(stderr,
+                 "Usage: %s [options]\n"
+                 "  --host H            server address (default 127.0.0.1)\n"
+                 "  --port P            server port (default 8080)\n"
+                 "  --clients N         concurrent connections (default 200)\n"
+                 "  --msgs N            messages per client (default 200)\n"
+                 "  --size B            message size in bytes, newline-terminated (default 256)\n"
+                 "  --threads N         client threads (default: min(clients, cores))\n"
+                 "  --rate R            open loop: R messages/s in total, latency corrected\n"
+                 "                      for coordinated omission (default: closed loop)\n"
+                 "  --churn             a new connection for every message\n"
+                 "  --io-timeout S      fail a client after S seconds without progress (default 5)\n"
+                 "  --label NAME        'file' column of the CSV/JSON row (default loadgen)\n"
+                 "  --csv PATH          write the result in the aggregate_results.py CSV schema\n"
+                 "  --json PATH         same, as a JSON list\n"
+                 "  --hist-out PATH     write the HDR percentile distribution (ms)\n"
+                 "  --kv-keys N         memcache workload over N keys of --size byte values\n"
+                 "  --kv-sets F         share of sets in the memcache workload (default 0.1)\n",
+                 prog);
+}
+
+bool parse_options(int argc, char **argv, Options &o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (a == "--churn") {
+            o.churn = true;
+        } else if (!has_value) {
+            return false;
+        } else if (a == "--host") {
+            o.host = argv[++i];
+        } else if (a == "--port") {
+            o.port = std::atoi(argv[++i]);
+        } else if (a == "--clients") {
+            o.clients = std::atoi(argv[++i]);
+        } else if (a == "--msgs") {
+            o.msgs = std::atoi(argv[++i]);
+        } else if (a == "--size") {
+            o.size = std::atoi(argv[++i]);
+        } else if (a == "--threads") {
+            o.threads = std::atoi(argv[++i]);
+        } else if (a == "--rate") {
+            o.rate = std::atof(argv[++i]);
+        } else if (a == "--io-timeout") {
+            o.io_timeout = std::atof(argv[++i]);
+        } else if (a == "--label") {
+            o.label = argv[++i];
+        } else if (a == "--csv") {
+            o.csv = argv[++i];
+        } else if (a == "--json") {
+            o.json = argv[++i];
+        } else if (a == "--hist-out") {
+            o.hist_out = argv[++i];
+        } else if (a == "--kv-keys") {
+            o.kv_keys = std::atoi(argv[++i]);
+        } else if (a == "--kv-sets") {
+            o.kv_sets = std::atof(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return o.clients > 0 && o.msgs > 0 && o.size > 0 && o.port > 0;
+}
+
+struct Client {
+    int id{0};
+    int fd{-1};
+    bool connecting{false};
+    int queued{0};              // messages scheduled so far
+    int sent{0};                // messages completely written
+    int done{0};                // replies received
+    size_t send_off{0};         // bytes of the message being written
+    size_t recv_bytes{0};       // bytes of the reply being read
+    uint64_t next_due{0};       // open loop: scheduled time of message `queued`
+    std::deque<uint64_t> intended; // per outstanding message: scheduled send time
+    std::deque<uint64_t> actual;   // per outstanding message: first byte written
+    uint64_t last_progress{0};
+    bool active{true};
+    // memcache workload
+    std::string msg;            // command being written
+    std::deque<bool> sets;      // per outstanding command: a set rather than a get
+    std::string rx;             // replies not complete yet
+    uint64_t rng{0};
+};
+
+class Worker {
+public:
+    Worker(const Options &o, const sockaddr_in &addr, const std::string &payload, int first, int count)
+        : opt_(o), addr_(addr), payload_(payload), clients_(count) {
+        for (int i = 0; i < count; ++i) {
+            clients_[i].id = first + i;
+            clients_[i].rng = 0x9e3779b97f4a7c15ull * (uint64_t)(first + i + 1);
+        }
+        if (o.rate > 0) interval_ns_ = (uint64_t)(1e9 * o.clients / o.rate);
+    }
+
+    ~Worker() {
+        for (Client &c : clients_) close_conn(c);
+        if (epfd_ != -1) close(epfd_);
+    }
+
+    // connect every client (except in churn mode); false if epoll fails
+    bool setup();
+    void run(uint64_t start_ns);
+
+    Histogram corrected;   // from the scheduled send time
+    Histogram uncorrected; // from the actual send time
+    uint64_t completed{0};
+    uint64_t kv_gets{0};
+    uint64_t kv_hits{0};
+    int errors{0};
+    std::string first_error;
+
+private:
+    bool open_conn(Client &c, bool blocking);
+    void close_conn(Client &c);
+    void fail(Client &c, const std::string &why);
+    void finish(Client &c);
+    // schedule messages that are due (closed loop: the next one)
+    void schedule(Client &c, uint64_t now);
+    void on_connected(Client &c);
+    void pump_send(Client &c);
+    void pump_recv(Client &c);
+    // the message to write next: the echo payload or a memcache command
+    const std::string &message(Client &c);
+    // split the memcache replies buffered in c.rx; false if c failed
+    bool parse_kv(Client &c, uint64_t now);
+    // account for one reply; false if c failed
+    bool complete(Client &c, uint64_t now);
+    void check_timeouts(uint64_t now);
+    // epoll timeout until the next scheduled message, in ns
+    int64_t next_wakeup(uint64_t now) const;
+
+    const Options &opt_;
+    sockaddr_in addr_;
+    const std::string &payload_;
+    std::vector<Client> clients_;
+    int epfd_{-1};
+    int active_{0};
+    uint64_t interval_ns_{0};
+    char rbuf_[64 * 1024];
+};
+
+bool Worker::setup() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ == -1) return false;
+    active_ = (int)clients_.size();
+    if (opt_.churn) return true;
+    // connect before the clock starts so duration and latency cover the
+    // messages only
+    for (Client &c : clients_) {
+        if (!open_conn(c, true)) fail(c, std::string("connect: ") + std::strerror(errno));
+    }
+    return true;
+}
+
+bool Worker::open_conn(Client &c, bool blocking) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK), 0);
+    if (fd == -1) return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int r = connect(fd, (const sockaddr *)&addr_, sizeof(addr_));
+    if (r == -1 && !(errno == EINPROGRESS && !blocking)) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return false;
+    }
+    if (blocking) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    c.fd = fd;
+    c.connecting = r == -1;
+    c.send_off = 0;
+    c.recv_bytes = 0;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = &c;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+    return true;
+}
+
+void Worker::close_conn(Client &c) {
+    if (c.fd == -1) return;
+    close(c.fd); // also drops it from the epoll set
+    c.fd = -1;
+    c.connecting = false;
+}
+
+void Worker::fail(Client &c, const std::string &why) {
+    if (!c.active) return;
+    if (first_error.empty()) first_error = "client " + std::to_string(c.id) + ": " + why;
+    ++errors;
+    c.active = false;
+    --active_;
+    close_conn(c);
+}
+
+void Worker::finish(Client &c) {
+    c.active = false;
+    --active_;
+    close_conn(c);
+}
+
+void Worker::schedule(Client &c, uint64_t now) {
+    if (!c.active) return;
+    // the timeout clock starts when the client begins waiting again
+    if (c.done == c.queued) c.last_progress = now;
+    if (interval_ns_ == 0) {
+        // closed loop: one message in flight
+        if (c.queued == c.done && c.queued < opt_.msgs) {
+            c.intended.push_back(now);
+            ++c.queued;
+        }
+    } else {
+        while (c.queued < opt_.msgs && c.next_due <= now) {
+            c.intended.push_back(c.next_due);
+            ++c.queued;
+            c.next_due += interval_ns_;
+        }
+    }
+    if (c.fd == -1 && c.queued > c.done && opt_.churn) {
+        if (!open_conn(c, false)) {
+            fail(c, std::string("connect: ") + std::strerror(errno));
+            return;
+        }
+        c.last_progress = now;
+    }
+    pump_send(c);
+}
+
+void Worker::on_connected(Client &c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+        fail(c, std::string("connect: ") + std::strerror(err));
+        return;
+    }
+    c.connecting = false;
+}
+
+void Worker::pump_send(Client &c) {
+    if (c.fd == -1 || c.connecting) return;
+    while (c.sent < c.queued) {
+        const std::string &msg = message(c);
+        if (c.send_off == 0) c.actual.push_back(Metrics::now_ns());
+        ssize_t w = send(c.fd, msg.data() + c.send_off, msg.size() - c.send_off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (c.send_off == 0) c.actual.pop_back();
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail(c, std::string("send: ") + std::strerror(errno));
+            return;
+        }
+        c.send_off += (size_t)w;
+        if (c.send_off == msg.size()) {
+            c.send_off = 0;
+            c.msg.clear();
+            ++c.sent;
+        }
+    }
+}
+
+const std::string &Worker::message(Client &c) {
+    if (opt_.kv_keys == 0) return payload_;
+    if (c.msg.empty()) {
+        c.rng = c.rng * 6364136223846793005ull + 1442695040888963407ull;
+        char key[32];
+        std::snprintf(key, sizeof(key), "key:%010llu", (unsigned long long)((c.rng >> 33) % opt_.kv_keys));
+        bool set = (double)((c.rng >> 8) & 0xffffff) / (1 << 24) < opt_.kv_sets;
+        if (set) {
+            c.msg = std::string("set ") + key + " 0 0 " + std::to_string(payload_.size()) + "\r\n" + payload_ + "\r\n";
+        } else {
+            c.msg = std::string("get ") + key + "\r\n";
+        }
+        c.sets.push_back(set);
+    }
+    return c.msg;
+}
+
+bool Worker::parse_kv(Client &c, uint64_t now) {
+    size_t pos = 0;
+    while (!c.sets.empty()) {
+        bool set = c.sets.front();
+        // values are filled with 'X', so the terminators cannot occur in them
+        const char *end = set ? "\r\n" : "END\r\n";
+        size_t e = c.rx.find(end, pos);
+        if (e == std::string::npos) break;
+        if (set && c.rx.compare(pos, 8, "STORED\r\n") != 0) {
+            fail(c, "set refused: " + c.rx.substr(pos, e - pos));
+            return false;
+        }
+        if (!set) {
+            ++kv_gets;
+            if (c.rx.compare(pos, 6, "VALUE ") == 0) ++kv_hits;
+        }
+        pos = e + std::strlen(end);
+        c.sets.pop_front();
+        if (!complete(c, now)) return false;
+    }
+    c.rx.erase(0, pos);
+    return true;
+}
+
+bool Worker::complete(Client &c, uint64_t now) {
+    if (c.intended.empty() || c.actual.empty()) {
+        fail(c, "unexpected data");
+        return false;
+    }
+    corrected.record(now - c.intended.front());
+    uncorrected.record(now - c.actual.front());
+    c.intended.pop_front();
+    c.actual.pop_front();
+    ++c.done;
+    ++completed;
+    return true;
+}
+
+void Worker::pump_recv(Client &c) {
+    while (c.fd != -1) {
+        ssize_t n = recv(c.fd, rbuf_, sizeof(rbuf_), 0);
+        if (n == 0) {
+            fail(c, "connection closed");
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail(c, std::string("recv: ") + std::strerror(errno));
+            return;
+        }
+        uint64_t now = Metrics::now_ns();
+        c.last_progress = now;
+        if (opt_.kv_keys > 0) {
+            c.rx.append(rbuf_, (size_t)n);
+            if (!parse_kv(c, now)) return;
+        }
+        size_t left = opt_.kv_keys > 0 ? 0 : (size_t)n;
+        while (left > 0) {
+            size_t take = std::min(left, payload_.size() - c.recv_bytes);
+            c.recv_bytes += take;
+            left -= take;
+            if (c.recv_bytes < payload_.size()) break;
+            c.recv_bytes = 0;
+            if (!complete(c, now)) return;
+        }
+        if (c.done == opt_.msgs) {
+            finish(c);
+            return;
+        }
+        if (opt_.churn && c.done == c.queued) {
+            // the next message gets a new connection
+            close_conn(c);
+            schedule(c, now);
+            return;
+        }
+        if (interval_ns_ == 0) schedule(c, now);
+    }
+}
+
+void Worker::check_timeouts(uint64_t now) {
+    uint64_t limit = (uint64_t)(opt_.io_timeout * 1e9);
+    for (Client &c : clients_) {
+        // only clients waiting for the server can time out
+        if (c.active && c.done < c.queued && now - c.last_progress > limit) fail(c, "timeout");
+    }
+}
+
+int64_t Worker::next_wakeup(uint64_t now) const {
+    int64_t wait = 100 * 1000000ll;
+    if (interval_ns_ == 0) return wait;
+    for (const Client &c : clients_) {
+        if (!c.active || c.queued >= opt_.msgs) continue;
+        int64_t d = (int64_t)(c.next_due - now);
+        wait = std::min(wait, std::max<int64_t>(d, 0));
+    }
+    return wait;
+}
+
+// epoll_wait with a nanosecond timeout where the kernel has epoll_pwait2
+int wait_events(int epfd, epoll_event *events, int max, int64_t timeout_ns) {
+#ifdef SYS_epoll_pwait2
+    static bool have_pwait2 = true;
+    if (have_pwait2) {
+        timespec ts;
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        int n = (int)syscall(SYS_epoll_pwait2, epfd, events, max, &ts, nullptr, 0);
+        if (n >= 0 || errno != ENOSYS) return n;
+        have_pwait2 = false;
+    }
+#endif
+    return epoll_wait(epfd, events, max, (int)(timeout_ns / 1000000));
+}
+
+void Worker::run(uint64_t start_ns) {
+    for (Client &c : clients_) {
+        c.last_progress = start_ns;
+        // spread the open-loop schedule so clients do not send in lockstep
+        if (interval_ns_) c.next_due = start_ns + (uint64_t)(1e9 * c.id / opt_.rate);
+        schedule(c, start_ns);
+    }
+
+    epoll_event events[256];
+    uint64_t next_check = start_ns + 100 * 1000000ull;
+    while (active_ > 0) {
+        uint64_t now = Metrics::now_ns();
+        int n = wait_events(epfd_, events, 256, next_wakeup(now));
+        if (n < 0 && errno != EINTR) {
+            std::perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            Client &c = *(Client *)events[i].data.ptr;
+            if (c.fd == -1) continue;
+            if (c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) on_connected(c);
+            if (c.fd == -1) continue;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) pump_recv(c);
+            if (c.fd != -1 && (events[i].events & EPOLLOUT)) pump_send(c);
+        }
+        now = Metrics::now_ns();
+        if (interval_ns_) {
+            for (Client &c : clients_) {
+                if (c.active && c.queued < opt_.msgs && c.next_due <= now) schedule(c, now);
+            }
+        }
+        if (now >= next_check) {
+            check_timeouts(now);
+            next_check = now + 100 * 1000000ull;
+        }
+    }
+}
+
+double ms(uint64_t ns) { return ns / 1e6; }
+
+// store every key of the memcache workload, 100 sets per round trip
+bool preload(const sockaddr_in &addr, const Options &o, const std::string &value) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) == -1) {
+        std::perror("preload connect");
+        if (fd != -1) close(fd);
+        return false;
+    }
+    bool ok = true;
+    std::string batch, rx;
+    char buf[4096];
+    for (int k = 0; k < o.kv_keys && ok;) {
+        batch.clear();
+        int n = 0;
+        for (; n < 100 && k < o.kv_keys; ++n, ++k) {
+            char key[32];
+            std::snprintf(key, sizeof(key), "key:%010d", k);
+            batch += std::string("set ") + key + " 0 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+        }
+        ok = send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) == (ssize_t)batch.size();
+        rx.clear();
+        for (int replies = 0; ok && replies < n;) {
+            ssize_t r = recv(fd, buf, sizeof(buf), 0);
+            if (r <= 0) {
+                ok = false;
+                break;
+            }
+            rx.append(buf, (size_t)r);
+            size_t e;
+            while (replies < n && (e = rx.find("\r\n")) != std::string::npos) {
+                if (rx.compare(0, 8, "STORED\r\n") != 0) {
+                    std::fprintf(stderr, "preload: %s\n", rx.substr(0, e).c_str());
+                    ok = false;
+                    break;
+                }
+                rx.erase(0, e + 2);
+                ++replies;
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// HdrHistogram's percentile distribution text format, values in ms
+void write_distribution(const std::string &path, const HistogramSnapshot &h) {
+    std::FILE *f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        std::perror(path.c_str());
+        return;
+    }
+    std::fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    uint64_t seen = 0;
+    double sq = 0;
+    double mean = h.count ? (double)h.sum / h.count : 0;
+    for (size_t i = 0; i < h.buckets.size(); ++i) {
+        if (h.buckets[i] == 0) continue;
+        seen += h.buckets[i];
+        uint64_t v = std::min(Histogram::bucket_upper((int)i), h.max);
+        double d = (double)v - mean;
+        sq += d * d * h.buckets[i];
+        double p = (double)seen / h.count;
+        if (p < 1.0) {
+            std::fprintf(f, "%12.3f %14.12f %10llu %14.2f\n", ms(v), p, (unsigned long long)seen, 1.0 / (1.0 - p));
+        } else {
+            std::fprintf(f, "%12.3f %14.12f %10llu\n", ms(v), p, (unsigned long long)seen);
+        }
+    }
+    double stddev = h.count ? std::sqrt(sq / h.count) : 0;
+    std::fprintf(f, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", ms((uint64_t)mean), ms((uint64_t)stddev));
+    std::fprintf(f, "#[Max     = %12.3f, Total count    = %12llu]\n", ms(h.max), (unsigned long long)h.count);
+    std::fprintf(f, "#[Buckets = %12d, SubBuckets     = %12d]\n", Histogram::kBuckets, Histogram::kSubBuckets);
+    std::fclose(f);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.size < 2) opt.size = 2;
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)opt.port);
+    if (inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr) != 1) {
+        addrinfo hints, *res = nullptr;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(opt.host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+            std::fprintf(stderr, "cannot resolve %s\n", opt.host.c_str());
+            return 2;
+        }
+        addr.sin_addr = ((sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+
+    // one newline-terminated line per message: works with the raw echo and
+    // with --codec line
+    std::string payload((size_t)opt.size, 'X');
+    if (opt.kv_keys > 0) {
+        // memcache values are stored as they are
+        if (!preload(addr, opt, payload)) return 2;
+    } else {
+        payload[payload.size() - 1] = '\n';
+    }
+
+    int nthreads = opt.threads > 0 ? opt.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::min(nthreads, opt.clients);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0, first = 0; t < nthreads; ++t) {
+        int count = opt.clients / nthreads + (t < opt.clients % nthreads ? 1 : 0);
+        workers.emplace_back(new Worker(opt, addr, payload, first, count));
+        first += count;
+    }
+
+    uint64_t start = 0;
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (auto &w : workers) {
+        Worker *wp = w.get();
+        threads.emplace_back([wp, &ready, &go, &start]() {
+            if (!wp->setup()) std::perror("epoll_create1");
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            wp->run(start);
+        });
+    }
+    while (ready.load() < nthreads) std::this_thread::yield();
+    start = Metrics::now_ns();
+    go.store(true, std::memory_order_release);
+    for (auto &t : threads) t.join();
+    double duration = (Metrics::now_ns() - start) / 1e9;
+
+    HistogramSnapshot lat, raw;
+    uint64_t total = 0;
+    int errors = 0;
+    uint64_t kv_gets = 0, kv_hits = 0;
+    std::string first_error;
+    for (auto &w : workers) {
+        kv_gets += w->kv_gets;
+        kv_hits += w->kv_hits;
+        w->corrected.merge_into(lat);
+        w->uncorrected.merge_into(raw);
+        total += w->completed;
+        errors += w->errors;
+        if (first_error.empty()) first_error = w->first_error;
+    }
+    double ops = duration > 0 ? total / duration : 0;
+    double mean = lat.count ? ms(lat.sum) / lat.count : 0;
+
+    std::string mode = opt.churn ? "churn" : "closed";
+    if (opt.rate > 0) mode = std::string(opt.churn ? "churn+" : "") + "open rate=" + std::to_string((long long)opt.rate) + "/s";
+    std::printf("Mode: %s threads=%d\n", mode.c_str(), nthreads);
+    std::printf("Stress test finished: clients=%d msgs/client=%d msg_size=%d\n", opt.clients, opt.msgs, opt.size);
+    std::printf("Total messages: %llu errors: %d duration=%.2fs ops/s=%.2f\n", (unsigned long long)total, errors,
+                duration, ops);
+    if (lat.count) {
+        std::printf("Latency ms: mean=%.2f p50=%.2f p95=%.2f p99=%.2f max=%.2f\n", mean, ms(lat.percentile(50)),
+                    ms(lat.percentile(95)), ms(lat.percentile(99)), ms(lat.max));
+        std::printf("Latency ms (tail): p99.9=%.3f p99.99=%.3f\n", ms(lat.percentile(99.9)), ms(lat.percentile(99.99)));
+        if (opt.rate > 0) {
+            std::printf("Uncorrected latency ms: mean=%.2f p50=%.2f p95=%.2f p99=%.2f max=%.2f\n",
+                        ms(raw.sum) / raw.count, ms(raw.percentile(50)), ms(raw.percentile(95)),
+                        ms(raw.percentile(99)), ms(raw.max));
+        }
+    }
+    if (opt.kv_keys > 0) {
+        std::printf("KV: keys=%d sets=%.2f gets=%llu hit_rate=%.2f%%\n", opt.kv_keys, opt.kv_sets,
+                    (unsigned long long)kv_gets, kv_gets ? 100.0 * kv_hits / kv_gets : 0.0);
+    }
+    if (errors) std::printf("Some errors (first): %s\n", first_error.c_str());
+
+    if (!opt.hist_out.empty()) write_distribution(opt.hist_out, lat);
+
+    // one row in the schema of scripts/aggregate_results.py
+    char row[512];
+    std::snprintf(row, sizeof(row), "%d,%d,%d,%llu,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f", opt.clients, opt.msgs,
+                  opt.size, (unsigned long long)total, errors, duration, ops, mean, ms(lat.percentile(50)),
+                  ms(lat.percentile(95)), ms(lat.percentile(99)), ms(lat.max));
+    if (!opt.csv.empty()) {
+        std::ofstream f(opt.csv);
+        f << "file,clients,msgs_per_client,msg_size,total_messages,errors,duration_s,ops_per_s,"
+             "mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n"
+          << opt.label << "," << row << "\n";
+    }
+    if (!opt.json.empty()) {
+        char obj[768];
+        std::snprintf(obj, sizeof(obj),
+                      "[\n  {\n    \"file\": \"%s\",\n    \"clients\": %d,\n    \"msgs_per_client\": %d,\n"
+                      "    \"msg_size\": %d,\n    \"total_messages\": %llu,\n    \"errors\": %d,\n"
+                      "    \"duration_s\": %.2f,\n    \"ops_per_s\": %.2f,\n    \"mean_ms\": %.2f,\n"
+                      "    \"p50_ms\": %.2f,\n    \"p95_ms\": %.2f,\n    \"p99_ms\": %.2f,\n    \"max_ms\": %.2f\n  }\n]\n",
+                      opt.label.c_str(), opt.clients, opt.msgs, opt.size, (unsigned long long)total, errors,
+                      duration, ops, mean, ms(lat.percentile(50)), ms(lat.percentile(95)), ms(lat.percentile(99)),
+                      ms(lat.max));
+        std::ofstream f(opt.json);
+        f << obj;
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Functional test for the memcache mode.
+
+Start the server with a small cache so that eviction can be seen:
+
+    ./high_performance_server --codec memcache --kv-memory 8
+
+then run this script. It checks noreply, malformed and oversized sets,
+expiry, eviction and multi-get, prints a summary and exits non-zero if a
+check failed.
+"""
+import socket, sys, time, argparse
+
+parser = argparse.ArgumentParser(description='Functional test for --codec memcache')
+parser.add_argument('--host', default='127.0.0.1')
+parser.add_argument('--port', type=int, default=8080)
+parser.add_argument('--evict-mb', type=int, default=64,
+                    help='bytes stored by the eviction check; more than --kv-memory')
+parser.add_argument('--io-timeout', type=float, default=5.0)
+args = parser.parse_args()
+
+results = []
+
+def check(name, ok, detail=""):
+    results.append((name, ok, detail))
+
+def connect():
+    s = socket.create_connection((args.host, args.port), timeout=args.io_timeout)
+    s.settimeout(args.io_timeout)
+    return s
+
+def recv_until(s, end):
+    data = b""
+    while not data.endswith(end):
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+def recv_until_count(s, reply, n):
+    data = b""
+    while data.count(reply) < n:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    return data.count(reply)
+
+def request(s, data, end=b"\r\n"):
+    s.sendall(data)
+    return recv_until(s, end)
+
+def closed(s):
+    try:
+        return s.recv(1) == b""
+    except (ConnectionResetError, socket.timeout):
+        return True
+
+def test_noreply():
+    s = connect()
+    # only the get answers
+    r = request(s, b"set nr 0 0 2 noreply\r\nhi\r\ndelete nothere noreply\r\nget nr\r\n", b"END\r\n")
+    check("noreply", r == b"VALUE nr 0 2\r\nhi\r\nEND\r\n", r)
+    s.close()
+
+def test_malformed():
+    s = connect()
+    # a bad flags field is refused, its data block skipped
+    r = request(s, b"set bad abc 0 1\r\nx\r\n")
+    check("malformed set refused", r.startswith(b"CLIENT_ERROR"), r)
+    r = request(s, b"get bad\r\n")
+    check("malformed set not stored", r == b"END\r\n", r)
+    check("unknown command", request(s, b"bogus\r\n") == b"ERROR\r\n")
+    # a data block without its \r\n ends the connection
+    r = request(s, b"set k 0 0 1\r\nxyz\r\n")
+    check("bad data chunk", r.startswith(b"CLIENT_ERROR bad data chunk"), r)
+    check("bad data chunk closes", closed(s))
+    s.close()
+
+def test_oversized():
+    s = connect()
+    # larger than a slab page: refused, the connection stays usable
+    value = b"v" * (2 * 1024 * 1024)
+    r = request(s, b"set big 0 0 %d\r\n" % len(value) + value + b"\r\n")
+    check("oversized set refused", r == b"SERVER_ERROR object too large for cache\r\n", r)
+    check("oversized set then get", request(s, b"get big\r\n") == b"END\r\n")
+    # larger than the codec reads at all: closed without reading the block
+    r = request(s, b"set huge 0 0 %d\r\n" % (64 * 1024 * 1024))
+    check("huge set refused", r.startswith(b"CLIENT_ERROR object too large"), r)
+    check("huge set closes", closed(s))
+    s.close()
+
+def test_expiry():
+    s = connect()
+    check("set with ttl", request(s, b"set ttl 0 1 3\r\nabc\r\n") == b"STORED\r\n")
+    r = request(s, b"get ttl\r\n", b"END\r\n")
+    check("get before expiry", r == b"VALUE ttl 0 3\r\nabc\r\nEND\r\n", r)
+    time.sleep(2.2)
+    r = request(s, b"get ttl\r\n", b"END\r\n")
+    check("get after expiry", r == b"END\r\n", r)
+    s.close()
+
+def test_eviction():
+    s = connect()
+    value = b"e" * (100 * 1024)
+    count = args.evict_mb * 1024 * 1024 // len(value)
+    batch = 16
+    stored = 0
+    for first in range(0, count, batch):
+        keys = range(first, min(first + batch, count))
+        msg = b"".join(b"set evict%d 0 0 %d\r\n" % (i, len(value)) + value + b"\r\n" for i in keys)
+        s.sendall(msg)
+        stored += recv_until_count(s, b"STORED\r\n", len(keys))
+    check("eviction: every set stored", stored == count, "%d of %d" % (stored, count))
+    r = request(s, b"get evict0\r\n", b"END\r\n")
+    check("eviction: oldest item evicted", r == b"END\r\n", r[:40])
+    r = request(s, b"get evict%d\r\n" % (count - 1), b"END\r\n")
+    check("eviction: newest item kept", r.startswith(b"VALUE evict%d 0 " % (count - 1)), r[:40])
+    s.close()
+
+def test_multi_get():
+    s = connect()
+    # pipelined sets, then one get for hits and a miss in between
+    r = request(s, b"set m1 1 0 1\r\na\r\nset m2 2 0 2\r\nbb\r\nset m3 3 0 3\r\nccc\r\n", b"STORED\r\nSTORED\r\nSTORED\r\n")
+    check("pipelined sets", r == b"STORED\r\n" * 3, r)
+    r = request(s, b"get m1 missing m2 m3\r\n", b"END\r\n")
+    want = b"VALUE m1 1 1\r\na\r\nVALUE m2 2 2\r\nbb\r\nVALUE m3 3 3\r\nccc\r\nEND\r\n"
+    check("multi-get", r == want, r)
+    # the longest key memcache allows
+    key = b"k" * 250
+    check("set longest key", request(s, b"set " + key + b" 4294967295 0 3\r\nxyz\r\n") == b"STORED\r\n")
+    r = request(s, b"get " + key + b"\r\n", b"END\r\n")
+    check("get longest key", r == b"VALUE " + key + b" 4294967295 3\r\nxyz\r\nEND\r\n", r[-40:])
+    # a set split over several writes
+    s.sendall(b"set split 0 0 10\r\n01234")
+    time.sleep(0.1)
+    s.sendall(b"56789\r\n")
+    check("split set", recv_until(s, b"\r\n") == b"STORED\r\n")
+    r = request(s, b"get split\r\n", b"END\r\n")
+    check("split set value", r == b"VALUE split 0 10\r\n0123456789\r\nEND\r\n", r)
+    s.close()
+
+for test in (test_noreply, test_malformed, test_oversized, test_expiry, test_multi_get, test_eviction):
+    try:
+        test()
+    except Exception as e:
+        check(test.__name__, False, repr(e))
+
+ok_count = sum(1 for r in results if r[1])
+print(f"Total checks: {len(results)}, OK: {ok_count}, Failed: {len(results) - ok_count}")
+for r in results:
+    if not r[1]:
+        print("FAILED:", r)
+sys.exit(0 if ok_count == len(results) else 1)
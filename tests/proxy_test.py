@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""
+Functional test for the proxy mode.
+
+Starts two echo servers and a proxy in front of them from the given
+binary, then checks that streams are relayed unchanged (half-close
+included), that clients fail over when an upstream goes down, that a
+client is reset when no upstream is up, and that a restarted upstream is
+used again. Prints a summary and exits non-zero if a check failed.
+
+    python3 tests/proxy_test.py --binary ./high_performance_server
+"""
+import os, socket, subprocess, sys, threading, time, argparse
+
+parser = argparse.ArgumentParser(description='Functional test for --proxy')
+parser.add_argument('--binary', default='./high_performance_server')
+parser.add_argument('--port', type=int, default=9100, help='proxy port; upstreams use the next two')
+parser.add_argument('--check-ms', type=int, default=200, help='--proxy-check of the proxy')
+parser.add_argument('--io-timeout', type=float, default=5.0)
+args = parser.parse_args()
+
+results = []
+
+def check(name, ok, detail=""):
+    results.append((name, ok, detail))
+
+def start(*flags):
+    p = subprocess.Popen([args.binary, "--log-level", "error"] + list(flags),
+                         stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    time.sleep(0.4)
+    return p
+
+def stop(p):
+    p.terminate()
+    p.wait()
+
+# send data, half-close, and read everything back until EOF
+def round_trip(data):
+    s = socket.create_connection(("127.0.0.1", args.port), timeout=args.io_timeout)
+    s.settimeout(args.io_timeout)
+    got = []
+    errors = []
+    def reader():
+        try:
+            while True:
+                chunk = s.recv(65536)
+                if not chunk:
+                    break
+                got.append(chunk)
+        except OSError as e:
+            errors.append(e)
+    t = threading.Thread(target=reader)
+    t.start()
+    try:
+        s.sendall(data)
+        s.shutdown(socket.SHUT_WR)
+    finally:
+        t.join()
+        s.close()
+    if errors:
+        raise errors[0]
+    return b"".join(got)
+
+def relays(n, size):
+    ok = 0
+    for _ in range(n):
+        data = os.urandom(size)
+        try:
+            if round_trip(data) == data:
+                ok += 1
+        except OSError:
+            pass
+    return ok
+
+def test_relay():
+    check("relay small", relays(10, 100) == 10)
+    data = os.urandom(4 * 1024 * 1024)
+    check("relay 4 MB with half-close", round_trip(data) == data)
+    # clients at once, each relayed on its own upstream connection
+    counts = []
+    def client():
+        counts.append(relays(5, 16 * 1024))
+    threads = [threading.Thread(target=client) for _ in range(8)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    check("concurrent relays", sum(counts) == 40, sum(counts))
+
+def test_failover():
+    stop(upstreams[1])
+    # the first client to meet the dead upstream is moved to the live one
+    check("failover", relays(10, 1000) == 10)
+    stop(upstreams[0])
+    time.sleep(args.check_ms * 3 / 1000.0)
+    try:
+        # a FIN instead of a reset would end here with an empty reply
+        reply = round_trip(b"nobody home")
+        check("no upstream: client reset", False, reply)
+    except (ConnectionResetError, BrokenPipeError):
+        check("no upstream: client reset", True)
+    upstreams[0] = start("--port", str(args.port + 1))
+    time.sleep(args.check_ms * 3 / 1000.0)
+    check("upstream back", relays(5, 1000) == 5)
+
+upstreams = [start("--port", str(args.port + 1)), start("--port", str(args.port + 2))]
+proxy = start("--port", str(args.port), "--proxy",
+              "127.0.0.1:%d,127.0.0.1:%d" % (args.port + 1, args.port + 2),
+              "--proxy-check", str(args.check_ms))
+try:
+    for test in (test_relay, test_failover):
+        try:
+            test()
+        except Exception as e:
+            check(test.__name__, False, repr(e))
+finally:
+    for p in upstreams + [proxy]:
+        if p.poll() is None:
+            stop(p)
+
+ok_count = sum(1 for r in results if r[1])
+print(f"Total checks: {len(results)}, OK: {ok_count}, Failed: {len(results) - ok_count}")
+for r in results:
+    if not r[1]:
+        print("FAILED:", r)
+sys.exit(0 if ok_count == len(results) else 1)
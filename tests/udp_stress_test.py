@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+UDP counterpart of stress_test.py, for a server started with --udp-threads.
+
+Each of `--clients` threads owns one UDP socket (so the kernel spreads the
+clients over the server's SO_REUSEPORT loops), sends `--msgs` datagrams of
+`--size` bytes and waits for every echo. `--window` datagrams are in flight
+per client at a time; with `--gso` each window goes out in one sendmsg with
+UDP_SEGMENT, which exercises the server's GRO path. A datagram whose reply
+has not arrived within `--io-timeout` seconds counts as lost.
+
+The summary lines match stress_test.py, so the output works with
+scripts/aggregate_results.py; lost datagrams are the errors.
+"""
+import socket, struct, threading, time, argparse
+import statistics
+
+# from <netinet/udp.h>; not exported by every Python build
+SOL_UDP = 17
+UDP_SEGMENT = 103
+
+parser = argparse.ArgumentParser(description='UDP stress test for the echo server')
+parser.add_argument('--host', default='127.0.0.1')
+parser.add_argument('--port', type=int, default=8080)
+parser.add_argument('--clients', type=int, default=16)
+parser.add_argument('--msgs', type=int, default=2000)
+parser.add_argument('--size', type=int, default=256)
+parser.add_argument('--window', type=int, default=1)
+parser.add_argument('--gso', action='store_true')
+parser.add_argument('--io-timeout', type=float, default=1.0)
+args = parser.parse_args()
+
+MSG_SIZE = max(args.size, 16)
+
+latencies = []
+lost = [0]
+errors = []
+lock = threading.Lock()
+
+
+def client_worker(cid):
+    try:
+        s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        s.connect((args.host, args.port))
+        s.settimeout(args.io_timeout)
+        pad = b"X" * (MSG_SIZE - 9) + b"\n"
+        mine = []
+        missing = 0
+        seq = 0
+        while seq < args.msgs:
+            n = min(args.window, args.msgs - seq)
+            batch = [struct.pack("!II", cid, seq + i) + pad for i in range(n)]
+            sent = {}
+            t0 = time.monotonic()
+            if args.gso and n > 1:
+                s.sendmsg([b"".join(batch)], [(SOL_UDP, UDP_SEGMENT, struct.pack("=H", MSG_SIZE))])
+            else:
+                for d in batch:
+                    s.send(d)
+            for i in range(n):
+                sent[seq + i] = t0
+            while sent:
+                try:
+                    data = s.recv(65536)
+                except socket.timeout:
+                    break
+                t1 = time.monotonic()
+                if len(data) < 8:
+                    continue
+                rcid, rseq = struct.unpack("!II", data[:8])
+                t = sent.pop(rseq, None) if rcid == cid else None
+                if t is not None:
+                    mine.append(t1 - t)
+            missing += len(sent)
+            seq += n
+        s.close()
+        with lock:
+            latencies.extend(mine)
+            lost[0] += missing
+    except Exception as e:
+        with lock:
+            errors.append((cid, str(e)))
+
+
+def percentile(data, p):
+    if not data: return None
+    k = (len(data)-1) * (p/100.0)
+    f = int(k)
+    c = min(f+1, len(data)-1)
+    if f == c:
+        return data[int(k)]
+    d0 = data[f] * (c-k)
+    d1 = data[c] * (k-f)
+    return d0 + d1
+
+
+def main():
+    start = time.time()
+    threads = []
+    for i in range(args.clients):
+        t = threading.Thread(target=client_worker, args=(i,))
+        t.start()
+        threads.append(t)
+
+    for t in threads:
+        t.join()
+
+    end = time.time()
+    total_msgs = len(latencies)
+    duration = end - start
+    ops_per_sec = total_msgs / duration if duration > 0 else 0
+
+    lat_ms = [x*1000.0 for x in latencies]
+    lat_ms.sort()
+
+    print(f"Stress test finished: clients={args.clients} msgs/client={args.msgs} msg_size={MSG_SIZE}")
+    print(f"Total messages: {total_msgs} errors: {lost[0] + len(errors)} duration={duration:.2f}s ops/s={ops_per_sec:.2f}")
+    if lat_ms:
+        print(f"Latency ms: mean={statistics.mean(lat_ms):.2f} p50={percentile(lat_ms,50):.2f} p95={percentile(lat_ms,95):.2f} p99={percentile(lat_ms,99):.2f} max={max(lat_ms):.2f}")
+    print(f"Lost datagrams: {lost[0]} (window={args.window}{', gso' if args.gso else ''})")
+    if errors:
+        print("Some errors (sample up to 10):")
+        for e in errors[:10]:
+            print(e)
+
+
+if __name__ == '__main__':
+    main()